@@ -270,6 +270,31 @@ void mpr_dev_set_time(mpr_dev device, mpr_time time);
  *  \param device       The device to use. */
 void mpr_dev_update_maps(mpr_dev device);
 
+/*! Set the maximum number of datagrams a device receives with a single system call when polling.
+ *  Batched receiving is only available on platforms that support it; elsewhere datagrams are
+ *  received one at a time. Each datagram in a batch needs a 64 KiB receive buffer, so the batch
+ *  size is limited to 32.
+ *  \param device       The device to modify.
+ *  \param size         The maximum number of datagrams per call, up to 32, or 0 to receive
+ *                      datagrams one at a time (the default).
+ *  \return             The batch size in effect. */
+int mpr_dev_set_recv_batch_size(mpr_dev device, int size);
+
+/*! Enable or disable sending the bundles for all of a device's links with a single system call
+ *  per poll. Batched sending is enabled by default where the system supports it.
+ *  \param device       The device to modify.
+ *  \param enable       1 to batch outgoing bundles, 0 to send them one at a time.
+ *  \return             1 if batched sending is in effect, 0 otherwise. */
+int mpr_dev_set_send_batching(mpr_dev device, int enable);
+
+/*! Request a size for the receive buffer of a device's UDP socket. A larger buffer reduces the
+ *  number of updates dropped when signals are updated faster than the device is polled.
+ *  \param device       The device to modify.
+ *  \param bytes        The requested buffer size in bytes.
+ *  \return             The buffer size reported by the operating system, or less than zero if
+ *                      the size could not be set. */
+int mpr_dev_set_recv_buffer_size(mpr_dev device, int bytes);
+
 /** @} */ /* end of group Devices */
 
 /*** Signals ***/
@@ -334,6 +359,22 @@ void mpr_sig_free(mpr_sig signal);
 void mpr_sig_set_value(mpr_sig signal, mpr_id instance, int length, mpr_type type,
                        const void *value);
 
+/*! Update the values of several instances of a signal at once. This is equivalent to calling
+ *  mpr_sig_set_value() for each instance, but the instances share a single timetag and maps
+ *  from the signal are processed once for the whole set.
+ *  \param signal       The signal to operate on.
+ *  \param num_inst     The number of instances to update.
+ *  \param instances    Array of num_inst instance identifiers.
+ *  \param length       Length of each value. Expected to be equal to the signal length.
+ *  \param type         Data type of the values argument.
+ *  \param values       Array of num_inst * length values, one vector per instance in the
+ *                      order of the instances array, or 0 to release the instances.
+ *  \param time         The timetag shared by the updates. Use mpr_dev_get_time() for the
+ *                      current time of the signal's device. Ignored for releases and
+ *                      remote signals. */
+void mpr_sig_set_values(mpr_sig signal, int num_inst, const mpr_id *instances, int length,
+                        mpr_type type, const void *values, mpr_time time);
+
 /*! Get the value of a signal instance.
  *  \param signal       The signal to operate on.
  *  \param instance     A pointer to the identifier of the instance to query,
@@ -381,6 +422,13 @@ void mpr_sig_set_cb(mpr_sig signal, mpr_sig_handler *handler, int events);
  *  \return             Number of instances added. */
 int mpr_sig_reserve_inst(mpr_sig signal, int number, mpr_id *ids, void **data);
 
+/*! Set the maximum number of instances that may be reserved for a local signal. The default
+ *  maximum is 128; it cannot be set below the number of instances already reserved.
+ *  \param signal       The signal to operate on.
+ *  \param maximum      The maximum number of instances.
+ *  \return             The resulting maximum, or zero if the signal is not local. */
+int mpr_sig_set_max_inst(mpr_sig signal, int maximum);
+
 /*! Release a specific instance of a signal by removing it from the list of
  *  active instances and adding it to the reserve list.
  *  \param signal       The signal to operate on.
@@ -858,6 +858,21 @@ namespace mapper {
         template <typename T>
         Signal& _set_value(std::vector<T> val)
             { return set_value(&val[0], (int)val.size()); }
+        int _vector_len() const
+            { return mpr_obj_get_prop_as_int32(_obj, MPR_PROP_LEN, NULL); }
+        mpr_time _dev_time() const
+            { return mpr_dev_get_time(mpr_sig_get_dev(_obj)); }
+        Signal& _set_values(int num, const Id *ids, mpr_type type, const void *vals, mpr_time time)
+            { mpr_sig_set_values(_obj, num, ids, _vector_len(), type, vals, time); RETURN_SELF }
+        template <typename T>
+        int _num_vectors(const std::vector<Id>& ids, const std::vector<T>& vals) const
+        {
+            /* never read past the end of either vector */
+            int len = _vector_len(), num = (int)ids.size();
+            if (len <= 0)
+                return 0;
+            return (int)vals.size() / len < num ? (int)vals.size() / len : num;
+        }
     public:
         /*! Set the current value for this Signal.
          *  \param vals     The value to set. Can be scalar, array, std::array, or std::vector of
@@ -867,6 +882,53 @@ namespace mapper {
         Signal& set_value(Values... vals)
             { return _set_value(vals...); }
 
+        /*! Set the current values of several Instances of this Signal at once, using the
+         *  current time of the Signal's Device.
+         *  \param num      The number of Instances to update.
+         *  \param ids      An array of num Instance ids.
+         *  \param vals     An array of num values, each as long as the Signal vector length.
+         *  \return         Self. */
+        Signal& set_values(int num, const Id *ids, const int *vals)
+            { return _set_values(num, ids, MPR_INT32, vals, _dev_time()); }
+        Signal& set_values(int num, const Id *ids, const float *vals)
+            { return _set_values(num, ids, MPR_FLT, vals, _dev_time()); }
+        Signal& set_values(int num, const Id *ids, const double *vals)
+            { return _set_values(num, ids, MPR_DBL, vals, _dev_time()); }
+
+        /*! Set the current values of several Instances of this Signal at once.
+         *  \param num      The number of Instances to update.
+         *  \param ids      An array of num Instance ids.
+         *  \param vals     An array of num values, each as long as the Signal vector length.
+         *  \param time     The timetag shared by the updates.
+         *  \return         Self. */
+        Signal& set_values(int num, const Id *ids, const int *vals, Time time)
+            { return _set_values(num, ids, MPR_INT32, vals, *(mpr_time*)time); }
+        Signal& set_values(int num, const Id *ids, const float *vals, Time time)
+            { return _set_values(num, ids, MPR_FLT, vals, *(mpr_time*)time); }
+        Signal& set_values(int num, const Id *ids, const double *vals, Time time)
+            { return _set_values(num, ids, MPR_DBL, vals, *(mpr_time*)time); }
+
+        /*! Set the current values of several Instances of this Signal at once. Only the
+         *  Instances for which vals holds a complete vector are updated.
+         *  \param ids      A std::vector of Instance ids.
+         *  \param vals     A std::vector of int, float, or double values holding one vector per
+         *                  Instance id.
+         *  \return         Self. */
+        template <typename T>
+        Signal& set_values(const std::vector<Id>& ids, const std::vector<T>& vals)
+            { return set_values(_num_vectors(ids, vals), ids.data(), vals.data()); }
+
+        /*! Set the current values of several Instances of this Signal at once. Only the
+         *  Instances for which vals holds a complete vector are updated.
+         *  \param ids      A std::vector of Instance ids.
+         *  \param vals     A std::vector of int, float, or double values holding one vector per
+         *                  Instance id.
+         *  \param time     The timetag shared by the updates.
+         *  \return         Self. */
+        template <typename T>
+        Signal& set_values(const std::vector<Id>& ids, const std::vector<T>& vals, Time time)
+            { return set_values(_num_vectors(ids, vals), ids.data(), vals.data(), time); }
+
         const void *value() const
             { return mpr_sig_get_value(_obj, 0, 0); }
         const void *value(Time time) const
@@ -1250,6 +1312,12 @@ namespace mapper {
         Signal& reserve_instance(mpr_id id, void* data)
             { mpr_sig_reserve_inst(_obj, 1, &id, &data); RETURN_SELF }
 
+        /*! Set the maximum number of Instances that may be reserved.
+         *  \param max      The maximum number of Instances.
+         *  \return         Self. */
+        Signal& set_max_instances(int max)
+            { mpr_sig_set_max_inst(_obj, max); RETURN_SELF }
+
         /*! Retrieve an Instance from the pool using an index and status.
          *  \param idx      The index of the Instance to retrieve.
          *  \param status   The status pool to query: ACTIVE, RESERVED, or ALL.
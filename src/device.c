@@ -1,3 +1,10 @@
+#include "config.h"
+
+#if defined(HAVE_RECVMMSG) && !defined(_GNU_SOURCE)
+ /* required for recvmmsg() */
+ #define _GNU_SOURCE
+#endif
+
 #include <lo/lo.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -12,12 +19,21 @@
 #include <sys/time.h>
 #endif
 #include <assert.h>
+#include <errno.h>
 
 #include <stddef.h>
 
+#ifdef HAVE_ARPA_INET_H
+ #include <sys/socket.h>
+#else
+ #ifdef HAVE_WINSOCK2_H
+  #include <winsock2.h>
+  #include <ws2tcpip.h>
+ #endif
+#endif
+
 #include "mapper_internal.h"
 #include "types_internal.h"
-#include "config.h"
 #include <mapper/mapper.h>
 
 #ifdef HAVE_LIBPTHREAD
@@ -34,6 +50,7 @@ extern const char* net_msg_strings[NUM_MSG_STRINGS];
 /* prototypes */
 static void mpr_dev_start_servers(mpr_local_dev dev);
 static void mpr_dev_remove_idmap(mpr_local_dev dev, int group, mpr_id_map rem);
+static void mpr_dev_set_idmap_GID(mpr_local_dev dev, int group, mpr_id_map map, mpr_id GID);
 MPR_INLINE static int _process_outgoing_maps(mpr_local_dev dev);
 
 mpr_time ts = {0,1};
@@ -131,10 +148,13 @@ mpr_dev mpr_dev_new(const char *name_prefix, mpr_graph g)
     g->net.rtr->dev = dev;
 
     dev->expr_stack = mpr_expr_stack_new();
+#ifdef HAVE_SENDMMSG
+    /* batch outgoing bundles into a single system call per poll */
+    dev->tx_batch.enabled = 1;
+#endif
 
     dev->ordinal_allocator.val = 1;
-    dev->idmaps.active = (mpr_id_map*) malloc(sizeof(mpr_id_map));
-    dev->idmaps.active[0] = 0;
+    dev->idmaps.active = (mpr_id_map_tbl) calloc(1, sizeof(mpr_id_map_tbl_t));
     dev->num_sig_groups = 1;
 
     mpr_net_add_dev(&g->net, dev);
@@ -150,7 +170,7 @@ void mpr_dev_free(mpr_dev dev)
     mpr_net net;
     mpr_local_dev ldev;
     mpr_list list;
-    int i;
+    int i, j;
     RETURN_UNLESS(dev && dev->is_local);
     if (!dev->obj.graph) {
         free(dev);
@@ -220,11 +240,16 @@ void mpr_dev_free(mpr_dev dev)
 
     /* Release device id maps */
     for (i = 0; i < ldev->num_sig_groups; i++) {
-        while (ldev->idmaps.active[i]) {
-            mpr_id_map map = ldev->idmaps.active[i];
-            ldev->idmaps.active[i] = map->next;
-            free(map);
+        mpr_id_map_tbl tbl = &ldev->idmaps.active[i];
+        for (j = 0; j < tbl->size; j++) {
+            while (tbl->LID[j]) {
+                mpr_id_map map = tbl->LID[j];
+                tbl->LID[j] = map->next;
+                free(map);
+            }
         }
+        FUNC_IF(free, tbl->LID);
+        FUNC_IF(free, tbl->GID);
     }
     free(ldev->idmaps.active);
 
@@ -234,6 +259,13 @@ void mpr_dev_free(mpr_dev dev)
         free(map);
     }
 
+    FUNC_IF(free, ldev->queued_in.maps);
+    FUNC_IF(free, ldev->queued_out.maps);
+    mpr_link_batch_free(&ldev->tx_batch);
+    FUNC_IF(free, ldev->rx_batch.bufs);
+    FUNC_IF(free, ldev->rx_batch.hdrs);
+    FUNC_IF(free, ldev->rx_batch.iov);
+
     FUNC_IF(free, dev->prefix);
 
     mpr_expr_stack_free(ldev->expr_stack);
@@ -258,7 +290,7 @@ void mpr_dev_on_registered(mpr_local_dev dev)
         for (i = 0; i < sig->idmap_len; i++) {
             mpr_id_map idmap = sig->idmaps[i].map;
             if (idmap && !(idmap->GID >> 32))
-                idmap->GID |= dev->obj.id;
+                mpr_dev_set_idmap_GID(dev, sig->group, idmap, idmap->GID | dev->obj.id);
         }
         sig->obj.id |= dev->obj.id;
     }
@@ -316,15 +348,8 @@ int mpr_dev_handler(const char *path, const char *types, lo_arg **argv, int argc
 {
     mpr_local_sig sig = (mpr_local_sig)data;
     mpr_local_dev dev;
-    mpr_sig_inst si;
-    mpr_rtr rtr = sig->obj.graph->net.rtr;
-    int i, val_len = 0, vals, size, all;
-    int idmap_idx, inst_idx, slot_idx = -1, map_manages_inst = 0;
+    int i, val_len = 0, slot_idx = -1;
     mpr_id GID = 0;
-    mpr_id_map idmap;
-    mpr_local_map map = 0;
-    mpr_local_slot slot = 0;
-    float diff;
 
     TRACE_RETURN_UNLESS(sig && (dev = sig->dev), 0,
                         "error in mpr_dev_handler, cannot retrieve user data\n");
@@ -359,6 +384,21 @@ int mpr_dev_handler(const char *path, const char *types, lo_arg **argv, int argc
             return 0;
         }
     }
+    return mpr_dev_handle_update(sig, types, argv, val_len, GID, slot_idx);
+}
+
+int mpr_dev_handle_update(mpr_local_sig sig, const mpr_type *types, lo_arg **argv, int val_len,
+                          mpr_id GID, int slot_idx)
+{
+    mpr_local_dev dev = sig->dev;
+    mpr_sig_inst si;
+    mpr_rtr rtr = sig->obj.graph->net.rtr;
+    int i, vals, size, all;
+    int idmap_idx, inst_idx, map_manages_inst = 0;
+    mpr_id_map idmap;
+    mpr_local_map map = 0;
+    mpr_local_slot slot = 0;
+    float diff;
 
     if (slot_idx >= 0) {
         /* retrieve mapping associated with this slot */
@@ -367,7 +407,7 @@ int mpr_dev_handler(const char *path, const char *types, lo_arg **argv, int argc
         map = slot->map;
         TRACE_DEV_RETURN_UNLESS(map->status >= MPR_STATUS_READY, 0, "error in mpr_dev_handler: "
                                 "mapping not yet ready.\n");
-        if (map->expr && !map->is_local_only) {
+        if (map->expr && (!map->is_local_only || MPR_LOC_DST == map->process_loc)) {
             vals = check_types(types, val_len, slot->sig->type, slot->sig->len);
             map_manages_inst = mpr_expr_get_manages_inst(map->expr);
         }
@@ -505,7 +545,7 @@ int mpr_dev_handler(const char *path, const char *types, lo_arg **argv, int argc
                 mpr_value_set_samp(&slot->val, inst_idx, argv[0], dev->time);
                 if (slot->causes_update) {
                     set_bitflag(map->updated_inst, inst_idx);
-                    map->updated = 1;
+                    mpr_dev_queue_map(dev, map, MPR_DIR_IN);
                     dev->receiving = 1;
                 }
             }
@@ -664,6 +704,11 @@ mpr_list mpr_dev_get_links(mpr_dev dev, mpr_dir dir)
     return mpr_list_start(qry);
 }
 
+const mpr_bundle_stats_t *mpr_dev_get_bundle_stats(mpr_local_dev dev)
+{
+    return &dev->bundle_stats;
+}
+
 mpr_link mpr_dev_get_link_by_remote(mpr_local_dev dev, mpr_dev remote)
 {
     mpr_list links;
@@ -680,52 +725,180 @@ mpr_link mpr_dev_get_link_by_remote(mpr_local_dev dev, mpr_dev remote)
     return 0;
 }
 
+void mpr_dev_queue_map(mpr_local_dev dev, mpr_local_map map, mpr_dir dir)
+{
+    mpr_map_queue q = (MPR_DIR_IN == dir) ? &dev->queued_in : &dev->queued_out;
+    map->updated = 1;
+    RETURN_UNLESS(!(map->queued & dir));
+    map->queued |= dir;
+    if (q->num >= q->size) {
+        q->size = q->size ? q->size * 2 : 8;
+        q->maps = realloc(q->maps, q->size * sizeof(mpr_local_map));
+    }
+    q->maps[q->num++] = map;
+}
+
+/* Maps may be removed while the queue is being processed, so entries are cleared rather than
+ * compacted; the queue is emptied after each processing pass. */
+static void _dequeue_map(mpr_map_queue q, mpr_local_map map)
+{
+    int i;
+    for (i = 0; i < q->num; i++) {
+        if (q->maps[i] == map)
+            q->maps[i] = 0;
+    }
+}
+
+void mpr_dev_dequeue_map(mpr_local_dev dev, mpr_local_map map)
+{
+    _dequeue_map(&dev->queued_in, map);
+    _dequeue_map(&dev->queued_out, map);
+    map->queued = 0;
+}
+
 /* TODO: handle interrupt-driven updates that omit call to this function */
 MPR_INLINE static void _process_incoming_maps(mpr_local_dev dev)
 {
-    mpr_graph graph;
-    mpr_list maps;
+    int i;
     RETURN_UNLESS(dev->receiving);
-    graph = dev->obj.graph;
-    /* process and send updated maps */
-    /* TODO: speed this up! */
     dev->receiving = 0;
-    maps = mpr_list_from_data(graph->maps);
-    while (maps) {
-        mpr_local_map map = *(mpr_local_map*)maps;
-        maps = mpr_list_get_next(maps);
-        if (map->is_local && map->updated && map->expr && !map->muted)
+    /* process and send updated maps; the queue may grow during iteration */
+    for (i = 0; i < dev->queued_in.num; i++) {
+        mpr_local_map map = dev->queued_in.maps[i];
+        if (!map)
+            continue;
+        map->queued &= ~MPR_DIR_IN;
+        /* updates to muted maps stay pending until the map is unmuted */
+        if (map->updated && map->expr && !map->muted)
             mpr_map_receive(map, dev->time);
     }
+    dev->queued_in.num = 0;
 }
 
 /* TODO: handle interrupt-driven updates that omit call to this function */
 MPR_INLINE static int _process_outgoing_maps(mpr_local_dev dev)
 {
-    int msgs = 0;
+    int i, msgs = 0;
     mpr_list list;
-    mpr_graph graph;
     RETURN_ARG_UNLESS(dev->sending, 0);
 
-    graph = dev->obj.graph;
-    /* process and send updated maps */
-    /* TODO: speed this up! */
-    list = mpr_list_from_data(graph->maps);
-    while (list) {
-        mpr_local_map map = *(mpr_local_map*)list;
-        list = mpr_list_get_next(list);
-        if (map->is_local && map->updated && map->expr && !map->muted)
+    /* process and send updated maps; the queue may grow during iteration */
+    for (i = 0; i < dev->queued_out.num; i++) {
+        mpr_local_map map = dev->queued_out.maps[i];
+        if (!map)
+            continue;
+        map->queued &= ~MPR_DIR_OUT;
+        if (map->updated && map->expr && !map->muted && MPR_DIR_OUT == map->src[0]->dir)
             mpr_map_send(map, dev->time);
     }
+    dev->queued_out.num = 0;
     dev->sending = 0;
-    list = mpr_list_from_data(graph->links);
+    list = mpr_list_from_data(dev->obj.graph->links);
     while (list) {
-        msgs += mpr_link_process_bundles((mpr_link)*list, dev->time, 0);
+        msgs += mpr_link_process_bundles((mpr_link)*list, dev->time, 0,
+                                         dev->tx_batch.enabled ? &dev->tx_batch : 0);
         list = mpr_list_get_next(list);
     }
+    if (dev->tx_batch.num)
+        mpr_link_send_batch(&dev->tx_batch, 0);
     return msgs ? 1 : 0;
 }
 
+#ifdef HAVE_RECVMMSG
+/* Largest datagram that can be received in batched mode. */
+#define MAX_DGRAM_LEN 65536
+/* Maximum number of batches received per poll, so that a flooded socket cannot starve the
+ * rest of the poll. */
+#define MAX_RECV_BATCHES 8
+
+/* Maximum number of datagrams received per call; each needs a buffer of MAX_DGRAM_LEN bytes. */
+#define MAX_RECV_BATCH_SIZE 32
+
+/* Receive and dispatch pending datagrams on the UDP server a batch at a time, until the socket
+ * is drained. Returns the number of datagrams handled. */
+static int _recv_batch(mpr_local_dev dev)
+{
+    mpr_recv_batch b = &dev->rx_batch;
+    lo_server server = dev->servers[SERVER_UDP];
+    struct mmsghdr *hdrs;
+    struct iovec *iov;
+    int i, ret, count = 0, num_batches = 0, fd = lo_server_get_socket_fd(server);
+
+    if (b->alloced < b->size) {
+        b->bufs = realloc(b->bufs, MAX_DGRAM_LEN * b->size);
+        b->hdrs = realloc(b->hdrs, sizeof(struct mmsghdr) * b->size);
+        b->iov = realloc(b->iov, sizeof(struct iovec) * b->size);
+        hdrs = (struct mmsghdr*)b->hdrs;
+        iov = (struct iovec*)b->iov;
+        memset(hdrs, 0, sizeof(struct mmsghdr) * b->size);
+        for (i = 0; i < b->size; i++) {
+            iov[i].iov_base = b->bufs + MAX_DGRAM_LEN * i;
+            iov[i].iov_len = MAX_DGRAM_LEN;
+            hdrs[i].msg_hdr.msg_iov = &iov[i];
+            hdrs[i].msg_hdr.msg_iovlen = 1;
+        }
+        b->alloced = b->size;
+    }
+    hdrs = (struct mmsghdr*)b->hdrs;
+    iov = (struct iovec*)b->iov;
+
+    do {
+        ret = recvmmsg(fd, hdrs, b->size, MSG_DONTWAIT, NULL);
+        if (ret < 0) {
+            if (ENOSYS == errno) {
+                /* fall back to receiving one datagram at a time from now on */
+                trace_dev(dev, "batched receiving is not supported by the system.\n");
+                b->size = 0;
+            }
+            break;
+        }
+        for (i = 0; i < ret; i++) {
+            if (hdrs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                trace_dev(dev, "dropping truncated datagram.\n");
+                continue;
+            }
+            if (lo_server_dispatch_data(server, iov[i].iov_base, hdrs[i].msg_len) >= 0)
+                ++count;
+        }
+    } while (ret == b->size && ++num_batches < MAX_RECV_BATCHES);
+    return count;
+}
+#endif
+
+int mpr_dev_set_recv_batch_size(mpr_dev dev, int size)
+{
+    RETURN_ARG_UNLESS(dev && dev->is_local, 0);
+#ifdef HAVE_RECVMMSG
+    if (size > MAX_RECV_BATCH_SIZE)
+        size = MAX_RECV_BATCH_SIZE;
+    ((mpr_local_dev)dev)->rx_batch.size = size > 0 ? size : 0;
+#endif
+    return ((mpr_local_dev)dev)->rx_batch.size;
+}
+
+int mpr_dev_set_send_batching(mpr_dev dev, int enable)
+{
+    RETURN_ARG_UNLESS(dev && dev->is_local, 0);
+#ifdef HAVE_SENDMMSG
+    ((mpr_local_dev)dev)->tx_batch.enabled = enable ? 1 : 0;
+#endif
+    return ((mpr_local_dev)dev)->tx_batch.enabled;
+}
+
+int mpr_dev_set_recv_buffer_size(mpr_dev dev, int bytes)
+{
+    int fd, size = 0;
+    socklen_t len = sizeof(int);
+    RETURN_ARG_UNLESS(dev && dev->is_local && bytes > 0, -1);
+    fd = lo_server_get_socket_fd(((mpr_local_dev)dev)->servers[SERVER_UDP]);
+    if (   setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (const char*)&bytes, sizeof(int))
+        || getsockopt(fd, SOL_SOCKET, SO_RCVBUF, (char*)&size, &len)) {
+        trace_dev(dev, "error setting receive buffer size.\n");
+        return -1;
+    }
+    return size;
+}
+
 void mpr_dev_update_maps(mpr_dev dev) {
     RETURN_UNLESS(dev && dev->is_local);
     ((mpr_local_dev)dev)->time_is_stale = 1;
@@ -800,6 +973,19 @@ int mpr_dev_poll(mpr_dev dev, int block_ms)
      * proportion of the number of input signals. Arbitrarily choosing 1 for
      * now, but perhaps could be a heuristic based on a recent number of
      * messages per channel per poll. */
+#ifdef HAVE_RECVMMSG
+    if (ldev->rx_batch.size > 0) {
+        /* drain the UDP server in batches, then check the TCP server with its own budget so
+         * that it is still serviced while UDP traffic is heavy */
+        int tcp_count = 0;
+        device_count += _recv_batch(ldev);
+        while (tcp_count < (dev->num_inputs + ldev->n_output_callbacks)*1
+               && (lo_servers_recv_noblock(&ldev->servers[SERVER_TCP], &status[3], 1, 0)))
+            ++tcp_count;
+        device_count += tcp_count;
+    }
+    else
+#endif
     while (device_count < (dev->num_inputs + ldev->n_output_callbacks)*1
            && (lo_servers_recv_noblock(ldev->servers, &status[2], 2, 0)))
         device_count += (status[2] > 0) + (status[3] > 0);
@@ -933,6 +1119,68 @@ void mpr_dev_set_time(mpr_dev dev, mpr_time time)
         _process_outgoing_maps((mpr_local_dev)dev);
 }
 
+/* Fibonacci hashing of instance ids into a power-of-two number of buckets. */
+MPR_INLINE static int _idmap_hash(mpr_id id, int size)
+{
+    return (int)((((id ^ (id >> 32)) * 0x9E3779B97F4A7C15ULL) >> 32) & (size - 1));
+}
+
+static void _idmap_tbl_add(mpr_id_map_tbl tbl, mpr_id_map map)
+{
+    int i = _idmap_hash(map->LID, tbl->size);
+    map->next = tbl->LID[i];
+    tbl->LID[i] = map;
+    i = _idmap_hash(map->GID, tbl->size);
+    map->next_GID = tbl->GID[i];
+    tbl->GID[i] = map;
+}
+
+static void _idmap_tbl_remove_GID(mpr_id_map_tbl tbl, mpr_id_map rem)
+{
+    mpr_id_map *map = &tbl->GID[_idmap_hash(rem->GID, tbl->size)];
+    while (*map) {
+        if ((*map) == rem) {
+            *map = rem->next_GID;
+            break;
+        }
+        map = &(*map)->next_GID;
+    }
+}
+
+static int _idmap_tbl_remove(mpr_id_map_tbl tbl, mpr_id_map rem)
+{
+    mpr_id_map *map;
+    RETURN_ARG_UNLESS(tbl->size, 0);
+    map = &tbl->LID[_idmap_hash(rem->LID, tbl->size)];
+    while (*map) {
+        if ((*map) == rem) {
+            *map = rem->next;
+            _idmap_tbl_remove_GID(tbl, rem);
+            --tbl->num;
+            return 1;
+        }
+        map = &(*map)->next;
+    }
+    return 0;
+}
+
+static void _idmap_tbl_resize(mpr_id_map_tbl tbl, int size)
+{
+    int i, old_size = tbl->size;
+    mpr_id_map *old_LID = tbl->LID, map, next;
+    FUNC_IF(free, tbl->GID);
+    tbl->LID = (mpr_id_map*) calloc(1, sizeof(mpr_id_map) * size);
+    tbl->GID = (mpr_id_map*) calloc(1, sizeof(mpr_id_map) * size);
+    tbl->size = size;
+    for (i = 0; i < old_size; i++) {
+        for (map = old_LID[i]; map; map = next) {
+            next = map->next;
+            _idmap_tbl_add(tbl, map);
+        }
+    }
+    FUNC_IF(free, old_LID);
+}
+
 void mpr_dev_reserve_idmap(mpr_local_dev dev)
 {
     mpr_id_map map;
@@ -944,13 +1192,16 @@ void mpr_dev_reserve_idmap(mpr_local_dev dev)
 #ifdef DEBUG
 static void print_idmaps(mpr_local_dev dev)
 {
+    int i;
+    mpr_id_map_tbl tbl = &dev->idmaps.active[0];
     printf("ID MAPS for %s:\n", dev->name);
-    mpr_id_map *map = &dev->idmaps.active[0];
-    while (*map) {
-        mpr_id_map m = *map;
-        printf("  %p: %"PR_MPR_ID" (%d) -> %"PR_MPR_ID" (%d)\n",
-               m, m->LID, m->LID_refcount, m->GID, m->GID_refcount);
-        map = &(*map)->next;
+    for (i = 0; i < tbl->size; i++) {
+        mpr_id_map m = tbl->LID[i];
+        while (m) {
+            printf("  %p: %"PR_MPR_ID" (%d) -> %"PR_MPR_ID" (%d)\n",
+                   m, m->LID, m->LID_refcount, m->GID, m->GID_refcount);
+            m = m->next;
+        }
     }
 }
 #endif
@@ -958,6 +1209,7 @@ static void print_idmaps(mpr_local_dev dev)
 mpr_id_map mpr_dev_add_idmap(mpr_local_dev dev, int group, mpr_id LID, mpr_id GID)
 {
     mpr_id_map map;
+    mpr_id_map_tbl tbl = &dev->idmaps.active[group];
     if (!dev->idmaps.reserve)
         mpr_dev_reserve_idmap(dev);
     map = dev->idmaps.reserve;
@@ -967,8 +1219,12 @@ mpr_id_map mpr_dev_add_idmap(mpr_local_dev dev, int group, mpr_id LID, mpr_id GI
     map->LID_refcount = 1;
     map->GID_refcount = 0;
     dev->idmaps.reserve = map->next;
-    map->next = dev->idmaps.active[group];
-    dev->idmaps.active[group] = map;
+
+    /* keep the load factor of the hash index at or below one */
+    if (tbl->num >= tbl->size)
+        _idmap_tbl_resize(tbl, tbl->size ? tbl->size * 2 : 16);
+    _idmap_tbl_add(tbl, map);
+    ++tbl->num;
 #ifdef DEBUG
     print_idmaps(dev);
 #endif
@@ -977,23 +1233,29 @@ mpr_id_map mpr_dev_add_idmap(mpr_local_dev dev, int group, mpr_id LID, mpr_id GI
 
 static void mpr_dev_remove_idmap(mpr_local_dev dev, int group, mpr_id_map rem)
 {
-    mpr_id_map *map = &dev->idmaps.active[group];
     trace_dev(dev, "mpr_dev_remove_idmap(%s) %"PR_MPR_ID" -> %"PR_MPR_ID"\n",
               dev->name, rem->LID, rem->GID);
-    while (*map) {
-        if ((*map) == rem) {
-            *map = (*map)->next;
-            rem->next = dev->idmaps.reserve;
-            dev->idmaps.reserve = rem;
-            break;
-        }
-        map = &(*map)->next;
+    if (_idmap_tbl_remove(&dev->idmaps.active[group], rem)) {
+        rem->next = dev->idmaps.reserve;
+        rem->next_GID = 0;
+        dev->idmaps.reserve = rem;
     }
 #ifdef DEBUG
     print_idmaps(dev);
 #endif
 }
 
+static void mpr_dev_set_idmap_GID(mpr_local_dev dev, int group, mpr_id_map map, mpr_id GID)
+{
+    mpr_id_map_tbl tbl = &dev->idmaps.active[group];
+    int i;
+    _idmap_tbl_remove_GID(tbl, map);
+    map->GID = GID;
+    i = _idmap_hash(GID, tbl->size);
+    map->next_GID = tbl->GID[i];
+    tbl->GID[i] = map;
+}
+
 int mpr_dev_LID_decref(mpr_local_dev dev, int group, mpr_id_map map)
 {
     trace_dev(dev, "mpr_dev_LID_decref(%s) %"PR_MPR_ID" -> %"PR_MPR_ID"\n",
@@ -1028,7 +1290,10 @@ int mpr_dev_GID_decref(mpr_local_dev dev, int group, mpr_id_map map)
 
 mpr_id_map mpr_dev_get_idmap_by_LID(mpr_local_dev dev, int group, mpr_id LID)
 {
-    mpr_id_map map = dev->idmaps.active[group];
+    mpr_id_map_tbl tbl = &dev->idmaps.active[group];
+    mpr_id_map map;
+    RETURN_ARG_UNLESS(tbl->size, 0);
+    map = tbl->LID[_idmap_hash(LID, tbl->size)];
     while (map) {
         if (map->LID == LID)
             return map;
@@ -1039,11 +1304,14 @@ mpr_id_map mpr_dev_get_idmap_by_LID(mpr_local_dev dev, int group, mpr_id LID)
 
 mpr_id_map mpr_dev_get_idmap_by_GID(mpr_local_dev dev, int group, mpr_id GID)
 {
-    mpr_id_map map = dev->idmaps.active[group];
+    mpr_id_map_tbl tbl = &dev->idmaps.active[group];
+    mpr_id_map map;
+    RETURN_ARG_UNLESS(tbl->size, 0);
+    map = tbl->GID[_idmap_hash(GID, tbl->size)];
     while (map) {
         if (map->GID == GID)
             return map;
-        map = map->next;
+        map = map->next_GID;
     }
     return 0;
 }
@@ -8,9 +8,31 @@
 #include <float.h>
 #include "mapper_internal.h"
 
-#define MAX_HIST_SIZE 100
-#define STACK_SIZE 64
-#define N_USER_VARS 16
+/* Define MPR_NO_SIMD to build the expression engine without SIMD kernels. */
+#if !defined(MPR_NO_SIMD) && defined(__GNUC__)
+#if defined(__x86_64__)
+#define SIMD_X86
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define SIMD_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+/* Define ENABLE_JIT (configure --enable-jit) to compile frequently evaluated expressions to
+ * machine code. Only x86-64 with the System V calling convention is supported. */
+#if defined(ENABLE_JIT) && defined(__GNUC__) && defined(__x86_64__) && !defined(WIN32)
+#define BC_JIT
+#include <sys/mman.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+#define MAX_HIST_SIZE 0x10000  /* sanity limit on literal history indices */
+#define INIT_STACK_SIZE 64      /* initial size of the parser stacks, grown as needed */
+#define MAX_USER_VARS 0x4000    /* size of the user variable index space */
+#define JIT_THRESHOLD 64        /* evaluations of a compiled program before it is JIT compiled */
 #ifdef DEBUG
     #define TRACE_PARSE 0 /* Set non-zero to see trace during parse. */
     #define TRACE_EVAL 0 /* Set non-zero to see trace during evaluation. */
@@ -34,10 +56,13 @@ typedef union _mpr_expr_val {
 struct _mpr_expr_stack {
     mpr_expr_val stk;
     mpr_type *types;
-    uint8_t *dims;
+    int *dims;
     int size;
+    mpr_expr cache;     /* shared expressions parsed with this stack */
 };
 
+static void expr_cache_remove(mpr_expr expr);
+
 mpr_expr_stack mpr_expr_stack_new() {
     mpr_expr_stack stk = calloc(1, sizeof(struct _mpr_expr_stack));
     return stk;
@@ -56,13 +81,16 @@ static void expr_stack_realloc(mpr_expr_stack stk, int num_samps) {
         else
             stk->types = malloc(stk->size * sizeof(mpr_type));
         if (stk->dims)
-            stk->dims = realloc(stk->dims, stk->size * sizeof(uint8_t));
+            stk->dims = realloc(stk->dims, stk->size * sizeof(int));
         else
-            stk->dims = malloc(stk->size * sizeof(uint8_t));
+            stk->dims = malloc(stk->size * sizeof(int));
     }
 }
 
 void mpr_expr_stack_free(mpr_expr_stack stk) {
+    /* expressions still in use remain valid but are no longer shared */
+    while (stk->cache)
+        expr_cache_remove(stk->cache);
     if (stk->stk)
         free(stk->stk);
     if (stk->types)
@@ -72,6 +100,517 @@ void mpr_expr_stack_free(mpr_expr_stack stk) {
     free(stk);
 }
 
+/* SIMD kernels for element-wise operators and vector functions. Elements of the evaluation stack
+ * occupy an 8-byte union, so 32-bit elements are deinterleaved on load and written back with
+ * zeroed upper halves. The instruction set is selected at runtime: AVX2 if the CPU supports it,
+ * otherwise SSE2 on x86-64, and NEON on aarch64. Element-wise kernels and min/max reductions
+ * produce exactly the results of the scalar code (reductions fall back to it if they encounter
+ * NaN or signed zeros); sums, means, norms and dot products accumulate partial sums in parallel
+ * lanes, so floating-point results may differ from the sequential sum in the last bits. */
+
+#define SIMD_MIN_LEN    8   /* shorter vectors are left to the scalar code */
+
+#define SIMD_BCAST_A    1   /* broadcast the first operand's first element */
+#define SIMD_BCAST_B    2   /* broadcast the second operand's first element */
+
+#define SIMD_TYPE_i     0
+#define SIMD_TYPE_f     1
+#define SIMD_TYPE_d     2
+
+typedef enum {
+    SIMD_ADD,
+    SIMD_SUB,
+    SIMD_MUL,
+    SIMD_DIV,
+    SIMD_GT,
+    SIMD_GTE,
+    SIMD_LT,
+    SIMD_LTE,
+    SIMD_EQ,
+    SIMD_NEQ,
+    N_SIMD_OP
+} simd_op_t;
+
+/* d[i] = a[i] OP b[i] */
+typedef void simd_op_fn(mpr_expr_val d, mpr_expr_val a, mpr_expr_val b, int n, int bcast);
+
+/* d[0] = reduction of a (and b) */
+typedef void simd_reduce_fn(mpr_expr_val d, mpr_expr_val a, mpr_expr_val b, int n);
+
+/* d[0] = extremum of a; returns 0 without writing d if the scalar code must be used instead */
+typedef int simd_extrema_fn(mpr_expr_val d, mpr_expr_val a, int n);
+
+/* element-wise update of two accumulators x and y from a new vector */
+typedef void simd_update_fn(mpr_expr_val x, mpr_expr_val y, mpr_expr_val new, int n);
+
+typedef struct _simd_isa {
+    const char *name;
+    simd_op_fn *op[N_SIMD_OP][3];
+    simd_reduce_fn *sum[3];
+    simd_reduce_fn *sumsq[3];
+    simd_reduce_fn *dot[3];
+    simd_extrema_fn *max[3];
+    simd_extrema_fn *min[3];
+    simd_update_fn *maxmin[3];
+    simd_update_fn *sumnum[3];
+} simd_isa_t;
+
+static const simd_isa_t simd_none = { "none" };
+static const simd_isa_t *simd = &simd_none;
+static int simd_selected = 0;
+
+/* Get a SIMD kernel for the typed function FN, or 0 if the vector is too short. */
+#define SIMD_FN(FN, T, LEN) ((LEN) >= SIMD_MIN_LEN ? simd->FN[SIMD_TYPE_##T] : 0)
+
+#define SIMD_NAN_i(X)   0
+#define SIMD_NAN_f(X)   ((X) != (X))
+#define SIMD_NAN_d(X)   ((X) != (X))
+
+#define SIMD_OP_KERNEL(ISA, NAME, TYPE, T, OP, SYM)                                         \
+static ISA##_ATTR void simd_##ISA##_##NAME##T(mpr_expr_val d, mpr_expr_val a,               \
+                                              mpr_expr_val b, int n, int bcast)             \
+{                                                                                           \
+    int i, ia = !(bcast & SIMD_BCAST_A), ib = !(bcast & SIMD_BCAST_B);                      \
+    TYPE sa = a[0].T, sb = b[0].T;                                                          \
+    ISA##_V##T va = ISA##_SET1##T(sa), vb = ISA##_SET1##T(sb), vd;                          \
+    for (i = 0; i + ISA##_W##T <= n; i += ISA##_W##T) {                                     \
+        if (ia)                                                                             \
+            va = ISA##_LOAD##T(a + i);                                                      \
+        if (ib)                                                                             \
+            vb = ISA##_LOAD##T(b + i);                                                      \
+        vd = ISA##_##OP##T(va, vb);                                                         \
+        ISA##_STORE##T(d + i, vd);                                                          \
+    }                                                                                       \
+    for (; i < n; i++)                                                                      \
+        d[i].T = (ia ? a[i].T : sa) SYM (ib ? b[i].T : sb);                                 \
+}
+
+#define SIMD_REDUCE_KERNEL(ISA, NAME, TYPE, T, CALC, SCALAR)                                \
+static ISA##_ATTR void simd_##ISA##_##NAME##T(mpr_expr_val d, mpr_expr_val a,               \
+                                              mpr_expr_val b, int n)                        \
+{                                                                                           \
+    int i, j;                                                                               \
+    TYPE lanes[ISA##_W##T], acc = 0;                                                        \
+    ISA##_V##T va, vacc = ISA##_SET1##T(0);                                                 \
+    for (i = 0; i + ISA##_W##T <= n; i += ISA##_W##T) {                                     \
+        va = ISA##_LOAD##T(a + i);                                                          \
+        vacc = ISA##_ADD##T(vacc, CALC);                                                    \
+    }                                                                                       \
+    ISA##_STOREA##T(lanes, vacc);                                                           \
+    for (j = 0; j < ISA##_W##T; j++)                                                        \
+        acc += lanes[j];                                                                    \
+    for (; i < n; i++)                                                                      \
+        acc += SCALAR;                                                                      \
+    d[0].T = acc;                                                                           \
+}
+
+#define SIMD_EXTREMA_KERNEL(ISA, NAME, TYPE, T, OP, SYM)                                    \
+static ISA##_ATTR int simd_##ISA##_##NAME##T(mpr_expr_val d, mpr_expr_val a, int n)         \
+{                                                                                           \
+    int i, j;                                                                               \
+    TYPE lanes[ISA##_W##T], ext;                                                            \
+    ISA##_V##T v, vext, vnan;                                                               \
+    RETURN_ARG_UNLESS(n >= ISA##_W##T, 0);                                                  \
+    vext = ISA##_LOAD##T(a);                                                                \
+    vnan = ISA##_NEQ##T(vext, vext);                                                        \
+    for (i = ISA##_W##T; i + ISA##_W##T <= n; i += ISA##_W##T) {                            \
+        v = ISA##_LOAD##T(a + i);                                                           \
+        vnan = ISA##_ADD##T(vnan, ISA##_NEQ##T(v, v));                                      \
+        vext = ISA##_##OP##T(v, vext);                                                      \
+    }                                                                                       \
+    ISA##_STOREA##T(lanes, vext);                                                           \
+    ext = lanes[0];                                                                         \
+    for (j = 1; j < ISA##_W##T; j++) {                                                      \
+        if (lanes[j] SYM ext)                                                               \
+            ext = lanes[j];                                                                 \
+    }                                                                                       \
+    for (; i < n; i++) {                                                                    \
+        RETURN_ARG_UNLESS(!SIMD_NAN_##T(a[i].T), 0);                                        \
+        if (a[i].T SYM ext)                                                                 \
+            ext = a[i].T;                                                                   \
+    }                                                                                       \
+    if (SIMD_TYPE_i != SIMD_TYPE_##T) {                                                     \
+        /* the order in which lanes are visited matters for NaN and signed zeros */         \
+        RETURN_ARG_UNLESS(0 != ext, 0);                                                     \
+        ISA##_STOREA##T(lanes, vnan);                                                       \
+        for (j = 0; j < ISA##_W##T; j++)                                                    \
+            RETURN_ARG_UNLESS(0 == lanes[j], 0);                                            \
+    }                                                                                       \
+    d[0].T = ext;                                                                           \
+    return 1;                                                                               \
+}
+
+#define SIMD_MAXMIN_KERNEL(ISA, TYPE, T)                                                    \
+static ISA##_ATTR void simd_##ISA##_maxmin##T(mpr_expr_val max, mpr_expr_val min,           \
+                                              mpr_expr_val new, int n)                      \
+{                                                                                           \
+    int i;                                                                                  \
+    ISA##_V##T v, vmax, vmin;                                                               \
+    for (i = 0; i + ISA##_W##T <= n; i += ISA##_W##T) {                                     \
+        v = ISA##_LOAD##T(new + i);                                                         \
+        vmax = ISA##_LOAD##T(max + i);                                                      \
+        vmin = ISA##_LOAD##T(min + i);                                                      \
+        vmax = ISA##_MAX##T(v, vmax);                                                       \
+        vmin = ISA##_MIN##T(v, vmin);                                                       \
+        ISA##_STORE##T(max + i, vmax);                                                      \
+        ISA##_STORE##T(min + i, vmin);                                                      \
+    }                                                                                       \
+    for (; i < n; i++) {                                                                    \
+        if (new[i].T > max[i].T)                                                            \
+            max[i].T = new[i].T;                                                            \
+        if (new[i].T < min[i].T)                                                            \
+            min[i].T = new[i].T;                                                            \
+    }                                                                                       \
+}
+
+#define SIMD_SUMNUM_KERNEL(ISA, TYPE, T)                                                    \
+static ISA##_ATTR void simd_##ISA##_sumnum##T(mpr_expr_val sum, mpr_expr_val num,           \
+                                              mpr_expr_val new, int n)                      \
+{                                                                                           \
+    int i;                                                                                  \
+    ISA##_V##T vsum, vnum, one = ISA##_SET1##T(1);                                          \
+    for (i = 0; i + ISA##_W##T <= n; i += ISA##_W##T) {                                     \
+        vsum = ISA##_ADD##T(ISA##_LOAD##T(sum + i), ISA##_LOAD##T(new + i));                \
+        vnum = ISA##_ADD##T(ISA##_LOAD##T(num + i), one);                                   \
+        ISA##_STORE##T(sum + i, vsum);                                                      \
+        ISA##_STORE##T(num + i, vnum);                                                      \
+    }                                                                                       \
+    for (; i < n; i++) {                                                                    \
+        sum[i].T += new[i].T;                                                               \
+        num[i].T += 1;                                                                      \
+    }                                                                                       \
+}
+
+#define SIMD_KERNELS(ISA, TYPE, T)                                                          \
+    SIMD_OP_KERNEL(ISA, add, TYPE, T, ADD, +)                                               \
+    SIMD_OP_KERNEL(ISA, sub, TYPE, T, SUB, -)                                               \
+    SIMD_OP_KERNEL(ISA, gt, TYPE, T, GT, >)                                                 \
+    SIMD_OP_KERNEL(ISA, gte, TYPE, T, GTE, >=)                                              \
+    SIMD_OP_KERNEL(ISA, lt, TYPE, T, LT, <)                                                 \
+    SIMD_OP_KERNEL(ISA, lte, TYPE, T, LTE, <=)                                              \
+    SIMD_OP_KERNEL(ISA, eq, TYPE, T, EQ, ==)                                                \
+    SIMD_OP_KERNEL(ISA, neq, TYPE, T, NEQ, !=)                                              \
+    SIMD_REDUCE_KERNEL(ISA, sum, TYPE, T, va, a[i].T)                                       \
+    SIMD_EXTREMA_KERNEL(ISA, max, TYPE, T, MAX, >)                                          \
+    SIMD_EXTREMA_KERNEL(ISA, min, TYPE, T, MIN, <)                                          \
+    SIMD_MAXMIN_KERNEL(ISA, TYPE, T)                                                        \
+    SIMD_SUMNUM_KERNEL(ISA, TYPE, T)
+
+/* kernels that need a vector multiply */
+#define SIMD_MUL_KERNELS(ISA, TYPE, T)                                                      \
+    SIMD_OP_KERNEL(ISA, mul, TYPE, T, MUL, *)                                               \
+    SIMD_REDUCE_KERNEL(ISA, dot, TYPE, T, ISA##_MUL##T(va, ISA##_LOAD##T(b + i)),           \
+                       a[i].T * b[i].T)
+
+/* kernels for floating-point types only */
+#define SIMD_FLT_KERNELS(ISA, TYPE, T)                                                      \
+    SIMD_OP_KERNEL(ISA, div, TYPE, T, DIV, /)                                               \
+    SIMD_REDUCE_KERNEL(ISA, sumsq, TYPE, T, ISA##_MUL##T(va, va), a[i].T * a[i].T)
+
+/* Missing integer kernels. */
+#define simd_sse2_muli      0
+#define simd_sse2_doti      0
+#define simd_sse2_divi      0
+#define simd_sse2_sumsqi    0
+#define simd_avx2_divi      0
+#define simd_avx2_sumsqi    0
+#define simd_neon_divi      0
+#define simd_neon_sumsqi    0
+
+#define SIMD_TYPED(ISA, NAME) \
+    { simd_##ISA##_##NAME##i, simd_##ISA##_##NAME##f, simd_##ISA##_##NAME##d }
+
+#define SIMD_ISA(ISA)                                                                       \
+static const simd_isa_t simd_##ISA = {                                                      \
+    #ISA,                                                                                   \
+    {                                                                                       \
+        SIMD_TYPED(ISA, add), SIMD_TYPED(ISA, sub), SIMD_TYPED(ISA, mul),                   \
+        SIMD_TYPED(ISA, div), SIMD_TYPED(ISA, gt), SIMD_TYPED(ISA, gte),                    \
+        SIMD_TYPED(ISA, lt), SIMD_TYPED(ISA, lte), SIMD_TYPED(ISA, eq), SIMD_TYPED(ISA, neq) \
+    },                                                                                      \
+    SIMD_TYPED(ISA, sum),                                                                   \
+    SIMD_TYPED(ISA, sumsq),                                                                 \
+    SIMD_TYPED(ISA, dot),                                                                   \
+    SIMD_TYPED(ISA, max),                                                                   \
+    SIMD_TYPED(ISA, min),                                                                   \
+    SIMD_TYPED(ISA, maxmin),                                                                \
+    SIMD_TYPED(ISA, sumnum)                                                                 \
+};
+
+#ifdef SIMD_X86
+/* SSE2 is part of the x86-64 baseline. */
+#define sse2_ATTR
+typedef __m128i sse2_Vi;
+typedef __m128 sse2_Vf;
+typedef __m128d sse2_Vd;
+#define sse2_Wi                 4
+#define sse2_Wf                 4
+#define sse2_Wd                 2
+#define sse2_LOADf(P)           _mm_shuffle_ps(_mm_loadu_ps(&(P)[0].f), _mm_loadu_ps(&(P)[2].f), \
+                                               _MM_SHUFFLE(2, 0, 2, 0))
+#define sse2_LOADi(P)           _mm_castps_si128(sse2_LOADf(P))
+#define sse2_LOADd(P)           _mm_loadu_pd(&(P)[0].d)
+#define sse2_STOREf(P, V)                                                   \
+{                                                                           \
+    _mm_storeu_ps(&(P)[0].f, _mm_unpacklo_ps(V, _mm_setzero_ps()));         \
+    _mm_storeu_ps(&(P)[2].f, _mm_unpackhi_ps(V, _mm_setzero_ps()));         \
+}
+#define sse2_STOREi(P, V)       sse2_STOREf(P, _mm_castsi128_ps(V))
+#define sse2_STOREd(P, V)       _mm_storeu_pd(&(P)[0].d, V)
+#define sse2_STOREAi(L, V)      _mm_storeu_si128((__m128i*)(L), V)
+#define sse2_STOREAf(L, V)      _mm_storeu_ps(L, V)
+#define sse2_STOREAd(L, V)      _mm_storeu_pd(L, V)
+#define sse2_SET1i(X)           _mm_set1_epi32(X)
+#define sse2_SET1f(X)           _mm_set1_ps(X)
+#define sse2_SET1d(X)           _mm_set1_pd(X)
+#define sse2_BOOLi(M)           _mm_and_si128(M, _mm_set1_epi32(1))
+#define sse2_NBOOLi(M)          _mm_andnot_si128(M, _mm_set1_epi32(1))
+#define sse2_BOOLf(M)           _mm_and_ps(M, _mm_set1_ps(1.f))
+#define sse2_BOOLd(M)           _mm_and_pd(M, _mm_set1_pd(1.))
+#define sse2_SELi(M, A, B)      _mm_or_si128(_mm_and_si128(M, A), _mm_andnot_si128(M, B))
+
+#define sse2_ADDi(A, B)         _mm_add_epi32(A, B)
+#define sse2_SUBi(A, B)         _mm_sub_epi32(A, B)
+#define sse2_GTi(A, B)          sse2_BOOLi(_mm_cmpgt_epi32(A, B))
+#define sse2_GTEi(A, B)         sse2_NBOOLi(_mm_cmplt_epi32(A, B))
+#define sse2_LTi(A, B)          sse2_BOOLi(_mm_cmplt_epi32(A, B))
+#define sse2_LTEi(A, B)         sse2_NBOOLi(_mm_cmpgt_epi32(A, B))
+#define sse2_EQi(A, B)          sse2_BOOLi(_mm_cmpeq_epi32(A, B))
+#define sse2_NEQi(A, B)         sse2_NBOOLi(_mm_cmpeq_epi32(A, B))
+#define sse2_MAXi(A, B)         sse2_SELi(_mm_cmpgt_epi32(A, B), A, B)
+#define sse2_MINi(A, B)         sse2_SELi(_mm_cmplt_epi32(A, B), A, B)
+
+#define sse2_ADDf(A, B)         _mm_add_ps(A, B)
+#define sse2_SUBf(A, B)         _mm_sub_ps(A, B)
+#define sse2_MULf(A, B)         _mm_mul_ps(A, B)
+#define sse2_DIVf(A, B)         _mm_div_ps(A, B)
+#define sse2_GTf(A, B)          sse2_BOOLf(_mm_cmpgt_ps(A, B))
+#define sse2_GTEf(A, B)         sse2_BOOLf(_mm_cmpge_ps(A, B))
+#define sse2_LTf(A, B)          sse2_BOOLf(_mm_cmplt_ps(A, B))
+#define sse2_LTEf(A, B)         sse2_BOOLf(_mm_cmple_ps(A, B))
+#define sse2_EQf(A, B)          sse2_BOOLf(_mm_cmpeq_ps(A, B))
+#define sse2_NEQf(A, B)         sse2_BOOLf(_mm_cmpneq_ps(A, B))
+/* maxps/minps return the second operand unless the first compares greater/less */
+#define sse2_MAXf(A, B)         _mm_max_ps(A, B)
+#define sse2_MINf(A, B)         _mm_min_ps(A, B)
+
+#define sse2_ADDd(A, B)         _mm_add_pd(A, B)
+#define sse2_SUBd(A, B)         _mm_sub_pd(A, B)
+#define sse2_MULd(A, B)         _mm_mul_pd(A, B)
+#define sse2_DIVd(A, B)         _mm_div_pd(A, B)
+#define sse2_GTd(A, B)          sse2_BOOLd(_mm_cmpgt_pd(A, B))
+#define sse2_GTEd(A, B)         sse2_BOOLd(_mm_cmpge_pd(A, B))
+#define sse2_LTd(A, B)          sse2_BOOLd(_mm_cmplt_pd(A, B))
+#define sse2_LTEd(A, B)         sse2_BOOLd(_mm_cmple_pd(A, B))
+#define sse2_EQd(A, B)          sse2_BOOLd(_mm_cmpeq_pd(A, B))
+#define sse2_NEQd(A, B)         sse2_BOOLd(_mm_cmpneq_pd(A, B))
+#define sse2_MAXd(A, B)         _mm_max_pd(A, B)
+#define sse2_MINd(A, B)         _mm_min_pd(A, B)
+
+SIMD_KERNELS(sse2, int, i)
+SIMD_KERNELS(sse2, float, f)
+SIMD_KERNELS(sse2, double, d)
+SIMD_MUL_KERNELS(sse2, float, f)
+SIMD_MUL_KERNELS(sse2, double, d)
+SIMD_FLT_KERNELS(sse2, float, f)
+SIMD_FLT_KERNELS(sse2, double, d)
+SIMD_ISA(sse2)
+
+/* AVX2 kernels are compiled for the target regardless of the compiler flags and only selected
+ * if the CPU supports them. Eight 32-bit elements are loaded in the order [0,1,4,5,2,3,6,7],
+ * which the store reverses. */
+#define avx2_ATTR               __attribute__((target("avx2")))
+typedef __m256i avx2_Vi;
+typedef __m256 avx2_Vf;
+typedef __m256d avx2_Vd;
+#define avx2_Wi                 8
+#define avx2_Wf                 8
+#define avx2_Wd                 4
+#define avx2_LOADf(P)           _mm256_shuffle_ps(_mm256_loadu_ps(&(P)[0].f),               \
+                                                  _mm256_loadu_ps(&(P)[4].f),               \
+                                                  _MM_SHUFFLE(2, 0, 2, 0))
+#define avx2_LOADi(P)           _mm256_castps_si256(avx2_LOADf(P))
+#define avx2_LOADd(P)           _mm256_loadu_pd(&(P)[0].d)
+#define avx2_STOREf(P, V)                                                   \
+{                                                                           \
+    _mm256_storeu_ps(&(P)[0].f, _mm256_unpacklo_ps(V, _mm256_setzero_ps()));\
+    _mm256_storeu_ps(&(P)[4].f, _mm256_unpackhi_ps(V, _mm256_setzero_ps()));\
+}
+#define avx2_STOREi(P, V)       avx2_STOREf(P, _mm256_castsi256_ps(V))
+#define avx2_STOREd(P, V)       _mm256_storeu_pd(&(P)[0].d, V)
+#define avx2_STOREAi(L, V)      _mm256_storeu_si256((__m256i*)(L), V)
+#define avx2_STOREAf(L, V)      _mm256_storeu_ps(L, V)
+#define avx2_STOREAd(L, V)      _mm256_storeu_pd(L, V)
+#define avx2_SET1i(X)           _mm256_set1_epi32(X)
+#define avx2_SET1f(X)           _mm256_set1_ps(X)
+#define avx2_SET1d(X)           _mm256_set1_pd(X)
+#define avx2_BOOLi(M)           _mm256_and_si256(M, _mm256_set1_epi32(1))
+#define avx2_NBOOLi(M)          _mm256_andnot_si256(M, _mm256_set1_epi32(1))
+#define avx2_BOOLf(M)           _mm256_and_ps(M, _mm256_set1_ps(1.f))
+#define avx2_BOOLd(M)           _mm256_and_pd(M, _mm256_set1_pd(1.))
+
+#define avx2_ADDi(A, B)         _mm256_add_epi32(A, B)
+#define avx2_SUBi(A, B)         _mm256_sub_epi32(A, B)
+#define avx2_MULi(A, B)         _mm256_mullo_epi32(A, B)
+#define avx2_GTi(A, B)          avx2_BOOLi(_mm256_cmpgt_epi32(A, B))
+#define avx2_GTEi(A, B)         avx2_NBOOLi(_mm256_cmpgt_epi32(B, A))
+#define avx2_LTi(A, B)          avx2_BOOLi(_mm256_cmpgt_epi32(B, A))
+#define avx2_LTEi(A, B)         avx2_NBOOLi(_mm256_cmpgt_epi32(A, B))
+#define avx2_EQi(A, B)          avx2_BOOLi(_mm256_cmpeq_epi32(A, B))
+#define avx2_NEQi(A, B)         avx2_NBOOLi(_mm256_cmpeq_epi32(A, B))
+#define avx2_MAXi(A, B)         _mm256_max_epi32(A, B)
+#define avx2_MINi(A, B)         _mm256_min_epi32(A, B)
+
+#define avx2_ADDf(A, B)         _mm256_add_ps(A, B)
+#define avx2_SUBf(A, B)         _mm256_sub_ps(A, B)
+#define avx2_MULf(A, B)         _mm256_mul_ps(A, B)
+#define avx2_DIVf(A, B)         _mm256_div_ps(A, B)
+#define avx2_GTf(A, B)          avx2_BOOLf(_mm256_cmp_ps(A, B, _CMP_GT_OQ))
+#define avx2_GTEf(A, B)         avx2_BOOLf(_mm256_cmp_ps(A, B, _CMP_GE_OQ))
+#define avx2_LTf(A, B)          avx2_BOOLf(_mm256_cmp_ps(A, B, _CMP_LT_OQ))
+#define avx2_LTEf(A, B)         avx2_BOOLf(_mm256_cmp_ps(A, B, _CMP_LE_OQ))
+#define avx2_EQf(A, B)          avx2_BOOLf(_mm256_cmp_ps(A, B, _CMP_EQ_OQ))
+#define avx2_NEQf(A, B)         avx2_BOOLf(_mm256_cmp_ps(A, B, _CMP_NEQ_UQ))
+#define avx2_MAXf(A, B)         _mm256_max_ps(A, B)
+#define avx2_MINf(A, B)         _mm256_min_ps(A, B)
+
+#define avx2_ADDd(A, B)         _mm256_add_pd(A, B)
+#define avx2_SUBd(A, B)         _mm256_sub_pd(A, B)
+#define avx2_MULd(A, B)         _mm256_mul_pd(A, B)
+#define avx2_DIVd(A, B)         _mm256_div_pd(A, B)
+#define avx2_GTd(A, B)          avx2_BOOLd(_mm256_cmp_pd(A, B, _CMP_GT_OQ))
+#define avx2_GTEd(A, B)         avx2_BOOLd(_mm256_cmp_pd(A, B, _CMP_GE_OQ))
+#define avx2_LTd(A, B)          avx2_BOOLd(_mm256_cmp_pd(A, B, _CMP_LT_OQ))
+#define avx2_LTEd(A, B)         avx2_BOOLd(_mm256_cmp_pd(A, B, _CMP_LE_OQ))
+#define avx2_EQd(A, B)          avx2_BOOLd(_mm256_cmp_pd(A, B, _CMP_EQ_OQ))
+#define avx2_NEQd(A, B)         avx2_BOOLd(_mm256_cmp_pd(A, B, _CMP_NEQ_UQ))
+#define avx2_MAXd(A, B)         _mm256_max_pd(A, B)
+#define avx2_MINd(A, B)         _mm256_min_pd(A, B)
+
+SIMD_KERNELS(avx2, int, i)
+SIMD_KERNELS(avx2, float, f)
+SIMD_KERNELS(avx2, double, d)
+SIMD_MUL_KERNELS(avx2, int, i)
+SIMD_MUL_KERNELS(avx2, float, f)
+SIMD_MUL_KERNELS(avx2, double, d)
+SIMD_FLT_KERNELS(avx2, float, f)
+SIMD_FLT_KERNELS(avx2, double, d)
+SIMD_ISA(avx2)
+#endif /* SIMD_X86 */
+
+#ifdef SIMD_NEON
+/* NEON is part of the aarch64 baseline. vld2/vst2 deinterleave 32-bit elements directly. */
+#define neon_ATTR
+typedef int32x4_t neon_Vi;
+typedef float32x4_t neon_Vf;
+typedef float64x2_t neon_Vd;
+#define neon_Wi                 4
+#define neon_Wf                 4
+#define neon_Wd                 2
+#define neon_LOADi(P)           vld2q_s32(&(P)[0].i).val[0]
+#define neon_LOADf(P)           vld2q_f32(&(P)[0].f).val[0]
+#define neon_LOADd(P)           vld1q_f64(&(P)[0].d)
+#define neon_STOREi(P, V)                                                   \
+{                                                                           \
+    int32x4x2_t pair;                                                       \
+    pair.val[0] = V;                                                        \
+    pair.val[1] = vdupq_n_s32(0);                                           \
+    vst2q_s32(&(P)[0].i, pair);                                             \
+}
+#define neon_STOREf(P, V)                                                   \
+{                                                                           \
+    float32x4x2_t pair;                                                     \
+    pair.val[0] = V;                                                        \
+    pair.val[1] = vdupq_n_f32(0);                                           \
+    vst2q_f32(&(P)[0].f, pair);                                             \
+}
+#define neon_STOREd(P, V)       vst1q_f64(&(P)[0].d, V)
+#define neon_STOREAi(L, V)      vst1q_s32(L, V)
+#define neon_STOREAf(L, V)      vst1q_f32(L, V)
+#define neon_STOREAd(L, V)      vst1q_f64(L, V)
+#define neon_SET1i(X)           vdupq_n_s32(X)
+#define neon_SET1f(X)           vdupq_n_f32(X)
+#define neon_SET1d(X)           vdupq_n_f64(X)
+#define neon_ONEf               vreinterpretq_u32_f32(vdupq_n_f32(1.f))
+#define neon_ONEd               vreinterpretq_u64_f64(vdupq_n_f64(1.))
+#define neon_BOOLi(M)           vreinterpretq_s32_u32(vandq_u32(M, vdupq_n_u32(1)))
+#define neon_NBOOLi(M)          vreinterpretq_s32_u32(vbicq_u32(vdupq_n_u32(1), M))
+#define neon_BOOLf(M)           vreinterpretq_f32_u32(vandq_u32(M, neon_ONEf))
+#define neon_NBOOLf(M)          vreinterpretq_f32_u32(vbicq_u32(neon_ONEf, M))
+#define neon_BOOLd(M)           vreinterpretq_f64_u64(vandq_u64(M, neon_ONEd))
+#define neon_NBOOLd(M)          vreinterpretq_f64_u64(vbicq_u64(neon_ONEd, M))
+
+#define neon_ADDi(A, B)         vaddq_s32(A, B)
+#define neon_SUBi(A, B)         vsubq_s32(A, B)
+#define neon_MULi(A, B)         vmulq_s32(A, B)
+#define neon_GTi(A, B)          neon_BOOLi(vcgtq_s32(A, B))
+#define neon_GTEi(A, B)         neon_BOOLi(vcgeq_s32(A, B))
+#define neon_LTi(A, B)          neon_BOOLi(vcltq_s32(A, B))
+#define neon_LTEi(A, B)         neon_BOOLi(vcleq_s32(A, B))
+#define neon_EQi(A, B)          neon_BOOLi(vceqq_s32(A, B))
+#define neon_NEQi(A, B)         neon_NBOOLi(vceqq_s32(A, B))
+#define neon_MAXi(A, B)         vmaxq_s32(A, B)
+#define neon_MINi(A, B)         vminq_s32(A, B)
+
+/* vmaxq/vminq propagate NaN, so select explicitly to match the scalar comparisons */
+#define neon_ADDf(A, B)         vaddq_f32(A, B)
+#define neon_SUBf(A, B)         vsubq_f32(A, B)
+#define neon_MULf(A, B)         vmulq_f32(A, B)
+#define neon_DIVf(A, B)         vdivq_f32(A, B)
+#define neon_GTf(A, B)          neon_BOOLf(vcgtq_f32(A, B))
+#define neon_GTEf(A, B)         neon_BOOLf(vcgeq_f32(A, B))
+#define neon_LTf(A, B)          neon_BOOLf(vcltq_f32(A, B))
+#define neon_LTEf(A, B)         neon_BOOLf(vcleq_f32(A, B))
+#define neon_EQf(A, B)          neon_BOOLf(vceqq_f32(A, B))
+#define neon_NEQf(A, B)         neon_NBOOLf(vceqq_f32(A, B))
+#define neon_MAXf(A, B)         vbslq_f32(vcgtq_f32(A, B), A, B)
+#define neon_MINf(A, B)         vbslq_f32(vcltq_f32(A, B), A, B)
+
+#define neon_ADDd(A, B)         vaddq_f64(A, B)
+#define neon_SUBd(A, B)         vsubq_f64(A, B)
+#define neon_MULd(A, B)         vmulq_f64(A, B)
+#define neon_DIVd(A, B)         vdivq_f64(A, B)
+#define neon_GTd(A, B)          neon_BOOLd(vcgtq_f64(A, B))
+#define neon_GTEd(A, B)         neon_BOOLd(vcgeq_f64(A, B))
+#define neon_LTd(A, B)          neon_BOOLd(vcltq_f64(A, B))
+#define neon_LTEd(A, B)         neon_BOOLd(vcleq_f64(A, B))
+#define neon_EQd(A, B)          neon_BOOLd(vceqq_f64(A, B))
+#define neon_NEQd(A, B)         neon_NBOOLd(vceqq_f64(A, B))
+#define neon_MAXd(A, B)         vbslq_f64(vcgtq_f64(A, B), A, B)
+#define neon_MINd(A, B)         vbslq_f64(vcltq_f64(A, B), A, B)
+
+SIMD_KERNELS(neon, int, i)
+SIMD_KERNELS(neon, float, f)
+SIMD_KERNELS(neon, double, d)
+SIMD_MUL_KERNELS(neon, int, i)
+SIMD_MUL_KERNELS(neon, float, f)
+SIMD_MUL_KERNELS(neon, double, d)
+SIMD_FLT_KERNELS(neon, float, f)
+SIMD_FLT_KERNELS(neon, double, d)
+SIMD_ISA(neon)
+#endif /* SIMD_NEON */
+
+const char *mpr_expr_set_simd(const char *name)
+{
+    const simd_isa_t *isa = &simd_none;
+#ifdef SIMD_X86
+    if (!name || !strcmp(name, "avx2")) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            isa = &simd_avx2;
+    }
+    if (&simd_none == isa && (!name || !strcmp(name, "sse2")))
+        isa = &simd_sse2;
+#endif
+#ifdef SIMD_NEON
+    if (!name || !strcmp(name, "neon"))
+        isa = &simd_neon;
+#endif
+    simd = isa;
+    simd_selected = 1;
+    return isa->name;
+}
+
 #define EXTREMA_FUNC(NAME, TYPE, OP)    \
     static TYPE NAME(TYPE x, TYPE y) { return (x OP y) ? x : y; }
 EXTREMA_FUNC(maxi, int, >)
@@ -93,7 +632,7 @@ UNARY_FUNC(int, sign, i, x >= 0 ? 1 : -1)
 FLOAT_OR_DOUBLE_UNARY_FUNC(sign, x >= 0 ? 1.0 : -1.0)
 
 #define TEST_VEC_TYPED(NAME, TYPE, OP, CMP, RET, T)                 \
-static void NAME(mpr_expr_val stk, uint8_t *dim, int idx, int inc)  \
+static void NAME(mpr_expr_val stk, int *dim, int idx, int inc)      \
 {                                                                   \
     register TYPE ret = 1 - RET;                                    \
     mpr_expr_val val = stk + idx * inc;                             \
@@ -114,11 +653,16 @@ TEST_VEC_TYPED(vanyf, float, !=, 0.f, 1, f)
 TEST_VEC_TYPED(vanyd, double, !=, 0., 1, d)
 
 #define SUM_VFUNC(NAME, TYPE, T)                                    \
-static void NAME(mpr_expr_val stk, uint8_t *dim, int idx, int inc)  \
+static void NAME(mpr_expr_val stk, int *dim, int idx, int inc)      \
 {                                                                   \
     register TYPE aggregate = 0;                                    \
     mpr_expr_val val = stk + idx * inc;                             \
     int i, len = dim[idx];                                          \
+    simd_reduce_fn *simd_fn = SIMD_FN(sum, T, len);                 \
+    if (simd_fn) {                                                  \
+        simd_fn(val, val, 0, len);                                  \
+        return;                                                     \
+    }                                                               \
     for (i = 0; i < len; i++)                                       \
         aggregate += val[i].T;                                      \
     val[0].T = aggregate;                                           \
@@ -128,11 +672,17 @@ SUM_VFUNC(vsumf, float, f)
 SUM_VFUNC(vsumd, double, d)
 
 #define MEAN_VFUNC(NAME, TYPE, T)                                   \
-static void NAME(mpr_expr_val stk, uint8_t *dim, int idx, int inc)  \
+static void NAME(mpr_expr_val stk, int *dim, int idx, int inc)      \
 {                                                                   \
     register TYPE mean = 0;                                         \
     mpr_expr_val val = stk + idx * inc;                             \
     int i, len = dim[idx];                                          \
+    simd_reduce_fn *simd_fn = SIMD_FN(sum, T, len);                 \
+    if (simd_fn) {                                                  \
+        simd_fn(val, val, 0, len);                                  \
+        val[0].T /= len;                                            \
+        return;                                                     \
+    }                                                               \
     for (i = 0; i < len; i++)                                       \
         mean += val[i].T;                                           \
     val[0].T = mean / len;                                          \
@@ -141,11 +691,19 @@ MEAN_VFUNC(vmeanf, float, f)
 MEAN_VFUNC(vmeand, double, d)
 
 #define CENTER_VFUNC(NAME, TYPE, T)                                 \
-static void NAME(mpr_expr_val stk, uint8_t *dim, int idx, int inc)  \
+static void NAME(mpr_expr_val stk, int *dim, int idx, int inc)      \
 {                                                                   \
     mpr_expr_val val = stk + idx * inc;                             \
     register TYPE max = val[0].T, min = max;                        \
     int i, len = dim[idx];                                          \
+    simd_extrema_fn *simd_max = SIMD_FN(max, T, len);               \
+    simd_extrema_fn *simd_min = SIMD_FN(min, T, len);               \
+    mpr_expr_val_t hi, lo;                                          \
+    if (simd_max && simd_min && simd_max(&hi, val, len)             \
+        && simd_min(&lo, val, len)) {                               \
+        val[0].T = (hi.T + lo.T) * 0.5;                             \
+        return;                                                     \
+    }                                                               \
     for (i = 0; i < len; i++) {                                     \
         if (val[i].T > max)                                         \
             max = val[i].T;                                         \
@@ -157,24 +715,27 @@ static void NAME(mpr_expr_val stk, uint8_t *dim, int idx, int inc)  \
 CENTER_VFUNC(vcenterf, float, f)
 CENTER_VFUNC(vcenterd, double, d)
 
-#define EXTREMA_VFUNC(NAME, OP, TYPE, T)                            \
-static void NAME(mpr_expr_val stk, uint8_t *dim, int idx, int inc)  \
+#define EXTREMA_VFUNC(NAME, OP, TYPE, T, EXT)                       \
+static void NAME(mpr_expr_val stk, int *dim, int idx, int inc)      \
 {                                                                   \
     mpr_expr_val val = stk + idx * inc;                             \
     register TYPE extrema = val[0].T;                               \
     int i, len = dim[idx];                                          \
+    simd_extrema_fn *simd_fn = SIMD_FN(EXT, T, len);                \
+    if (simd_fn && simd_fn(val, val, len))                          \
+        return;                                                     \
     for (i = 1; i < len; i++) {                                     \
         if (val[i].T OP extrema)                                    \
             extrema = val[i].T;                                     \
     }                                                               \
     val[0].T = extrema;                                             \
 }
-EXTREMA_VFUNC(vmaxi, >, int, i)
-EXTREMA_VFUNC(vmini, <, int, i)
-EXTREMA_VFUNC(vmaxf, >, float, f)
-EXTREMA_VFUNC(vminf, <, float, f)
-EXTREMA_VFUNC(vmaxd, >, double, d)
-EXTREMA_VFUNC(vmind, <, double, d)
+EXTREMA_VFUNC(vmaxi, >, int, i, max)
+EXTREMA_VFUNC(vmini, <, int, i, min)
+EXTREMA_VFUNC(vmaxf, >, float, f, max)
+EXTREMA_VFUNC(vminf, <, float, f, min)
+EXTREMA_VFUNC(vmaxd, >, double, d, max)
+EXTREMA_VFUNC(vmind, <, double, d, min)
 
 #define INC_SORT_FUNC(TYPE, T)                              \
 int inc_sort_func##T (const void * a, const void * b) {     \
@@ -193,7 +754,7 @@ DEC_SORT_FUNC(float, f)
 DEC_SORT_FUNC(double, d)
 
 #define SORT_VFUNC(NAME, TYPE, T)                                   \
-static void NAME(mpr_expr_val stk, uint8_t *dim, int idx, int inc)  \
+static void NAME(mpr_expr_val stk, int *dim, int idx, int inc)      \
 {                                                                   \
     mpr_expr_val val = stk + idx * inc, dir = val + inc;            \
     int len = dim[idx];                                             \
@@ -211,11 +772,17 @@ SORT_VFUNC(vsortd, double, d)
 #define acosd acos
 
 #define NORM_VFUNC(NAME, TYPE, T)                                   \
-static void NAME(mpr_expr_val stk, uint8_t *dim, int idx, int inc)  \
+static void NAME(mpr_expr_val stk, int *dim, int idx, int inc)      \
 {                                                                   \
     mpr_expr_val val = stk + idx * inc;                             \
     register TYPE tmp = 0;                                          \
     int i, len = dim[idx];                                          \
+    simd_reduce_fn *simd_fn = SIMD_FN(sumsq, T, len);               \
+    if (simd_fn) {                                                  \
+        simd_fn(val, val, 0, len);                                  \
+        val[0].T = sqrt##T(val[0].T);                               \
+        return;                                                     \
+    }                                                               \
     for (i = 0; i < len; i++)                                       \
         tmp += pow##T(val[i].T, 2);                                 \
     val[0].T = sqrt##T(tmp);                                        \
@@ -224,11 +791,16 @@ NORM_VFUNC(vnormf, float, f)
 NORM_VFUNC(vnormd, double, d)
 
 #define DOT_VFUNC(NAME, TYPE, T)                                    \
-static void NAME(mpr_expr_val stk, uint8_t *dim, int idx, int inc)  \
+static void NAME(mpr_expr_val stk, int *dim, int idx, int inc)      \
 {                                                                   \
     register TYPE dot = 0;                                          \
     mpr_expr_val a = stk + idx * inc, b = a + inc;                  \
     int i, len = dim[idx];                                          \
+    simd_reduce_fn *simd_fn = SIMD_FN(dot, T, len);                 \
+    if (simd_fn) {                                                  \
+        simd_fn(a, a, b, len);                                      \
+        return;                                                     \
+    }                                                               \
     for (i = 0; i < len; i++)                                       \
         dot += a[i].T * b[i].T;                                     \
     a[0].T = dot;                                                   \
@@ -243,7 +815,7 @@ DOT_VFUNC(vdotd, double, d)
 
 #define atan2d atan2
 #define ANGLE_VFUNC(NAME, TYPE, T)                                  \
-static void NAME(mpr_expr_val stk, uint8_t *dim, int idx, int inc)  \
+static void NAME(mpr_expr_val stk, int *dim, int idx, int inc)      \
 {                                                                   \
     register TYPE theta;                                            \
     mpr_expr_val a = stk + idx * inc, b = a + inc;                  \
@@ -258,10 +830,15 @@ ANGLE_VFUNC(vanglef, float, f)
 ANGLE_VFUNC(vangled, double, d)
 
 #define MAXMIN_VFUNC(NAME, TYPE, T)                                 \
-static void NAME(mpr_expr_val stk, uint8_t *dim, int idx, int inc)  \
+static void NAME(mpr_expr_val stk, int *dim, int idx, int inc)      \
 {                                                                   \
     mpr_expr_val max = stk+idx*inc, min = max+inc, new = min+inc;   \
     int i, len = dim[idx];                                          \
+    simd_update_fn *simd_fn = SIMD_FN(maxmin, T, len);              \
+    if (simd_fn) {                                                  \
+        simd_fn(max, min, new, len);                                \
+        return;                                                     \
+    }                                                               \
     for (i = 0; i < len; i++) {                                     \
         if (new[i].T > max[i].T)                                    \
             max[i].T = new[i].T;                                    \
@@ -274,10 +851,15 @@ MAXMIN_VFUNC(vmaxminf, float, f)
 MAXMIN_VFUNC(vmaxmind, double, d)
 
 #define SUMNUM_VFUNC(NAME, TYPE, T)                                 \
-static void NAME(mpr_expr_val stk, uint8_t *dim, int idx, int inc)  \
+static void NAME(mpr_expr_val stk, int *dim, int idx, int inc)      \
 {                                                                   \
     mpr_expr_val sum = stk+idx*inc, num = sum+inc, new = num+inc;   \
     int i, len = dim[idx];                                          \
+    simd_update_fn *simd_fn = SIMD_FN(sumnum, T, len);              \
+    if (simd_fn) {                                                  \
+        simd_fn(sum, num, new, len);                                \
+        return;                                                     \
+    }                                                               \
     for (i = 0; i < len; i++) {                                     \
         sum[i].T += new[i].T;                                       \
         num[i].T += 1;                                              \
@@ -299,9 +881,67 @@ static TYPE schmitt##T(TYPE memory, TYPE val, TYPE low, TYPE high)  \
 TYPED_SCHMITT(float, f)
 TYPED_SCHMITT(double, d)
 
+typedef void vfn_template(mpr_expr_val, int*, int, int);
+typedef void vfn_mem_template(mpr_expr_val, int*, int, int, void*);
+
+/* Filter functions keep their state in a hidden user variable passed in as 'mem'. The first
+ * argument is filtered element-wise; coefficient arguments are repeated to its length. */
+
+#define ONEPOLE_VFUNC(NAME, TYPE, T)                                            \
+static void NAME(mpr_expr_val stk, int *dim, int idx, int inc, void *mem)       \
+{                                                                               \
+    mpr_expr_val x = stk + idx * inc, a = x + inc;                              \
+    TYPE *y1 = (TYPE*)mem;                                                      \
+    int i, len = dim[idx], alen = dim[idx + 1];                                 \
+    for (i = 0; i < len; i++)                                                   \
+        x[i].T = y1[i] = x[i].T + a[i % alen].T * (y1[i] - x[i].T);             \
+}
+ONEPOLE_VFUNC(vonepolef, float, f)
+ONEPOLE_VFUNC(vonepoled, double, d)
+
+/* biquad(x, b0, b1, b2, a1, a2) in transposed direct form II, two state values per element */
+#define BIQUAD_VFUNC(NAME, TYPE, T)                                             \
+static void NAME(mpr_expr_val stk, int *dim, int idx, int inc, void *mem)       \
+{                                                                               \
+    mpr_expr_val x = stk + idx * inc, b0 = x + inc, b1 = b0 + inc, b2 = b1 + inc; \
+    mpr_expr_val a1 = b2 + inc, a2 = a1 + inc;                                  \
+    TYPE *s = (TYPE*)mem, in, out;                                              \
+    int i, len = dim[idx], *clen = dim + idx + 1;                               \
+    for (i = 0; i < len; i++, s += 2) {                                         \
+        in = x[i].T;                                                            \
+        out = b0[i % clen[0]].T * in + s[0];                                    \
+        s[0] = b1[i % clen[1]].T * in - a1[i % clen[3]].T * out + s[1];         \
+        s[1] = b2[i % clen[2]].T * in - a2[i % clen[4]].T * out;                \
+        x[i].T = out;                                                           \
+    }                                                                           \
+}
+BIQUAD_VFUNC(vbiquadf, float, f)
+BIQUAD_VFUNC(vbiquadd, double, d)
+
+/* fir(x, [c0, c1, ...]) keeps a delay line of the previous inputs for each element */
+#define FIR_VFUNC(NAME, TYPE, T)                                                \
+static void NAME(mpr_expr_val stk, int *dim, int idx, int inc, void *mem)       \
+{                                                                               \
+    mpr_expr_val x = stk + idx * inc, c = x + inc;                              \
+    TYPE *d = (TYPE*)mem, acc;                                                  \
+    int i, j, len = dim[idx], n = dim[idx + 1] - 1;                             \
+    for (i = 0; i < len; i++, d += n) {                                         \
+        acc = c[0].T * x[i].T;                                                  \
+        for (j = 0; j < n; j++)                                                 \
+            acc += c[j + 1].T * d[j];                                           \
+        if (n) {                                                                \
+            memmove(d + 1, d, sizeof(TYPE) * (n - 1));                          \
+            d[0] = x[i].T;                                                      \
+        }                                                                       \
+        x[i].T = acc;                                                           \
+    }                                                                           \
+}
+FIR_VFUNC(vfirf, float, f)
+FIR_VFUNC(vfird, double, d)
+
 typedef enum {
     VAR_UNKNOWN = -1,
-    VAR_Y = N_USER_VARS,
+    VAR_Y = MAX_USER_VARS,
     VAR_X,
     N_VARS
 } expr_var_t;
@@ -364,7 +1004,7 @@ static struct {
     { "|",          2, 3,  GET_OPER | GET_OPER <<4 | GET_ONE  <<8 | GET_ONE  <<12 },
     { "&&",         2, 2,  GET_ZERO | GET_ZERO <<4 | NONE     <<8 | NONE     <<12 },
     { "||",         2, 1,  GET_OPER | GET_OPER <<4 | GET_ONE  <<8 | GET_ONE  <<12 },
-    /* TODO: handle optimization of ternary operator */
+    /* ternary operators with scalar conditions are lowered to branches after parsing */
     { "IFTHEN",     2, 0,  NONE     | NONE     <<4 | NONE     <<8 | NONE     <<12 },
     { "IFELSE",     2, 0,  NONE     | NONE     <<4 | NONE     <<8 | NONE     <<12 },
     { "IFTHENELSE", 3, 0,  NONE     | NONE     <<4 | NONE     <<8 | NONE     <<12 },
@@ -481,6 +1121,10 @@ typedef enum {
     VFN_SUMNUM,
     VFN_ANGLE,
     VFN_DOT,
+    /* functions below this line keep state in a hidden variable */
+    VFN_BIQUAD,
+    VFN_FIR,
+    VFN_ONEPOLE,
     N_VFN
 } expr_vfn_t;
 
@@ -489,25 +1133,43 @@ static struct {
     uint8_t arity;
     uint8_t reduce; /* TODO: use bitflags */
     uint8_t dot_notation;
-    void (*fn_int)(mpr_expr_val, uint8_t*, int, int);
-    void (*fn_flt)(mpr_expr_val, uint8_t*, int, int);
-    void (*fn_dbl)(mpr_expr_val, uint8_t*, int, int);
+    uint8_t memory;
+    vfn_template *fn_int;
+    vfn_template *fn_flt;
+    vfn_template *fn_dbl;
+    vfn_mem_template *mem_flt;  /* filter kernels keeping state between evaluations */
+    vfn_mem_template *mem_dbl;
 } vfn_tbl[] = {
-    { "all",    1, 1, 1, valli,    vallf,    valld    },
-    { "any",    1, 1, 1, vanyi,    vanyf,    vanyd    },
-    { "center", 1, 1, 1, 0,        vcenterf, vcenterd },
-    { "max",    1, 1, 1, vmaxi,    vmaxf,    vmaxd    },
-    { "mean",   1, 1, 1, 0,        vmeanf,   vmeand   },
-    { "min",    1, 1, 1, vmini,    vminf,    vmind    },
-    { "sum",    1, 1, 1, vsumi,    vsumf,    vsumd    },
-    { "norm",   1, 1, 1, 0,        vnormf,   vnormd   },
-    { "sort",   2, 0, 1, vsorti,   vsortf,   vsortd   },
-    { "maxmin", 3, 0, 0, vmaxmini, vmaxminf, vmaxmind },
-    { "sumnum", 3, 0, 0, vsumnumi, vsumnumf, vsumnumd },
-    { "angle",  2, 1, 0, 0,        vanglef,  vangled  },
-    { "dot",    2, 1, 0, vdoti,    vdotf,    vdotd    }
+    { "all",     1, 1, 1, 0, valli,    vallf,    valld    },
+    { "any",     1, 1, 1, 0, vanyi,    vanyf,    vanyd    },
+    { "center",  1, 1, 1, 0, 0,        vcenterf, vcenterd },
+    { "max",     1, 1, 1, 0, vmaxi,    vmaxf,    vmaxd    },
+    { "mean",    1, 1, 1, 0, 0,        vmeanf,   vmeand   },
+    { "min",     1, 1, 1, 0, vmini,    vminf,    vmind    },
+    { "sum",     1, 1, 1, 0, vsumi,    vsumf,    vsumd    },
+    { "norm",    1, 1, 1, 0, 0,        vnormf,   vnormd   },
+    { "sort",    2, 0, 1, 0, vsorti,   vsortf,   vsortd   },
+    { "maxmin",  3, 0, 0, 0, vmaxmini, vmaxminf, vmaxmind },
+    { "sumnum",  3, 0, 0, 0, vsumnumi, vsumnumf, vsumnumd },
+    { "angle",   2, 1, 0, 0, 0,        vanglef,  vangled  },
+    { "dot",     2, 1, 0, 0, vdoti,    vdotf,    vdotd    },
+    { "biquad",  6, 0, 0, 1, 0,        0,        0,        vbiquadf,  vbiquadd  },
+    { "fir",     2, 0, 0, 1, 0,        0,        0,        vfirf,     vfird     },
+    { "onepole", 2, 0, 0, 1, 0,        0,        0,        vonepolef, vonepoled }
 };
 
+/* Number of state values needed by a filter function for an output of length 'len' and a last
+ * argument of length 'coeff_len'. */
+static int vfn_mem_len(int vfn_idx, int len, int coeff_len)
+{
+    switch (vfn_idx) {
+        case VFN_BIQUAD:    return len * 2;
+        case VFN_FIR:       return coeff_len > 1 ? len * (coeff_len - 1) : len;
+        case VFN_ONEPOLE:   return len;
+        default:            return 0;
+    }
+}
+
 typedef enum {
     RFN_UNKNOWN = -1,
     RFN_ALL = 0,
@@ -569,7 +1231,6 @@ typedef double fn_dbl_arity1(double);
 typedef double fn_dbl_arity2(double,double);
 typedef double fn_dbl_arity3(double,double,double);
 typedef double fn_dbl_arity4(double,double,double,double);
-typedef void vfn_template(mpr_expr_val, uint8_t*, int, int);
 
 /* Const special flags */
 #define CONST_MINVAL    0x0001
@@ -642,6 +1303,8 @@ enum toktype {
     TOK_LOOP_END,
     TOK_SP_ADD,                         /* Stack pointer offset */
     TOK_REDUCING,
+    TOK_BRANCH,                         /* Jump forward within a statement */
+    TOK_JOIN,                           /* End of a conditional */
     TOK_END             = 0x2000000
 };
 
@@ -649,16 +1312,16 @@ struct generic_type {
     enum toktype toktype;
     mpr_type datatype;
     mpr_type casttype;
-    uint8_t vec_len;
     uint8_t flags;
+    int vec_len;
 };
 
 struct literal_type {
     enum toktype toktype;
     mpr_type datatype;
     mpr_type casttype;
-    uint8_t vec_len;
     uint8_t flags;
+    int vec_len;
     /* end of generic_type */
     union {
         float f;
@@ -674,8 +1337,8 @@ struct operator_type {
     enum toktype toktype;
     mpr_type datatype;
     mpr_type casttype;
-    uint8_t vec_len;
     uint8_t flags;
+    int vec_len;
     /* end of generic_type */
     expr_op_t idx;
 };
@@ -684,23 +1347,24 @@ struct variable_type {
     enum toktype toktype;
     mpr_type datatype;
     mpr_type casttype;
-    uint8_t vec_len;
     uint8_t flags;
+    int vec_len;
     /* end of generic_type */
-    int8_t idx;
-    uint8_t offset;         /* only used by TOK_ASSIGN* and TOK_COPY_FROM */
-    uint8_t vec_idx;        /* only used by TOK_VAR and TOK_ASSIGN */
+    int16_t idx;
+    uint16_t offset;        /* only used by TOK_ASSIGN* and TOK_COPY_FROM */
+    int vec_idx;            /* only used by TOK_VAR and TOK_ASSIGN */
 };
 
 struct function_type {
     enum toktype toktype;
     mpr_type datatype;
     mpr_type casttype;
-    uint8_t vec_len;
     uint8_t flags;
+    int vec_len;
     /* end of generic_type */
-    int8_t idx;
-    uint8_t arity;          /* used by TOK_FN, TOK_VFN, TOK_VECTORIZE */
+    int16_t idx;
+    uint16_t arity;         /* used by TOK_FN, TOK_VFN, TOK_VECTORIZE */
+    int16_t var;            /* state variable of filter functions (TOK_VFN only) */
 };
 
 enum reduce_type {
@@ -713,17 +1377,20 @@ enum reduce_type {
 
 #define REDUCE_TYPE_MASK 0x0F
 
+#define BRANCH_IF_FALSE 0x01    /* pop the condition and branch if it is zero */
+#define BRANCH_VOLATILE 0x02    /* the skipped tokens depend on the inputs */
+
 struct control_type {
     enum toktype toktype;
     mpr_type datatype;
     mpr_type casttype;
-    uint8_t vec_len;
     uint8_t flags;
+    int vec_len;
     /* end of generic_type */
-    uint8_t cache_offset;
-    uint8_t reduce_start;
-    uint8_t reduce_stop;
-    uint8_t branch_offset;
+    uint16_t cache_offset;
+    uint16_t branch_offset;
+    int reduce_start;
+    int reduce_stop;
 };
 
 typedef union _token {
@@ -745,8 +1412,8 @@ typedef struct _var {
     char *name;
     mpr_type datatype;
     mpr_type casttype;
-    uint8_t vec_len;
     uint8_t flags;
+    int vec_len;
 } mpr_var_t, *mpr_var;
 
 static int strncmp_lc(const char *a, const char *b, int len)
@@ -831,6 +1498,8 @@ static int const_lookup(mpr_token_t *tok, const char *s, int len)
 
 static int const_tok_is_zero(mpr_token_t tok)
 {
+    /* special constants are not assigned a value until later */
+    RETURN_ARG_UNLESS(!(tok.gen.flags & CONST_SPECIAL), 0);
     switch (tok.gen.datatype) {
         case MPR_INT32:     return tok.lit.val.i == 0;
         case MPR_FLT:       return tok.lit.val.f == 0.f;
@@ -841,6 +1510,8 @@ static int const_tok_is_zero(mpr_token_t tok)
 
 static int const_tok_equals_one(mpr_token_t tok)
 {
+    /* special constants are not assigned a value until later */
+    RETURN_ARG_UNLESS(!(tok.gen.flags & CONST_SPECIAL), 0);
     switch (tok.gen.datatype) {
         case MPR_INT32:     return tok.lit.val.i == 1;
         case MPR_FLT:       return tok.lit.val.f == 1.f;
@@ -1131,24 +1802,37 @@ static int expr_lex(const char *str, int idx, mpr_token_t *tok)
     return 1;
 }
 
+typedef struct _mpr_expr_prog *mpr_expr_prog;
+
 struct _mpr_expr
 {
     mpr_token tokens;
     mpr_token start;
     mpr_var vars;
-    uint8_t offset;
-    uint8_t n_tokens;
-    uint8_t stack_size;
-    uint8_t vec_len;
-    uint16_t *in_hist_size;
-    uint16_t out_hist_size;
-    uint8_t n_vars;
-    int8_t inst_ctl;
-    int8_t mute_ctl;
+    int offset;
+    int n_tokens;
+    int stack_size;
+    int vec_len;
+    int *in_hist_size;
+    int out_hist_size;
+    int max_in_hist_size;
+    int16_t n_vars;
+    int16_t inst_ctl;
+    int16_t mute_ctl;
     int8_t n_ins;
-    uint16_t max_in_hist_size;
+    uint8_t use_prog;
+    mpr_expr_prog prog;     /* compiled bytecode for the tokens following prog_offset */
+    int prog_offset;
+    int n_parsed_tokens;    /* token count before optimization */
+    int refcount;
+    char *cache_key;        /* signature and normalised string if cached for sharing */
+    mpr_expr_stack cache;   /* stack caching this expression */
+    mpr_expr next_cached;
 };
 
+static mpr_expr_prog bc_compile(mpr_expr expr);
+static void bc_free(mpr_expr_prog prog);
+
 static void free_stack_vliterals(mpr_token_t *stk, int top)
 {
     while (top >= 0) {
@@ -1158,10 +1842,26 @@ static void free_stack_vliterals(mpr_token_t *stk, int top)
     }
 }
 
+static void expr_cache_remove(mpr_expr expr)
+{
+    mpr_expr *e = &expr->cache->cache;
+    while (*e && *e != expr)
+        e = &(*e)->next_cached;
+    if (*e)
+        *e = expr->next_cached;
+    expr->cache = 0;
+    FUNC_IF(free, expr->cache_key);
+    expr->cache_key = 0;
+}
+
 void mpr_expr_free(mpr_expr expr)
 {
     int i;
+    RETURN_UNLESS(--expr->refcount <= 0);
+    if (expr->cache)
+        expr_cache_remove(expr);
     FUNC_IF(free, expr->in_hist_size);
+    FUNC_IF(bc_free, expr->prog);
     free_stack_vliterals(expr->tokens, expr->n_tokens - 1);
     FUNC_IF(free, expr->tokens);
     if (expr->n_vars && expr->vars) {
@@ -1334,6 +2034,11 @@ static void printtoken(mpr_token_t *t, mpr_var_t *vars)
             }
             break;
         case TOK_SP_ADD:            snprintf(s, len, "<sp add %d>", t->lit.val.i);  break;
+        case TOK_BRANCH:
+            snprintf(s, len, "<branch%s +%d>", t->con.flags & BRANCH_IF_FALSE ? " if false" : "",
+                     t->con.branch_offset);
+            break;
+        case TOK_JOIN:              snprintf(s, len, "<join>");                     break;
         case TOK_SEMICOLON:         snprintf(s, len, "semicolon");                  break;
         case TOK_END:               printf("END\n");                                return;
         default:                    printf("(unknown token)\n");                    return;
@@ -1624,6 +2329,427 @@ error:
     return -1;
 }
 
+/* Check whether two tokens will produce the same value given the same operands. */
+static int tok_equal(mpr_token_t *a, mpr_token_t *b)
+{
+    if (a->toktype != b->toktype || a->gen.datatype != b->gen.datatype
+        || a->gen.casttype != b->gen.casttype || a->gen.flags != b->gen.flags
+        || a->gen.vec_len != b->gen.vec_len)
+        return 0;
+    switch (a->toktype) {
+        case TOK_LITERAL:
+            return !memcmp(&a->lit.val, &b->lit.val, mpr_type_get_size(a->lit.datatype));
+        case TOK_VLITERAL:
+            return !memcmp(a->lit.val.ip, b->lit.val.ip,
+                           mpr_type_get_size(a->lit.datatype) * a->lit.vec_len);
+        case TOK_VAR:
+        case TOK_TT:
+            return (a->var.idx == b->var.idx && a->var.offset == b->var.offset
+                    && a->var.vec_idx == b->var.vec_idx);
+        case TOK_VAR_NUM_INST:
+            return a->var.idx == b->var.idx;
+        case TOK_OP:
+            return a->op.idx == b->op.idx;
+        case TOK_FN:
+        case TOK_VFN:
+            return a->fn.idx == b->fn.idx;
+        case TOK_VECTORIZE:
+            return a->fn.arity == b->fn.arity;
+        default:
+            return 0;
+    }
+}
+
+/* Check whether a token computes its result from its operands alone, without side effects. */
+static int tok_is_pure(mpr_token_t *tok)
+{
+    switch (tok->toktype) {
+        case TOK_LITERAL:
+        case TOK_VLITERAL:
+        case TOK_VAR:
+        case TOK_VAR_NUM_INST:
+        case TOK_TT:
+        case TOK_OP:
+        case TOK_VECTORIZE:
+            return 1;
+        case TOK_FN:
+            return tok->fn.idx < FN_DEL_IDX && !fn_tbl[tok->fn.idx].memory;
+        case TOK_VFN:
+            return (!vfn_tbl[tok->fn.idx].memory && VFN_MAXMIN != tok->fn.idx
+                    && VFN_SUMNUM != tok->fn.idx);
+        default:
+            return 0;
+    }
+}
+
+/* Remove statements that only assign user variables which are never read. Returns the new index
+ * of the top of the stack. */
+static int remove_dead_stores(mpr_token_t *stk, int sp, int n_vars, int inst_ctl, int mute_ctl)
+{
+    int i, j, start, removed, *reads;
+    if (!n_vars)
+        return sp;
+    reads = malloc(sizeof(int) * n_vars);
+    do {
+        removed = 0;
+        memset(reads, 0, sizeof(int) * n_vars);
+        for (i = 0; i <= sp; i++) {
+            if ((TOK_VAR == stk[i].toktype || TOK_VAR_NUM_INST == stk[i].toktype)
+                && stk[i].var.idx >= 0 && stk[i].var.idx < n_vars)
+                ++reads[stk[i].var.idx];
+        }
+        for (i = 0, start = 0; i <= sp; i++) {
+            int dead = start || i < sp;
+            if (!(TOK_ASSIGN & stk[i].toktype) || !(stk[i].gen.flags & CLEAR_STACK))
+                continue;
+            /* statement spans tokens start..i; hidden state of memory functions may be updated */
+            for (j = start; j <= i && dead; j++) {
+                int var = stk[j].var.idx;
+                if (!(TOK_ASSIGN & stk[j].toktype) || TOK_ASSIGN_USE == stk[j].toktype)
+                    continue;
+                dead = (TOK_ASSIGN_TT != stk[j].toktype && var >= 0 && var < n_vars
+                        && !reads[var] && var != inst_ctl && var != mute_ctl);
+            }
+            if (dead) {
+                trace("removing unused assignment to variable %d\n", stk[i].var.idx);
+                free_stack_vliterals(stk + start, i - start);
+                memmove(stk + start, stk + i + 1, sizeof(mpr_token_t) * (sp - i));
+                sp -= i - start + 1;
+                i = start - 1;
+                removed = 1;
+            }
+            else
+                start = i + 1;
+        }
+    } while (removed);
+    free(reads);
+    return sp;
+}
+
+/* Find the first token of the subexpression ending at each token of the statement spanning tokens
+ * start..end, using 'tmp' as scratch space. Returns 0 if the statement contains loops or other
+ * control tokens. */
+static int find_subexprs(mpr_token_t *stk, int start, int end, int *sub_start, int *tmp)
+{
+    int j, depth = 0;
+    for (j = start; j <= end; j++) {
+        int arity = tok_arity(stk[j]);
+        if (stk[j].toktype >= TOK_COPY_FROM || TOK_RFN == stk[j].toktype
+            || TOK_ASSIGN_TT == stk[j].toktype)
+            return 0;
+        if (TOK_ASSIGN & stk[j].toktype)
+            ++arity;
+        if (arity > depth)
+            return 0;
+        depth -= arity;
+        sub_start[j] = arity ? tmp[depth] : j;
+        tmp[depth++] = sub_start[j];
+    }
+    return 1;
+}
+
+/* Replace repeated pure subexpressions in each statement by TOK_COPY_FROM tokens that duplicate
+ * the first result while it is still on the evaluation stack. The stack is cleared at the end of
+ * each statement so subexpressions are not shared between statements. Returns the new index of
+ * the top of the stack. */
+static int share_subexprs(mpr_token_t *stk, int sp)
+{
+    int i, j, k, start = 0;
+    int *sub_start = malloc(sizeof(int) * (sp + 1));
+    int *ent_start = malloc(sizeof(int) * (sp + 2));
+    int *ent_end = malloc(sizeof(int) * (sp + 2));
+    int *freed = malloc(sizeof(int) * (sp + 1));
+    char *pure = malloc(sp + 1);
+    mpr_token_t *tmp = malloc(sizeof(mpr_token_t) * (sp + 1));
+
+    for (i = 0; i <= sp; i++) {
+        int end, depth, n, n_tmp = 0, n_freed = 0;
+        if (!(TOK_ASSIGN & stk[i].toktype) || !(stk[i].gen.flags & CLEAR_STACK))
+            continue;
+        end = i;
+
+        if (!find_subexprs(stk, start, end, sub_start, ent_start)) {
+            start = end + 1;
+            continue;
+        }
+        /* a subexpression is pure if its last token and all of its operands are pure */
+        for (j = start; j <= end; j++) {
+            int arity = tok_arity(stk[j]) + ((TOK_ASSIGN & stk[j].toktype) ? 1 : 0);
+            pure[j] = tok_is_pure(&stk[j]);
+            for (k = 0, n = j - 1; k < arity; k++, n = sub_start[n] - 1)
+                pure[j] &= pure[n];
+        }
+
+        /* rebuild the statement, tracking the source range of each evaluation stack entry */
+        depth = 0;
+        j = start;
+        while (j <= end) {
+            int best = -1, best_len = 1;
+            for (k = depth - 1; k >= 0; k--) {
+                int a = ent_start[k], len = ent_end[k] - a + 1;
+                if (len <= best_len || j + len - 1 > end || sub_start[j + len - 1] != j
+                    || !pure[ent_end[k]])
+                    continue;
+                /* operands must not be reassigned between the two subexpressions */
+                for (n = ent_end[k] + 1; n < j; n++) {
+                    if (TOK_ASSIGN & stk[n].toktype)
+                        break;
+                }
+                if (n < j)
+                    continue;
+                for (n = 0; n < len && tok_equal(&stk[a + n], &stk[j + n]); n++) ;
+                if (n == len) {
+                    best = k;
+                    best_len = len;
+                }
+            }
+            if (best >= 0) {
+                mpr_token_t *top = &stk[j + best_len - 1];
+                mpr_token_t *t = &tmp[n_tmp++];
+                memset(t, 0, sizeof(mpr_token_t));
+                t->toktype = TOK_COPY_FROM;
+                t->gen.datatype = top->gen.casttype ? top->gen.casttype : top->gen.datatype;
+                t->gen.vec_len = top->gen.vec_len;
+                t->con.cache_offset = depth - 1 - best;
+                freed[n_freed++] = j;
+                freed[n_freed++] = j + best_len - 1;
+                ent_start[depth] = j;
+                ent_end[depth] = j + best_len - 1;
+                ++depth;
+                j += best_len;
+            }
+            else {
+                int arity = tok_arity(stk[j]);
+                if (TOK_ASSIGN & stk[j].toktype)
+                    ++arity;
+                tmp[n_tmp++] = stk[j];
+                depth -= arity;
+                ent_start[depth] = sub_start[j];
+                ent_end[depth] = j;
+                ++depth;
+                ++j;
+            }
+        }
+        if (n_tmp == end - start + 1) {
+            start = end + 1;
+            continue;
+        }
+        trace("replaced %d tokens with stack copies\n", end - start + 1 - n_tmp);
+        for (k = 0; k < n_freed; k += 2)
+            free_stack_vliterals(stk + freed[k], freed[k + 1] - freed[k]);
+        memcpy(stk + start, tmp, sizeof(mpr_token_t) * n_tmp);
+        memmove(stk + start + n_tmp, stk + end + 1, sizeof(mpr_token_t) * (sp - end));
+        sp -= end - start + 1 - n_tmp;
+        i = start + n_tmp - 1;
+        start = i + 1;
+    }
+    free(sub_start);
+    free(ent_start);
+    free(ent_end);
+    free(freed);
+    free(pure);
+    free(tmp);
+    return sp;
+}
+
+/* Check whether all elements of a subexpression are equal, i.e. it only combines scalar
+ * variables and literals element-wise. */
+static int subexpr_is_uniform(mpr_token_t *stk, int start, int end)
+{
+    for (; start <= end; start++) {
+        switch (stk[start].toktype) {
+            case TOK_LITERAL:
+            case TOK_OP:
+                break;
+            case TOK_VAR:
+            case TOK_TT:
+                RETURN_ARG_UNLESS(1 == stk[start].gen.vec_len, 0);
+                break;
+            case TOK_FN:
+                RETURN_ARG_UNLESS(stk[start].fn.idx < FN_DEL_IDX
+                                  && !fn_tbl[stk[start].fn.idx].memory, 0);
+                break;
+            default:
+                return 0;
+        }
+    }
+    return 1;
+}
+
+/* Get the last token of each operand of a conditional operator at stk[j] if it should be lowered
+ * to branches. Returns the number of operands, or 0 if the operator is left as it is. */
+static int cond_operands(mpr_token_t *stk, int j, int *sub_start, int *ends)
+{
+    int i, arity;
+    if (TOK_OP != stk[j].toktype)
+        return 0;
+    switch (stk[j].op.idx) {
+        case OP_IF_THEN_ELSE:   arity = 3;  break;
+        case OP_LOGICAL_AND:
+        case OP_LOGICAL_OR:     arity = 2;  break;
+        default:                return 0;
+    }
+    ends[arity - 1] = j - 1;
+    for (i = arity - 1; i > 0; i--)
+        ends[i - 1] = sub_start[ends[i]] - 1;
+    /* vector conditions select each element separately */
+    if (!subexpr_is_uniform(stk, sub_start[ends[0]], ends[0]))
+        return 0;
+    for (i = 0; i < arity; i++) {
+        mpr_token_t *t = &stk[ends[i]];
+        if ((t->gen.casttype ? t->gen.casttype : t->gen.datatype) != stk[j].gen.datatype)
+            return 0;
+    }
+    /* only worthwhile if an operand that can be skipped is more than a single token */
+    for (i = 1; i < arity; i++) {
+        if (sub_start[ends[i]] < ends[i])
+            return arity;
+    }
+    return 0;
+}
+
+/* Check whether skipping a range of tokens could hide a dependency on the inputs. */
+static int range_is_volatile(mpr_token_t *stk, int start, int end)
+{
+    for (; start <= end; start++) {
+        mpr_token_t *t = &stk[start];
+        if ((TOK_VAR == t->toktype && t->var.idx >= VAR_Y) || TOK_TT == t->toktype
+            || TOK_VAR_NUM_INST == t->toktype || (TOK_FN == t->toktype && t->fn.idx > FN_DEL_IDX)
+            || (TOK_VFN == t->toktype && vfn_tbl[t->fn.idx].memory))
+            return 1;
+    }
+    return 0;
+}
+
+static void init_token(mpr_token_t *tok, enum toktype toktype, mpr_type type, int vec_len)
+{
+    memset(tok, 0, sizeof(mpr_token_t));
+    tok->toktype = toktype;
+    tok->gen.datatype = type;
+    tok->gen.vec_len = vec_len;
+}
+
+static void set_branch_token(mpr_token_t *tok, mpr_type type, int flags)
+{
+    init_token(tok, TOK_BRANCH, type, 1);
+    tok->con.flags = flags;
+}
+
+static void set_literal_token(mpr_token_t *tok, mpr_type type, int val)
+{
+    init_token(tok, TOK_LITERAL, type, 1);
+    switch (type) {
+        case MPR_INT32: tok->lit.val.i = val;           break;
+        case MPR_FLT:   tok->lit.val.f = (float)val;    break;
+        default:        tok->lit.val.d = (double)val;   break;
+    }
+}
+
+/* Lower conditional operators with scalar conditions to branches so that only the operands
+ * selected are evaluated: 'c?a:b' becomes 'c <branch if false> a <branch> b <join>', while 'a&&b'
+ * and 'a||b' are lowered as 'a?b!=0:0' and 'a?1:b!=0'. Operators with vector conditions still
+ * evaluate all operands and select each element. Returns the token stack, which is replaced if
+ * tokens were added, and updates the index of its top. */
+static mpr_token_t *lower_conditionals(mpr_token_t *stk, int *sp_ptr)
+{
+    int i, j, k, n, start = 0, sp = *sp_ptr, n_ops = 0, ends[3];
+    int *sub_start = malloc(sizeof(int) * (sp + 1));
+    int *after = malloc(sizeof(int) * (sp + 1));
+    int *br = malloc(sizeof(int) * (sp + 1));
+    int *jmp = malloc(sizeof(int) * (sp + 1));
+    mpr_token_t *out;
+
+    /* find the operators to lower and mark the operands that branches will follow */
+    for (i = 0; i <= sp; i++)
+        after[i] = br[i] = -1;
+    for (i = 0; i <= sp; i++) {
+        if (!(TOK_ASSIGN & stk[i].toktype) || !(stk[i].gen.flags & CLEAR_STACK))
+            continue;
+        if (find_subexprs(stk, start, i, sub_start, jmp)) {
+            for (j = start; j < i; j++) {
+                if (!cond_operands(stk, j, sub_start, ends))
+                    continue;
+                /* the condition only needs to be computed once */
+                for (k = sub_start[ends[0]]; k <= ends[0]; k++)
+                    stk[k].gen.vec_len = 1;
+                after[ends[0]] = after[ends[1]] = j;
+                br[j] = 0;
+                ++n_ops;
+            }
+        }
+        start = i + 1;
+    }
+    if (!n_ops) {
+        out = stk;
+        goto done;
+    }
+
+    out = malloc(sizeof(mpr_token_t) * (sp + 1 + n_ops * 5));
+    for (i = 0, n = 0; i <= sp; i++) {
+        mpr_type type;
+        if (br[i] >= 0) {
+            /* the operator marks the end of the conditional */
+            init_token(&out[n], TOK_JOIN, stk[i].gen.datatype, stk[i].gen.vec_len);
+            out[n].gen.casttype = stk[i].gen.casttype;
+            out[br[i]].con.branch_offset = jmp[i] + 1 - br[i];
+            out[jmp[i]].con.branch_offset = n - jmp[i];
+            ++n;
+        }
+        else
+            out[n++] = stk[i];
+        if ((j = after[i]) < 0)
+            continue;
+        cond_operands(stk, j, sub_start, ends);
+        type = stk[j].gen.datatype;
+        if (OP_IF_THEN_ELSE == stk[j].op.idx) {
+            if (i == ends[0]) {
+                br[j] = n;
+                set_branch_token(&out[n++], type, BRANCH_IF_FALSE
+                                 | (range_is_volatile(stk, i + 1, ends[1]) ? BRANCH_VOLATILE : 0));
+            }
+            else {
+                jmp[j] = n;
+                set_branch_token(&out[n++], type,
+                                 range_is_volatile(stk, i + 1, ends[2]) ? BRANCH_VOLATILE : 0);
+            }
+            continue;
+        }
+        if (i == ends[0]) {
+            br[j] = n;
+            if (OP_LOGICAL_AND == stk[j].op.idx) {
+                set_branch_token(&out[n++], type, BRANCH_IF_FALSE
+                                 | (range_is_volatile(stk, i + 1, ends[1]) ? BRANCH_VOLATILE : 0));
+                continue;
+            }
+            set_branch_token(&out[n++], type, BRANCH_IF_FALSE);
+            set_literal_token(&out[n++], type, 1);
+            jmp[j] = n;
+            set_branch_token(&out[n++], type,
+                             range_is_volatile(stk, i + 1, ends[1]) ? BRANCH_VOLATILE : 0);
+            continue;
+        }
+        /* compare the second operand with zero */
+        set_literal_token(&out[n++], type, 0);
+        init_token(&out[n], TOK_OP, type, stk[i].gen.vec_len);
+        out[n++].op.idx = OP_IS_NOT_EQUAL;
+        if (OP_LOGICAL_AND == stk[j].op.idx) {
+            jmp[j] = n;
+            set_branch_token(&out[n++], type, 0);
+            set_literal_token(&out[n++], type, 0);
+        }
+    }
+    trace("lowered %d conditional operators to branches\n", n_ops);
+    free(stk);
+    *sp_ptr = n - 1;
+
+done:
+    free(sub_start);
+    free(after);
+    free(br);
+    free(jmp);
+    return out;
+}
+
 static int precompute(mpr_expr_stack eval_stk, mpr_token_t *stk, int len, int vec_len)
 {
     int i;
@@ -1685,9 +2811,9 @@ static int check_type(mpr_expr_stack eval_stk, mpr_token_t *stk, int sp, mpr_var
                       int enable_optimize)
 {
     /* TODO: enable precomputation of const-only vectors */
-    int i, arity, can_precompute = 1, optimize = NONE;
+    int i, arity, sized_args, can_precompute = 1, optimize = NONE;
     mpr_type type = stk[sp].gen.datatype;
-    uint8_t vec_len = stk[sp].gen.vec_len;
+    int vec_len = stk[sp].gen.vec_len;
     switch (stk[sp].toktype) {
         case TOK_OP:
             if (stk[sp].op.idx == OP_IF) {
@@ -1703,6 +2829,8 @@ static int check_type(mpr_expr_stack eval_stk, mpr_token_t *stk, int sp, mpr_var
             break;
         case TOK_VFN:
             arity = vfn_tbl[stk[sp].fn.idx].arity;
+            if (vfn_tbl[stk[sp].fn.idx].memory)
+                can_precompute = 0;
             break;
         case TOK_VECTORIZE:
             arity = stk[sp].fn.arity;
@@ -1723,12 +2851,14 @@ static int check_type(mpr_expr_stack eval_stk, mpr_token_t *stk, int sp, mpr_var
         default:
             return sp;
     }
+    /* the coefficient vector of fir() does not set the vector length of its output */
+    sized_args = (TOK_VFN == stk[sp].toktype && VFN_FIR == stk[sp].fn.idx) ? arity - 1 : arity;
     if (arity) {
         /* find operator or function inputs */
-        uint8_t skip = 0;
-        uint8_t depth = arity;
-        uint8_t operand = 0;
-        uint8_t vec_reduce = 0;
+        int skip = 0;
+        int depth = arity;
+        int operand = 0;
+        int vec_reduce = 0;
         i = sp;
 
         /* Walk down stack distance of arity, checking types. */
@@ -1770,11 +2900,11 @@ static int check_type(mpr_expr_stack eval_stk, mpr_token_t *stk, int sp, mpr_var
                 j = i;
                 do {
                     type = compare_token_datatype(stk[j], type);
-                    if (stk[j].gen.vec_len > vec_len)
+                    if (stk[j].gen.vec_len > vec_len && depth <= sized_args)
                         vec_len = stk[j].gen.vec_len;
                     if (TOK_COPY_FROM == stk[j].toktype) {
-                        uint8_t offset = stk[j].con.cache_offset + 1;
-                        uint8_t vec_reduce = 0;
+                        int offset = stk[j].con.cache_offset + 1;
+                        int vec_reduce = 0;
                         while (offset > 0 && j > 0) {
                             --j;
                             if (TOK_SP_ADD == stk[j].toktype)
@@ -1794,7 +2924,8 @@ static int check_type(mpr_expr_stack eval_stk, mpr_token_t *stk, int sp, mpr_var
                             else if (stk[j].toktype <= TOK_MOVE)
                                 offset += tok_arity(stk[j]) - 1;
                             type = compare_token_datatype(stk[j], type);
-                            if (vec_reduce <= 0 && stk[j].gen.vec_len > vec_len)
+                            if (vec_reduce <= 0 && stk[j].gen.vec_len > vec_len
+                                && depth <= sized_args)
                                 vec_len = stk[j].gen.vec_len;
                         }
                         assert(j > 0);
@@ -1861,7 +2992,7 @@ static int check_type(mpr_expr_stack eval_stk, mpr_token_t *stk, int sp, mpr_var
             case TOK_VECTORIZE:  skip = stk[sp].fn.arity;                   depth = 0;      break;
             case TOK_ASSIGN_USE: skip = 1;                                  depth = 0;      break;
             case TOK_VAR:        skip = NUM_VAR_IDXS(stk[sp].gen.flags);    depth = 0;      break;
-            default:             skip = 0;                                  depth = arity;  break;
+            default:             skip = arity - sized_args;                 depth = sized_args; break;
         }
         promote_token(stk, i, type, 0, 0);
         while (--i >= 0) {
@@ -1880,7 +3011,7 @@ static int check_type(mpr_expr_stack eval_stk, mpr_token_t *stk, int sp, mpr_var
                     --depth;
                     if (!vec_reduce && !(stk[j].gen.flags & VEC_LEN_LOCKED)) {
                         stk[j].var.vec_len = vec_len;
-                        if (TOK_VAR == stk[j].toktype && stk[j].var.idx < N_USER_VARS)
+                        if (TOK_VAR == stk[j].toktype && stk[j].var.idx < VAR_Y)
                             vars[stk[j].var.idx].vec_len = vec_len;
                     }
                 }
@@ -1949,7 +3080,8 @@ static int check_type(mpr_expr_stack eval_stk, mpr_token_t *stk, int sp, mpr_var
     }
 
     if (!(stk[sp].gen.flags & VEC_LEN_LOCKED)) {
-        if (stk[sp].toktype != TOK_VFN || VFN_SORT == stk[sp].fn.idx)
+        if (   stk[sp].toktype != TOK_VFN || VFN_SORT == stk[sp].fn.idx
+            || vfn_tbl[stk[sp].fn.idx].memory)
             stk[sp].gen.vec_len = vec_len;
     }
 
@@ -1980,8 +3112,8 @@ static int check_assign_type_and_len(mpr_expr_stack eval_stk, mpr_token_t *stk,
                                      mpr_var_t *vars)
 {
     int i = sp, j, optimize = 1, expr_len = 0;
-    uint8_t vec_len = 0;
-    int8_t var = stk[sp].var.idx;
+    int vec_len = 0;
+    int var = stk[sp].var.idx;
 
     while (i >= 0 && (stk[i].toktype & TOK_ASSIGN) && (stk[i].var.idx == var)) {
         int num_var_idx = NUM_VAR_IDXS(stk[i].gen.flags);
@@ -2007,7 +3139,7 @@ static int check_assign_type_and_len(mpr_expr_stack eval_stk, mpr_token_t *stk,
         return -1;
     promote_token(stk, i, stk[sp].gen.datatype, 0, vars);
 
-    if (stk[sp].var.idx < N_USER_VARS) {
+    if (stk[sp].var.idx < VAR_Y) {
         /* Check if this expression assignment is instance-reducing */
         int reducing = 1, skipping = 0;
         for (i = 0; i < expr_len; i++) {
@@ -2075,7 +3207,9 @@ static int _eval_stack_size(mpr_token_t *token_stack, int token_stack_len)
     while (i < token_stack_len && tok->toktype != TOK_END) {
         switch (tok->toktype) {
             case TOK_LOOP_START:
-            case TOK_LITERAL:           ++sp;                                   break;
+            case TOK_LITERAL:
+            case TOK_VLITERAL:
+            case TOK_VAR_NUM_INST:      ++sp;                                   break;
             case TOK_VAR:
             case TOK_TT:                sp -= NUM_VAR_IDXS(tok->gen.flags) - 1; break;
             case TOK_OP:                sp -= op_tbl[tok->op.idx].arity - 1;    break;
@@ -2094,6 +3228,9 @@ static int _eval_stack_size(mpr_token_t *token_stack, int token_stack_len)
                 break;
             case TOK_COPY_FROM:         ++sp;                                   break;
             case TOK_MOVE:              sp -= tok->con.cache_offset;            break;
+            /* conditions are popped and only one branch leaves a value */
+            case TOK_BRANCH:            --sp;                                   break;
+            case TOK_JOIN:                                                      break;
             default:
                 return -1;
         }
@@ -2114,9 +3251,51 @@ static int _eval_stack_size(mpr_token_t *token_stack, int token_stack_len)
 #define FAIL_IF(condition, msg) \
     if (condition) {FAIL(msg)}
 
+/* Grow a parser stack so that it can hold at least n tokens. Returns the grown stack, or NULL
+ * if allocation failed, in which case the original stack is left intact. */
+static mpr_token grow_stack(mpr_token stk, int *size, int n)
+{
+    int new_size = *size * 2 > n ? *size * 2 : n;
+    mpr_token new_stk = calloc(1, sizeof(mpr_token_t) * new_size);
+    RETURN_ARG_UNLESS(new_stk, 0);
+    if (stk) {
+        memcpy(new_stk, stk, sizeof(mpr_token_t) * *size);
+        free(stk);
+    }
+    *size = new_size;
+    return new_stk;
+}
+
+#define RESERVE_STACK(STK, SIZE, N)                                             \
+{                                                                               \
+    if ((N) > SIZE) {                                                           \
+        mpr_token new_stk = grow_stack(STK, &SIZE, N);                          \
+        {FAIL_IF(!new_stk, "Failed to allocate parser stack.");}                \
+        STK = new_stk;                                                          \
+    }                                                                           \
+}
+
+/* Grow the user variable table so that N more variables can be stored. */
+#define RESERVE_VARS(N)                                                         \
+{                                                                               \
+    {FAIL_IF(n_vars + (N) > MAX_USER_VARS, "Maximum number of variables exceeded.");} \
+    if (n_vars + (N) > vars_size) {                                             \
+        int new_size = (n_vars + (N)) * 2;                                      \
+        mpr_var new_vars = malloc(sizeof(mpr_var_t) * new_size);                \
+        {FAIL_IF(!new_vars, "Failed to allocate variables.");}                  \
+        if (vars) {                                                             \
+            memcpy(new_vars, vars, sizeof(mpr_var_t) * n_vars);                 \
+            free(vars);                                                         \
+        }                                                                       \
+        vars = new_vars;                                                        \
+        vars_size = new_size;                                                   \
+    }                                                                           \
+}
+
 #define PUSH_TO_OUTPUT(x)                                           \
 {                                                                   \
-    {FAIL_IF(++out_idx >= STACK_SIZE, "Stack size exceeded. (1)");} \
+    ++out_idx;                                                      \
+    RESERVE_STACK(out, out_size, out_idx + 1);                      \
     if (x.toktype == TOK_ASSIGN_CONST && !is_const)                 \
         x.toktype = TOK_ASSIGN;                                     \
     memcpy(out + out_idx, &x, sizeof(mpr_token_t));                 \
@@ -2135,7 +3314,8 @@ static int _eval_stack_size(mpr_token_t *token_stack, int token_stack_len)
 
 #define PUSH_TO_OPERATOR(x)                                         \
 {                                                                   \
-    {FAIL_IF(++op_idx >= STACK_SIZE, "Stack size exceeded. (2)");}  \
+    ++op_idx;                                                       \
+    RESERVE_STACK(op, op_size, op_idx + 1);                         \
     memcpy(op + op_idx, &x, sizeof(mpr_token_t));                   \
 }
 
@@ -2303,8 +3483,8 @@ typedef struct _temp_var_cache {
     const char *accum_name;
     struct _temp_var_cache *next;
     int scope_start;
-    uint8_t in_pos;
-    uint8_t accum_pos;
+    int in_pos;
+    int accum_pos;
 } temp_var_cache_t, *temp_var_cache;
 
 #define ASSIGN_MASK (TOK_VAR | TOK_OPEN_SQUARE | TOK_COMMA | TOK_CLOSE_SQUARE | TOK_CLOSE_CURLY \
@@ -2317,9 +3497,9 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
                                const mpr_type *in_types, const int *in_vec_lens, mpr_type out_type,
                                int out_vec_len)
 {
-    mpr_token_t out[STACK_SIZE];
-    mpr_token_t op[STACK_SIZE];
-    int i, lex_idx = 0, out_idx = -1, op_idx = -1;
+    mpr_token_t *out = 0, *op = 0;
+    int out_size = 0, op_size = 0;
+    int i, lex_idx = 0, out_idx = -1, op_idx = -1, n_parsed;
     int oldest_in[MAX_NUM_MAP_SRC], oldest_out = 0, max_vector = 1;
 
     /* TODO: use bitflags instead? */
@@ -2329,10 +3509,10 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
     int allow_toktype = 0x2FFFFF;
     int vec_len_ctx = 0;
 
-    mpr_var_t vars[N_USER_VARS];
+    mpr_var_t *vars = NULL;
     temp_var_cache temp_vars = NULL;
     /* TODO: optimise these vars */
-    int n_vars = 0;
+    int n_vars = 0, vars_size = 0;
     int inst_ctl = -1;
     int mute_ctl = -1;
     mpr_token_t tok;
@@ -2358,8 +3538,8 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
             var_type = in_types[i];
     }
 
-    memset(out, 0, sizeof(mpr_token_t) * STACK_SIZE);
-    memset(op, 0, sizeof(mpr_token_t) * STACK_SIZE);
+    RESERVE_STACK(out, out_size, INIT_STACK_SIZE);
+    RESERVE_STACK(op, op_size, INIT_STACK_SIZE);
 
 #if TRACE_PARSE
     printf("parsing expression '%s'\n", str);
@@ -2509,7 +3689,7 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
                             tok.gen.flags |= VEC_LEN_LOCKED;
                     }
                     else {
-                        {FAIL_IF(n_vars >= N_USER_VARS, "Maximum number of variables exceeded.");}
+                        RESERVE_VARS(1);
                         /* need to store new variable */
                         vars[n_vars].name = malloc(len + 1);
                         snprintf(vars[n_vars].name, len + 1, "%s", varname);
@@ -2571,12 +3751,12 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
                 tok.fn.arity = fn_tbl[tok.fn.idx].arity;
                 if (fn_tbl[tok.fn.idx].memory) {
                     /* add assignment token */
-                    char varname[6];
+                    char varname[16];
                     int varidx = n_vars;
-                    {FAIL_IF(n_vars >= N_USER_VARS, "Maximum number of variables exceeded.");}
+                    RESERVE_VARS(1);
                     do {
-                        snprintf(varname, 6, "var%d", varidx++);
-                    } while (find_var_by_name(vars, n_vars, varname, 6) >= 0);
+                        snprintf(varname, 16, "var%d", varidx++);
+                    } while (find_var_by_name(vars, n_vars, varname, 16) >= 0);
                     /* need to store new variable */
                     vars[n_vars].name = strdup(varname);
                     vars[n_vars].datatype = var_type;
@@ -2622,10 +3802,26 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
                 }
                 else
                     tok.gen.vec_len = 1;
+                if (vfn_tbl[tok.fn.idx].memory) {
+                    /* add a variable to store the filter state; its length is set after parsing */
+                    char varname[16];
+                    int varidx = n_vars;
+                    RESERVE_VARS(1);
+                    do {
+                        snprintf(varname, 16, "var%d", varidx++);
+                    } while (find_var_by_name(vars, n_vars, varname, 16) >= 0);
+                    vars[n_vars].name = strdup(varname);
+                    vars[n_vars].datatype = var_type;
+                    vars[n_vars].vec_len = 1;
+                    vars[n_vars].flags = VAR_ASSIGNED | VAR_INSTANCED;
+                    tok.fn.var = n_vars++;
+                    is_const = 0;
+                }
                 PUSH_TO_OPERATOR(tok);
                 allow_toktype = TOK_OPEN_PAREN;
                 break;
             case TOK_VFN_DOT:
+                {FAIL_IF(vfn_tbl[tok.fn.idx].memory, "Filter functions cannot use dot notation.");}
                 if (op[op_idx].toktype != TOK_RFN || op[op_idx].fn.idx < RFN_HISTORY) {
                     tok.toktype = TOK_VFN;
                     tok.gen.datatype = vfn_tbl[tok.fn.idx].fn_int ? MPR_INT32 : MPR_FLT;
@@ -2757,7 +3953,7 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
                             /* Fail if variables in substack have signal idx other than zero */
                             mpr_type hi = 0, lo = 0;
                             uint8_t x_ref = 0;
-                            uint8_t max_vec_len = in_vec_lens[0];
+                            int max_vec_len = in_vec_lens[0];
                             for (i = 1; i < n_ins; i++) {
                                 if (in_vec_lens[i] > max_vec_len)
                                     max_vec_len = in_vec_lens[i];
@@ -2801,7 +3997,7 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
                             break;
                         }
                         case RT_VECTOR: {
-                            uint8_t vec_len = 0;
+                            int vec_len = 0;
                             /* Fail if variables in substack have vector idx other than zero */
                             /* TODO: use start variable or expr instead */
                             for (i = 0; i < sslen; i++) {
@@ -2868,7 +4064,7 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
                     default:                                        pre = 2; break;
                 }
 
-                {FAIL_IF(out_idx + pre > STACK_SIZE, "Stack size exceeded. (3)");}
+                RESERVE_STACK(out, out_size, out_idx + pre + 1);
 
                 /* find source token(s) for reduce input */
                 idx = out_idx;
@@ -2880,7 +4076,7 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
                 if (TOK_COPY_FROM == out[out_idx].toktype && TOK_VAR != out[idx].toktype) {
                     /* make a new copy of this substack */
                     sslen = substack_len(out, idx);
-                    {FAIL_IF(out_idx + sslen + pre > STACK_SIZE, "Stack size exceeded. (3)");}
+                    RESERVE_STACK(out, out_size, out_idx + sslen + pre + 1);
                     /* deliberately overwrite out[out_idx] */
                     memcpy(&out[out_idx + pre], &out[idx - sslen + 1], sslen * sizeof(mpr_token_t));
                 }
@@ -2910,7 +4106,7 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
                     temp_var_cache var_cache;
                     char *temp, *in_name, *accum_name;
                     int len;
-                    {FAIL_IF(n_vars >= N_USER_VARS, "Maximum number of variables exceeded.");}
+                    RESERVE_VARS(1);
                     GET_NEXT_TOKEN(tok);
                     {FAIL_IF(tok.toktype != TOK_OPEN_PAREN, "missing parenthesis.");}
                     GET_NEXT_TOKEN(tok);
@@ -3486,7 +4682,7 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
                     POP_OPERATOR_TO_OUTPUT();
                 }
                 var_idx = op[op_idx].var.idx;
-                if (var_idx < N_USER_VARS) {
+                if (var_idx < VAR_Y) {
                     if (!vars[var_idx].vec_len) {
                         int temp = out_idx, num_idx = NUM_VAR_IDXS(op[op_idx].gen.flags);
                         for (i = 0; i < num_idx && temp > 0; i++)
@@ -3757,7 +4953,7 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
 
     if (op_idx >= 0) {
         int var_idx = op[op_idx].var.idx;
-        if (var_idx < N_USER_VARS) {
+        if (var_idx < VAR_Y) {
             if (!vars[var_idx].vec_len)
                 vars[var_idx].vec_len = out[out_idx].gen.vec_len;
             /* update and lock vector length of assigned variable */
@@ -3782,7 +4978,7 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
 
     /* promote unlocked variable token vector lengths */
     for (i = 0; i < out_idx; i++) {
-        if (TOK_VAR == out[i].toktype && out[i].var.idx < N_USER_VARS
+        if (TOK_VAR == out[i].toktype && out[i].var.idx < VAR_Y
             && !(out[i].gen.flags & VEC_LEN_LOCKED))
             out[i].gen.vec_len = vars[out[i].var.idx].vec_len;
     }
@@ -3793,6 +4989,25 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
 
     {FAIL_IF(replace_special_constants(out, out_idx), "Error replacing special constants."); }
 
+    /* size filter state variables now that argument types and lengths are final */
+    for (i = 1; i <= out_idx; i++) {
+        if (TOK_VFN == out[i].toktype && vfn_tbl[out[i].fn.idx].memory) {
+            mpr_var_t *var = &vars[out[i].fn.var];
+            var->datatype = out[i].gen.datatype;
+            var->vec_len = vfn_mem_len(out[i].fn.idx, out[i].gen.vec_len, out[i - 1].gen.vec_len);
+        }
+    }
+
+    /* remove unused assignments, lower conditionals to branches and share repeated
+     * subexpressions in the remaining statements */
+    n_parsed = out_idx + 1;
+    out_idx = remove_dead_stores(out, out_idx, n_vars, inst_ctl, mute_ctl);
+    out = lower_conditionals(out, &out_idx);
+    out_idx = share_subexprs(out, out_idx);
+#if TRACE_PARSE
+    printf("optimized %d tokens to %d\n", n_parsed, out_idx + 1);
+#endif
+
 #if TRACE_PARSE
     printstack("OUTPUT STACK", out, out_idx, vars, 0);
     printstack("OPERATOR STACK", op, op_idx, vars, 0);
@@ -3804,20 +5019,28 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
             max_vector = out[i].gen.vec_len;
     }
 
+    i = _eval_stack_size(out, out_idx);
+    {FAIL_IF(i < 0, "Malformed expression (13).");}
+
     expr = malloc(sizeof(struct _mpr_expr));
     expr->n_tokens = out_idx + 1;
-    expr->stack_size = _eval_stack_size(out, out_idx);
+    expr->n_parsed_tokens = n_parsed;
+    expr->stack_size = i;
     expr->offset = 0;
+    expr->refcount = 1;
+    expr->cache_key = 0;
+    expr->cache = 0;
+    expr->next_cached = 0;
     expr->inst_ctl = inst_ctl;
     expr->mute_ctl = mute_ctl;
 
     /* copy tokens */
     expr->tokens = malloc(sizeof(union _token) * (size_t)expr->n_tokens);
-    memcpy(expr->tokens, &out, sizeof(union _token) * (size_t)expr->n_tokens);
+    memcpy(expr->tokens, out, sizeof(union _token) * (size_t)expr->n_tokens);
     expr->start = expr->tokens;
     expr->vec_len = max_vector;
     expr->out_hist_size = -oldest_out + 1;
-    expr->in_hist_size = malloc(sizeof(uint16_t) * n_ins);
+    expr->in_hist_size = malloc(sizeof(int) * n_ins);
     expr->max_in_hist_size = 0;
     for (i = 0; i < n_ins; i++) {
         register int hist_size = -oldest_in[i] + 1;
@@ -3826,12 +5049,15 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
         expr->in_hist_size[i] = hist_size;
     }
     if (n_vars) {
-        /* copy user-defined variables */
-        expr->vars = malloc(sizeof(mpr_var_t) * n_vars);
-        memcpy(expr->vars, vars, sizeof(mpr_var_t) * n_vars);
+        /* hand over user-defined variables */
+        expr->vars = realloc(vars, sizeof(mpr_var_t) * n_vars);
     }
-    else
+    else {
+        FUNC_IF(free, vars);
         expr->vars = NULL;
+    }
+    free(out);
+    free(op);
 
     expr->n_vars = n_vars;
     /* TODO: is this the same as n_ins arg passed to this function? */
@@ -3839,6 +5065,14 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int n_i
 
     expr_stack_realloc(eval_stk, expr->stack_size * expr->vec_len);
 
+    if (!simd_selected)
+        mpr_expr_set_simd(NULL);
+
+    /* lower the token stream to bytecode where possible */
+    expr->use_prog = 1;
+    expr->prog_offset = 0;
+    expr->prog = bc_compile(expr);
+
 #if TRACE_PARSE
     printf("expression allocated and initialized\n");
 #endif
@@ -3854,12 +5088,112 @@ error:
         free(temp_vars);
         temp_vars = tmp;
     }
+    FUNC_IF(free, vars);
     free_stack_vliterals(out, out_idx);
     free_stack_vliterals(op, op_idx);
+    free(out);
+    free(op);
     return 0;
 
 }
 
+/* Expressions created with mpr_expr_new_shared() are cached on the evaluation stack they were
+ * parsed with, keyed by their input and output types and lengths followed by the expression
+ * string with insignificant whitespace removed. Each device evaluates its maps with its own stack,
+ * so an expression is only ever evaluated from one thread. */
+
+#define IS_WORD_CHAR(C) (isalnum(C) || '_' == (C) || '.' == (C) || '$' == (C) || '@' == (C))
+#define IS_PUNCT_CHAR(C) (strchr("()[]{},;", C) != 0)
+
+/* Whitespace is kept only where removing it could join two tokens: between two word or two
+ * operator characters, and after the 'e' of a number in case it precedes an exponent sign. */
+static int expr_ws_is_significant(const char *str, int prev, int next)
+{
+    char a = str[prev], b = str[next];
+    if (IS_WORD_CHAR(a) && IS_WORD_CHAR(b))
+        return 1;
+    if (!IS_WORD_CHAR(a) && !IS_PUNCT_CHAR(a) && !IS_WORD_CHAR(b) && !IS_PUNCT_CHAR(b))
+        return 1;
+    return ('e' == a || 'E' == a) && prev > 0 && (isdigit(str[prev - 1]) || '.' == str[prev - 1]);
+}
+
+static char *expr_cache_key(const char *str, int n_ins, const mpr_type *in_types,
+                            const int *in_vec_lens, mpr_type out_type, int out_vec_len)
+{
+    int i, len, prev = -1, size = strlen(str) + 16 * (n_ins + 1);
+    char *key = malloc(size);
+
+    for (i = 0, len = 0; i < n_ins; i++)
+        len += snprintf(key + len, size - len, "%c%d,", in_types[i], in_vec_lens[i]);
+    len += snprintf(key + len, size - len, "%c%d:", out_type, out_vec_len);
+    for (i = 0; str[i]; i++) {
+        if (isspace(str[i]))
+            continue;
+        if (prev >= 0 && i > prev + 1 && expr_ws_is_significant(str, prev, i))
+            key[len++] = ' ';
+        key[len++] = str[i];
+        prev = i;
+    }
+    key[len] = '\0';
+    return key;
+}
+
+mpr_expr mpr_expr_new_shared(mpr_expr_stack eval_stk, const char *str, int n_ins,
+                             const mpr_type *in_types, const int *in_vec_lens, mpr_type out_type,
+                             int out_vec_len)
+{
+    mpr_expr expr;
+    char *key;
+    RETURN_ARG_UNLESS(eval_stk && str && n_ins && in_types && in_vec_lens, 0);
+    key = expr_cache_key(str, n_ins, in_types, in_vec_lens, out_type, out_vec_len);
+    for (expr = eval_stk->cache; expr; expr = expr->next_cached) {
+        if (0 == strcmp(expr->cache_key, key)) {
+            free(key);
+            ++expr->refcount;
+            return expr;
+        }
+    }
+    /* parse the normalised string so that unshared copies are parsed identically */
+    expr = mpr_expr_new_from_str(eval_stk, strchr(key, ':') + 1, n_ins, in_types, in_vec_lens,
+                                 out_type, out_vec_len);
+    if (!expr) {
+        free(key);
+        return 0;
+    }
+    expr->cache_key = key;
+    expr->cache = eval_stk;
+    expr->next_cached = eval_stk->cache;
+    eval_stk->cache = expr;
+    return expr;
+}
+
+mpr_expr mpr_expr_unshare(mpr_expr_stack eval_stk, mpr_expr expr)
+{
+    mpr_type types[MAX_NUM_MAP_SRC + 1];
+    int i, lens[MAX_NUM_MAP_SRC + 1];
+    char *key;
+    mpr_expr copy;
+
+    RETURN_ARG_UNLESS(expr && expr->cache, expr);
+    if (1 == expr->refcount) {
+        expr_cache_remove(expr);
+        return expr;
+    }
+    /* recover the signature from the cache key */
+    key = expr->cache_key;
+    for (i = 0; i <= expr->n_ins; i++) {
+        types[i] = *key++;
+        lens[i] = strtol(key, &key, 10);
+        ++key;
+    }
+    copy = mpr_expr_new_from_str(eval_stk, key, expr->n_ins, types, lens, types[expr->n_ins],
+                                 lens[expr->n_ins]);
+    RETURN_ARG_UNLESS(copy, expr);
+    copy->use_prog = expr->use_prog;
+    --expr->refcount;
+    return copy;
+}
+
 int mpr_expr_get_in_hist_size(mpr_expr expr, int idx)
 {
     return expr->in_hist_size[idx];
@@ -3870,6 +5204,11 @@ int mpr_expr_get_out_hist_size(mpr_expr expr)
     return expr->out_hist_size;
 }
 
+int mpr_expr_get_num_tokens(mpr_expr expr, int optimized)
+{
+    return optimized ? expr->n_tokens : expr->n_parsed_tokens;
+}
+
 int mpr_expr_get_num_vars(mpr_expr expr)
 {
     return expr->n_vars;
@@ -3966,6 +5305,32 @@ static const char *type_name(const mpr_type type)
 }
 #endif
 
+/* Get the SIMD kernel for a binary operator, or 0 if there is none. */
+static simd_op_fn *simd_op(expr_op_t op, mpr_type type, int len)
+{
+    int t;
+    RETURN_ARG_UNLESS(len >= SIMD_MIN_LEN, 0);
+    switch (type) {
+        case MPR_INT32: t = SIMD_TYPE_i;    break;
+        case MPR_FLT:   t = SIMD_TYPE_f;    break;
+        case MPR_DBL:   t = SIMD_TYPE_d;    break;
+        default:        return 0;
+    }
+    switch (op) {
+        case OP_ADD:                        return simd->op[SIMD_ADD][t];
+        case OP_SUBTRACT:                   return simd->op[SIMD_SUB][t];
+        case OP_MULTIPLY:                   return simd->op[SIMD_MUL][t];
+        case OP_DIVIDE:                     return simd->op[SIMD_DIV][t];
+        case OP_IS_GREATER_THAN:            return simd->op[SIMD_GT][t];
+        case OP_IS_GREATER_THAN_OR_EQUAL:   return simd->op[SIMD_GTE][t];
+        case OP_IS_LESS_THAN:               return simd->op[SIMD_LT][t];
+        case OP_IS_LESS_THAN_OR_EQUAL:      return simd->op[SIMD_LTE][t];
+        case OP_IS_EQUAL:                   return simd->op[SIMD_EQ][t];
+        case OP_IS_NOT_EQUAL:               return simd->op[SIMD_NEQ][t];
+        default:                            return 0;
+    }
+}
+
 #define UNARY_OP_CASE(OP, SYM, T)               \
     case OP:                                    \
         for (i = sp; i < sp + dims[dp]; i++)    \
@@ -4014,6 +5379,1517 @@ MPR_INLINE static int _max(int a, int b)
     return a > b ? a : b;
 }
 
+/* Register-based bytecode. The token stream of an expression is lowered into a sequence of
+ * instructions whose operand types, vector lengths and locations are resolved at compile time.
+ * Each position of the evaluation stack becomes a register occupying vec_len elements of the
+ * evaluation stack memory, and literals are read in place from a constant pool. Only the steady
+ * state of an expression is compiled, i.e. the tokens following the current expression offset,
+ * and only if evaluating them would not move the offset. Anything else is left to the token
+ * interpreter in mpr_expr_eval(). */
+
+#define BC_REG      0   /* operand is stored in the register file */
+#define BC_CONST    1   /* operand is stored in the constant pool */
+
+typedef struct _bc_opnd {
+    int idx;            /* element offset in the register file or constant pool */
+    int len;            /* vector length */
+    uint8_t loc;        /* BC_REG or BC_CONST */
+    mpr_type type;
+} bc_opnd_t;
+
+typedef void bc_kernel(mpr_expr_val dst, mpr_expr_val *src, const int *lens, int len, void *fn);
+
+enum bc_code {
+    BC_LOAD,            /* copy a variable into a register */
+    BC_COPY,            /* copy (and repeat) an operand into a register */
+    BC_KERNEL,          /* apply an element-wise kernel */
+    BC_VFN,             /* apply a vector function */
+    BC_FILTER,          /* apply a vector function with state kept in a variable */
+    BC_CAST,            /* cast a register to a different type */
+    BC_ASSIGN,          /* copy a register or constant to a variable */
+    BC_BRANCH           /* jump forward, if a scalar operand is zero when one is given */
+};
+
+typedef struct _bc_instr {
+    enum bc_code code;
+    mpr_type type;      /* type of the result, or of the value assigned */
+    mpr_type casttype;  /* type to cast to (BC_CAST only) */
+    uint8_t arity;
+    int16_t var;        /* variable index (BC_LOAD, BC_FILTER and BC_ASSIGN only) */
+    int len;            /* number of elements computed, loaded or assigned */
+    int vec_idx;        /* vector offset (BC_LOAD and BC_ASSIGN only) */
+    int offset;         /* offset into the assigned operand (BC_ASSIGN only) */
+    int hist_idx;       /* constant history index (BC_LOAD only) */
+    int dst;            /* element offset of the destination register */
+    int target;         /* index of the instruction jumped to (BC_BRANCH only) */
+    bc_opnd_t src[4];   /* operands; src[0] of BC_LOAD is a history index if present */
+    int lens[6];        /* operand vector lengths, vector functions take up to 6 operands */
+    bc_kernel *kernel;
+    void *fn;           /* function called by the kernel, BC_VFN or BC_FILTER */
+} bc_instr_t, *bc_instr;
+
+#ifdef BC_JIT
+struct _bc_state;
+typedef int jit_fn(struct _bc_state *st, mpr_expr_val regs, mpr_expr_val consts);
+
+typedef struct _bc_jit {
+    void *mem;
+    size_t size;
+    jit_fn *fn;
+} *bc_jit;
+#endif
+
+struct _mpr_expr_prog {
+    bc_instr code;
+    mpr_expr_val consts;
+    mpr_type *in_types; /* expected type of each input read, or 0 if unused */
+    int n_code;
+    int n_consts;
+    mpr_type out_type;  /* expected type of the output, or 0 if unused */
+    uint8_t reads_x;
+    uint8_t reads_vars;
+    uint8_t assigns_shared; /* assigns variables shared between instances */
+    uint8_t branches;       /* contains branches, so instances are evaluated one at a time */
+    struct _bc_linear *linear;  /* linear form of the program, if it has one */
+#ifdef BC_JIT
+    bc_jit jit;             /* machine code for single instances, once compiled */
+    int n_evals;            /* evaluations before JIT compilation, or -1 once attempted */
+#endif
+};
+
+#define BC_OP_KERNEL(NAME, T, CALC, SIMD)                                               \
+static void NAME(mpr_expr_val d, mpr_expr_val *s, const int *l, int n, void *fn)        \
+{                                                                                       \
+    int i;                                                                              \
+    mpr_expr_val a = s[0], b = s[1];                                                    \
+    simd_op_fn *simd_fn = SIMD;                                                         \
+    if (simd_fn && n >= SIMD_MIN_LEN                                                    \
+        && (l[0] == n || 1 == l[0]) && (l[1] == n || 1 == l[1])) {                      \
+        simd_fn(d, a, b, n, (l[0] < n ? SIMD_BCAST_A : 0) | (l[1] < n ? SIMD_BCAST_B : 0)); \
+        return;                                                                         \
+    }                                                                                   \
+    if (l[0] == n && l[1] == n) {                                                       \
+        for (i = 0; i < n; i++)                                                         \
+            d[i].T = CALC(a[i].T, b[i].T);                                              \
+    }                                                                                   \
+    else if (l[0] == n && 1 == l[1]) {                                                  \
+        for (i = 0; i < n; i++)                                                         \
+            d[i].T = CALC(a[i].T, b[0].T);                                              \
+    }                                                                                   \
+    else if (1 == l[0] && l[1] == n) {                                                  \
+        for (i = 0; i < n; i++)                                                         \
+            d[i].T = CALC(a[0].T, b[i].T);                                              \
+    }                                                                                   \
+    else {                                                                              \
+        for (i = 0; i < n; i++)                                                         \
+            d[i].T = CALC(a[i % l[0]].T, b[i % l[1]].T);                                \
+    }                                                                                   \
+}
+
+#define BC_ADD(A, B)        ((A) + (B))
+#define BC_SUB(A, B)        ((A) - (B))
+#define BC_MUL(A, B)        ((A) * (B))
+#define BC_DIV(A, B)        ((A) / (B))
+#define BC_MOD(A, B)        ((A) % (B))
+#define BC_FMODF(A, B)      fmodf(A, B)
+#define BC_FMOD(A, B)       fmod(A, B)
+#define BC_SHL(A, B)        ((A) << (B))
+#define BC_SHR(A, B)        ((A) >> (B))
+#define BC_GT(A, B)         ((A) > (B))
+#define BC_GTE(A, B)        ((A) >= (B))
+#define BC_LT(A, B)         ((A) < (B))
+#define BC_LTE(A, B)        ((A) <= (B))
+#define BC_EQ(A, B)         ((A) == (B))
+#define BC_NEQ(A, B)        ((A) != (B))
+#define BC_AND(A, B)        ((A) & (B))
+#define BC_XOR(A, B)        ((A) ^ (B))
+#define BC_OR(A, B)         ((A) | (B))
+#define BC_LAND(A, B)       ((A) && (B))
+#define BC_LOR(A, B)        ((A) || (B))
+#define BC_IF_ELSE(A, B)    ((A) ? (A) : (B))
+
+#define BC_SIMD(OP, T) simd->op[OP][SIMD_TYPE_##T]
+
+#define BC_OP_KERNELS(T)                                        \
+    BC_OP_KERNEL(bc_add##T, T, BC_ADD, BC_SIMD(SIMD_ADD, T))    \
+    BC_OP_KERNEL(bc_sub##T, T, BC_SUB, BC_SIMD(SIMD_SUB, T))    \
+    BC_OP_KERNEL(bc_mul##T, T, BC_MUL, BC_SIMD(SIMD_MUL, T))    \
+    BC_OP_KERNEL(bc_gt##T, T, BC_GT, BC_SIMD(SIMD_GT, T))       \
+    BC_OP_KERNEL(bc_gte##T, T, BC_GTE, BC_SIMD(SIMD_GTE, T))    \
+    BC_OP_KERNEL(bc_lt##T, T, BC_LT, BC_SIMD(SIMD_LT, T))       \
+    BC_OP_KERNEL(bc_lte##T, T, BC_LTE, BC_SIMD(SIMD_LTE, T))    \
+    BC_OP_KERNEL(bc_eq##T, T, BC_EQ, BC_SIMD(SIMD_EQ, T))       \
+    BC_OP_KERNEL(bc_neq##T, T, BC_NEQ, BC_SIMD(SIMD_NEQ, T))    \
+    BC_OP_KERNEL(bc_land##T, T, BC_LAND, 0)                     \
+    BC_OP_KERNEL(bc_lor##T, T, BC_LOR, 0)                       \
+    BC_OP_KERNEL(bc_if_else##T, T, BC_IF_ELSE, 0)               \
+                                                \
+static void bc_not##T(mpr_expr_val d, mpr_expr_val *s, const int *l, int n, void *fn)       \
+{                                                                                           \
+    int i;                                                                                  \
+    for (i = 0; i < n; i++)                                                                 \
+        d[i].T = !s[0][i % l[0]].T;                                                         \
+}                                                                                           \
+                                                                                            \
+static void bc_if_then_else##T(mpr_expr_val d, mpr_expr_val *s, const int *l, int n,        \
+                               void *fn)                                                    \
+{                                                                                           \
+    int i;                                                                                  \
+    for (i = 0; i < n; i++)                                                                 \
+        d[i].T = s[0][i % l[0]].T ? s[1][i % l[1]].T : s[2][i % l[2]].T;                    \
+}
+
+BC_OP_KERNELS(i)
+BC_OP_KERNELS(f)
+BC_OP_KERNELS(d)
+BC_OP_KERNEL(bc_divf, f, BC_DIV, BC_SIMD(SIMD_DIV, f))
+BC_OP_KERNEL(bc_divd, d, BC_DIV, BC_SIMD(SIMD_DIV, d))
+BC_OP_KERNEL(bc_modi, i, BC_MOD, 0)
+BC_OP_KERNEL(bc_modf, f, BC_FMODF, 0)
+BC_OP_KERNEL(bc_modd, d, BC_FMOD, 0)
+BC_OP_KERNEL(bc_shli, i, BC_SHL, 0)
+BC_OP_KERNEL(bc_shri, i, BC_SHR, 0)
+BC_OP_KERNEL(bc_andi, i, BC_AND, 0)
+BC_OP_KERNEL(bc_xori, i, BC_XOR, 0)
+BC_OP_KERNEL(bc_ori, i, BC_OR, 0)
+
+/* Integer division is left to the interpreter, which skips the assignment on division by zero. */
+static bc_kernel *bc_op_kernel(expr_op_t op, mpr_type type)
+{
+    switch (op) {
+#define TYPED_CASE(OP, NAME)                            \
+        case OP:                                        \
+            switch (type) {                             \
+                case MPR_INT32: return NAME##i;         \
+                case MPR_FLT:   return NAME##f;         \
+                case MPR_DBL:   return NAME##d;         \
+                default:        return 0;               \
+            }
+        TYPED_CASE(OP_LOGICAL_NOT, bc_not)
+        TYPED_CASE(OP_MULTIPLY, bc_mul)
+        TYPED_CASE(OP_MODULO, bc_mod)
+        TYPED_CASE(OP_ADD, bc_add)
+        TYPED_CASE(OP_SUBTRACT, bc_sub)
+        TYPED_CASE(OP_IS_GREATER_THAN, bc_gt)
+        TYPED_CASE(OP_IS_GREATER_THAN_OR_EQUAL, bc_gte)
+        TYPED_CASE(OP_IS_LESS_THAN, bc_lt)
+        TYPED_CASE(OP_IS_LESS_THAN_OR_EQUAL, bc_lte)
+        TYPED_CASE(OP_IS_EQUAL, bc_eq)
+        TYPED_CASE(OP_IS_NOT_EQUAL, bc_neq)
+        TYPED_CASE(OP_LOGICAL_AND, bc_land)
+        TYPED_CASE(OP_LOGICAL_OR, bc_lor)
+        TYPED_CASE(OP_IF_ELSE, bc_if_else)
+        TYPED_CASE(OP_IF_THEN_ELSE, bc_if_then_else)
+#undef TYPED_CASE
+#define TYPED_CASE(OP, NAME, MTYPE, T)                  \
+        case OP:                                        \
+            return MTYPE == type ? NAME##T : 0;
+        TYPED_CASE(OP_LEFT_BIT_SHIFT, bc_shl, MPR_INT32, i)
+        TYPED_CASE(OP_RIGHT_BIT_SHIFT, bc_shr, MPR_INT32, i)
+        TYPED_CASE(OP_BITWISE_AND, bc_and, MPR_INT32, i)
+        TYPED_CASE(OP_BITWISE_XOR, bc_xor, MPR_INT32, i)
+        TYPED_CASE(OP_BITWISE_OR, bc_or, MPR_INT32, i)
+#undef TYPED_CASE
+        case OP_DIVIDE:
+            switch (type) {
+                case MPR_FLT:   return bc_divf;
+                case MPR_DBL:   return bc_divd;
+                default:        return 0;
+            }
+        default:
+            return 0;
+    }
+}
+
+#define BC_FN_KERNELS(TYPE, T, FN)                                                          \
+static void bc_fn1##T(mpr_expr_val d, mpr_expr_val *s, const int *l, int n, void *fn)       \
+{                                                                                           \
+    int i;                                                                                  \
+    for (i = 0; i < n; i++)                                                                 \
+        d[i].T = ((FN##_arity1*)fn)(s[0][i % l[0]].T);                                      \
+}                                                                                           \
+static void bc_fn2##T(mpr_expr_val d, mpr_expr_val *s, const int *l, int n, void *fn)       \
+{                                                                                           \
+    int i;                                                                                  \
+    for (i = 0; i < n; i++)                                                                 \
+        d[i].T = ((FN##_arity2*)fn)(s[0][i % l[0]].T, s[1][i % l[1]].T);                    \
+}                                                                                           \
+static void bc_fn3##T(mpr_expr_val d, mpr_expr_val *s, const int *l, int n, void *fn)       \
+{                                                                                           \
+    int i;                                                                                  \
+    for (i = 0; i < n; i++)                                                                 \
+        d[i].T = ((FN##_arity3*)fn)(s[0][i % l[0]].T, s[1][i % l[1]].T, s[2][i % l[2]].T);  \
+}                                                                                           \
+static void bc_fn4##T(mpr_expr_val d, mpr_expr_val *s, const int *l, int n, void *fn)       \
+{                                                                                           \
+    int i;                                                                                  \
+    for (i = 0; i < n; i++)                                                                 \
+        d[i].T = ((FN##_arity4*)fn)(s[0][i % l[0]].T, s[1][i % l[1]].T, s[2][i % l[2]].T,   \
+                                    s[3][i % l[3]].T);                                      \
+}
+
+BC_FN_KERNELS(int, i, fn_int)
+BC_FN_KERNELS(float, f, fn_flt)
+BC_FN_KERNELS(double, d, fn_dbl)
+
+static bc_kernel *bc_fn_kernel(int arity, mpr_type type)
+{
+    switch (type) {
+#define TYPED_CASE(MTYPE, T)                        \
+        case MTYPE:                                 \
+            switch (arity) {                        \
+                case 1:     return bc_fn1##T;       \
+                case 2:     return bc_fn2##T;       \
+                case 3:     return bc_fn3##T;       \
+                case 4:     return bc_fn4##T;       \
+                default:    return 0;               \
+            }
+        TYPED_CASE(MPR_INT32, i)
+        TYPED_CASE(MPR_FLT, f)
+        TYPED_CASE(MPR_DBL, d)
+#undef TYPED_CASE
+        default:
+            return 0;
+    }
+}
+
+static void bc_cast(mpr_expr_val v, int len, mpr_type from, mpr_type to)
+{
+    int i;
+    switch (from) {
+#define TYPED_CASE(MTYPE0, T0, MTYPE1, TYPE1, T1, MTYPE2, TYPE2, T2)\
+        case MTYPE0:                                        \
+            switch (to) {                                   \
+                case MTYPE1:                                \
+                    for (i = 0; i < len; i++)               \
+                        v[i].T1 = (TYPE1)v[i].T0;           \
+                    break;                                  \
+                case MTYPE2:                                \
+                    for (i = 0; i < len; i++)               \
+                        v[i].T2 = (TYPE2)v[i].T0;           \
+                    break;                                  \
+                default:                                    \
+                    break;                                  \
+            }                                               \
+            break;
+        TYPED_CASE(MPR_INT32, i, MPR_FLT, float, f, MPR_DBL, double, d)
+        TYPED_CASE(MPR_FLT, f, MPR_INT32, int, i, MPR_DBL, double, d)
+        TYPED_CASE(MPR_DBL, d, MPR_INT32, int, i, MPR_FLT, float, f)
+#undef TYPED_CASE
+        default:
+            break;
+    }
+}
+
+static bc_instr bc_add_instr(mpr_expr_prog prog, enum bc_code code, mpr_type type, int len,
+                             int dst)
+{
+    bc_instr ins;
+    prog->code = realloc(prog->code, sizeof(bc_instr_t) * (prog->n_code + 1));
+    ins = &prog->code[prog->n_code++];
+    memset(ins, 0, sizeof(bc_instr_t));
+    ins->code = code;
+    ins->type = type;
+    ins->len = len;
+    ins->dst = dst;
+    return ins;
+}
+
+static void bc_add_copy(mpr_expr_prog prog, int dst, bc_opnd_t *src, int len)
+{
+    bc_instr ins = bc_add_instr(prog, BC_COPY, src->type, len, dst);
+    ins->arity = 1;
+    ins->src[0] = *src;
+    ins->lens[0] = src->len;
+}
+
+/* Add a constant to the pool, returning an operand referring to it. */
+static bc_opnd_t bc_add_const(mpr_expr_prog prog, mpr_token tok)
+{
+    int i, len = tok->gen.vec_len;
+    bc_opnd_t o;
+    mpr_expr_val c;
+    prog->consts = realloc(prog->consts, sizeof(mpr_expr_val_t) * (prog->n_consts + len));
+    c = prog->consts + prog->n_consts;
+    switch (tok->gen.datatype) {
+#define TYPED_CASE(MTYPE, T)                                    \
+        case MTYPE:                                             \
+            for (i = 0; i < len; i++)                           \
+                c[i].T = (TOK_LITERAL == tok->toktype           \
+                          ? tok->lit.val.T : tok->lit.val.T##p[i]); \
+            break;
+        TYPED_CASE(MPR_INT32, i)
+        TYPED_CASE(MPR_FLT, f)
+        TYPED_CASE(MPR_DBL, d)
+#undef TYPED_CASE
+        default:
+            break;
+    }
+    o.idx = prog->n_consts;
+    o.len = len;
+    o.loc = BC_CONST;
+    o.type = tok->gen.datatype;
+    prog->n_consts += len;
+    return o;
+}
+
+static void bc_free(mpr_expr_prog prog)
+{
+    FUNC_IF(free, prog->code);
+    FUNC_IF(free, prog->consts);
+    FUNC_IF(free, prog->in_types);
+    FUNC_IF(free, prog->linear);
+#ifdef BC_JIT
+    if (prog->jit) {
+        munmap(prog->jit->mem, prog->jit->size);
+        free(prog->jit);
+    }
+#endif
+    free(prog);
+}
+
+/* Leave the value of a conditional branch in its own register with the length of the result so
+ * that both branches produce the same operand at the join. */
+static int bc_place_branch(mpr_expr_prog prog, bc_opnd_t *opnd, int dst, mpr_token join)
+{
+    RETURN_ARG_UNLESS(opnd->type == join->gen.datatype, 0);
+    if (BC_CONST == opnd->loc || opnd->idx != dst || opnd->len != join->gen.vec_len) {
+        bc_add_copy(prog, dst, opnd, join->gen.vec_len);
+        opnd->idx = dst;
+        opnd->len = join->gen.vec_len;
+        opnd->loc = BC_REG;
+    }
+    return 1;
+}
+
+/* Programs computing y=x, y=x*m, y=x+b or y=x*m+b from the current value of the first input,
+ * optionally cast, and coefficients that are constants or current values of variables (as for
+ * maps using the default or linear expressions) are evaluated by bc_eval_linear() in one pass
+ * instead of instruction by instruction. Coefficient element j is read from element j % len. */
+
+typedef struct _bc_coef {
+    int16_t var;        /* variable index, or -1 for the constant pool */
+    int idx;            /* offset into the constant pool */
+    int len;            /* number of elements, or 0 if absent */
+    int vec_idx;        /* vector offset into the variable */
+} bc_coef_t, *bc_coef;
+
+typedef struct _bc_linear {
+    bc_coef_t m;
+    bc_coef_t b;
+    mpr_type type;      /* type of the computation and output */
+    mpr_type in_type;   /* type of the input, cast to type if different */
+    int in_vec_idx;
+    int len;            /* number of output elements */
+} bc_linear_t, *bc_linear;
+
+#define LIN_NONE    0
+#define LIN_X       1   /* register holds x, x*m, x+b or x*m+b */
+#define LIN_COEF    2   /* register holds a coefficient */
+
+/* Return the coefficient an operand refers to, or one with zero length if it is not one. */
+static bc_coef_t bc_linear_coef(bc_opnd_t *o, int len, uint8_t *kinds, bc_coef_t *coefs)
+{
+    bc_coef_t c;
+    memset(&c, 0, sizeof(bc_coef_t));
+    if (BC_CONST == o->loc) {
+        c.var = -1;
+        c.idx = o->idx;
+        c.len = o->len;
+    }
+    else if (LIN_COEF == kinds[o->idx])
+        c = coefs[o->idx];
+    /* reading element j % len of the operand must read element j % c.len of the coefficient */
+    if (c.len != 1 && c.len != len)
+        c.len = 0;
+    return c;
+}
+
+static bc_linear bc_match_linear(mpr_expr expr, mpr_expr_prog prog)
+{
+    int i, x_len = 0, n_regs = expr->stack_size * expr->vec_len;
+    uint8_t *kinds = calloc(1, n_regs);
+    bc_coef_t *coefs = calloc(1, sizeof(bc_coef_t) * n_regs), c[2];
+    mpr_type *types = calloc(1, sizeof(mpr_type) * n_regs);
+    bc_linear_t lin;
+    bc_instr ins;
+
+    memset(&lin, 0, sizeof(bc_linear_t));
+    for (i = 0; i < prog->n_code; i++) {
+        ins = prog->code + i;
+        switch (ins->code) {
+            case BC_LOAD:
+                if (ins->arity || ins->hist_idx || ins->dst >= n_regs)
+                    goto fail;
+                if (VAR_X == ins->var && !lin.in_type) {
+                    kinds[ins->dst] = LIN_X;
+                    lin.in_type = lin.type = ins->type;
+                    lin.in_vec_idx = ins->vec_idx;
+                    x_len = ins->len;
+                }
+                else if (ins->var >= 0 && ins->var < expr->n_vars) {
+                    kinds[ins->dst] = LIN_COEF;
+                    coefs[ins->dst].var = ins->var;
+                    coefs[ins->dst].len = ins->len;
+                    coefs[ins->dst].vec_idx = ins->vec_idx;
+                }
+                else
+                    goto fail;
+                types[ins->dst] = ins->type;
+                break;
+            case BC_CAST:
+                /* only x can be cast, before it is combined with a coefficient */
+                if (LIN_X != kinds[ins->dst] || lin.m.len || lin.b.len)
+                    goto fail;
+                types[ins->dst] = lin.type = ins->casttype;
+                break;
+            case BC_COPY:
+                c[0] = bc_linear_coef(&ins->src[0], ins->lens[0], kinds, coefs);
+                if (!c[0].len || ins->dst >= n_regs)
+                    goto fail;
+                kinds[ins->dst] = LIN_COEF;
+                coefs[ins->dst] = c[0];
+                types[ins->dst] = ins->type;
+                break;
+            case BC_KERNEL: {
+                int x = BC_REG == ins->src[0].loc && LIN_X == kinds[ins->src[0].idx] ? 0 : 1;
+                bc_kernel *k = ins->kernel;
+                if (2 != ins->arity || ins->type != lin.type || ins->len != x_len)
+                    goto fail;
+                if (BC_REG != ins->src[x].loc || LIN_X != kinds[ins->src[x].idx]
+                    || ins->lens[x] != x_len || types[ins->src[x].idx] != lin.type)
+                    goto fail;
+                c[0] = bc_linear_coef(&ins->src[!x], ins->lens[!x], kinds, coefs);
+                if (!c[0].len || ins->src[!x].type != lin.type)
+                    goto fail;
+                if ((k == bc_muli || k == bc_mulf || k == bc_muld) && !lin.m.len && !lin.b.len)
+                    lin.m = c[0];
+                else if ((k == bc_addi || k == bc_addf || k == bc_addd) && !lin.b.len)
+                    lin.b = c[0];
+                else
+                    goto fail;
+                kinds[ins->src[x].idx] = LIN_NONE;
+                kinds[ins->dst] = LIN_X;
+                types[ins->dst] = lin.type;
+                break;
+            }
+            case BC_ASSIGN:
+                if (i != prog->n_code - 1 || VAR_Y != ins->var || ins->vec_idx || ins->offset
+                    || BC_REG != ins->src[0].loc || LIN_X != kinds[ins->src[0].idx]
+                    || ins->type != lin.type || ins->lens[0] != x_len || ins->len > x_len)
+                    goto fail;
+                lin.len = ins->len;
+                break;
+            default:
+                goto fail;
+        }
+    }
+    if (!lin.len)
+        goto fail;
+    free(kinds);
+    free(coefs);
+    free(types);
+    return memcpy(malloc(sizeof(bc_linear_t)), &lin, sizeof(bc_linear_t));
+
+  fail:
+    free(kinds);
+    free(coefs);
+    free(types);
+    return 0;
+}
+
+#define BC_REG_OPND(DP, LEN, TYPE)  \
+    o.idx = (DP) * vlen;            \
+    o.len = LEN;                    \
+    o.loc = BC_REG;                 \
+    o.type = TYPE;                  \
+    opnds[DP] = o;
+
+/* Compile the tokens following the expression offset. Returns 0 if they contain constructs
+ * that must be left to the interpreter. */
+static mpr_expr_prog bc_compile(mpr_expr expr)
+{
+    mpr_token tok = expr->start + expr->offset, end = expr->start + expr->n_tokens;
+    mpr_expr_prog prog;
+    bc_opnd_t *opnds, o;
+    bc_instr ins;
+    int i, j, dp = -1, vlen = expr->vec_len, can_advance = 1, *tok_ins;
+
+    /* instance and mute control depend on per-instance state recovered by the interpreter */
+    RETURN_ARG_UNLESS(tok < end && expr->inst_ctl < 0 && expr->mute_ctl < 0, 0);
+
+    prog = calloc(1, sizeof(struct _mpr_expr_prog));
+    prog->in_types = calloc(1, expr->n_ins ? expr->n_ins : 1);
+    opnds = calloc(1, sizeof(bc_opnd_t) * (expr->n_tokens + 1));
+    /* index of the first instruction compiled for each token, used to resolve branches */
+    tok_ins = calloc(1, sizeof(int) * (expr->n_tokens + 1));
+
+    for (; tok < end; tok++) {
+        tok_ins[tok - expr->start] = prog->n_code;
+        switch (tok->toktype) {
+        case TOK_LITERAL:
+        case TOK_VLITERAL:
+            ++dp;
+            opnds[dp] = bc_add_const(prog, tok);
+            break;
+        case TOK_VAR: {
+            bc_opnd_t hist;
+            int has_hist = tok->gen.flags & VAR_HIST_IDX;
+            if (tok->gen.flags & (VAR_SIG_IDX | VAR_VEC_IDX | VAR_INST_IDX))
+                goto fail;
+            if (has_hist) {
+                /* fractional history indices are interpolated by the interpreter */
+                if (dp < 0 || MPR_INT32 != opnds[dp].type)
+                    goto fail;
+                hist = opnds[dp--];
+            }
+            if (VAR_Y == tok->var.idx) {
+                if (prog->out_type && prog->out_type != tok->gen.datatype)
+                    goto fail;
+                prog->out_type = tok->gen.datatype;
+                can_advance = 0;
+            }
+            else if (tok->var.idx >= VAR_X) {
+                i = tok->var.idx - VAR_X;
+                if (i >= expr->n_ins || (prog->in_types[i] && prog->in_types[i] != tok->gen.datatype))
+                    goto fail;
+                prog->in_types[i] = tok->gen.datatype;
+                prog->reads_x = 1;
+                can_advance = 0;
+            }
+            else if (tok->var.idx >= 0 && tok->var.idx < expr->n_vars) {
+                if (tok->gen.datatype != expr->vars[tok->var.idx].datatype)
+                    goto fail;
+                prog->reads_vars = 1;
+            }
+            else
+                goto fail;
+            ++dp;
+            ins = bc_add_instr(prog, BC_LOAD, tok->gen.datatype, tok->gen.vec_len, dp * vlen);
+            ins->var = tok->var.idx;
+            ins->vec_idx = tok->var.vec_idx;
+            if (has_hist) {
+                if (BC_CONST == hist.loc)
+                    ins->hist_idx = prog->consts[hist.idx].i;
+                else {
+                    ins->arity = 1;
+                    ins->src[0] = hist;
+                }
+            }
+            BC_REG_OPND(dp, tok->gen.vec_len, tok->gen.datatype);
+            break;
+        }
+        case TOK_OP:
+        case TOK_FN: {
+            int arity, maxlen = 0;
+            bc_kernel *kernel;
+            void *fn = 0;
+            if (TOK_OP == tok->toktype) {
+                arity = op_tbl[tok->op.idx].arity;
+                kernel = bc_op_kernel(tok->op.idx, tok->gen.datatype);
+            }
+            else {
+                /* delay, sig_idx and vec_idx are resolved during parsing */
+                if (tok->fn.idx >= FN_DEL_IDX && tok->fn.idx <= FN_VEC_IDX)
+                    goto fail;
+                if (tok->fn.idx > FN_DEL_IDX)
+                    can_advance = 0;
+                arity = fn_tbl[tok->fn.idx].arity;
+                kernel = bc_fn_kernel(arity, tok->gen.datatype);
+                switch (tok->gen.datatype) {
+                    case MPR_INT32: fn = fn_tbl[tok->fn.idx].fn_int;    break;
+                    case MPR_FLT:   fn = fn_tbl[tok->fn.idx].fn_flt;    break;
+                    case MPR_DBL:   fn = fn_tbl[tok->fn.idx].fn_dbl;    break;
+                    default:                                            break;
+                }
+                if (!fn)
+                    goto fail;
+            }
+            if (!kernel || arity < 1 || dp - arity + 1 < 0)
+                goto fail;
+            dp -= arity - 1;
+            for (i = 0; i < arity; i++) {
+                /* operand types are reinterpreted rather than cast by the interpreter */
+                if (opnds[dp + i].type != tok->gen.datatype)
+                    goto fail;
+                maxlen = _max(maxlen, opnds[dp + i].len);
+            }
+            if (TOK_OP == tok->toktype && OP_MODULO == tok->op.idx && tok->gen.vec_len != maxlen)
+                goto fail;
+            /* expand a shorter register operand in place so it can be overwritten safely */
+            if (BC_REG == opnds[dp].loc && opnds[dp].len < maxlen) {
+                bc_add_copy(prog, dp * vlen, &opnds[dp], maxlen);
+                opnds[dp].len = maxlen;
+            }
+            ins = bc_add_instr(prog, BC_KERNEL, tok->gen.datatype, maxlen, dp * vlen);
+            ins->kernel = kernel;
+            ins->fn = fn;
+            ins->arity = arity;
+            for (i = 0; i < arity; i++) {
+                ins->src[i] = opnds[dp + i];
+                ins->lens[i] = opnds[dp + i].len;
+            }
+            BC_REG_OPND(dp, maxlen, tok->gen.datatype);
+            break;
+        }
+        case TOK_VFN: {
+            int arity = vfn_tbl[tok->fn.idx].arity, maxlen = tok->gen.vec_len;
+            void *fn;
+            if (VFN_MAXMIN == tok->fn.idx || VFN_SUMNUM == tok->fn.idx || dp - arity + 1 < 0)
+                goto fail;
+            switch (tok->gen.datatype) {
+                case MPR_INT32: fn = (void*)vfn_tbl[tok->fn.idx].fn_int;    break;
+                case MPR_FLT:   fn = (void*)vfn_tbl[tok->fn.idx].fn_flt;    break;
+                case MPR_DBL:   fn = (void*)vfn_tbl[tok->fn.idx].fn_dbl;    break;
+                default:        fn = 0;
+            }
+            if (vfn_tbl[tok->fn.idx].memory) {
+                switch (tok->gen.datatype) {
+                    case MPR_FLT:   fn = (void*)vfn_tbl[tok->fn.idx].mem_flt;   break;
+                    case MPR_DBL:   fn = (void*)vfn_tbl[tok->fn.idx].mem_dbl;   break;
+                    default:        fn = 0;
+                }
+            }
+            if (!fn)
+                goto fail;
+            dp -= arity - 1;
+            for (i = 0; i < arity; i++) {
+                if (opnds[dp + i].type != tok->gen.datatype)
+                    goto fail;
+                maxlen = _max(maxlen, opnds[dp + i].len);
+            }
+            /* vector functions operate on consecutive registers of equal length, except for
+             * filters which only expand their input */
+            for (i = 0; i < arity; i++) {
+                int len = opnds[dp + i].len;
+                if (vfn_tbl[tok->fn.idx].memory)
+                    len = i ? len : tok->gen.vec_len;
+                else if (arity > 1 || VFN_DOT == tok->fn.idx)
+                    len = maxlen;
+                if (BC_CONST == opnds[dp + i].loc || opnds[dp + i].len < len) {
+                    bc_add_copy(prog, (dp + i) * vlen, &opnds[dp + i], len);
+                    BC_REG_OPND(dp + i, len, tok->gen.datatype);
+                }
+            }
+            if (vfn_tbl[tok->fn.idx].memory) {
+                i = vfn_mem_len(tok->fn.idx, tok->gen.vec_len, opnds[dp + arity - 1].len);
+                if (i > expr->vars[tok->fn.var].vec_len)
+                    goto fail;
+                ins = bc_add_instr(prog, BC_FILTER, tok->gen.datatype, tok->gen.vec_len, dp);
+                ins->var = tok->fn.var;
+                prog->reads_vars = 1;
+                if (!(expr->vars[tok->fn.var].flags & VAR_INSTANCED))
+                    prog->assigns_shared = 1;
+                can_advance = 0;
+            }
+            else
+                ins = bc_add_instr(prog, BC_VFN, tok->gen.datatype, tok->gen.vec_len, dp);
+            ins->arity = arity;
+            ins->fn = fn;
+            ins->offset = vfn_tbl[tok->fn.idx].reduce;
+            for (i = 0; i < arity; i++)
+                ins->lens[i] = opnds[dp + i].len;
+            BC_REG_OPND(dp, tok->gen.vec_len, tok->gen.datatype);
+            break;
+        }
+        case TOK_VECTORIZE:
+            if (dp - tok->fn.arity + 1 < 0)
+                goto fail;
+            dp -= tok->fn.arity - 1;
+            for (i = 0; i < tok->fn.arity; i++) {
+                if (opnds[dp + i].type != tok->gen.datatype)
+                    goto fail;
+            }
+            if (BC_CONST == opnds[dp].loc)
+                bc_add_copy(prog, dp * vlen, &opnds[dp], opnds[dp].len);
+            j = opnds[dp].len;
+            for (i = 1; i < tok->fn.arity; i++) {
+                if (j + opnds[dp + i].len > vlen)
+                    goto fail;
+                bc_add_copy(prog, dp * vlen + j, &opnds[dp + i], opnds[dp + i].len);
+                j += opnds[dp + i].len;
+            }
+            BC_REG_OPND(dp, j, tok->gen.datatype);
+            break;
+        case TOK_COPY_FROM:
+            /* shared subexpression: constants are copied too since casts modify them in place */
+            i = dp - tok->con.cache_offset;
+            if (i < 0 || opnds[i].type != tok->gen.datatype || opnds[i].len != tok->gen.vec_len)
+                goto fail;
+            ++dp;
+            bc_add_copy(prog, dp * vlen, &opnds[i], opnds[i].len);
+            BC_REG_OPND(dp, opnds[i].len, opnds[i].type);
+            break;
+        case TOK_ASSIGN:
+        case TOK_ASSIGN_USE:
+        case TOK_ASSIGN_CONST:
+            if (dp < 0 || (tok->gen.flags & VAR_IDXS) || tok->gen.casttype)
+                goto fail;
+            if (VAR_Y == tok->var.idx) {
+                if (prog->out_type && prog->out_type != opnds[dp].type)
+                    goto fail;
+                prog->out_type = opnds[dp].type;
+                can_advance = 0;
+            }
+            else if (tok->var.idx < 0 || tok->var.idx >= expr->n_vars)
+                goto fail;
+            else if (opnds[dp].type != expr->vars[tok->var.idx].datatype)
+                goto fail;
+            else {
+                prog->reads_vars = 1;
+                if (!(expr->vars[tok->var.idx].flags & VAR_INSTANCED))
+                    prog->assigns_shared = 1;
+            }
+            /* assignments that move the expression offset are left to the interpreter */
+            if (can_advance)
+                goto fail;
+            ins = bc_add_instr(prog, BC_ASSIGN, opnds[dp].type, tok->gen.vec_len, 0);
+            ins->arity = 1;
+            ins->var = tok->var.idx;
+            ins->vec_idx = tok->var.vec_idx;
+            ins->offset = tok->var.offset;
+            ins->src[0] = opnds[dp];
+            ins->lens[0] = opnds[dp].len;
+            if (tok->gen.flags & CLEAR_STACK)
+                dp = -1;
+            break;
+        case TOK_BRANCH:
+            if (dp < 0)
+                goto fail;
+            if (tok->con.flags & BRANCH_IF_FALSE) {
+                ins = bc_add_instr(prog, BC_BRANCH, opnds[dp].type, 1, 0);
+                ins->arity = 1;
+                ins->src[0] = opnds[dp];
+                ins->lens[0] = opnds[dp].len;
+            }
+            else if (bc_place_branch(prog, &opnds[dp], dp * vlen, tok + tok->con.branch_offset))
+                ins = bc_add_instr(prog, BC_BRANCH, opnds[dp].type, 0, 0);
+            else
+                goto fail;
+            /* resolved to an instruction index once the target has been compiled */
+            ins->target = tok - expr->start + tok->con.branch_offset;
+            prog->branches = 1;
+            --dp;
+            break;
+        case TOK_JOIN:
+            if (dp < 0 || !bc_place_branch(prog, &opnds[dp], dp * vlen, tok))
+                goto fail;
+            /* the first branch skips placing the value of the second */
+            tok_ins[tok - expr->start] = prog->n_code;
+            break;
+        default:
+            goto fail;
+        }
+        if (tok->gen.casttype) {
+            if (dp < 0)
+                goto fail;
+            if (BC_CONST == opnds[dp].loc)
+                bc_cast(prog->consts + opnds[dp].idx, opnds[dp].len, opnds[dp].type,
+                        tok->gen.casttype);
+            else {
+                ins = bc_add_instr(prog, BC_CAST, opnds[dp].type, opnds[dp].len, opnds[dp].idx);
+                ins->casttype = tok->gen.casttype;
+            }
+            opnds[dp].type = tok->gen.casttype;
+        }
+        if (dp >= expr->stack_size)
+            goto fail;
+    }
+    for (i = 0; i < prog->n_code; i++) {
+        if (BC_BRANCH == prog->code[i].code)
+            prog->code[i].target = tok_ins[prog->code[i].target];
+    }
+    prog->linear = bc_match_linear(expr, prog);
+    free(opnds);
+    free(tok_ins);
+    return prog;
+
+  fail:
+#if TRACE_PARSE
+    printf("expression uses constructs unsupported by the bytecode compiler at token %ld\n",
+           (long)(tok - expr->start));
+#endif
+    free(opnds);
+    free(tok_ins);
+    bc_free(prog);
+    return 0;
+}
+
+MPR_INLINE static mpr_value_buffer bc_get_buffer(mpr_value v, int inst_idx, int instanced)
+{
+    return &v->inst[instanced ? inst_idx % v->num_inst : 0];
+}
+
+/* State shared by the instructions of one evaluation of a compiled program. The register file is
+ * transposed so that element e of the register at element offset r is stored for the k-th of n
+ * instances at (r + e) * n + k, letting each kernel call process an element of every instance at
+ * once; for a single instance this is the usual stack layout. */
+typedef struct _bc_state {
+    mpr_expr expr;
+    mpr_expr_stack expr_stk;
+    mpr_expr_val regs;
+    mpr_expr_val scratch;
+    mpr_value *v_in;
+    mpr_value *v_vars;
+    mpr_value v_out;
+    mpr_time *time;
+    mpr_type *out_types;
+    const int *inst_idx;
+    int n;
+    int status;
+} bc_state_t, *bc_state;
+
+/* Execute one instruction. Returns the next instruction, or 0 if evaluation failed. */
+MPR_INLINE static bc_instr bc_exec(bc_state st, bc_instr ins)
+{
+    mpr_expr expr = st->expr;
+    mpr_expr_stack expr_stk = st->expr_stk;
+    mpr_expr_val regs = st->regs, scratch = st->scratch, consts = expr->prog->consts, src[4];
+    mpr_value *v_in = st->v_in, *v_vars = st->v_vars, v_out = st->v_out;
+    const int *inst_idx = st->inst_idx;
+    int lens[4];
+    int i, j, k, e, vlen = expr->vec_len, n = st->n;
+
+/* pointer to element E of operand O for the first instance */
+#define BC_OPND_PTR(O, E) ((O).loc == BC_CONST ? consts + (O).idx + (E) : regs + ((O).idx + (E)) * n)
+/* value of element E of operand O for the K-th instance */
+#define BC_OPND_VAL(O, E, K) ((O).loc == BC_CONST ? consts[(O).idx + (E)] \
+                                                  : regs[((O).idx + (E)) * n + (K)])
+
+    switch (ins->code) {
+    case BC_LOAD:
+        for (k = 0; k < n; k++) {
+            mpr_value v;
+            mpr_value_buffer b;
+            int hidx = ins->arity ? BC_OPND_VAL(ins->src[0], 0, k).i : ins->hist_idx;
+            mpr_expr_val d = regs + ins->dst * n + k;
+            if (VAR_Y == ins->var) {
+                v = v_out;
+                b = &v_out->inst[inst_idx[k] % v_out->num_inst];
+            }
+            else if (ins->var >= VAR_X) {
+                v = v_in[ins->var - VAR_X];
+                b = bc_get_buffer(v, inst_idx[k], 1);
+            }
+            else {
+                v = *v_vars + ins->var;
+                b = bc_get_buffer(v, inst_idx[k], expr->vars[ins->var].flags & VAR_INSTANCED);
+            }
+            i = mpr_value_get_hist_idx(v, b->pos, hidx);
+            switch (ins->type) {
+#define TYPED_CASE(MTYPE, TYPE, T)                                          \
+                case MTYPE: {                                               \
+                    TYPE *a = (TYPE*)b->samps + i * v->vlen;                \
+                    if (!ins->vec_idx && ins->len <= v->vlen) {             \
+                        for (j = 0; j < ins->len; j++)                      \
+                            d[j * n].T = a[j];                              \
+                    }                                                       \
+                    else {                                                  \
+                        for (j = 0; j < ins->len; j++)                      \
+                            d[j * n].T = a[(j + ins->vec_idx) % v->vlen];   \
+                    }                                                       \
+                    break;                                                  \
+                }
+                TYPED_CASE(MPR_INT32, int, i)
+                TYPED_CASE(MPR_FLT, float, f)
+                TYPED_CASE(MPR_DBL, double, d)
+#undef TYPED_CASE
+                default:
+                    return 0;
+            }
+        }
+        break;
+    case BC_COPY:
+        for (e = 0; e < ins->len; e++) {
+            mpr_expr_val d = regs + (ins->dst + e) * n;
+            mpr_expr_val s = BC_OPND_PTR(ins->src[0], e % ins->lens[0]);
+            if (BC_CONST == ins->src[0].loc) {
+                for (k = 0; k < n; k++)
+                    d[k] = s[0];
+            }
+            else if (d != s)
+                memcpy(d, s, sizeof(mpr_expr_val_t) * n);
+        }
+        break;
+    case BC_KERNEL: {
+        /* operands are either register rows of n elements or broadcast constants */
+        int full = 1;
+        for (i = 0; i < ins->arity; i++) {
+            if (1 == n)
+                lens[i] = ins->lens[i];
+            else {
+                lens[i] = BC_CONST == ins->src[i].loc ? 1 : n;
+                if (ins->lens[i] != (BC_CONST == ins->src[i].loc ? 1 : ins->len))
+                    full = 0;
+            }
+        }
+        if (1 == n || full) {
+            /* consecutive rows can be processed in a single call */
+            for (i = 0; i < ins->arity; i++) {
+                src[i] = BC_OPND_PTR(ins->src[i], 0);
+                if (n > 1 && BC_REG == ins->src[i].loc)
+                    lens[i] = n * ins->len;
+            }
+            ins->kernel(regs + ins->dst * n, src, lens, n * ins->len, ins->fn);
+            break;
+        }
+        for (e = 0; e < ins->len; e++) {
+            for (i = 0; i < ins->arity; i++)
+                src[i] = BC_OPND_PTR(ins->src[i], e % ins->lens[i]);
+            ins->kernel(regs + (ins->dst + e) * n, src, lens, n, ins->fn);
+        }
+        break;
+    }
+    case BC_VFN:
+        /* vector functions read operand lengths from the dims array */
+        if (1 == n) {
+            for (i = 0; i < ins->arity; i++)
+                expr_stk->dims[ins->dst + i] = ins->lens[i];
+            ((vfn_template*)ins->fn)(regs, expr_stk->dims, ins->dst, vlen);
+            if (ins->offset) {
+                mpr_expr_val d = regs + ins->dst * vlen;
+                for (i = 1; i < ins->len; i++)
+                    d[i].d = d[0].d;
+            }
+            break;
+        }
+        /* gather each instance's operands into scratch registers in the usual layout */
+        for (i = 0; i < ins->arity; i++)
+            expr_stk->dims[i] = ins->lens[i];
+        for (k = 0; k < n; k++) {
+            mpr_expr_val d = regs + ins->dst * vlen * n + k;
+            for (i = 0; i < ins->arity; i++) {
+                for (e = 0; e < ins->lens[i]; e++)
+                    scratch[i * vlen + e] = d[(i * vlen + e) * n];
+            }
+            ((vfn_template*)ins->fn)(scratch, expr_stk->dims, 0, vlen);
+            for (e = 0; e < ins->len; e++)
+                d[e * n] = scratch[ins->offset ? 0 : e];
+        }
+        break;
+    case BC_FILTER:
+        /* filters are applied per instance since each instance has its own state */
+        for (i = 0; i < ins->arity; i++)
+            expr_stk->dims[(1 == n ? ins->dst : 0) + i] = ins->lens[i];
+        for (k = 0; k < n; k++) {
+            mpr_value v = *v_vars + ins->var;
+            mpr_value_buffer b;
+            mpr_expr_val d = regs + ins->dst * vlen * n + k;
+            if (v->vlen < expr->vars[ins->var].vec_len)
+                return 0;
+            b = bc_get_buffer(v, inst_idx[k], expr->vars[ins->var].flags & VAR_INSTANCED);
+            if (1 == n) {
+                ((vfn_mem_template*)ins->fn)(regs, expr_stk->dims, ins->dst, vlen, b->samps);
+                break;
+            }
+            for (i = 0; i < ins->arity; i++) {
+                for (e = 0; e < ins->lens[i]; e++)
+                    scratch[i * vlen + e] = d[(i * vlen + e) * n];
+            }
+            ((vfn_mem_template*)ins->fn)(scratch, expr_stk->dims, 0, vlen, b->samps);
+            for (e = 0; e < ins->len; e++)
+                d[e * n] = scratch[e];
+        }
+        break;
+    case BC_CAST:
+        bc_cast(regs + ins->dst * n, ins->len * n, ins->type, ins->casttype);
+        break;
+    case BC_BRANCH:
+        /* programs with branches are only evaluated for one instance at a time */
+        if (ins->arity) {
+            mpr_expr_val c = BC_OPND_PTR(ins->src[0], 0);
+            switch (ins->type) {
+                case MPR_INT32: j = !c->i;  break;
+                case MPR_FLT:   j = !c->f;  break;
+                case MPR_DBL:   j = !c->d;  break;
+                default:        return 0;
+            }
+            if (!j)
+                break;
+        }
+        return expr->prog->code + ins->target;
+    case BC_ASSIGN:
+        if (VAR_Y == ins->var)
+            st->status |= EXPR_UPDATE;
+        else if (expr->vars[ins->var].flags & VAR_SET_EXTERN)
+            break;
+        for (k = 0; k < n; k++) {
+            mpr_value v;
+            mpr_value_buffer b;
+            int vidx = ins->vec_idx;
+            if (VAR_Y == ins->var) {
+                v = v_out;
+                b = &v_out->inst[inst_idx[k] % v_out->num_inst];
+            }
+            else {
+                v = *v_vars + ins->var;
+                b = bc_get_buffer(v, inst_idx[k], expr->vars[ins->var].flags & VAR_INSTANCED);
+            }
+            while (vidx < 0)
+                vidx += v->vlen;
+            i = mpr_value_get_hist_idx(v, b->pos, 0);
+            if (st->time)
+                memcpy(&b->times[i], st->time, sizeof(mpr_time));
+            switch (ins->type) {
+#define TYPED_CASE(MTYPE, TYPE, T)                                                      \
+                case MTYPE: {                                                           \
+                    TYPE *a = (TYPE*)b->samps + i * v->vlen;                            \
+                    for (i = vidx, j = ins->offset; i < ins->len + vidx; i++, j++) {    \
+                        if (j >= ins->lens[0]) j = 0;                                   \
+                        a[i] = BC_OPND_VAL(ins->src[0], j, k).T;                        \
+                    }                                                                   \
+                    break;                                                              \
+                }
+                TYPED_CASE(MPR_INT32, int, i)
+                TYPED_CASE(MPR_FLT, float, f)
+                TYPED_CASE(MPR_DBL, double, d)
+#undef TYPED_CASE
+                default:
+                    return 0;
+            }
+            if (VAR_Y == ins->var && !k) {
+                for (i = 0, j = vidx; i < ins->len; i++, j++) {
+                    if (j >= v->vlen) j = 0;
+                    st->out_types[j] = ins->type;
+                }
+            }
+        }
+        break;
+    }
+#undef BC_OPND_PTR
+#undef BC_OPND_VAL
+    return ins + 1;
+}
+
+#ifdef BC_JIT
+/* Programs evaluated JIT_THRESHOLD times for single instances are translated to x86-64 machine
+ * code. Copies, branches, float and double arithmetic and integer addition, subtraction and
+ * multiplication are emitted inline with their operand addresses resolved at compile time, and
+ * every other instruction becomes a call to bc_exec(). The generated function is called with the
+ * evaluation state, register file and constant pool, keeps them in rbx, r12 and r13, and returns
+ * zero if evaluation failed. */
+
+typedef struct _jit_buf {
+    uint8_t *code;
+    int len;
+    int size;
+    int *fixups;        /* pairs of rel32 positions and target instructions (-1 for failure) */
+    int n_fixups;
+} jit_buf_t, *jit_buf;
+
+static void jit_byte(jit_buf b, int byte)
+{
+    if (b->len >= b->size) {
+        b->size = b->size ? b->size * 2 : 256;
+        b->code = realloc(b->code, b->size);
+    }
+    b->code[b->len++] = (uint8_t)byte;
+}
+
+static void jit_bytes(jit_buf b, const uint8_t *bytes, int len)
+{
+    int i;
+    for (i = 0; i < len; i++)
+        jit_byte(b, bytes[i]);
+}
+
+static void jit_int(jit_buf b, int64_t val, int size)
+{
+    int i;
+    for (i = 0; i < size; i++)
+        jit_byte(b, (int)((val >> (i * 8)) & 0xFF));
+}
+
+/* Emit a rel32 operand to be patched with the address of a target instruction. */
+static void jit_fixup(jit_buf b, int target)
+{
+    b->fixups = realloc(b->fixups, sizeof(int) * 2 * (b->n_fixups + 1));
+    b->fixups[b->n_fixups * 2] = b->len;
+    b->fixups[b->n_fixups * 2 + 1] = target;
+    ++b->n_fixups;
+    jit_int(b, 0, 4);
+}
+
+/* Emit an instruction whose memory operand is element E of operand O, addressed through r12 for
+ * registers or r13 for constants. OPCODE may be a two-byte opcode and REG fills ModRM.reg. */
+static void jit_mem(jit_buf b, int prefix, int rex_w, int opcode, int reg, bc_opnd_t *o, int e)
+{
+    if (prefix)
+        jit_byte(b, prefix);
+    jit_byte(b, rex_w ? 0x49 : 0x41);
+    if (opcode > 0xFF)
+        jit_byte(b, opcode >> 8);
+    jit_byte(b, opcode & 0xFF);
+    if (BC_CONST == o->loc)
+        jit_byte(b, 0x85 | (reg << 3));
+    else {
+        jit_byte(b, 0x84 | (reg << 3));
+        jit_byte(b, 0x24);
+    }
+    jit_int(b, (o->idx + e) * (int)sizeof(mpr_expr_val_t), 4);
+}
+
+/* Return the opcode of an element-wise operator kernel that can be emitted inline, or 0. */
+static int jit_op_opcode(bc_instr ins)
+{
+    bc_kernel *k = ins->kernel;
+    switch (ins->type) {
+        case MPR_INT32:
+            return k == bc_addi ? 0x03 : k == bc_subi ? 0x2B : k == bc_muli ? 0x0FAF : 0;
+        case MPR_FLT:
+            return (k == bc_addf ? 0x0F58 : k == bc_subf ? 0x0F5C : k == bc_mulf ? 0x0F59
+                    : k == bc_divf ? 0x0F5E : 0);
+        case MPR_DBL:
+            return (k == bc_addd ? 0x0F58 : k == bc_subd ? 0x0F5C : k == bc_muld ? 0x0F59
+                    : k == bc_divd ? 0x0F5E : 0);
+        default:
+            return 0;
+    }
+}
+
+static void jit_emit_instr(jit_buf b, bc_instr ins)
+{
+    static const uint8_t call[] = {0x48, 0x89, 0xDF};          /* mov rdi, rbx */
+    static const uint8_t check[] = {0x48, 0x85, 0xC0, 0x0F, 0x84}; /* test rax, rax; jz */
+    bc_opnd_t dst;
+    int e, opcode, prefix;
+
+    dst.idx = ins->dst;
+    dst.loc = BC_REG;
+
+    switch (ins->code) {
+        case BC_COPY:
+            for (e = 0; e < ins->len; e++) {
+                jit_mem(b, 0, 1, 0x8B, 0, &ins->src[0], e % ins->lens[0]);   /* mov rax, src */
+                jit_mem(b, 0, 1, 0x89, 0, &dst, e);                         /* mov dst, rax */
+            }
+            return;
+        case BC_KERNEL:
+            if (2 != ins->arity || !(opcode = jit_op_opcode(ins)))
+                break;
+            if (MPR_INT32 == ins->type) {
+                for (e = 0; e < ins->len; e++) {
+                    jit_mem(b, 0, 0, 0x8B, 0, &ins->src[0], e % ins->lens[0]);
+                    jit_mem(b, 0, 0, opcode, 0, &ins->src[1], e % ins->lens[1]);
+                    jit_mem(b, 0, 0, 0x89, 0, &dst, e);
+                }
+                return;
+            }
+            prefix = MPR_FLT == ins->type ? 0xF3 : 0xF2;
+            for (e = 0; e < ins->len; e++) {
+                jit_mem(b, prefix, 0, 0x0F10, 0, &ins->src[0], e % ins->lens[0]);
+                jit_mem(b, prefix, 0, opcode, 0, &ins->src[1], e % ins->lens[1]);
+                jit_mem(b, prefix, 0, 0x0F11, 0, &dst, e);
+            }
+            return;
+        case BC_BRANCH:
+            if (!ins->arity) {
+                jit_byte(b, 0xE9);                                          /* jmp target */
+                jit_fixup(b, ins->target);
+                return;
+            }
+            if (MPR_INT32 == ins->type) {
+                jit_mem(b, 0, 0, 0x83, 7, &ins->src[0], 0);                 /* cmp src, 0 */
+                jit_byte(b, 0);
+            }
+            else {
+                /* ucomiss/ucomisd against zero, not branching if the operand is NaN */
+                static const uint8_t zero[] = {0x0F, 0x57, 0xC9, 0x0F, 0x2E, 0xC1, 0x7A, 0x06};
+                prefix = MPR_FLT == ins->type ? 0xF3 : 0xF2;
+                jit_mem(b, prefix, 0, 0x0F10, 0, &ins->src[0], 0);
+                if (MPR_DBL == ins->type)
+                    jit_byte(b, 0x66);
+                jit_bytes(b, zero, 3);
+                if (MPR_DBL == ins->type)
+                    jit_byte(b, 0x66);
+                jit_bytes(b, zero + 3, 5);
+            }
+            jit_byte(b, 0x0F);                                              /* je target */
+            jit_byte(b, 0x84);
+            jit_fixup(b, ins->target);
+            return;
+        default:
+            break;
+    }
+    /* call bc_exec(state, ins), failing if it returns 0 */
+    jit_bytes(b, call, sizeof(call));
+    jit_byte(b, 0x48);
+    jit_byte(b, 0xBE);
+    jit_int(b, (int64_t)(size_t)ins, 8);
+    jit_byte(b, 0x48);
+    jit_byte(b, 0xB8);
+    jit_int(b, (int64_t)(size_t)bc_exec, 8);
+    jit_byte(b, 0xFF);
+    jit_byte(b, 0xD0);
+    jit_bytes(b, check, sizeof(check));
+    jit_fixup(b, -1);
+}
+
+static void jit_compile(mpr_expr_prog prog)
+{
+    /* push rbx, r12 and r13, then move the arguments into them */
+    static const uint8_t prologue[] = {0x53, 0x41, 0x54, 0x41, 0x55,
+                                       0x48, 0x89, 0xFB, 0x49, 0x89, 0xF4, 0x49, 0x89, 0xD5};
+    /* return 1, restoring rbx, r12 and r13 */
+    static const uint8_t epilogue[] = {0xB8, 0x01, 0x00, 0x00, 0x00,
+                                       0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3};
+    jit_buf_t b;
+    int i, *offsets, ret_offset, fail_offset;
+    void *mem;
+
+    prog->n_evals = -1;
+    memset(&b, 0, sizeof(jit_buf_t));
+    offsets = malloc(sizeof(int) * (prog->n_code + 1));
+
+    jit_bytes(&b, prologue, sizeof(prologue));
+    for (i = 0; i < prog->n_code; i++) {
+        offsets[i] = b.len;
+        jit_emit_instr(&b, prog->code + i);
+    }
+    offsets[i] = b.len;
+    ret_offset = b.len + 5;
+    jit_bytes(&b, epilogue, sizeof(epilogue));
+    /* on failure return 0 */
+    fail_offset = b.len;
+    jit_byte(&b, 0x31);
+    jit_byte(&b, 0xC0);
+    jit_byte(&b, 0xE9);
+    jit_int(&b, ret_offset - (b.len + 4), 4);
+
+    for (i = 0; i < b.n_fixups; i++) {
+        int pos = b.fixups[i * 2], target = b.fixups[i * 2 + 1];
+        int rel = (target < 0 ? fail_offset : offsets[target]) - (pos + 4);
+        memcpy(b.code + pos, &rel, 4);
+    }
+
+    mem = mmap(NULL, b.len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED != mem) {
+        memcpy(mem, b.code, b.len);
+        if (0 == mprotect(mem, b.len, PROT_READ | PROT_EXEC)) {
+            prog->jit = malloc(sizeof(struct _bc_jit));
+            prog->jit->mem = mem;
+            prog->jit->size = b.len;
+            prog->jit->fn = (jit_fn*)mem;
+        }
+        else
+            munmap(mem, b.len);
+    }
+#if TRACE_PARSE
+    printf("compiled %d bytecode instructions to %d bytes of machine code\n", prog->n_code, b.len);
+#endif
+    free(offsets);
+    FUNC_IF(free, b.fixups);
+    free(b.code);
+}
+#endif /* BC_JIT */
+
+/* Return the samples of a coefficient for the k-th instance, and the vector length of the
+ * variable holding it, or 0 if it is read from the constant pool. */
+MPR_INLINE static void *bc_coef_samps(bc_state st, bc_coef c, int k, int *vlen)
+{
+    mpr_value v;
+    mpr_value_buffer b;
+    int i;
+    if (c->var < 0) {
+        *vlen = 0;
+        return st->expr->prog->consts + c->idx;
+    }
+    v = *st->v_vars + c->var;
+    b = bc_get_buffer(v, st->inst_idx[k], st->expr->vars[c->var].flags & VAR_INSTANCED);
+    i = mpr_value_get_hist_idx(v, b->pos, 0);
+    *vlen = v->vlen;
+    return (char*)b->samps + i * v->vlen * mpr_type_get_size(v->type);
+}
+
+/* Evaluate a program matched by bc_match_linear() for the k-th instance. Products and sums are
+ * rounded separately, as by the instructions they replace. */
+static void bc_eval_linear(bc_state st, bc_linear lin, int k)
+{
+    mpr_value v = st->v_in[0], v_out = st->v_out;
+    mpr_value_buffer b = bc_get_buffer(v, st->inst_idx[k], 1);
+    mpr_value_buffer b_out = &v_out->inst[st->inst_idx[k] % v_out->num_inst];
+    void *x, *m = 0, *add = 0;
+    int i, j, m_vlen = 0, b_vlen = 0;
+
+    i = mpr_value_get_hist_idx(v, b->pos, 0);
+    x = (char*)b->samps + i * v->vlen * mpr_type_get_size(v->type);
+    if (lin->m.len)
+        m = bc_coef_samps(st, &lin->m, k, &m_vlen);
+    if (lin->b.len)
+        add = bc_coef_samps(st, &lin->b, k, &b_vlen);
+
+    i = mpr_value_get_hist_idx(v_out, b_out->pos, 0);
+    if (st->time)
+        memcpy(&b_out->times[i], st->time, sizeof(mpr_time));
+
+    switch (lin->type) {
+#define COEF(C, P, VLEN, J, TYPE, T)                                                    \
+    (VLEN ? ((TYPE*)P)[((J) % C.len + C.vec_idx) % VLEN] : ((mpr_expr_val)P)[(J) % C.len].T)
+#define X(J, TYPE) ((TYPE*)x)[((J) + lin->in_vec_idx) % v->vlen]
+#define TYPED_CASE(MTYPE, TYPE, T)                                                      \
+        case MTYPE: {                                                                   \
+            TYPE *d = (TYPE*)b_out->samps + i * v_out->vlen;                            \
+            switch (lin->in_type) {                                                     \
+                case MPR_INT32:                                                         \
+                    for (j = 0; j < lin->len; j++)                                      \
+                        d[j] = (TYPE)X(j, int);                                         \
+                    break;                                                              \
+                case MPR_FLT:                                                           \
+                    for (j = 0; j < lin->len; j++)                                      \
+                        d[j] = (TYPE)X(j, float);                                       \
+                    break;                                                              \
+                default:                                                                \
+                    for (j = 0; j < lin->len; j++)                                      \
+                        d[j] = (TYPE)X(j, double);                                      \
+                    break;                                                              \
+            }                                                                           \
+            if (m) {                                                                    \
+                for (j = 0; j < lin->len; j++)                                          \
+                    d[j] *= COEF(lin->m, m, m_vlen, j, TYPE, T);                        \
+            }                                                                           \
+            if (add) {                                                                  \
+                for (j = 0; j < lin->len; j++)                                          \
+                    d[j] += COEF(lin->b, add, b_vlen, j, TYPE, T);                      \
+            }                                                                           \
+            break;                                                                      \
+        }
+        TYPED_CASE(MPR_INT32, int, i)
+        TYPED_CASE(MPR_FLT, float, f)
+        TYPED_CASE(MPR_DBL, double, d)
+#undef TYPED_CASE
+#undef X
+#undef COEF
+        default:
+            break;
+    }
+    if (!k)
+        memset(st->out_types, lin->type, lin->len);
+}
+
+/* Evaluate compiled bytecode for one or more instances. Callers must have checked that the
+ * expression offset matches the program and that the output buffers have been initialised. */
+static int bc_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_value *v_vars,
+                   mpr_value v_out, mpr_time *time, mpr_type *out_types, const int *inst_idx,
+                   int n)
+{
+    mpr_expr_prog prog = expr->prog;
+    bc_instr ins = prog->code, end = prog->code + prog->n_code;
+    mpr_value_buffer b_out;
+    bc_state_t st;
+    int k, vlen = expr->vec_len;
+
+    if (n > 1)
+        expr_stack_realloc(expr_stk, expr->stack_size * vlen * (n + 1));
+    st.expr = expr;
+    st.expr_stk = expr_stk;
+    st.regs = expr_stk->stk;
+    st.scratch = st.regs + expr->stack_size * vlen * n;
+    st.v_in = v_in;
+    st.v_vars = v_vars;
+    st.v_out = v_out;
+    st.time = time;
+    st.out_types = out_types;
+    st.inst_idx = inst_idx;
+    st.n = n;
+    st.status = 1 | EXPR_EVAL_DONE;
+
+    memset(out_types, MPR_NULL, v_out->vlen);
+    for (k = 0; k < n; k++) {
+        b_out = &v_out->inst[inst_idx[k] % v_out->num_inst];
+        b_out->pos = (b_out->pos + 1) & (v_out->mlen - 1);
+    }
+    if (prog->reads_x)
+        st.status &= ~EXPR_EVAL_DONE;
+
+    if (prog->linear) {
+        for (k = 0; k < n; k++)
+            bc_eval_linear(&st, prog->linear, k);
+        return st.status | EXPR_UPDATE;
+    }
+
+#ifdef BC_JIT
+    if (1 == n && !prog->jit && prog->n_evals >= 0 && ++prog->n_evals >= JIT_THRESHOLD)
+        jit_compile(prog);
+    if (1 == n && prog->jit) {
+        RETURN_ARG_UNLESS(prog->jit->fn(&st, st.regs, prog->consts), 0);
+        ins = end;
+    }
+#endif
+    while (ins < end) {
+        RETURN_ARG_UNLESS(ins = bc_exec(&st, ins), 0);
+    }
+
+    /* Undo position increment if nothing was updated. */
+    if (!(st.status & EXPR_UPDATE)) {
+        for (k = 0; k < n; k++) {
+            b_out = &v_out->inst[inst_idx[k] % v_out->num_inst];
+            if (--b_out->pos < 0)
+                b_out->pos = v_out->mlen - 1;
+        }
+    }
+    return st.status;
+}
+
+/* Return the program for the current expression offset, recompiling it if the offset has moved
+ * past the tokens it was compiled from. */
+static mpr_expr_prog bc_update(mpr_expr expr)
+{
+    if (expr->offset > expr->prog_offset) {
+        /* the offset only moves backwards when variables are set externally */
+        FUNC_IF(bc_free, expr->prog);
+        expr->prog_offset = expr->offset;
+        expr->prog = bc_compile(expr);
+    }
+    return expr->offset == expr->prog_offset ? expr->prog : 0;
+}
+
+/* Check whether the compiled program can evaluate this call. */
+static int bc_can_eval(mpr_expr expr, mpr_value *v_in, mpr_value *v_vars, mpr_value v_out,
+                       mpr_type *out_types, int inst_idx)
+{
+    int i;
+    mpr_expr_prog prog;
+    RETURN_ARG_UNLESS(expr->use_prog && v_out && out_types, 0);
+    RETURN_ARG_UNLESS(v_out->inst[inst_idx % v_out->num_inst].pos >= 0, 0);
+    RETURN_ARG_UNLESS(prog = bc_update(expr), 0);
+    RETURN_ARG_UNLESS(!prog->out_type || v_out->type == prog->out_type, 0);
+    if (prog->reads_x) {
+        RETURN_ARG_UNLESS(v_in, 0);
+        for (i = 0; i < expr->n_ins; i++) {
+            if (prog->in_types[i] && prog->in_types[i] != v_in[i]->type)
+                return 0;
+        }
+    }
+    if (prog->reads_vars) {
+        RETURN_ARG_UNLESS(v_vars, 0);
+        for (i = 0; i < expr->n_vars; i++) {
+            if ((*v_vars)[i].type != expr->vars[i].datatype)
+                return 0;
+        }
+    }
+    return 1;
+}
+
+void mpr_expr_set_use_bytecode(mpr_expr expr, int use)
+{
+    RETURN_UNLESS(expr);
+    expr->use_prog = use ? 1 : 0;
+}
+
+int mpr_expr_get_uses_bytecode(mpr_expr expr)
+{
+    return expr && expr->use_prog && bc_update(expr);
+}
+
+int mpr_expr_get_uses_jit(mpr_expr expr)
+{
+#ifdef BC_JIT
+    return mpr_expr_get_uses_bytecode(expr) && expr->prog->jit;
+#else
+    return 0;
+#endif
+}
+
 int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_value *v_vars,
                   mpr_value v_out, mpr_time *time, mpr_type *out_types, int inst_idx)
 {
@@ -4023,12 +6899,13 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
     mpr_token_t *tok, *end;
     int status = 1 | EXPR_EVAL_DONE, cache = 0, vlen;
     int i, j, sp, dp = -1;
-    uint8_t alive = 1, muted = 0, can_advance = 1, hist_offset = 0, sig_offset = 0, vec_offset = 0;
+    uint8_t alive = 1, muted = 0, can_advance = 1;
+    int hist_offset = 0, sig_offset = 0, vec_offset = 0, out_pos = -1;
     mpr_value_buffer b_out;
     mpr_value x = NULL;
 
     mpr_expr_val stk = expr_stk->stk;
-    uint8_t *dims = expr_stk->dims;
+    int *dims = expr_stk->dims;
     mpr_type *types = expr_stk->types;
 
     if (!expr) {
@@ -4038,12 +6915,17 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
         return 0;
     }
 
+    if (v_in && bc_can_eval(expr, v_in, v_vars, v_out, out_types, inst_idx))
+        return bc_eval(expr_stk, expr, v_in, v_vars, v_out, time, out_types, &inst_idx, 1);
+
     sp = -expr->vec_len;
     vlen = expr->vec_len;
     tok = expr->start;
     end = expr->start + expr->n_tokens;
     b_out = v_out ? &v_out->inst[inst_idx % v_out->num_inst] : 0;
-    if (v_out && b_out->pos >= 0) {
+    /* Evaluating without inputs initialises variables, so always starts from the first token:
+     * the offset may have been advanced by other maps sharing the expression. */
+    if (v_in && v_out && b_out->pos >= 0) {
         tok += expr->offset;
     }
 
@@ -4067,7 +6949,8 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
         if (out_types)
             memset(out_types, MPR_NULL, v_out->vlen);
         /* Increment index position of output data structure. */
-        b_out->pos = (b_out->pos + 1) % v_out->mlen;
+        out_pos = b_out->pos;
+        b_out->pos = (b_out->pos + 1) & (v_out->mlen - 1);
     }
 
     /* choose one input to represent active instances
@@ -4133,7 +7016,8 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
                 can_advance = 0;
             }
             else if (tok->var.idx >= VAR_X) {
-                RETURN_ARG_UNLESS(v_in, status);
+                if (!v_in)
+                    goto abort;
                 if (!(tok->gen.flags & VAR_SIG_IDX)) {
                     v = v_in[tok->var.idx - VAR_X + sig_offset];
 #if TRACE_EVAL
@@ -4219,9 +7103,7 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
             dims[dp] = tok->gen.vec_len;
             types[dp] = v->type;
 
-            i = (b->pos + v->mlen + hidx) % v->mlen;
-            if (i < 0)
-                i += v->mlen;
+            i = mpr_value_get_hist_idx(v, b->pos, hidx);
             switch (v->type) {
 #define COPY_TYPED(MTYPE, TYPE, T)                                          \
                 case MTYPE: {                                               \
@@ -4241,8 +7123,7 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
                     goto error;
             }
             if (weight) {
-                if (--i < 0)
-                    i += v->mlen;
+                i = (i - 1) & (v->mlen - 1);
                 switch (v->type) {
 #define WEIGHTED_ADD(MTYPE, TYPE, T)                                                    \
                     case MTYPE: {                                                       \
@@ -4288,7 +7169,8 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
                 stk[sp].i = v_out->num_active_inst;
             }
             else if (tok->var.idx >= VAR_X) {
-                RETURN_ARG_UNLESS(v_in, status);
+                if (!v_in)
+                    goto abort;
                 stk[sp].i = v_in[tok->var.idx - VAR_X]->num_active_inst;
             }
             else if (v_vars)
@@ -4354,7 +7236,7 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
                 mpr_value_buffer b;
                 RETURN_ARG_UNLESS(v_out, status);
                 b = b_out;
-                idx = (b->pos + v_out->mlen + hidx) % v_out->mlen;
+                idx = mpr_value_get_hist_idx(v_out, b->pos, hidx);
                 t_d = mpr_time_as_dbl(b->times[idx]);
                 if (weight)
                     t_d = t_d * weight + ((b->pos + v_out->mlen + hidx - 1) % v_out->mlen) * (1 - weight);
@@ -4362,11 +7244,12 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
             else if (tok->var.idx >= VAR_X) {
                 mpr_value v;
                 mpr_value_buffer b;
-                RETURN_ARG_UNLESS(v_in, status);
+                if (!v_in)
+                    goto abort;
                 v = v_in[tok->var.idx - VAR_X];
                 b = &v->inst[inst_idx % v->num_inst];
                 /* TODO: ensure buffer overrun is not possible here amd similar */
-                t_d = mpr_time_as_dbl(b->times[(b->pos + v->mlen + hidx) % v->mlen]);
+                t_d = mpr_time_as_dbl(b->times[mpr_value_get_hist_idx(v, b->pos, hidx)]);
                 if (weight)
                     t_d = t_d * weight + ((b->pos + v->mlen + hidx - 1) % v->mlen) * (1 - weight);
             }
@@ -4388,6 +7271,7 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
         case TOK_OP: {
             int maxlen, diff;
             unsigned int rdim;
+            simd_op_fn *simd_fn;
             dp -= (op_tbl[tok->op.idx].arity - 1);
             assert(dp >= 0);
             sp = dp * vlen;
@@ -4429,7 +7313,12 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
                 diff -= mindiff;
             }
             rdim = dims[dp + 1];
-            switch (types[dp]) {
+            simd_fn = (2 == op_tbl[tok->op.idx].arity && (rdim == dims[dp] || 1 == rdim)
+                       ? simd_op(tok->op.idx, types[dp], dims[dp]) : 0);
+            if (simd_fn)
+                simd_fn(stk + sp, stk + sp, stk + sp + vlen, dims[dp],
+                        1 == rdim ? SIMD_BCAST_B : 0);
+            else switch (types[dp]) {
                 case MPR_INT32: {
                     switch (tok->op.idx) {
                         OP_CASES_META(i);
@@ -4587,7 +7476,16 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
             dp -= (vfn_tbl[tok->fn.idx].arity - 1);
             assert(dp >= 0);
             sp = dp * vlen;
-            if (vfn_tbl[tok->fn.idx].arity > 1 || VFN_DOT == tok->fn.idx) {
+            if (vfn_tbl[tok->fn.idx].memory) {
+                /* filter kernels repeat their coefficients, only the input needs expanding */
+                while (dims[dp] < tok->gen.vec_len) {
+                    int diff = tok->gen.vec_len - dims[dp];
+                    diff = diff < dims[dp] ? diff : dims[dp];
+                    memcpy(&stk[sp + dims[dp]], &stk[sp], diff * sizeof(mpr_expr_val_t));
+                    dims[dp] += diff;
+                }
+            }
+            else if (vfn_tbl[tok->fn.idx].arity > 1 || VFN_DOT == tok->fn.idx) {
                 int maxdim = tok->gen.vec_len;
                 for (i = 0; i < vfn_tbl[tok->fn.idx].arity; i++)
                     maxdim = maxdim > dims[dp + i] ? maxdim : dims[dp + i];
@@ -4613,17 +7511,40 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
             }
             printf("\b\b)");
 #endif
-            switch (types[dp]) {
-#define TYPED_CASE(MTYPE, FN)                                                       \
-                case MTYPE:                                                         \
-                    (((vfn_template*)vfn_tbl[tok->fn.idx].FN)(stk, dims, dp, vlen));\
-                    break;
-                TYPED_CASE(MPR_INT32, fn_int)
-                TYPED_CASE(MPR_FLT, fn_flt)
-                TYPED_CASE(MPR_DBL, fn_dbl)
+            if (vfn_tbl[tok->fn.idx].memory) {
+                /* filter state is kept in a hidden user variable */
+                mpr_value v;
+                mpr_value_buffer b;
+                vfn_mem_template *fn;
+                int var = tok->fn.var, last = dp + vfn_tbl[tok->fn.idx].arity - 1;
+                if (!v_vars)
+                    goto error;
+                v = *v_vars + var;
+                b = &v->inst[expr->vars[var].flags & VAR_INSTANCED ? inst_idx % v->num_inst : 0];
+                if (v->type != types[dp]
+                    || v->vlen < vfn_mem_len(tok->fn.idx, dims[dp], dims[last]))
+                    goto error;
+                switch (types[dp]) {
+                    case MPR_FLT:   fn = vfn_tbl[tok->fn.idx].mem_flt;  break;
+                    case MPR_DBL:   fn = vfn_tbl[tok->fn.idx].mem_dbl;  break;
+                    default:        goto error;
+                }
+                fn(stk, dims, dp, vlen, b->samps);
+                can_advance = 0;
+            }
+            else {
+                switch (types[dp]) {
+#define TYPED_CASE(MTYPE, FN)                                                           \
+                    case MTYPE:                                                         \
+                        (((vfn_template*)vfn_tbl[tok->fn.idx].FN)(stk, dims, dp, vlen));\
+                        break;
+                    TYPED_CASE(MPR_INT32, fn_int)
+                    TYPED_CASE(MPR_FLT, fn_flt)
+                    TYPED_CASE(MPR_DBL, fn_dbl)
 #undef TYPED_CASE
-                default:
-                    break;
+                    default:
+                        break;
+                }
             }
 
             if (vfn_tbl[tok->fn.idx].reduce) {
@@ -4754,7 +7675,7 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
                                stk + sp - (tok->con.cache_offset - 1) * vlen,
                                sizeof(mpr_expr_val_t) * vlen * tok->con.cache_offset);
                         memcpy(dims + dp - tok->con.cache_offset, dims + dp - tok->con.cache_offset + 1,
-                               sizeof(uint8_t) * tok->con.cache_offset);
+                               sizeof(int) * tok->con.cache_offset);
                         memcpy(types + dp - tok->con.cache_offset, types + dp - tok->con.cache_offset + 1,
                                sizeof(mpr_type) * tok->con.cache_offset);
                         sp -= vlen;
@@ -4783,7 +7704,8 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
                     }
                     break;
                 case RT_VECTOR:
-                    RETURN_ARG_UNLESS(v_in, status);
+                    if (!v_in)
+                        goto abort;
                     ++vec_offset;
                     if (USE_VAR_LEN & tok->con.flags) {
                         if (vec_offset < v_in[sig_offset]->vlen) {
@@ -4819,6 +7741,38 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
                     goto error;
             }
             break;
+        case TOK_BRANCH:
+            if (tok->con.flags & BRANCH_IF_FALSE) {
+                int taken;
+                switch (types[dp]) {
+                    case MPR_INT32: taken = !stk[sp].i;     break;
+                    case MPR_FLT:   taken = !stk[sp].f;     break;
+                    case MPR_DBL:   taken = !stk[sp].d;     break;
+                    default:        goto error;
+                }
+                --dp;
+                sp = dp * vlen;
+                if (!taken)
+                    break;
+            }
+#if TRACE_EVAL
+            printf("branching +%d\n", tok->con.branch_offset);
+#endif
+            if (tok->con.flags & BRANCH_VOLATILE)
+                can_advance = 0;
+            tok += tok->con.branch_offset;
+            goto repeat;
+        case TOK_JOIN: {
+            /* repeat the value of the branch taken to the length of the result */
+            int diff = tok->gen.vec_len - dims[dp];
+            while (diff > 0) {
+                int mindiff = dims[dp] > diff ? diff : dims[dp];
+                memcpy(&stk[sp + dims[dp]], &stk[sp], mindiff * sizeof(mpr_expr_val_t));
+                dims[dp] += mindiff;
+                diff -= mindiff;
+            }
+            break;
+        }
         case TOK_COPY_FROM: {
             int dp_from = dp - tok->con.cache_offset;
             int sp_from = dp_from * vlen;
@@ -4904,7 +7858,7 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
                 v = v_out;
                 b = b_out;
             }
-            else if (tok->var.idx >= 0 && tok->var.idx < N_USER_VARS) {
+            else if (tok->var.idx >= 0 && tok->var.idx < VAR_Y) {
                 uint8_t flags = expr->vars[tok->var.idx].flags;
                 if (flags & VAR_SET_EXTERN) {
 #if TRACE_EVAL
@@ -4952,9 +7906,7 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
             printf("[%s%d]", tok->gen.flags & VAR_VEC_IDX ? "N=" : "", vidx);
             printf(" (%s x %u)\n", type_name(types[dp]), tok->gen.vec_len);
 #endif
-            i = (b->pos + v->mlen + hidx) % v->mlen;
-            if (i < 0)
-                i += v->mlen;
+            i = mpr_value_get_hist_idx(v, b->pos, hidx);
 
             /* Copy time from input */
             if (time) {
@@ -5035,9 +7987,7 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
             if (!v_out)
                 return status;
             hist = tok->gen.flags & VAR_HIST_IDX;
-            idx = (b_out->pos + v_out->mlen + (hist ? stk[sp - vlen].i : 0)) % v_out->mlen;
-            if (idx < 0)
-                idx = v_out->mlen + idx;
+            idx = mpr_value_get_hist_idx(v_out, b_out->pos, hist ? stk[sp - vlen].i : 0);
             mpr_time_set_dbl(&b_out->times[idx], stk[sp].d);
             /* If assignment was constant or history initialization, move expr
              * start token pointer so we don't evaluate this section again. */
@@ -5107,7 +8057,7 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
          * so we need to copy to output here. */
 
         /* Increment index position of output data structure. */
-        b_out->pos = (b_out->pos + 1) % v_out->mlen;
+        b_out->pos = (b_out->pos + 1) & (v_out->mlen - 1);
         v = mpr_value_get_samp(v_out, inst_idx);
         switch (v_out->type) {
 #define TYPED_CASE(MTYPE, TYPE, T)                              \
@@ -5135,9 +8085,64 @@ int mpr_expr_eval(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in, mpr_v
 
     return status;
 
+  abort:
+    /* Evaluating without inputs stops at the first input reference. Restore the output position
+     * so that the newest sample of an existing history remains current. */
+    if (out_pos >= 0 && !(status & (EXPR_UPDATE | EXPR_MUTED_UPDATE)))
+        b_out->pos = out_pos;
+    return status;
+
   error:
 #if TRACE_EVAL
     trace("Unexpected token in expression.");
 #endif
     return 0;
 }
+
+/* Lanes of a batch must not share any buffer that the program writes. */
+static int bc_can_eval_batch(mpr_expr expr, mpr_value *v_in, mpr_value *v_vars,
+                             mpr_value v_out, mpr_type *out_types, const int *inst_idx,
+                             int n_inst)
+{
+    int i, j;
+    RETURN_ARG_UNLESS(bc_can_eval(expr, v_in, v_vars, v_out, out_types, inst_idx[0]), 0);
+    RETURN_ARG_UNLESS(!expr->prog->assigns_shared && !expr->prog->branches, 0);
+    for (i = 0; i < n_inst; i++) {
+        RETURN_ARG_UNLESS(inst_idx[i] >= 0 && inst_idx[i] < v_out->num_inst, 0);
+        RETURN_ARG_UNLESS(v_out->inst[inst_idx[i]].pos >= 0, 0);
+        if (!expr->prog->reads_vars)
+            continue;
+        for (j = 0; j < expr->n_vars; j++) {
+            if (inst_idx[i] >= (*v_vars)[j].num_inst)
+                return 0;
+        }
+    }
+    return 1;
+}
+
+int mpr_expr_eval_batch(mpr_expr_stack expr_stk, mpr_expr expr, mpr_value *v_in,
+                        mpr_value *v_vars, mpr_value v_out, mpr_time *time,
+                        mpr_type *out_types, const int *inst_idx, int n_inst, int *status)
+{
+    int i, ret = 0, vlen;
+    RETURN_ARG_UNLESS(expr && v_out && inst_idx && status && n_inst > 0, 0);
+    vlen = v_out->vlen;
+
+    if (n_inst > 1 && bc_can_eval_batch(expr, v_in, v_vars, v_out, out_types, inst_idx, n_inst)) {
+        ret = bc_eval(expr_stk, expr, v_in, v_vars, v_out, time, out_types, inst_idx, n_inst);
+        for (i = 0; i < n_inst; i++) {
+            status[i] = ret;
+            if (i)
+                memcpy(out_types + i * vlen, out_types, vlen);
+        }
+        return ret;
+    }
+
+    /* fall back to evaluating each instance in turn */
+    for (i = 0; i < n_inst; i++) {
+        status[i] = mpr_expr_eval(expr_stk, expr, v_in, v_vars, v_out, time,
+                                  out_types + i * vlen, inst_idx[i]);
+        ret |= status[i];
+    }
+    return ret;
+}
@@ -1,9 +1,28 @@
+#include "config.h"
+
+#if defined(HAVE_SENDMMSG) && !defined(_GNU_SOURCE)
+ /* required for sendmmsg() */
+ #define _GNU_SOURCE
+#endif
+
 #include <string.h>
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stddef.h>
 #include <limits.h>
+#include <errno.h>
+
+#ifdef HAVE_ARPA_INET_H
+ #include <arpa/inet.h>
+ #include <sys/socket.h>
+ #include <netdb.h>
+#else
+ #ifdef HAVE_WINSOCK2_H
+  #include <winsock2.h>
+  #include <ws2tcpip.h>
+ #endif
+#endif
 
 #include "mapper_internal.h"
 #include "types_internal.h"
@@ -58,6 +77,69 @@ void mpr_link_init(mpr_link link)
     mpr_net_send(net);
 }
 
+#define MAX_OSC_BUNDLE_LEN 8192
+
+/* Bundle buffers form a per-link arena: they are reset after each poll and only grow, so the
+ * device's bundle statistics track any traffic to the system allocator. */
+static void *_arena_realloc(mpr_link link, void *ptr, size_t old_size, size_t new_size)
+{
+    mpr_bundle_stats stats = &((mpr_local_dev)link->devs[LOCAL_DEV])->bundle_stats;
+    ++stats->num_allocs;
+    stats->num_bytes += new_size - old_size;
+    return realloc(ptr, new_size);
+}
+
+static void _arena_free(mpr_link link, void *ptr, size_t size)
+{
+    RETURN_UNLESS(ptr);
+    ((mpr_local_dev)link->devs[LOCAL_DEV])->bundle_stats.num_bytes -= size;
+    free(ptr);
+}
+
+static void _free_bundles(mpr_link link)
+{
+    int i;
+    for (i = 0; i < NUM_BUNDLES; i++) {
+        mpr_bundle b = &link->bundles[i];
+        FUNC_IF(lo_bundle_free_recursive, b->udp);
+        FUNC_IF(lo_bundle_free_recursive, b->tcp);
+        _arena_free(link, b->osc.buf, b->osc.size);
+        _arena_free(link, b->local.msgs, b->local.msgs_size * sizeof(mpr_local_msg_t));
+        _arena_free(link, b->local.buf, b->local.buf_size);
+    }
+    memset(link->bundles, 0, sizeof(mpr_bundle_t) * NUM_BUNDLES);
+}
+
+/* Resolve the remote UDP endpoint so serialised bundles can be sent on the device's socket. */
+static void _resolve_udp_addr(mpr_link link, const char *host, const char *port)
+{
+    struct addrinfo hints, *res = 0;
+    struct sockaddr_storage ss;
+    socklen_t ss_len = sizeof(ss);
+    int fd;
+    RETURN_UNLESS(link->devs[LOCAL_DEV]->is_local);
+    fd = lo_server_get_socket_fd(((mpr_local_dev)link->devs[LOCAL_DEV])->servers[SERVER_UDP]);
+    RETURN_UNLESS(fd >= 0 && 0 == getsockname(fd, (struct sockaddr*)&ss, &ss_len));
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = ss.ss_family;
+    hints.ai_socktype = SOCK_DGRAM;
+#ifdef AI_V4MAPPED
+    if (AF_INET6 == ss.ss_family)
+        hints.ai_flags = AI_V4MAPPED;
+#endif
+    if (getaddrinfo(host, port, &hints, &res) || !res) {
+        trace_dev(link->devs[LOCAL_DEV], "couldn't resolve address of device '%s'\n",
+                  link->devs[REMOTE_DEV]->name);
+        return;
+    }
+    FUNC_IF(free, link->addr.udp_sa);
+    link->addr.udp_sa = malloc(res->ai_addrlen);
+    memcpy(link->addr.udp_sa, res->ai_addr, res->ai_addrlen);
+    link->addr.udp_sa_len = res->ai_addrlen;
+    freeaddrinfo(res);
+}
+
 void mpr_link_connect(mpr_link link, const char *host, int admin_port, int data_port)
 {
     if (!link->is_local_only) {
@@ -69,6 +151,7 @@ void mpr_link_connect(mpr_link link, const char *host, int admin_port, int data_
         sprintf(str, "%d", data_port);
         link->addr.udp = lo_address_new(host, str);
         link->addr.tcp = lo_address_new_with_proto(LO_TCP, host, str);
+        _resolve_udp_addr(link, host, str);
         sprintf(str, "%d", admin_port);
         link->addr.admin = lo_address_new(host, str);
         trace_dev(link->devs[LOCAL_DEV], "activated link to device '%s' at %s:%d\n",
@@ -78,13 +161,12 @@ void mpr_link_connect(mpr_link link, const char *host, int admin_port, int data_
         trace_dev(link->devs[LOCAL_DEV], "activating link to local device '%s'\n",
                   link->devs[REMOTE_DEV]->name);
     }
-    memset(link->bundles, 0, sizeof(mpr_bundle_t) * NUM_BUNDLES);
+    _free_bundles(link);
     mpr_dev_add_link(link->devs[LOCAL_DEV], link->devs[REMOTE_DEV]);
 }
 
 void mpr_link_free(mpr_link link)
 {
-    int i;
     FUNC_IF(mpr_tbl_free, link->obj.props.synced);
     FUNC_IF(mpr_tbl_free, link->obj.props.staged);
     if (!link->devs[LOCAL_DEV]->is_local)
@@ -92,10 +174,8 @@ void mpr_link_free(mpr_link link)
     FUNC_IF(lo_address_free, link->addr.admin);
     FUNC_IF(lo_address_free, link->addr.udp);
     FUNC_IF(lo_address_free, link->addr.tcp);
-    for (i = 0; i < NUM_BUNDLES; i++) {
-        FUNC_IF(lo_bundle_free_recursive, link->bundles[i].udp);
-        FUNC_IF(lo_bundle_free_recursive, link->bundles[i].tcp);
-    }
+    FUNC_IF(free, link->addr.udp_sa);
+    _free_bundles(link);
     mpr_dev_remove_link(link->devs[LOCAL_DEV], link->devs[REMOTE_DEV]);
 }
 
@@ -111,17 +191,285 @@ void mpr_link_add_msg(mpr_link link, mpr_sig dst, lo_message msg, mpr_time t,
 
     /* add message to existing bundles */
     b = (proto == MPR_PROTO_UDP) ? &link->bundles[idx].udp : &link->bundles[idx].tcp;
-    if (!(*b))
+    if (!(*b)) {
         *b = lo_bundle_new(t);
+        ++((mpr_local_dev)link->devs[LOCAL_DEV])->bundle_stats.num_lo_bundles;
+    }
     lo_bundle_add_message(*b, dst->path, msg);
 }
 
+static int _send_osc_bundle(mpr_link link, mpr_osc_bundle b)
+{
+    int num = b->num_msgs;
+    mpr_local_dev ldev = (mpr_local_dev)link->devs[LOCAL_DEV];
+    /* a bundle flushed early stays marked as batched until mpr_link_send_batch() runs, so
+     * that its link is only added to the batch once */
+    RETURN_ARG_UNLESS(b->len, 0);
+    if (sendto(lo_server_get_socket_fd(ldev->servers[SERVER_UDP]), b->buf, b->len, 0,
+               (struct sockaddr*)link->addr.udp_sa, link->addr.udp_sa_len) < 0) {
+        trace_dev(ldev, "error sending bundle to device '%s'\n", link->devs[REMOTE_DEV]->name);
+    }
+    b->len = 0;
+    b->num_msgs = 0;
+    return num;
+}
+
+char *mpr_link_reserve_osc_msg(mpr_link link, size_t len, mpr_time t, int idx)
+{
+    mpr_osc_bundle b = &link->bundles[idx].osc;
+    char *msg;
+    RETURN_ARG_UNLESS(link->addr.udp_sa, 0);
+
+    /* keep bundles within a single datagram where possible */
+    if (b->len && b->len + 4 + len > MAX_OSC_BUNDLE_LEN)
+        _send_osc_bundle(link, b);
+
+    if (b->size < (b->len ? b->len : 16) + 4 + len) {
+        size_t size = b->size;
+        while (size < (b->len ? b->len : 16) + 4 + len)
+            size = size ? size * 2 : 256;
+        b->buf = _arena_realloc(link, b->buf, b->size, size);
+        b->size = size;
+    }
+    if (!b->len) {
+        /* bundle header and timetag */
+        memcpy(b->buf, "#bundle", 8);
+        mpr_osc_write_int32(b->buf + 8, t.sec);
+        mpr_osc_write_int32(b->buf + 12, t.frac);
+        b->len = 16;
+    }
+    mpr_osc_write_int32(b->buf + b->len, (uint32_t)len);
+    msg = b->buf + b->len + 4;
+    b->len += 4 + len;
+    ++b->num_msgs;
+    return msg;
+}
+
+static void _batch_add(mpr_link_batch batch, mpr_link link, int idx)
+{
+    RETURN_UNLESS(!link->bundles[idx].osc.batched);
+    link->bundles[idx].osc.batched = 1;
+    if (batch->num >= batch->size) {
+        batch->size = batch->size ? batch->size * 2 : 16;
+        batch->links = realloc(batch->links, sizeof(mpr_link) * batch->size);
+#ifdef HAVE_SENDMMSG
+        batch->hdrs = realloc(batch->hdrs, sizeof(struct mmsghdr) * batch->size);
+        batch->iov = realloc(batch->iov, sizeof(struct iovec) * batch->size);
+#endif
+    }
+    batch->links[batch->num++] = link;
+}
+
+#ifdef HAVE_SENDMMSG
+/* Send the bundles of links batch->links[start..end), which share a device socket. Returns 0 if
+ * batched sending is not supported by the system. */
+static int _send_batch_run(mpr_link_batch batch, int start, int end, int idx)
+{
+    struct mmsghdr *hdrs = (struct mmsghdr*)batch->hdrs;
+    struct iovec *iov = (struct iovec*)batch->iov;
+    mpr_local_dev ldev = (mpr_local_dev)batch->links[start]->devs[LOCAL_DEV];
+    int i, ret, sent = 0, num = end - start;
+    int fd = lo_server_get_socket_fd(ldev->servers[SERVER_UDP]);
+
+    memset(hdrs, 0, sizeof(struct mmsghdr) * num);
+    for (i = 0; i < num; i++) {
+        mpr_link link = batch->links[start + i];
+        iov[i].iov_base = link->bundles[idx].osc.buf;
+        iov[i].iov_len = link->bundles[idx].osc.len;
+        hdrs[i].msg_hdr.msg_iov = &iov[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+        hdrs[i].msg_hdr.msg_name = link->addr.udp_sa;
+        hdrs[i].msg_hdr.msg_namelen = link->addr.udp_sa_len;
+    }
+    while (sent < num) {
+        ret = sendmmsg(fd, hdrs + sent, num - sent, 0);
+        if (ret > 0)
+            sent += ret;
+        else if (ret < 0 && ENOSYS == errno && !sent)
+            return 0;
+        else {
+            /* drop the bundle that failed, as sendto() would */
+            trace_dev(ldev, "error sending bundle to device '%s'\n",
+                      batch->links[start + sent]->devs[REMOTE_DEV]->name);
+            ++sent;
+        }
+    }
+    return 1;
+}
+#endif
+
+void mpr_link_send_batch(mpr_link_batch batch, int idx)
+{
+    int i, j;
+
+    /* skip bundles that were already sent because they outgrew a single datagram */
+    for (i = 0, j = 0; i < batch->num; i++) {
+        mpr_osc_bundle b = &batch->links[i]->bundles[idx].osc;
+        if (b->len)
+            batch->links[j++] = batch->links[i];
+        else
+            b->batched = 0;
+    }
+    batch->num = j;
+
+    i = 0;
+    while (i < batch->num) {
+        mpr_dev ldev = batch->links[i]->devs[LOCAL_DEV];
+        for (j = i + 1; j < batch->num && batch->links[j]->devs[LOCAL_DEV] == ldev; j++) ;
+#ifdef HAVE_SENDMMSG
+        if (batch->enabled && j - i > 1 && _send_batch_run(batch, i, j, idx)) {
+            for (; i < j; i++) {
+                mpr_osc_bundle b = &batch->links[i]->bundles[idx].osc;
+                b->len = 0;
+                b->num_msgs = 0;
+                b->batched = 0;
+            }
+            continue;
+        }
+        else if (j - i > 1) {
+            /* fall back to sending individually from now on */
+            batch->enabled = 0;
+        }
+#endif
+        for (; i < j; i++) {
+            _send_osc_bundle(batch->links[i], &batch->links[i]->bundles[idx].osc);
+            batch->links[i]->bundles[idx].osc.batched = 0;
+        }
+    }
+    batch->num = 0;
+}
+
+void mpr_link_batch_free(mpr_link_batch batch)
+{
+    FUNC_IF(free, batch->links);
+    FUNC_IF(free, batch->hdrs);
+    FUNC_IF(free, batch->iov);
+    batch->links = 0;
+    batch->hdrs = batch->iov = 0;
+    batch->num = batch->size = 0;
+}
+
+/* Reserve aligned space for len bytes in the local bundle buffer, returning its offset. */
+static size_t _local_bundle_reserve(mpr_link link, mpr_local_bundle b, size_t len)
+{
+    size_t offset = (b->buf_len + sizeof(double) - 1) & ~(sizeof(double) - 1);
+    if (offset + len > b->buf_size) {
+        size_t size = b->buf_size;
+        while (offset + len > size)
+            size = size ? size * 2 : 256;
+        b->buf = _arena_realloc(link, b->buf, b->buf_size, size);
+        b->buf_size = size;
+    }
+    b->buf_len = offset + len;
+    return offset;
+}
+
+void mpr_link_add_local_msg(mpr_link link, mpr_sig dst, int len, const mpr_type *types,
+                            const void *val, mpr_id GID, int slot, mpr_time t, int idx)
+{
+    mpr_local_bundle b = &link->bundles[idx].local;
+    mpr_local_msg msg;
+    mpr_type *msg_types;
+    int i, size = 0;
+
+    if (!b->num_msgs)
+        mpr_time_set(&b->time, t);
+    if (b->num_msgs >= b->msgs_size) {
+        int size = b->msgs_size ? b->msgs_size * 2 : 8;
+        b->msgs = _arena_realloc(link, b->msgs, sizeof(mpr_local_msg_t) * b->msgs_size,
+                                 sizeof(mpr_local_msg_t) * size);
+        b->msgs_size = size;
+    }
+    msg = &b->msgs[b->num_msgs++];
+    msg->sig = (mpr_local_sig)dst;
+    msg->GID = GID;
+    msg->slot = slot;
+    msg->len = len;
+
+    /* values are sized by their own type, which differs from the destination signal type if the
+     * map is processed at the destination */
+    for (i = 0; types && i < len; i++) {
+        if (MPR_NULL != types[i]) {
+            size = mpr_type_get_size(types[i]);
+            break;
+        }
+    }
+    msg->size = size;
+
+    /* copy the types and values, since the caller may reuse its buffers before delivery */
+    msg->types = _local_bundle_reserve(link, b, len * sizeof(mpr_type));
+    msg_types = (mpr_type*)(b->buf + msg->types);
+    if (val && size) {
+        memcpy(msg_types, types, len * sizeof(mpr_type));
+        msg->val = _local_bundle_reserve(link, b, size * len);
+        memcpy(b->buf + msg->val, val, size * len);
+    }
+    else {
+        /* vector consisting completely of nulls indicates a release */
+        for (i = 0; i < len; i++)
+            msg_types[i] = MPR_NULL;
+        msg->val = msg->types;
+    }
+}
+
+/* Deliver updates queued on a local-only link directly to the destination signals. */
+static int _process_local_bundle(mpr_link link, mpr_local_bundle b)
+{
+    int i, j, num;
+    mpr_local_bundle_t q;
+    lo_arg *argv[MPR_MAX_VECTOR_LEN];
+    RETURN_ARG_UNLESS(b->num_msgs, 0);
+
+    /* detach queued updates, since handlers may queue further updates on this link */
+    memcpy(&q, b, sizeof(mpr_local_bundle_t));
+    memset(b, 0, sizeof(mpr_local_bundle_t));
+    num = q.num_msgs;
+
+    /* set out-of-band timestamp */
+    mpr_dev_bundle_start(q.time, NULL);
+
+    for (i = 0; i < num; i++) {
+        mpr_local_msg msg = &q.msgs[i];
+        if (!msg->sig)
+            continue;
+        for (j = 0; j < msg->len; j++)
+            argv[j] = (lo_arg*)(q.buf + msg->val + j * msg->size);
+        mpr_dev_handle_update(msg->sig, (mpr_type*)(q.buf + msg->types), argv, msg->len,
+                              msg->GID, msg->slot);
+    }
+
+    /* keep the detached storage for reuse unless new storage was allocated meanwhile */
+    if (!b->msgs && !b->buf) {
+        q.num_msgs = 0;
+        q.buf_len = 0;
+        memcpy(b, &q, sizeof(mpr_local_bundle_t));
+    }
+    else {
+        _arena_free(link, q.msgs, q.msgs_size * sizeof(mpr_local_msg_t));
+        _arena_free(link, q.buf, q.buf_size);
+    }
+    return num;
+}
+
+void mpr_link_remove_local_msgs(mpr_link link, mpr_sig sig)
+{
+    int i, j;
+    RETURN_UNLESS(link->is_local_only);
+    for (i = 0; i < NUM_BUNDLES; i++) {
+        mpr_local_bundle b = &link->bundles[i].local;
+        for (j = 0; j < b->num_msgs; j++) {
+            if (b->msgs[j].sig == (mpr_local_sig)sig)
+                b->msgs[j].sig = 0;
+        }
+    }
+}
+
 /* TODO: pass in bundle index as argument */
 /* TODO: interrupt driven signal updates may not be followed by mpr_dev_process_outputs(); in the
  * case where the interrupt has interrupted mpr_dev_poll() these messages will not be dispatched. */
-int mpr_link_process_bundles(mpr_link link, mpr_time t, int idx)
+int mpr_link_process_bundles(mpr_link link, mpr_time t, int idx, mpr_link_batch batch)
 {
-    int i = 0, num = 0, tmp;
+    int num = 0, tmp;
     mpr_bundle b;
     lo_bundle lb;
     RETURN_ARG_UNLESS(link, 0);
@@ -130,9 +478,17 @@ int mpr_link_process_bundles(mpr_link link, mpr_time t, int idx)
 
     if (!link->is_local_only) {
         mpr_local_dev ldev = (mpr_local_dev)link->devs[LOCAL_DEV];
+        if (batch && b->osc.len) {
+            /* defer sending until the end of the poll cycle */
+            num = b->osc.num_msgs;
+            _batch_add(batch, link, idx);
+        }
+        else
+            num = _send_osc_bundle(link, &b->osc);
         if ((lb = b->udp)) {
             b->udp = 0;
-            if ((num = lo_bundle_count(lb))) {
+            if ((tmp = lo_bundle_count(lb))) {
+                num += tmp;
                 lo_send_bundle_from(link->addr.udp, ldev->servers[SERVER_UDP], lb);
             }
             lo_bundle_free_recursive(lb);
@@ -146,29 +502,8 @@ int mpr_link_process_bundles(mpr_link link, mpr_time t, int idx)
             lo_bundle_free_recursive(lb);
         }
     }
-    else if ((lb = b->udp)) {
-        const char *path;
-        b->udp = 0;
-        /* set out-of-band timestamp */
-        mpr_dev_bundle_start(lo_bundle_get_timestamp(lb), NULL);
-        /* call handler directly instead of sending over the network */
-        num = lo_bundle_count(lb);
-        while (i < num) {
-            lo_message m = lo_bundle_get_message(lb, i, &path);
-            /* need to look up signal by path */
-            mpr_rtr_sig rs = link->obj.graph->net.rtr->sigs;
-            while (rs) {
-                if (0 == strcmp(path, rs->sig->path)) {
-                    mpr_dev_handler(NULL, lo_message_get_types(m), lo_message_get_argv(m),
-                                    lo_message_get_argc(m), m, (void*)rs->sig);
-                    break;
-                }
-                rs = rs->next;
-            }
-            ++i;
-        }
-        lo_bundle_free_recursive(lb);
-    }
+    else
+        num = _process_local_bundle(link, &b->local);
     return num;
 }
 
@@ -444,13 +444,63 @@ static int _update_scope(mpr_map m, mpr_msg_atom a)
  * 4) when it comes to "to release" idmap, send release and decref LID
  */
 
+/* Pass an update from a local-only map through its intermediate destination signal directly
+ * to the fused downstream map, evaluating it in this pass rather than queuing a local message
+ * that would only be processed on the next poll. Returns 0 if the update must instead be
+ * delivered normally. */
+static int _send_fused(mpr_local_map m, mpr_local_map next, const void *val, mpr_type *types,
+                       mpr_time time)
+{
+    mpr_local_sig sig = (mpr_local_sig)m->dst->sig;
+    mpr_local_slot slot = next->src[0];
+    mpr_sig_inst si;
+    int i, idmap_idx;
+
+    /* partial vector updates are merged with the previous value by the normal path */
+    for (i = 0; i < sig->len; i++)
+        RETURN_ARG_UNLESS(MPR_NULL != types[i], 0);
+
+    /* use the first available instance, as mpr_dev_handle_update() does */
+    for (i = 0; i < sig->num_inst; i++) {
+        if (sig->inst[i]->active)
+            break;
+    }
+    if (i >= sig->num_inst)
+        i = 0;
+    idmap_idx = mpr_sig_get_idmap_with_LID(sig, sig->inst[i]->id, RELEASED_REMOTELY, time, 1);
+    RETURN_ARG_UNLESS(idmap_idx >= 0, 0);
+    si = sig->idmaps[idmap_idx].inst;
+
+    /* if the intermediate signal was also updated directly this cycle, leave the update to the
+     * normal path so that it is queued as before */
+    RETURN_ARG_UNLESS(!get_bitflag(sig->updated_inst, si->idx), 0);
+
+    /* update the intermediate signal; it has no handler to call */
+    mpr_sig_update_timing_stats(sig, mpr_time_get_diff(time, si->time));
+    memcpy(si->val, val, mpr_type_get_size(sig->type) * sig->len);
+    for (i = 0; i < sig->len; i++)
+        set_bitflag(si->has_val_flags, i);
+    si->has_val = 1;
+    memcpy(&si->time, &time, sizeof(mpr_time));
+
+    /* copy input value and process the downstream map immediately */
+    mpr_value_set_samp(&slot->val, si->idx, si->val, time);
+    set_bitflag(next->updated_inst, si->idx);
+    next->updated = 1;
+    sig->dev->sending = 1;
+    sig->locked = 1;
+    mpr_map_send(next, time);
+    sig->locked = 0;
+    return 1;
+}
+
 /* only called for outgoing maps */
 void mpr_map_send(mpr_local_map m, mpr_time time)
 {
-    int i, j, status, map_manages_inst = 0;
-    lo_message msg;
+    int i, j, k, n_inst, status, *inst_idx, *inst_status, map_manages_inst = 0;
     mpr_local_dev dev;
     uint8_t bundle_idx;
+    mpr_local_map fused;
     mpr_local_slot src_slot, dst_slot;
     mpr_local_sig src_sig;
     struct _mpr_sig_idmap *idmaps;
@@ -483,37 +533,49 @@ void mpr_map_send(mpr_local_map m, mpr_time time)
         idmap = m->idmap;
     }
 
-    types = alloca(dst_slot->sig->len * sizeof(char));
+    /* Collect the updated instances */
+    inst_idx = alloca(m->num_inst * sizeof(int));
+    inst_status = alloca(m->num_inst * sizeof(int));
+    for (i = 0, n_inst = 0; i < m->num_inst; i++) {
+        if (get_bitflag(m->updated_inst, i))
+            inst_idx[n_inst++] = i;
+    }
+    types = alloca(dst_slot->sig->len * (n_inst ? n_inst : 1) * sizeof(char));
 
-    for (i = 0; i < m->num_inst; i++) {
-        /* Check if this instance has been updated */
-        if (!get_bitflag(m->updated_inst, i))
-            continue;
+    /* Local map chains through unhandled signals are evaluated in a single pass */
+    fused = mpr_rtr_get_fused_map(m->rtr, m);
+
+    /* Instanced maps evaluate every updated instance together */
+    if (m->use_inst && n_inst > 1)
+        mpr_expr_eval_batch(dev->expr_stack, m->expr, src_vals, &m->vars, &dst_slot->val,
+                            &time, types, inst_idx, n_inst, inst_status);
+
+    for (k = 0; k < n_inst; k++) {
+        char *inst_types = types;
+        i = inst_idx[k];
         /* TODO: Check if this instance has enough history to process the expression */
-        status = mpr_expr_eval(dev->expr_stack, m->expr, src_vals, &m->vars,
-                               &dst_slot->val, &time, types, i);
+        if (m->use_inst && n_inst > 1) {
+            status = inst_status[k];
+            inst_types += k * dst_slot->sig->len;
+        }
+        else
+            status = mpr_expr_eval(dev->expr_stack, m->expr, src_vals, &m->vars,
+                                   &dst_slot->val, &time, types, i);
         if (!status)
             continue;
 
         if (src_sig->use_inst && !map_manages_inst) {
-            /* finding idmaps here will be a bit inefficient for now */
-            /* TODO: optimize storage and lookup */
-            for (j = 0; j < src_sig->idmap_len; j++) {
-                if (idmaps[j].inst && idmaps[j].inst->idx == i) {
-                    idmap = idmaps[j].map;
-                    break;
-                }
-            }
-            if (j == src_sig->idmap_len) {
+            j = mpr_sig_get_idmap_idx_with_inst_idx(src_sig, i);
+            if (j < 0) {
                 trace("error: couldn't find idmap for signal instance idx %d\n", i);
                 continue;
             }
+            idmap = idmaps[j].map;
         }
 
         /* send instance release if dst is instanced and either src or map is also instanced. */
         if (idmap && status & EXPR_RELEASE_BEFORE_UPDATE && m->use_inst) {
-            msg = mpr_map_build_msg(m, 0, 0, 0, idmap);
-            mpr_link_add_msg(dst_slot->link, dst_slot->sig, msg, time, m->protocol, bundle_idx);
+            mpr_map_add_msg(m, dst_slot->link, dst_slot->sig, 0, 0, 0, idmap, time, bundle_idx);
             if (map_manages_inst) {
                 mpr_dev_LID_decref(dev, 0, idmap);
                 idmap = m->idmap = 0;
@@ -522,19 +584,18 @@ void mpr_map_send(mpr_local_map m, mpr_time time)
         if (status & EXPR_UPDATE) {
             /* send instance update */
             void *result = mpr_value_get_samp(&dst_slot->val, i);
+            mpr_time t = *(mpr_time*)mpr_value_get_time(&dst_slot->val, i);
             if (map_manages_inst && !idmap) {
                 /* create an id_map and store it in the map */
                 idmap = m->idmap = mpr_dev_add_idmap(dev, 0, 0, 0);
             }
-            msg = mpr_map_build_msg(m, src_slot, result, types, idmap);
-            mpr_link_add_msg(dst_slot->link, dst_slot->sig, msg,
-                             *(mpr_time*)mpr_value_get_time(&dst_slot->val, i),
-                             m->protocol, bundle_idx);
+            if (!fused || !_send_fused(m, fused, result, inst_types, t))
+                mpr_map_add_msg(m, dst_slot->link, dst_slot->sig, src_slot, result, inst_types,
+                                idmap, t, bundle_idx);
         }
         /* send instance release if dst is instanced and either src or map is also instanced. */
         if (idmap && status & EXPR_RELEASE_AFTER_UPDATE && m->use_inst) {
-            msg = mpr_map_build_msg(m, 0, 0, 0, idmap);
-            mpr_link_add_msg(dst_slot->link, dst_slot->sig, msg, time, m->protocol, bundle_idx);
+            mpr_map_add_msg(m, dst_slot->link, dst_slot->sig, 0, 0, 0, idmap, time, bundle_idx);
             if (map_manages_inst) {
                 mpr_dev_LID_decref(dev, 0, idmap);
                 idmap = m->idmap = 0;
@@ -551,7 +612,7 @@ void mpr_map_send(mpr_local_map m, mpr_time time)
 /* TODO: merge with mpr_map_send()? */
 void mpr_map_receive(mpr_local_map m, mpr_time time)
 {
-    int i, j, status, val_size, map_manages_inst = 0;
+    int i, j, k, n_inst, status, val_size, *inst_idx, *inst_status, map_manages_inst = 0;
     mpr_local_slot src_slot, dst_slot;
     mpr_sig src_sig;
     mpr_local_sig dst_sig;
@@ -584,33 +645,42 @@ void mpr_map_receive(mpr_local_map m, mpr_time time)
         else
             idmap = 0;
     }
-    types = alloca(dst_sig->len * sizeof(char));
 
-    for (i = 0; i < m->num_inst; i++) {
+    /* Collect the updated instances */
+    inst_idx = alloca(m->num_inst * sizeof(int));
+    inst_status = alloca(m->num_inst * sizeof(int));
+    for (i = 0, n_inst = 0; i < m->num_inst; i++) {
+        if (get_bitflag(m->updated_inst, i))
+            inst_idx[n_inst++] = i;
+    }
+    types = alloca(dst_sig->len * (n_inst ? n_inst : 1) * sizeof(char));
+
+    /* Instanced maps evaluate every updated instance together */
+    if (m->use_inst && n_inst > 1)
+        mpr_expr_eval_batch(m->rtr->dev->expr_stack, m->expr, src_vals, &m->vars,
+                            &dst_slot->val, &time, types, inst_idx, n_inst, inst_status);
+
+    for (k = 0; k < n_inst; k++) {
         mpr_sig_inst si;
         float diff;
 
-        if (!get_bitflag(m->updated_inst, i))
-            continue;
-        status = mpr_expr_eval(m->rtr->dev->expr_stack, m->expr, src_vals,
-                               &m->vars, &dst_slot->val, &time, types, i);
+        i = inst_idx[k];
+        if (m->use_inst && n_inst > 1)
+            status = inst_status[k];
+        else
+            status = mpr_expr_eval(m->rtr->dev->expr_stack, m->expr, src_vals,
+                                   &m->vars, &dst_slot->val, &time, types, i);
         if (!status)
             continue;
 
         j = 0;
         if (dst_sig->use_inst && !map_manages_inst) {
-            /* finding idmaps here will be a bit inefficient for now */
-            /* TODO: optimize storage and lookup */
-            for (j = 0; j < dst_sig->idmap_len; j++) {
-                if (idmaps[j].inst && idmaps[j].inst->idx == i) {
-                    idmap = idmaps[j].map;
-                    break;
-                }
-            }
-            if (j == dst_sig->idmap_len) {
+            j = mpr_sig_get_idmap_idx_with_inst_idx(dst_sig, i);
+            if (j < 0) {
                 trace("error: couldn't find idmap for signal instance idx %d\n", i);
                 continue;
             }
+            idmap = idmaps[j].map;
         }
         else {
             
@@ -709,6 +779,253 @@ lo_message mpr_map_build_msg(mpr_local_map m, mpr_local_slot slot, const void *v
     return msg;
 }
 
+/* OSC strings are null-terminated and padded to a multiple of four bytes. */
+#define OSC_STR_LEN(len) (((len) + 4) & ~3)
+
+static int _osc_write_str(char *dst, const char *str)
+{
+    int len = strlen(str), padded = OSC_STR_LEN(len);
+    memcpy(dst, str, len);
+    memset(dst + len, 0, padded - len);
+    return padded;
+}
+
+/* Number of elements in an update message, matching the contents of mpr_map_build_msg(). */
+static int _msg_len(mpr_local_map m, mpr_local_slot slot, const void *val, mpr_type *types)
+{
+    if (!(val && types) && !m->use_inst)
+        return 0;
+    if (MPR_LOC_SRC == m->process_loc)
+        return m->dst->sig->len;
+    return slot ? slot->sig->len : 0;
+}
+
+/* Find or build a serialised update message with len elements of a single type (MPR_NULL for
+ * a release) and optional instance and slot properties. Values and instance id are left as
+ * placeholders to be patched for each update. */
+static mpr_map_msg_tmpl _get_msg_tmpl(mpr_local_map m, const char *path, int len, mpr_type type,
+                                      int has_GID, int slot_id)
+{
+    int i, size, offset;
+    char *typetag;
+    mpr_map_msg_tmpl t = 0;
+
+    for (i = 0; i < m->num_tmpls; i++) {
+        mpr_map_msg_tmpl tmp = &m->tmpls[i];
+        if (tmp->len != len || tmp->type != type || tmp->slot_id != slot_id
+            || (tmp->GID_offset >= 0) != has_GID)
+            continue;
+        /* compare by content since the destination signal may have been renamed */
+        if (0 == strcmp(tmp->path, path))
+            return tmp;
+        /* destination path has changed; rebuild in place */
+        t = tmp;
+        free(t->path);
+        free(t->buf);
+        break;
+    }
+    if (!t) {
+        m->tmpls = realloc(m->tmpls, sizeof(mpr_map_msg_tmpl_t) * (m->num_tmpls + 1));
+        t = &m->tmpls[m->num_tmpls++];
+    }
+    t->path = strdup(path);
+    t->len = len;
+    t->type = type;
+    t->slot_id = slot_id;
+
+    /* typetag: elements, followed by property name and value for instance and slot */
+    typetag = alloca(len + 6);
+    typetag[0] = ',';
+    memset(typetag + 1, type, len);
+    i = len + 1;
+    if (has_GID) {
+        typetag[i++] = MPR_STR;
+        typetag[i++] = MPR_INT64;
+    }
+    if (slot_id >= 0) {
+        typetag[i++] = MPR_STR;
+        typetag[i++] = MPR_INT32;
+    }
+    typetag[i] = 0;
+
+    size = (MPR_NULL == type) ? 0 : mpr_type_get_size(type) * len;
+    t->buf_len = OSC_STR_LEN(strlen(path)) + OSC_STR_LEN(i) + size
+                 + (has_GID ? 12 : 0) + (slot_id >= 0 ? 8 : 0);
+    t->buf = malloc(t->buf_len);
+
+    offset = _osc_write_str(t->buf, path);
+    offset += _osc_write_str(t->buf + offset, typetag);
+    t->val_offset = offset;
+    memset(t->buf + offset, 0, size);
+    offset += size;
+    if (has_GID) {
+        offset += _osc_write_str(t->buf + offset, "@in");
+        t->GID_offset = offset;
+        mpr_osc_write_int64(t->buf + offset, 0);
+        offset += 8;
+    }
+    else
+        t->GID_offset = -1;
+    if (slot_id >= 0) {
+        offset += _osc_write_str(t->buf + offset, "@sl");
+        mpr_osc_write_int32(t->buf + offset, slot_id);
+    }
+    return t;
+}
+
+/* Build the templates for the updates and releases a map is expected to send, so that they are
+ * ready when the map becomes active rather than built on its first updates. */
+static void _init_msg_tmpls(mpr_local_map m)
+{
+    int i;
+    mpr_sig dst = m->dst->sig;
+    RETURN_UNLESS(MPR_PROTO_UDP == m->protocol && !m->is_local_only && !dst->is_local);
+
+    if (MPR_LOC_SRC == m->process_loc) {
+        mpr_local_slot src_slot = m->src[0];
+        for (i = 1; i < m->num_src; i++) {
+            if (m->src[i]->sig->num_inst > src_slot->sig->num_inst)
+                src_slot = m->src[i];
+        }
+        _get_msg_tmpl(m, dst->path, dst->len, dst->type, m->use_inst, src_slot->id);
+        if (m->use_inst)
+            _get_msg_tmpl(m, dst->path, dst->len, MPR_NULL, 1, -1);
+        return;
+    }
+    for (i = 0; i < m->num_src; i++) {
+        mpr_sig src = m->src[i]->sig;
+        int has_GID = m->use_inst && src->use_inst;
+        _get_msg_tmpl(m, dst->path, src->len, src->type, has_GID, m->src[i]->id);
+        if (m->use_inst)
+            _get_msg_tmpl(m, dst->path, src->len, MPR_NULL, has_GID, m->src[i]->id);
+    }
+}
+
+/* Serialise an update that has no template, such as a partial vector containing nulls or a
+ * message carrying only properties, directly into the link's outgoing UDP bundle. */
+static int _write_osc_msg(mpr_local_map m, mpr_link link, mpr_sig dst, mpr_local_slot slot,
+                          const void *val, mpr_type *types, int len, mpr_id_map idmap,
+                          mpr_time t, int idx)
+{
+    int i, j, size = 0, offset, has_GID = m->use_inst && idmap;
+    char *typetag, *msg;
+
+    /* typetag: elements, followed by property name and value for instance and slot */
+    typetag = alloca(len + 6);
+    typetag[0] = ',';
+    for (i = 0, j = 1; i < len; i++) {
+        mpr_type type = (val && types) ? types[i] : MPR_NULL;
+        switch (type) {
+            case MPR_INT32:
+            case MPR_FLT:   size += 4;  break;
+            case MPR_DBL:   size += 8;  break;
+            case MPR_NULL:              break;
+            default:                    continue;
+        }
+        typetag[j++] = type;
+    }
+    if (has_GID) {
+        typetag[j++] = MPR_STR;
+        typetag[j++] = MPR_INT64;
+    }
+    if (slot) {
+        typetag[j++] = MPR_STR;
+        typetag[j++] = MPR_INT32;
+    }
+    typetag[j] = 0;
+
+    size += OSC_STR_LEN(strlen(dst->path)) + OSC_STR_LEN(j) + (has_GID ? 12 : 0) + (slot ? 8 : 0);
+    RETURN_ARG_UNLESS((msg = mpr_link_reserve_osc_msg(link, size, t, idx)), 0);
+
+    offset = _osc_write_str(msg, dst->path);
+    offset += _osc_write_str(msg + offset, typetag);
+    for (i = 0; val && types && i < len; i++) {
+        switch (types[i]) {
+            case MPR_INT32:
+            case MPR_FLT:
+                mpr_osc_write_int32(msg + offset, ((uint32_t*)val)[i]);
+                offset += 4;
+                break;
+            case MPR_DBL:
+                mpr_osc_write_int64(msg + offset, ((uint64_t*)val)[i]);
+                offset += 8;
+                break;
+            default:
+                break;
+        }
+    }
+    if (has_GID) {
+        offset += _osc_write_str(msg + offset, "@in");
+        mpr_osc_write_int64(msg + offset, idmap->GID);
+        offset += 8;
+    }
+    if (slot) {
+        offset += _osc_write_str(msg + offset, "@sl");
+        mpr_osc_write_int32(msg + offset, slot->id);
+    }
+    return 1;
+}
+
+/* Serialise an update directly into the link's outgoing UDP bundle, using a cached template for
+ * complete vectors of a single type. Returns 0 if the link has no resolved UDP address. */
+static int _add_osc_msg(mpr_local_map m, mpr_link link, mpr_sig dst, mpr_local_slot slot,
+                        const void *val, mpr_type *types, mpr_id_map idmap, mpr_time t, int idx)
+{
+    int i, len = _msg_len(m, slot, val, types), size = 0, has_GID = m->use_inst && idmap;
+    mpr_type type = MPR_NULL;
+    mpr_map_msg_tmpl tmpl;
+    char *msg;
+
+    if (!len)
+        return _write_osc_msg(m, link, dst, slot, val, types, len, idmap, t, idx);
+
+    if (val && types) {
+        /* templates only cover complete vectors of a single type */
+        type = types[0];
+        if (MPR_INT32 != type && MPR_FLT != type && MPR_DBL != type)
+            return _write_osc_msg(m, link, dst, slot, val, types, len, idmap, t, idx);
+        for (i = 1; i < len; i++) {
+            if (types[i] != type)
+                return _write_osc_msg(m, link, dst, slot, val, types, len, idmap, t, idx);
+        }
+        size = mpr_type_get_size(type);
+    }
+
+    tmpl = _get_msg_tmpl(m, dst->path, len, type, has_GID, slot ? slot->id : -1);
+    RETURN_ARG_UNLESS((msg = mpr_link_reserve_osc_msg(link, tmpl->buf_len, t, idx)), 0);
+    memcpy(msg, tmpl->buf, tmpl->buf_len);
+
+    /* patch in values and instance id */
+    if (4 == size) {
+        for (i = 0; i < len; i++)
+            mpr_osc_write_int32(msg + tmpl->val_offset + i * 4, ((uint32_t*)val)[i]);
+    }
+    else if (8 == size) {
+        for (i = 0; i < len; i++)
+            mpr_osc_write_int64(msg + tmpl->val_offset + i * 8, ((uint64_t*)val)[i]);
+    }
+    if (has_GID)
+        mpr_osc_write_int64(msg + tmpl->GID_offset, idmap->GID);
+    return 1;
+}
+
+void mpr_map_add_msg(mpr_local_map m, mpr_link link, mpr_sig dst, mpr_local_slot slot,
+                     const void *val, mpr_type *types, mpr_id_map idmap, mpr_time t, int idx)
+{
+    if (!link || !link->is_local_only) {
+        /* TCP links and links without a resolved UDP address are sent through liblo */
+        if (!(MPR_PROTO_UDP == m->protocol && link
+              && _add_osc_msg(m, link, dst, slot, val, types, idmap, t, idx)))
+            mpr_link_add_msg(link, dst, mpr_map_build_msg(m, slot, val, types, idmap), t,
+                             m->protocol, idx);
+        return;
+    }
+
+    /* pass the update directly, matching the contents of mpr_map_build_msg() */
+    mpr_link_add_local_msg(link, dst, _msg_len(m, slot, val, types), types, val,
+                           (m->use_inst && idmap) ? idmap->GID : 0, slot ? slot->id : -1, t, idx);
+}
+
 void mpr_map_alloc_values(mpr_local_map m)
 {
     /* TODO: check if this filters non-local processing.
@@ -802,8 +1119,9 @@ static int _replace_expr_str(mpr_local_map m, const char *expr_str)
         src_types[i] = m->src[i]->sig->type;
         src_lens[i] = m->src[i]->sig->len;
     }
-    expr = mpr_expr_new_from_str(m->rtr->dev->expr_stack, expr_str, m->num_src, src_types,
-                                 src_lens, m->dst->sig->type, m->dst->sig->len);
+    /* maps with identical expressions and signal types share one compiled expression */
+    expr = mpr_expr_new_shared(m->rtr->dev->expr_stack, expr_str, m->num_src, src_types,
+                               src_lens, m->dst->sig->type, m->dst->sig->len);
     RETURN_ARG_UNLESS(expr, 1);
 
     /* expression update may force processing location to change
@@ -1225,10 +1543,20 @@ static void _check_status(mpr_local_map m)
             }
         }
         _set_expr(m, m->expr_str);
+        _init_msg_tmpls(m);
     }
     return;
 }
 
+/* Updates to a muted map are left pending; queue the map again once it is unmuted. */
+static void _queue_pending_updates(mpr_local_map m)
+{
+    if (m->src[0]->sig->is_local && MPR_DIR_OUT == m->src[0]->dir)
+        mpr_dev_queue_map((mpr_local_dev)m->src[0]->sig->dev, m, MPR_DIR_OUT);
+    if (m->dst->sig->is_local)
+        mpr_dev_queue_map((mpr_local_dev)m->dst->sig->dev, m, MPR_DIR_IN);
+}
+
 /* if 'override' flag is not set, only remote properties can be set */
 int mpr_map_set_from_msg(mpr_map m, mpr_msg msg, int override)
 {
@@ -1448,6 +1776,8 @@ int mpr_map_set_from_msg(mpr_map m, mpr_msg msg, int override)
                                 default:
                                     --updated;
                             }
+                            /* the variable is only overridden for this map */
+                            lm->expr = mpr_expr_unshare(lm->rtr->dev->expr_stack, lm->expr);
                             mpr_expr_var_updated(lm->expr, j);
                             break;
                         }
@@ -1457,10 +1787,14 @@ int mpr_map_set_from_msg(mpr_map m, mpr_msg msg, int override)
                     /* otherwise continue to mpr_tbl_set_from_atom() below */
                 }
             case PROP(ID):
-            case PROP(MUTED):
             case PROP(VERSION):
                 updated += mpr_tbl_set_from_atom(tbl, a, REMOTE_MODIFY);
                 break;
+            case PROP(MUTED):
+                updated += mpr_tbl_set_from_atom(tbl, a, REMOTE_MODIFY);
+                if (m->is_local && !m->muted && ((mpr_local_map)m)->updated)
+                    _queue_pending_updates((mpr_local_map)m);
+                break;
             default:
                 break;
         }
@@ -146,6 +146,19 @@ void mpr_dev_remove_link(mpr_dev dev, mpr_dev rem);
 int mpr_dev_handler(const char *path, const char *types, lo_arg **argv, int argc,
                     lo_message msg, void *data);
 
+/*! Apply a value update to a local signal or one of its map slots. This is the part of
+ *  mpr_dev_handler() that follows message parsing, and is also used to deliver updates
+ *  over local-only links directly.
+ *  \param sig          The destination signal.
+ *  \param types        The element types.
+ *  \param argv         Pointers to the element values.
+ *  \param len          The number of vector elements.
+ *  \param GID          The global instance id, or 0 if none.
+ *  \param slot_idx     The destination map slot id, or -1 if none.
+ *  \return             Zero. */
+int mpr_dev_handle_update(mpr_local_sig sig, const mpr_type *types, lo_arg **argv, int len,
+                          mpr_id GID, int slot_idx);
+
 int mpr_dev_bundle_start(lo_timetag t, void *data);
 
 MPR_INLINE static void mpr_dev_LID_incref(mpr_local_dev dev, mpr_id_map map)
@@ -176,6 +189,18 @@ mpr_id_map mpr_dev_get_idmap_by_LID(mpr_local_dev dev, int group, mpr_id LID);
 
 mpr_id_map mpr_dev_get_idmap_by_GID(mpr_local_dev dev, int group, mpr_id GID);
 
+/*! Mark a map as updated and add it to one of a device's queues of maps awaiting
+ *  processing. The map is only queued if it is not already in that queue.
+ *  \param dev          The local device that will process the map.
+ *  \param map          The map with pending instance updates.
+ *  \param dir          MPR_DIR_IN for maps processed by the destination device,
+ *                      MPR_DIR_OUT for maps processed by the source device. */
+void mpr_dev_queue_map(mpr_local_dev dev, mpr_local_map map, mpr_dir dir);
+
+/*! Remove a map from a device's queues of maps awaiting processing. Entries are cleared in
+ *  place, so this may be called while the queues are being processed. */
+void mpr_dev_dequeue_map(mpr_local_dev dev, mpr_local_map map);
+
 const char *mpr_dev_get_name(mpr_dev dev);
 
 void mpr_dev_send_state(mpr_dev dev, net_msg_t cmd);
@@ -188,6 +213,13 @@ int mpr_dev_send_maps(mpr_local_dev dev, mpr_dir dir, int msg);
  *  \return             Information about the link, or zero if not found. */
 mpr_link mpr_dev_get_link_by_remote(mpr_local_dev dev, mpr_dev remote);
 
+/*! Retrieve allocator statistics for the buffers holding a device's outgoing updates. Bundle
+ *  buffers are reset after each poll and kept for reuse, so after warming up these counts
+ *  should only change when a larger bundle is needed or links are added or removed.
+ *  \param dev          The local device to query.
+ *  \return             The device's bundle allocator statistics. */
+const mpr_bundle_stats_t *mpr_dev_get_bundle_stats(mpr_local_dev dev);
+
 /*! Look up information for a registered object using its unique id.
  *  \param g            The graph to query.
  *  \param type         The type of object to return.
@@ -226,8 +258,27 @@ void mpr_rtr_remove_inst(mpr_rtr rtr, mpr_local_sig sig, int idx);
  *  destinations. */
 void mpr_rtr_process_sig(mpr_rtr rtr, mpr_local_sig sig, int inst_idx, const void *val, mpr_time t);
 
+/*! Forward updated values for several instances of a signal, queuing each map once for all of
+ *  the instances so that instanced maps can evaluate them together.
+ *  \param rtr          The router to use.
+ *  \param sig          The local signal that has been updated.
+ *  \param idmap_idx    Distinct id map indices of the updated instances.
+ *  \param n            The number of id map indices.
+ *  \param t            The time associated with the updates. */
+void mpr_rtr_process_sig_insts(mpr_rtr rtr, mpr_local_sig sig, const int *idmap_idx, int n,
+                               mpr_time t);
+
 void mpr_rtr_add_map(mpr_rtr rtr, mpr_local_map map);
 
+/*! Find a map that can be evaluated in the same pass as a local-only map, forming a fused
+ *  chain. This is the case when the map's destination is a non-instanced input signal with no
+ *  update handler, which is in turn the source of exactly one other active, non-instanced,
+ *  single-source local-only map.
+ *  \param rtr          The router to query.
+ *  \param map          The upstream local-only map.
+ *  \return             The downstream map, or 0 if the chain cannot be fused at this map. */
+mpr_local_map mpr_rtr_get_fused_map(mpr_rtr rtr, mpr_local_map map);
+
 void mpr_rtr_remove_link(mpr_rtr rtr, mpr_link lnk);
 
 int mpr_rtr_remove_map(mpr_rtr rtr, mpr_local_map map);
@@ -318,9 +369,55 @@ void mpr_link_init(mpr_link link);
 void mpr_link_connect(mpr_link link, const char *host, int admin_port,
                       int data_port);
 void mpr_link_free(mpr_link link);
-int mpr_link_process_bundles(mpr_link link, mpr_time t, int idx);
+/*! Send or deliver the bundles queued on a link.
+ *  \param link         The link.
+ *  \param t            Timestamp for the bundles.
+ *  \param idx          Index of the bundle to use.
+ *  \param batch        If non-zero, serialised UDP bundles are added to this batch to be sent
+ *                      later with mpr_link_send_batch() instead of being sent immediately.
+ *  \return             The number of messages sent or queued for sending. */
+int mpr_link_process_bundles(mpr_link link, mpr_time t, int idx, mpr_link_batch batch);
+
+/*! Send the serialised UDP bundles of a batch of links, using a single system call per
+ *  device socket where supported and falling back to one send per link otherwise.
+ *  \param batch        The batch to send. It is empty on return.
+ *  \param idx          Index of the bundle to use. */
+void mpr_link_send_batch(mpr_link_batch batch, int idx);
+
+/*! Free memory held by a batch of links. */
+void mpr_link_batch_free(mpr_link_batch batch);
 void mpr_link_add_msg(mpr_link link, mpr_sig dst, lo_message msg, mpr_time t, mpr_proto proto, int idx);
 
+/*! Reserve space for a serialised OSC message in a link's outgoing UDP bundle.
+ *  \param link         The link.
+ *  \param len          The length of the serialised message in bytes.
+ *  \param t            Timestamp for the bundle.
+ *  \param idx          Index of the bundle to use.
+ *  \return             Pointer to len bytes to be filled by the caller, or 0 if the link
+ *                      cannot send serialised messages. */
+char *mpr_link_reserve_osc_msg(mpr_link link, size_t len, mpr_time t, int idx);
+
+/*! Queue a value update on a local-only link for direct delivery, without building an OSC
+ *  message. Types and values are copied so the caller's buffers may be reused immediately.
+ *  Values are sized by their own types, which are those of the source signal for maps
+ *  processed at the destination.
+ *  \param link         The local-only link.
+ *  \param dst          The destination signal.
+ *  \param len          The number of vector elements.
+ *  \param types        The element types, or 0 if the update is a release.
+ *  \param val          The element values, or 0 if the update is a release.
+ *  \param GID          The global instance id, or 0 if none.
+ *  \param slot         The destination map slot id, or -1 if none.
+ *  \param t            Timestamp for the update.
+ *  \param idx          Index of the bundle to use. */
+void mpr_link_add_local_msg(mpr_link link, mpr_sig dst, int len, const mpr_type *types,
+                            const void *val, mpr_id GID, int slot, mpr_time t, int idx);
+
+/*! Discard updates queued on a local-only link for a signal that is being freed.
+ *  \param link         The link.
+ *  \param sig          The destination signal. */
+void mpr_link_remove_local_msgs(mpr_link link, mpr_sig sig);
+
 mpr_link mpr_graph_add_link(mpr_graph g, mpr_dev dev1, mpr_dev dev2);
 
 int mpr_link_get_is_local(mpr_link link);
@@ -335,6 +432,20 @@ void mpr_map_alloc_values(mpr_local_map map);
  *  \param time         Timestamp for this update. */
 void mpr_map_send(mpr_local_map map, mpr_time time);
 
+/*! Queue a value update for a map on a link. Updates on local-only links are queued for
+ *  direct delivery; all others are built into OSC messages with mpr_map_build_msg().
+ *  \param map          The map sending the update.
+ *  \param link         The link to queue the update on.
+ *  \param dst          The destination signal.
+ *  \param slot         The destination slot, or 0 if none.
+ *  \param val          The values to send, or 0 for a release.
+ *  \param types        The types of the values, or 0 for a release.
+ *  \param idmap        The instance id map, or 0 if none.
+ *  \param t            Timestamp for the update.
+ *  \param idx          Index of the bundle to use. */
+void mpr_map_add_msg(mpr_local_map map, mpr_link link, mpr_sig dst, mpr_local_slot slot,
+                     const void *val, mpr_type *types, mpr_id_map idmap, mpr_time t, int idx);
+
 void mpr_map_receive(mpr_local_map map, mpr_time time);
 
 lo_message mpr_map_build_msg(mpr_local_map map, mpr_local_slot slot, const void *val,
@@ -458,10 +569,43 @@ mpr_expr mpr_expr_new_from_str(mpr_expr_stack eval_stk, const char *str, int num
                                const mpr_type *in_types, const int *in_vec_lens, mpr_type out_type,
                                int out_vec_len);
 
+/*! Return a compiled expression shared with other users of the same evaluation stack, parsing
+ *  it only if no expression with the same string and signature is cached. Strings differing
+ *  only in whitespace between tokens are considered identical. Shared expressions are released
+ *  with mpr_expr_free() once all their users have freed them.
+ *  \param eval_stk     The evaluation stack that will be used to evaluate the expression.
+ *  \param str          The expression string.
+ *  \param num_in       The number of input signals.
+ *  \param in_types     The types of the input signals.
+ *  \param in_vec_lens  The vector lengths of the input signals.
+ *  \param out_type     The type of the output signal.
+ *  \param out_vec_len  The vector length of the output signal.
+ *  \return             The expression, or zero if it could not be parsed. */
+mpr_expr mpr_expr_new_shared(mpr_expr_stack eval_stk, const char *str, int num_in,
+                             const mpr_type *in_types, const int *in_vec_lens, mpr_type out_type,
+                             int out_vec_len);
+
+/*! Ensure an expression is used only by the caller before modifying it, e.g. with
+ *  mpr_expr_var_updated(). A shared expression is parsed again and released by the caller.
+ *  \param eval_stk     The evaluation stack used to evaluate the expression.
+ *  \param expr         The expression to unshare.
+ *  \return             An expression used only by the caller, or the shared expression if
+ *                      it could not be copied. */
+mpr_expr mpr_expr_unshare(mpr_expr_stack eval_stk, mpr_expr expr);
+
 int mpr_expr_get_in_hist_size(mpr_expr expr, int idx);
 
 int mpr_expr_get_out_hist_size(mpr_expr expr);
 
+/*! Get the number of tokens in an expression, for inspecting the effect of the optimizer.
+ *  Unused variable assignments are removed and repeated subexpressions replaced by copies of
+ *  earlier results after parsing.
+ *  \param expr         The expression to query.
+ *  \param optimized    Non-zero to count the tokens after optimization, zero to count the tokens
+ *                      produced by the parser.
+ *  \return             The number of tokens. */
+int mpr_expr_get_num_tokens(mpr_expr expr, int optimized);
+
 int mpr_expr_get_num_vars(mpr_expr expr);
 
 int mpr_expr_get_var_vec_len(mpr_expr expr, int idx);
@@ -478,6 +622,33 @@ int mpr_expr_get_manages_inst(mpr_expr expr);
 
 void mpr_expr_var_updated(mpr_expr expr, int var_idx);
 
+/*! Enable or disable evaluation of an expression using its compiled bytecode. Expressions are
+ *  compiled when parsed and evaluated with bytecode by default; constructs the compiler does not
+ *  support are always evaluated by the token interpreter.
+ *  \param expr         The expression to modify.
+ *  \param use          Non-zero to use bytecode where possible, zero to always interpret. */
+void mpr_expr_set_use_bytecode(mpr_expr expr, int use);
+
+/*! Check whether the next evaluation of an expression will use its compiled bytecode.
+ *  \param expr         The expression to query.
+ *  \return             Non-zero if bytecode is available for the current expression offset. */
+int mpr_expr_get_uses_bytecode(mpr_expr expr);
+
+/*! Check whether an expression's bytecode has been compiled to machine code. Libmapper built
+ *  with --enable-jit compiles a program after it has been evaluated repeatedly for single
+ *  instances; mpr_expr_set_use_bytecode() also controls the use of machine code.
+ *  \param expr         The expression to query.
+ *  \return             Non-zero if the next evaluation will run machine code. */
+int mpr_expr_get_uses_jit(mpr_expr expr);
+
+/*! Select the SIMD instruction set used for long vectors by all expressions. The best set
+ *  supported by the CPU is selected automatically when the first expression is parsed.
+ *  \param name         "avx2", "sse2", "neon" or "none" to disable SIMD kernels, or NULL to
+ *                      select the best supported instruction set.
+ *  \return             The name of the instruction set now in use, "none" if the requested
+ *                      set is unavailable. */
+const char *mpr_expr_set_simd(const char *name);
+
 #ifdef DEBUG
 void printexpr(const char*, mpr_expr);
 #endif
@@ -502,6 +673,27 @@ void printexpr(const char*, mpr_expr);
 int mpr_expr_eval(mpr_expr_stack stk, mpr_expr expr, mpr_value *srcs, mpr_value *expr_vars,
                   mpr_value result, mpr_time *t, mpr_type *types, int inst_idx);
 
+/*! Evaluate the given inputs for several instances at once. When the expression has been
+ *  compiled to bytecode the instances are evaluated together as vector lanes, otherwise
+ *  each instance is evaluated in turn. Evaluation does not stop at EXPR_EVAL_DONE.
+ *  \param stk          A preallocated expression eval stack.
+ *  \param expr         The expression to use.
+ *  \param srcs         An array of mpr_value structures for sources.
+ *  \param expr_vars    An array of mpr_value structures for user variables.
+ *  \param result       A mpr_value structure for the destination.
+ *  \param t            A pointer to a timetag structure for storing the time
+ *                      associated with the result.
+ *  \param types        An array of mpr_type for storing the output type per
+ *                      vector element, with `result->vlen` entries per instance.
+ *  \param inst_idx     Distinct indices of the instances being updated.
+ *  \param n_inst       The number of instance indices.
+ *  \param status       An array of n_inst ints for storing the per-instance result
+ *                      of mpr_expr_eval().
+ *  \result             A bitwise OR of the per-instance results. */
+int mpr_expr_eval_batch(mpr_expr_stack stk, mpr_expr expr, mpr_value *srcs,
+                        mpr_value *expr_vars, mpr_value result, mpr_time *t,
+                        mpr_type *types, const int *inst_idx, int n_inst, int *status);
+
 int mpr_expr_get_num_input_slots(mpr_expr expr);
 
 void mpr_expr_free(mpr_expr expr);
@@ -653,6 +845,13 @@ int mpr_value_remove_inst(mpr_value v, int idx);
 
 void mpr_value_set_samp(mpr_value v, int idx, void *s, mpr_time t);
 
+/*! Helper to find the ring buffer index of a history sample. History lengths are always
+ *  rounded up to a power of two, so the index can be wrapped with a mask. */
+MPR_INLINE static int mpr_value_get_hist_idx(mpr_value v, int pos, int hist_idx)
+{
+    return (pos + hist_idx) & (v->mlen - 1);
+}
+
 /*! Helper to find the pointer to the current value in a mpr_value_t. */
 MPR_INLINE static void* mpr_value_get_samp(mpr_value v, int idx)
 {
@@ -663,9 +862,7 @@ MPR_INLINE static void* mpr_value_get_samp(mpr_value v, int idx)
 MPR_INLINE static void* mpr_value_get_samp_hist(mpr_value v, int inst_idx, int hist_idx)
 {
     mpr_value_buffer b = &v->inst[inst_idx % v->num_inst];
-    int idx = (b->pos + v->mlen + hist_idx) % v->mlen;
-    if (idx < 0)
-        idx += v->mlen;
+    int idx = mpr_value_get_hist_idx(v, b->pos, hist_idx);
     return (char*)b->samps + idx * v->vlen * mpr_type_get_size(v->type);
 }
 
@@ -679,10 +876,7 @@ MPR_INLINE static mpr_time* mpr_value_get_time(mpr_value v, int idx)
 MPR_INLINE static mpr_time* mpr_value_get_time_hist(mpr_value v, int inst_idx, int hist_idx)
 {
     mpr_value_buffer b = &v->inst[inst_idx % v->num_inst];
-    int idx = (b->pos + v->mlen + hist_idx) % v->mlen;
-    if (idx < 0)
-        idx += v->mlen;
-    return &b->times[idx];
+    return &b->times[mpr_value_get_hist_idx(v, b->pos, hist_idx)];
 }
 
 void mpr_value_free(mpr_value v);
@@ -692,12 +886,37 @@ void mpr_value_print(mpr_value v, int inst_idx);
 void mpr_value_print_hist(mpr_value v, int inst_idx);
 #endif
 
+/*! Helpers to write big-endian OSC arguments. */
+MPR_INLINE static void mpr_osc_write_int32(char *dst, uint32_t val)
+{
+    dst[0] = (char)(val >> 24);
+    dst[1] = (char)(val >> 16);
+    dst[2] = (char)(val >> 8);
+    dst[3] = (char)val;
+}
+
+MPR_INLINE static void mpr_osc_write_int64(char *dst, uint64_t val)
+{
+    mpr_osc_write_int32(dst, (uint32_t)(val >> 32));
+    mpr_osc_write_int32(dst + 4, (uint32_t)val);
+}
+
 /*! Helper to find the size in bytes of a signal's full vector. */
 MPR_INLINE static size_t mpr_sig_get_vector_bytes(mpr_sig sig)
 {
     return mpr_type_get_size(sig->type) * sig->len;
 }
 
+/*! Helper to find the id map index associated with an active signal instance.
+ *  \param sig      The local signal owning the instance.
+ *  \param inst_idx The index of the instance.
+ *  \return         The index of the instance id map, or -1 if the instance is
+ *                  not active. */
+MPR_INLINE static int mpr_sig_get_idmap_idx_with_inst_idx(mpr_local_sig sig, int inst_idx)
+{
+    return (inst_idx >= 0 && inst_idx < sig->num_inst) ? sig->inst_idmap_idx[inst_idx] : -1;
+}
+
 /*! Helper to check if a type character is valid. */
 MPR_INLINE static int check_sig_length(int length)
 {
@@ -23,12 +23,9 @@ static int _is_map_in_scope(mpr_local_map map, mpr_id id)
     return 0;
 }
 
-static mpr_rtr_sig _find_rtr_sig(mpr_rtr rtr, mpr_local_sig sig)
+MPR_INLINE static mpr_rtr_sig _find_rtr_sig(mpr_rtr rtr, mpr_local_sig sig)
 {
-    mpr_rtr_sig rs = rtr->sigs;
-    while (rs && rs->sig != sig)
-        rs = rs->next;
-    return rs;
+    return sig->rsig;
 }
 
 void mpr_rtr_remove_inst(mpr_rtr rtr, mpr_local_sig sig, int inst_idx) {
@@ -101,12 +98,104 @@ static void _update_map_count(mpr_rtr rtr)
     dev->num_maps_out = dev_maps_out;
 }
 
+/* Mark the map instances to be updated by a source signal update and queue the map. If this
+ * signal is non-instanced but the map has other instanced sources all of the active map
+ * instances are updated. */
+static void _queue_map_insts(mpr_local_map map, mpr_local_slot slot, mpr_local_sig sig,
+                             int idmap_idx, int all)
+{
+    struct _mpr_sig_idmap *idmaps;
+    int j;
+
+    if (all) {
+        /* find a source signal with more instances */
+        for (j = 0; j < map->num_src; j++)
+            if (map->src[j]->sig->is_local && map->src[j]->num_inst > slot->num_inst)
+                sig = (mpr_local_sig)map->src[j]->sig;
+        idmap_idx = 0;
+    }
+
+    idmaps = sig->idmaps;
+    for (; idmap_idx < sig->idmap_len; idmap_idx++) {
+        /* check if map instance is active */
+        if ((all || sig->use_inst) && !idmaps[idmap_idx].inst)
+            continue;
+        set_bitflag(map->updated_inst, idmaps[idmap_idx].inst->idx);
+        mpr_dev_queue_map(sig->dev, map, MPR_DIR_OUT);
+        if (!all)
+            break;
+    }
+}
+
+/* Pass updated values for n instances of a signal to each outgoing map slot in turn, so that
+ * the maps are queued once and evaluate all of the updated instances together. */
+static void _process_sig_vals(mpr_rtr rtr, mpr_rtr_sig rs, mpr_local_sig sig,
+                              const int *idmap_idx, const void **vals, int n, mpr_time t)
+{
+    mpr_local_map map;
+    mpr_local_slot slot;
+    mpr_id_map idmap;
+    int i, k, in_scope, all;
+    uint8_t bundle_idx = rtr->dev->bundle_idx % NUM_BUNDLES;
+    char *types = 0;
+
+    /* TODO: remove duplicate flag set */
+    sig->dev->sending = 1; /* mark as updated */
+    sig->locked = 1;
+
+    for (i = 0; i < rs->num_slots; i++) {
+        if (!rs->slots[i])
+            continue;
+
+        slot = rs->slots[i];
+        if (MPR_DIR_IN == slot->dir)
+            continue;
+
+        map = slot->map;
+        if (map->status < MPR_STATUS_ACTIVE)
+            continue;
+
+        if (MPR_LOC_DST != map->process_loc && !map->expr) {
+            trace("error: missing expression!\n");
+            continue;
+        }
+
+        all = (map->num_src > 1 && map->num_inst > sig->num_inst);
+
+        for (k = 0; k < n; k++) {
+            idmap = sig->idmaps[idmap_idx[k]].map;
+            in_scope = _is_map_in_scope(map, idmap->GID);
+            /* TODO: should we continue for out-of-scope local destination updates? */
+            if (map->use_inst && !in_scope)
+                continue;
+
+            if (MPR_LOC_DST == map->process_loc) {
+                /* bypass map processing and bundle value without type coercion */
+                if (!types) {
+                    types = alloca(sig->len * sizeof(char));
+                    memset(types, sig->type, sig->len);
+                }
+                mpr_map_add_msg(map, map->dst->link, map->dst->sig, slot, vals[k], types,
+                                sig->use_inst ? idmap : 0, t, bundle_idx);
+                continue;
+            }
+
+            /* copy input value */
+            mpr_value_set_samp(&slot->val, sig->idmaps[idmap_idx[k]].inst->idx, (void*)vals[k], t);
+
+            if (slot->causes_update)
+                _queue_map_insts(map, slot, sig, idmap_idx[k], all);
+        }
+    }
+    sig->locked = 0;
+}
+
 void mpr_rtr_process_sig(mpr_rtr rtr, mpr_local_sig sig, int idmap_idx, const void *val, mpr_time t)
 {
     mpr_id_map idmap;
-    lo_message msg;
     mpr_rtr_sig rs;
     mpr_local_map map;
+    mpr_local_slot slot, dst_slot;
     int i, j, inst_idx;
     uint8_t bundle_idx, *lock;
 
@@ -121,135 +210,111 @@ void mpr_rtr_process_sig(mpr_rtr rtr, mpr_local_sig sig, int idmap_idx, const vo
     rs = _find_rtr_sig(rtr, sig);
     RETURN_UNLESS(rs);
 
+    if (val) {
+        _process_sig_vals(rtr, rs, sig, &idmap_idx, &val, 1, t);
+        return;
+    }
+
     inst_idx = sig->idmaps[idmap_idx].inst->idx;
     bundle_idx = rtr->dev->bundle_idx % NUM_BUNDLES;
     /* TODO: remove duplicate flag set */
-    rtr->dev->sending = 1; /* mark as updated */
+    sig->dev->sending = 1; /* mark as updated */
     lock = &sig->locked;
     *lock = 1;
 
-    if (!val) {
-        mpr_local_slot slot, dst_slot;
-
-        for (i = 0; i < rs->num_slots; i++) {
-            int in_scope;
-            if (!rs->slots[i])
-                continue;
-
-            slot = rs->slots[i];
-            map = slot->map;
-
-            if (map->status < MPR_STATUS_ACTIVE)
-                continue;
-
-            dst_slot = map->dst;
-            in_scope = _is_map_in_scope(map, idmap->GID);
+    for (i = 0; i < rs->num_slots; i++) {
+        int in_scope;
+        if (!rs->slots[i])
+            continue;
 
-            /* send release to upstream */
-            for (j = 0; j < map->num_src; j++) {
-                slot = map->src[j];
-                if (!slot->sig->use_inst)
-                    continue;
+        slot = rs->slots[i];
+        map = slot->map;
 
-                /* reset associated input memory */
-                mpr_value_reset_inst(&slot->val, inst_idx);
+        if (map->status < MPR_STATUS_ACTIVE)
+            continue;
 
-                if (!in_scope)
-                    continue;
+        dst_slot = map->dst;
+        in_scope = _is_map_in_scope(map, idmap->GID);
 
-                if (sig->idmaps[idmap_idx].status & RELEASED_REMOTELY)
-                    continue;
+        /* send release to upstream */
+        for (j = 0; j < map->num_src; j++) {
+            slot = map->src[j];
+            if (!slot->sig->use_inst)
+                continue;
 
-                if (slot->dir == MPR_DIR_IN) {
-                    msg = mpr_map_build_msg(map, slot, 0, 0, idmap);
-                    mpr_link_add_msg(slot->link, slot->sig, msg, t, map->protocol, bundle_idx);
-                }
-            }
+            /* reset associated input memory */
+            mpr_value_reset_inst(&slot->val, inst_idx);
 
-            if (!map->use_inst)
+            if (!in_scope)
                 continue;
 
-            /* reset associated output memory */
-            mpr_value_reset_inst(&dst_slot->val, inst_idx);
+            if (sig->idmaps[idmap_idx].status & RELEASED_REMOTELY)
+                continue;
 
-            /* send release to downstream */
-            if (slot->dir == MPR_DIR_OUT) {
-                msg = 0;
-                if (in_scope) {
-                    msg = mpr_map_build_msg(map, slot, 0, 0, idmap);
-                    mpr_link_add_msg(dst_slot->link, dst_slot->sig, msg, t, map->protocol,
-                                     bundle_idx);
-                }
-            }
+            if (slot->dir == MPR_DIR_IN)
+                mpr_map_add_msg(map, slot->link, slot->sig, slot, 0, 0, idmap, t, bundle_idx);
         }
-        *lock = 0;
-        return;
-    }
-    for (i = 0; i < rs->num_slots; i++) {
-        mpr_local_slot slot;
-        struct _mpr_sig_idmap *idmaps;
-        int in_scope, all;
-        if (!rs->slots[i])
-            continue;
 
-        slot = rs->slots[i];
-        if (MPR_DIR_IN == slot->dir)
+        if (!map->use_inst)
             continue;
 
-        map = slot->map;
-        if (map->status < MPR_STATUS_ACTIVE)
-            continue;
+        /* reset associated output memory */
+        mpr_value_reset_inst(&dst_slot->val, inst_idx);
 
-        in_scope = _is_map_in_scope(map, sig->idmaps[idmap_idx].map->GID);
-        /* TODO: should we continue for out-of-scope local destination updates? */
-        if (map->use_inst && !in_scope)
-            continue;
+        /* send release to downstream */
+        if (slot->dir == MPR_DIR_OUT && in_scope)
+            mpr_map_add_msg(map, dst_slot->link, dst_slot->sig, slot, 0, 0, idmap, t, bundle_idx);
+    }
+    *lock = 0;
+}
 
-        /* If this signal is non-instanced but the map has other instanced
-         * sources we will need to update all of the active map instances. */
-        all = (map->num_src > 1 && map->num_inst > sig->num_inst);
+void mpr_rtr_process_sig_insts(mpr_rtr rtr, mpr_local_sig sig, const int *idmap_idx, int n,
+                               mpr_time t)
+{
+    mpr_rtr_sig rs;
+    const void **vals;
+    int i;
 
-        if (MPR_LOC_DST == map->process_loc) {
-            /* bypass map processing and bundle value without type coercion */
-            char *types = alloca(sig->len * sizeof(char));
-            memset(types, sig->type, sig->len);
-            msg = mpr_map_build_msg(map, slot, val, types, sig->use_inst ? idmap : 0);
-            mpr_link_add_msg(map->dst->link, map->dst->sig, msg, t, map->protocol, bundle_idx);
-            continue;
-        }
+    if (sig->locked) {
+        trace_dev(rtr->dev, "Mapping loop detected on signal %s! (1)\n", sig->name);
+        return;
+    }
+    rs = _find_rtr_sig(rtr, sig);
+    RETURN_UNLESS(rs && n > 0);
 
-        if (!map->expr) {
-            trace("error: missing expression!\n");
-            continue;
-        }
+    vals = alloca(n * sizeof(void*));
+    for (i = 0; i < n; i++)
+        vals[i] = sig->idmaps[idmap_idx[i]].inst->val;
+    _process_sig_vals(rtr, rs, sig, idmap_idx, vals, n, t);
+}
 
-        /* copy input value */
-        mpr_value_set_samp(&slot->val, inst_idx, (void*)val, t);
+mpr_local_map mpr_rtr_get_fused_map(mpr_rtr rtr, mpr_local_map map)
+{
+    mpr_local_map next = 0;
+    mpr_local_sig sig;
+    mpr_rtr_sig rs;
+    int i;
 
-        if (!slot->causes_update)
-            continue;
+    RETURN_ARG_UNLESS(map->is_local_only && !map->use_inst, 0);
 
-        if (all) {
-            /* find a source signal with more instances */
-            for (j = 0; j < map->num_src; j++)
-                if (map->src[j]->sig->is_local && map->src[j]->num_inst > slot->num_inst)
-                    sig = (mpr_local_sig)map->src[j]->sig;
-            idmap_idx = 0;
-        }
+    /* the intermediate signal must not need its own update to be observed */
+    sig = (mpr_local_sig)map->dst->sig;
+    RETURN_ARG_UNLESS(MPR_DIR_IN == sig->dir && !sig->use_inst && !sig->handler && !sig->locked, 0);
+    rs = _find_rtr_sig(rtr, sig);
+    RETURN_ARG_UNLESS(rs, 0);
 
-        idmaps = sig->idmaps;
-        for (; idmap_idx < sig->idmap_len; idmap_idx++) {
-            /* check if map instance is active */
-            if ((all || sig->use_inst) && !idmaps[idmap_idx].inst)
-                continue;
-            inst_idx = idmaps[idmap_idx].inst->idx;
-            set_bitflag(map->updated_inst, inst_idx);
-            map->updated = 1;
-            if (!all)
-                break;
-        }
+    /* ...and must be the source of exactly one downstream map */
+    for (i = 0; i < rs->num_slots; i++) {
+        mpr_local_slot slot = rs->slots[i];
+        if (!slot || MPR_DIR_IN == slot->dir)
+            continue;
+        RETURN_ARG_UNLESS(!next && slot->causes_update, 0);
+        next = slot->map;
     }
-    *lock = 0;
+    RETURN_ARG_UNLESS(next && next != map && next->status >= MPR_STATUS_ACTIVE, 0);
+    RETURN_ARG_UNLESS(next->is_local_only && 1 == next->num_src && !next->use_inst, 0);
+    RETURN_ARG_UNLESS(next->expr && !next->muted, 0);
+    return next;
 }
 
 static mpr_rtr_sig _add_rtr_sig(mpr_rtr rtr, mpr_local_sig sig)
@@ -266,6 +331,7 @@ static mpr_rtr_sig _add_rtr_sig(mpr_rtr rtr, mpr_local_sig sig)
         rs->slots[0] = 0;
         rs->next = rtr->sigs;
         rtr->sigs = rs;
+        sig->rsig = rs;
     }
     return rs;
 }
@@ -460,6 +526,8 @@ void mpr_rtr_remove_sig(mpr_rtr rtr, mpr_rtr_sig rs)
         while (*rstemp) {
             if (*rstemp == rs) {
                 *rstemp = rs->next;
+                if (rs->sig->rsig == rs)
+                    rs->sig->rsig = 0;
                 free(rs->slots);
                 free(rs);
                 break;
@@ -481,11 +549,12 @@ int mpr_rtr_remove_map(mpr_rtr rtr, mpr_local_map map)
     if (map->idmap) {
         /* release map-generated instances */
         if (map->dst->rsig) {
-            lo_message msg = mpr_map_build_msg(map, 0, 0, 0, map->idmap);
+            /* a vector consisting completely of nulls indicates a release */
+            mpr_sig sig = map->dst->sig;
+            mpr_type *types = alloca(sig->len * sizeof(mpr_type));
+            memset(types, MPR_NULL, sig->len);
             mpr_dev_bundle_start(t, NULL);
-            mpr_dev_handler(NULL, lo_message_get_types(msg), lo_message_get_argv(msg),
-                            lo_message_get_argc(msg), msg, (void*)map->dst->sig);
-            lo_message_free(msg);
+            mpr_dev_handle_update((mpr_local_sig)sig, types, 0, sig->len, map->idmap->GID, -1);
         }
         if (map->dst->dir == MPR_DIR_OUT || map->is_local_only)
             mpr_dev_LID_decref(rtr->dev, 0, map->idmap);
@@ -563,6 +632,22 @@ int mpr_rtr_remove_map(mpr_rtr rtr, mpr_local_map map)
         free(map->var_names);
     }
 
+    /* remove map from the update queues of the devices owning its signals; a device that is
+     * being freed has already been removed from the network's device list */
+    if (map->dst->sig->is_local)
+        mpr_dev_dequeue_map((mpr_local_dev)map->dst->sig->dev, map);
+    for (i = 0; i < map->num_src; i++) {
+        if (map->src[i]->sig->is_local)
+            mpr_dev_dequeue_map((mpr_local_dev)map->src[i]->sig->dev, map);
+    }
+
+    /* free cached update messages */
+    for (i = 0; i < map->num_tmpls; i++) {
+        free(map->tmpls[i].path);
+        free(map->tmpls[i].buf);
+    }
+    FUNC_IF(free, map->tmpls);
+
     FUNC_IF(free, map->updated_inst);
     FUNC_IF(mpr_expr_free, map->expr);
     _update_map_count(rtr);
@@ -9,6 +9,11 @@
 #include "types_internal.h"
 #include <mapper/mapper.h>
 
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+/* Default maximum number of instances per signal, see mpr_sig_set_max_inst() */
 #define MAX_INST 128
 #define BUFFSIZE 512
 
@@ -19,9 +24,108 @@
 /* Function prototypes */
 static int _init_and_add_idmap(mpr_local_sig lsig, mpr_sig_inst si, mpr_id_map map);
 
+/* Header of a block of instance storage; blocks are chained so they can be freed together. */
+typedef union _inst_slab {
+    union _inst_slab *next;
+    mpr_id align;
+} inst_slab_t, *inst_slab;
+
 static int _compare_inst_ids(const void *l, const void *r)
 {
-    return (*(mpr_sig_inst*)l)->id - (*(mpr_sig_inst*)r)->id;
+    mpr_id lid = (*(mpr_sig_inst*)l)->id, rid = (*(mpr_sig_inst*)r)->id;
+    return (lid > rid) - (lid < rid);
+}
+
+/* Insert an instance into the first n elements of the instance array, keeping it sorted by id. */
+static void _insert_inst(mpr_local_sig lsig, mpr_sig_inst si, int n)
+{
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (lsig->inst[mid]->id < si->id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    memmove(&lsig->inst[lo + 1], &lsig->inst[lo], (n - lo) * sizeof(mpr_sig_inst));
+    lsig->inst[lo] = si;
+}
+
+/* Active instances are kept in two binary heaps ordered by creation time, so that the oldest
+ * and newest instances can be found without scanning. Inactive instances are kept in a third
+ * heap ordered by id so that the lowest available instance can be reused. */
+#define HEAP_OLDEST 0
+#define HEAP_NEWEST 1
+#define HEAP_FREE   2
+
+MPR_INLINE static int _heap_before(int h, mpr_sig_inst a, mpr_sig_inst b)
+{
+    int cmp;
+    if (HEAP_FREE == h)
+        return a->id < b->id;
+    cmp = (a->created.sec > b->created.sec) - (a->created.sec < b->created.sec);
+    if (!cmp)
+        cmp = (a->created.frac > b->created.frac) - (a->created.frac < b->created.frac);
+    return HEAP_OLDEST == h ? cmp < 0 : cmp > 0;
+}
+
+MPR_INLINE static void _heap_place(mpr_local_sig lsig, int h, mpr_sig_inst si, int pos)
+{
+    lsig->heaps[h][pos] = si;
+    si->heap_pos[h] = pos;
+}
+
+static void _heap_sift(mpr_local_sig lsig, int h, int pos)
+{
+    mpr_sig_inst *heap = lsig->heaps[h], si = heap[pos];
+    int child, len = lsig->heap_len[h];
+
+    /* move up towards the root... */
+    while (pos > 0 && _heap_before(h, si, heap[(pos - 1) / 2])) {
+        _heap_place(lsig, h, heap[(pos - 1) / 2], pos);
+        pos = (pos - 1) / 2;
+    }
+    /* ...or down towards the leaves */
+    while ((child = pos * 2 + 1) < len) {
+        if (child + 1 < len && _heap_before(h, heap[child + 1], heap[child]))
+            ++child;
+        if (!_heap_before(h, heap[child], si))
+            break;
+        _heap_place(lsig, h, heap[child], pos);
+        pos = child;
+    }
+    _heap_place(lsig, h, si, pos);
+}
+
+static void _heap_push(mpr_local_sig lsig, int h, mpr_sig_inst si)
+{
+    RETURN_UNLESS(si->heap_pos[h] < 0);
+    _heap_place(lsig, h, si, lsig->heap_len[h]++);
+    _heap_sift(lsig, h, lsig->heap_len[h] - 1);
+}
+
+static void _heap_pop(mpr_local_sig lsig, int h, mpr_sig_inst si)
+{
+    int pos = si->heap_pos[h];
+    RETURN_UNLESS(pos >= 0);
+    si->heap_pos[h] = -1;
+    if (pos == --lsig->heap_len[h])
+        return;
+    _heap_place(lsig, h, lsig->heaps[h][lsig->heap_len[h]], pos);
+    _heap_sift(lsig, h, pos);
+}
+
+/* Track an instance that has been linked to an id map as a candidate for stealing */
+static void _heap_add(mpr_local_sig lsig, mpr_sig_inst si)
+{
+    _heap_push(lsig, HEAP_OLDEST, si);
+    _heap_push(lsig, HEAP_NEWEST, si);
+}
+
+static void _heap_remove(mpr_local_sig lsig, mpr_sig_inst si)
+{
+    _heap_pop(lsig, HEAP_OLDEST, si);
+    _heap_pop(lsig, HEAP_NEWEST, si);
 }
 
 static mpr_sig_inst _find_inst_by_id(mpr_local_sig lsig, mpr_id id)
@@ -35,6 +139,14 @@ static mpr_sig_inst _find_inst_by_id(mpr_local_sig lsig, mpr_id id)
     return (sipp && *sipp) ? *sipp : 0;
 }
 
+/* Position of an instance in the sorted instance array */
+static int _find_inst_idx(mpr_local_sig lsig, mpr_sig_inst si)
+{
+    mpr_sig_inst *sipp = bsearch(&si, lsig->inst, lsig->num_inst, sizeof(mpr_sig_inst),
+                                 _compare_inst_ids);
+    return sipp ? sipp - lsig->inst : -1;
+}
+
 /* Add a signal to a parent object. */
 mpr_sig mpr_sig_new(mpr_dev dev, mpr_dir dir, const char *name, int len,
                     mpr_type type, const char *unit, const void *min,
@@ -104,6 +216,7 @@ void mpr_sig_init(mpr_sig sig, mpr_dir dir, const char *name, int len, mpr_type
     if (sig->is_local) {
         mpr_local_sig lsig = (mpr_local_sig)sig;
         sig->num_inst = 0;
+        lsig->max_inst = MAX_INST;
         lsig->vec_known = calloc(1, len / 8 + 1);
         for (i = 0; i < len; i++)
             set_bitflag(lsig->vec_known, i);
@@ -188,6 +301,7 @@ case TYPE: {                                                        \
 void mpr_sig_free(mpr_sig sig)
 {
     int i;
+    mpr_list list;
     mpr_local_dev ldev;
     mpr_net net;
     mpr_local_sig lsig = (mpr_local_sig)sig;
@@ -208,10 +322,7 @@ void mpr_sig_free(mpr_sig sig)
     mpr_dev_remove_sig_methods(ldev, lsig);
     net = &sig->obj.graph->net;
     rtr = net->rtr;
-    rs = rtr->sigs;
-    while (rs && rs->sig != lsig)
-        rs = rs->next;
-    if (rs) {
+    if ((rs = lsig->rsig)) {
         mpr_local_map map;
         /* need to unmap */
         for (i = 0; i < rs->num_slots; i++) {
@@ -222,6 +333,13 @@ void mpr_sig_free(mpr_sig sig)
             mpr_rtr_remove_map(rtr, map);
         }
         mpr_rtr_remove_sig(rtr, rs);
+
+        /* discard updates to this signal that are still queued on local-only links */
+        list = mpr_dev_get_links((mpr_dev)ldev, MPR_DIR_ANY);
+        while (list) {
+            mpr_link_remove_local_msgs((mpr_link)*list, sig);
+            list = mpr_list_get_next(list);
+        }
     }
     if (ldev->registered) {
         /* Notify subscribers */
@@ -245,12 +363,17 @@ void mpr_sig_free_internal(mpr_sig sig)
                 mpr_sig_release_inst_internal(lsig, i);
         }
         free(lsig->idmaps);
-        for (i = 0; i < lsig->num_inst; i++) {
-            FUNC_IF(free, lsig->inst[i]->val);
-            FUNC_IF(free, lsig->inst[i]->has_val_flags);
-            free(lsig->inst[i]);
+        while (lsig->inst_slabs) {
+            inst_slab slab = (inst_slab)lsig->inst_slabs;
+            lsig->inst_slabs = slab->next;
+            free(slab);
         }
+        FUNC_IF(free, lsig->inst_pool);
+        FUNC_IF(free, lsig->heaps[HEAP_OLDEST]);
+        FUNC_IF(free, lsig->heaps[HEAP_NEWEST]);
+        FUNC_IF(free, lsig->heaps[HEAP_FREE]);
         free(lsig->inst);
+        FUNC_IF(free, lsig->inst_idmap_idx);
         free(lsig->updated_inst);
         FUNC_IF(free, lsig->vec_known);
     }
@@ -288,12 +411,17 @@ static mpr_sig_inst _reserved_inst(mpr_local_sig lsig, mpr_id *id)
 {
     int i, j;
     mpr_sig_inst si;
+    mpr_id_map map;
 
     /* First we will try to find an inactive instance */
-    for (i = 0; i < lsig->num_inst; i++) {
-        si = lsig->inst[i];
-        if (!si->active)
-            goto done;
+    if (lsig->heap_len[HEAP_FREE]) {
+        si = lsig->heaps[HEAP_FREE][0];
+        if (!id || *id == si->id)
+            return si;
+        /* the id is the free heap key; the caller activates the instance next */
+        _heap_pop(lsig, HEAP_FREE, si);
+        i = _find_inst_idx(lsig, si);
+        goto done;
     }
 
     /* Otherwise if the signal is not ephemeral we will choose instances with local idmaps */
@@ -301,50 +429,37 @@ static mpr_sig_inst _reserved_inst(mpr_local_sig lsig, mpr_id *id)
 
     for (i = 0; i < lsig->num_inst; i++) {
         si = lsig->inst[i];
-        for (j = 0; j < lsig->idmap_len; j++) {
-            mpr_id_map map = lsig->idmaps[j].map;
-            if (!map)
-                goto done;
-            if (lsig->idmaps[j].inst != si)
-                continue;
-            if (map->GID >> 32 != lsig->dev->obj.id >> 32)
-                continue;
+        j = lsig->inst_idmap_idx[si->idx];
+        if (j >= 0 && (map = lsig->idmaps[j].map)
+            && map->GID >> 32 == lsig->dev->obj.id >> 32) {
             /* locally claimed instance, allow replacing idmap */
             mpr_dev_LID_decref((mpr_local_dev)lsig->dev, lsig->group, map);
             lsig->idmaps[j].map = NULL;
             goto done;
         }
+        if (i)
+            continue;
+        /* the first instance can also take any unused id map */
+        for (j = 0; j < lsig->idmap_len; j++) {
+            if (!lsig->idmaps[j].map)
+                goto done;
+        }
     }
     return 0;
 done:
-    if (id)
+    if (id && *id != si->id) {
         si->id = *id;
-    qsort(lsig->inst, lsig->num_inst, sizeof(mpr_sig_inst), _compare_inst_ids);
+        /* move the instance to its sorted position */
+        memmove(&lsig->inst[i], &lsig->inst[i + 1], (lsig->num_inst - i - 1) * sizeof(mpr_sig_inst));
+        _insert_inst(lsig, si, lsig->num_inst - 1);
+    }
     return si;
 }
 
 int _oldest_inst(mpr_local_sig lsig)
 {
-    int i, oldest;
-    mpr_sig_inst si;
-    for (i = 0; i < lsig->idmap_len; i++) {
-        if (lsig->idmaps[i].inst)
-            break;
-    }
-    if (i == lsig->idmap_len) {
-        /* no active instances to steal! */
-        return -1;
-    }
-    oldest = i;
-    for (i = oldest+1; i < lsig->idmap_len; i++) {
-        if (!(si = lsig->idmaps[i].inst))
-            continue;
-        if ((si->created.sec < lsig->idmaps[oldest].inst->created.sec) ||
-            (si->created.sec == lsig->idmaps[oldest].inst->created.sec &&
-             si->created.frac < lsig->idmaps[oldest].inst->created.frac))
-            oldest = i;
-    }
-    return oldest;
+    /* returns -1 if there are no active instances to steal */
+    return lsig->heap_len[HEAP_OLDEST] ? lsig->inst_idmap_idx[lsig->heaps[HEAP_OLDEST][0]->idx] : -1;
 }
 
 mpr_id mpr_sig_get_oldest_inst_id(mpr_sig sig)
@@ -359,26 +474,7 @@ mpr_id mpr_sig_get_oldest_inst_id(mpr_sig sig)
 
 int _newest_inst(mpr_local_sig lsig)
 {
-    int i, newest;
-    mpr_sig_inst si;
-    for (i = 0; i < lsig->idmap_len; i++) {
-        if (lsig->idmaps[i].inst)
-            break;
-    }
-    if (i == lsig->idmap_len) {
-        /* no active instances to steal! */
-        return -1;
-    }
-    newest = i;
-    for (i = newest + 1; i < lsig->idmap_len; i++) {
-        if (!(si = lsig->idmaps[i].inst))
-            continue;
-        if ((si->created.sec > lsig->idmaps[newest].inst->created.sec) ||
-            (si->created.sec == lsig->idmaps[newest].inst->created.sec &&
-             si->created.frac > lsig->idmaps[newest].inst->created.frac))
-            newest = i;
-    }
-    return newest;
+    return lsig->heap_len[HEAP_NEWEST] ? lsig->inst_idmap_idx[lsig->heaps[HEAP_NEWEST][0]->idx] : -1;
 }
 
 mpr_id mpr_sig_get_newest_inst_id(mpr_sig sig)
@@ -402,10 +498,19 @@ int mpr_sig_get_idmap_with_LID(mpr_local_sig lsig, mpr_id LID, int flags, mpr_ti
         LID = MPR_DEFAULT_INST;
     maps = lsig->idmaps;
     h = (mpr_sig_handler*)lsig->handler;
-    for (i = 0; i < lsig->idmap_len; i++) {
-        if (maps[i].inst && maps[i].map && maps[i].map->LID == LID)
+    if (lsig->use_inst) {
+        /* instances are sorted by id, so look up the instance rather than scanning id maps */
+        si = _find_inst_by_id(lsig, LID);
+        i = si ? lsig->inst_idmap_idx[si->idx] : -1;
+        if (i >= 0 && maps[i].inst && maps[i].map && maps[i].map->LID == LID)
             return (maps[i].status & ~flags) ? -1 : i;
     }
+    else {
+        for (i = 0; i < lsig->idmap_len; i++) {
+            if (maps[i].inst && maps[i].map && maps[i].map->LID == LID)
+                return (maps[i].status & ~flags) ? -1 : i;
+        }
+    }
     RETURN_ARG_UNLESS(activate, -1);
 
     /* check if device has record of id map */
@@ -475,14 +580,25 @@ int mpr_sig_get_idmap_with_GID(mpr_local_sig lsig, mpr_id GID, int flags, mpr_ti
     int i;
     maps = lsig->idmaps;
     h = (mpr_sig_handler*)lsig->handler;
-    for (i = 0; i < lsig->idmap_len; i++) {
-        if (maps[i].map && maps[i].map->GID == GID)
+
+    /* check if the device already has a map for this global id; the signal can
+     * only hold id maps that are active on its device */
+    map = mpr_dev_get_idmap_by_GID((mpr_local_dev)lsig->dev, lsig->group, GID);
+    if (map) {
+        /* try the active instance with this local id before scanning */
+        si = _find_inst_by_id(lsig, map->LID);
+        i = si ? lsig->inst_idmap_idx[si->idx] : -1;
+        if (i < 0 || maps[i].map != map) {
+            for (i = 0; i < lsig->idmap_len; i++) {
+                if (maps[i].map == map)
+                    break;
+            }
+        }
+        if (i < lsig->idmap_len)
             return (maps[i].status & ~flags) ? -1 : i;
     }
     RETURN_ARG_UNLESS(activate, -1);
 
-    /* check if the device already has a map for this global id */
-    map = mpr_dev_get_idmap_by_GID((mpr_local_dev)lsig->dev, lsig->group, GID);
     if (!map) {
         /* Here we still risk creating conflicting maps if two signals are updated asynchronously.
          * This is easy to avoid by not allowing a local id to be used with multiple active remote
@@ -565,55 +681,74 @@ int mpr_sig_get_idmap_with_GID(mpr_local_sig lsig, mpr_id GID, int flags, mpr_ti
     return -1;
 }
 
-static int _reserve_inst(mpr_local_sig lsig, mpr_id *id, void *data)
+/* Make room for n more instances in the instance arrays and make sure the pool holds at least
+ * n instances, allocating the shortfall together in a single block. The pool array has room for
+ * every allocated instance, so removed instances can be returned to it without reallocating. */
+static int _alloc_insts(mpr_local_sig lsig, int n)
+{
+    int i, k = n - lsig->inst_pool_len;
+    if (k > 0) {
+        size_t val_size = mpr_sig_get_vector_bytes((mpr_sig)lsig), flags_size = lsig->len / 8 + 1;
+        inst_slab slab = calloc(1, sizeof(inst_slab_t)
+                                   + k * (sizeof(mpr_sig_inst_t) + val_size + flags_size));
+        mpr_sig_inst insts;
+        char *vals;
+        RETURN_ARG_UNLESS(slab, 0);
+        slab->next = lsig->inst_slabs;
+        lsig->inst_slabs = slab;
+
+        insts = (mpr_sig_inst)(slab + 1);
+        vals = (char*)(insts + k);
+        lsig->inst_pool = realloc(lsig->inst_pool, sizeof(mpr_sig_inst) * (lsig->num_inst + n));
+        for (i = 0; i < k; i++) {
+            insts[i].val = vals + i * val_size;
+            insts[i].has_val_flags = vals + k * val_size + i * flags_size;
+            lsig->inst_pool[lsig->inst_pool_len++] = &insts[i];
+        }
+    }
+    lsig->inst = realloc(lsig->inst, sizeof(mpr_sig_inst) * (lsig->num_inst + n));
+    lsig->inst_idmap_idx = realloc(lsig->inst_idmap_idx, sizeof(int) * (lsig->num_inst + n));
+    for (i = 0; i < 3; i++)
+        lsig->heaps[i] = realloc(lsig->heaps[i], sizeof(mpr_sig_inst) * (lsig->num_inst + n));
+    return 1;
+}
+
+/* Take an instance from the pool; space must already have been made with _alloc_insts(). */
+static int _reserve_inst(mpr_local_sig lsig, mpr_id id, void *data)
 {
-    int i, cont;
     mpr_sig_inst si;
-    RETURN_ARG_UNLESS(lsig->num_inst < MAX_INST, -1);
+    void *val;
+    char *has_val_flags;
+    RETURN_ARG_UNLESS(lsig->num_inst < lsig->max_inst && lsig->inst_pool_len, -1);
 
     /* check if instance with this id already exists! If so, stop here. */
-    if (id && _find_inst_by_id(lsig, *id))
-        return -1;
-
-    /* reallocate array of instances */
-    lsig->inst = realloc(lsig->inst, sizeof(mpr_sig_inst) * (lsig->num_inst + 1));
-    lsig->inst[lsig->num_inst] = (mpr_sig_inst) calloc(1, sizeof(struct _mpr_sig_inst));
-    si = lsig->inst[lsig->num_inst];
-    si->val = calloc(1, mpr_sig_get_vector_bytes((mpr_sig)lsig));
-    si->has_val_flags = calloc(1, lsig->len / 8 + 1);
-    si->has_val = 0;
-    si->active = 0;
-
-    if (id)
-        si->id = *id;
-    else {
-        /* find lowest unused id */
-        mpr_id lowest_id = 0;
-        cont = 1;
-        while (cont) {
-            cont = 0;
-            for (i = 0; i < lsig->num_inst; i++) {
-                if (lsig->inst[i]->id == lowest_id) {
-                    cont = 1;
-                    break;
-                }
-            }
-            lowest_id += cont;
-        }
-        si->id = lowest_id;
-    }
+    RETURN_ARG_UNLESS(!_find_inst_by_id(lsig, id), -1);
+
+    si = lsig->inst_pool[--lsig->inst_pool_len];
+    val = si->val;
+    has_val_flags = si->has_val_flags;
+    memset(si, 0, sizeof(mpr_sig_inst_t));
+    si->val = memset(val, 0, mpr_sig_get_vector_bytes((mpr_sig)lsig));
+    si->has_val_flags = memset(has_val_flags, 0, lsig->len / 8 + 1);
+    si->id = id;
     si->idx = lsig->num_inst;
     si->data = data;
+    si->heap_pos[HEAP_OLDEST] = si->heap_pos[HEAP_NEWEST] = si->heap_pos[HEAP_FREE] = -1;
 
-    ++lsig->num_inst;
-    qsort(lsig->inst, lsig->num_inst, sizeof(mpr_sig_inst), _compare_inst_ids);
-    return lsig->num_inst - 1;
+    /* new instances are inactive and have no id map */
+    lsig->inst_idmap_idx[si->idx] = -1;
+    _heap_push(lsig, HEAP_FREE, si);
+
+    _insert_inst(lsig, si, lsig->num_inst);
+    return lsig->num_inst++;
 }
 
 int mpr_sig_reserve_inst(mpr_sig sig, int num, mpr_id *ids, void **data)
 {
-    int i = 0, count = 0, highest = -1, result, old_num = sig->num_inst;
+    int i = 0, count = 0, highest = -1, result, old_num = sig->num_inst, n;
     mpr_local_sig lsig = (mpr_local_sig)sig;
+    mpr_id id = 0;
+    char *used;
     RETURN_ARG_UNLESS(sig && sig->is_local && num, 0);
     sig->use_inst = 1;
 
@@ -626,12 +761,34 @@ int mpr_sig_reserve_inst(mpr_sig sig, int num, mpr_id *ids, void **data)
         ++i;
         ++count;
     }
-    for (; i < num; i++) {
-        result = _reserve_inst(lsig, ids ? &ids[i] : 0, data ? data[i] : 0);
-        if (result == -1)
-            continue;
-        highest = result;
-        ++count;
+
+    n = num - i;
+    if (n > lsig->max_inst - lsig->num_inst)
+        n = lsig->max_inst - lsig->num_inst;
+    if (n > 0 && _alloc_insts(lsig, n)) {
+        if (!ids) {
+            /* mark the ids in use; the n lowest unused ids are always below num_inst + n */
+            n += lsig->num_inst;
+            used = alloca(n / 8 + 1);
+            memset(used, 0, n / 8 + 1);
+            for (result = 0; result < lsig->num_inst; result++) {
+                if (lsig->inst[result]->id < n)
+                    set_bitflag(used, (int)lsig->inst[result]->id);
+            }
+        }
+        for (; i < num; i++) {
+            if (!ids) {
+                while (id < n && get_bitflag(used, (int)id))
+                    ++id;
+                result = _reserve_inst(lsig, id++, data ? data[i] : 0);
+            }
+            else
+                result = _reserve_inst(lsig, ids[i], data ? data[i] : 0);
+            if (result == -1)
+                continue;
+            highest = result;
+            ++count;
+        }
     }
     if (highest != -1)
         mpr_rtr_num_inst_changed(lsig->obj.graph->net.rtr, lsig, highest + 1);
@@ -650,6 +807,14 @@ int mpr_sig_reserve_inst(mpr_sig sig, int num, mpr_id *ids, void **data)
     return count;
 }
 
+int mpr_sig_set_max_inst(mpr_sig sig, int max)
+{
+    mpr_local_sig lsig = (mpr_local_sig)sig;
+    RETURN_ARG_UNLESS(sig && sig->is_local, 0);
+    lsig->max_inst = max > lsig->num_inst ? max : lsig->num_inst;
+    return lsig->max_inst;
+}
+
 int mpr_sig_get_inst_is_active(mpr_sig sig, mpr_id id)
 {
     int idmap_idx;
@@ -725,21 +890,11 @@ done:
     FUNC_IF(lo_address_free, addr);
 }
 
-void mpr_sig_set_value(mpr_sig sig, mpr_id id, int len, mpr_type type, const void *val)
+static void _set_value(mpr_local_sig lsig, mpr_id id, int len, mpr_type type, const void *val,
+                       mpr_time time)
 {
-    mpr_time time;
     int idmap_idx;
-    mpr_local_sig lsig = (mpr_local_sig)sig;
     mpr_sig_inst si;
-    RETURN_UNLESS(sig);
-    if (!sig->is_local) {
-        _mpr_remote_sig_set_value(sig, len, type, val);
-        return;
-    }
-    if (!len || !val) {
-        mpr_sig_release_inst(sig, id);
-        return;
-    }
     if (!mpr_type_get_is_num(type)) {
 #ifdef DEBUG
         trace("called update on signal '%s' with non-number type '%c'\n", lsig->name, type);
@@ -765,7 +920,6 @@ void mpr_sig_set_value(mpr_sig sig, mpr_id id, int len, mpr_type type, const voi
                 RETURN_UNLESS(((double*)val)[i] == ((double*)val)[i]);
         }
     }
-    time = mpr_dev_get_time(sig->dev);
     idmap_idx = mpr_sig_get_idmap_with_LID(lsig, id, 0, time, 1);
     RETURN_UNLESS(idmap_idx >= 0);
     si = lsig->idmaps[idmap_idx].inst;
@@ -778,7 +932,7 @@ void mpr_sig_set_value(mpr_sig sig, mpr_id id, int len, mpr_type type, const voi
     if (type != lsig->type)
         set_coerced_val(lsig->len, type, val, lsig->len, lsig->type, si->val);
     else
-        memcpy(si->val, (void*)val, mpr_sig_get_vector_bytes(sig));
+        memcpy(si->val, (void*)val, mpr_sig_get_vector_bytes((mpr_sig)lsig));
     si->has_val = 1;
 
     /* mark instance as updated */
@@ -788,6 +942,130 @@ void mpr_sig_set_value(mpr_sig sig, mpr_id id, int len, mpr_type type, const voi
     mpr_rtr_process_sig(lsig->obj.graph->net.rtr, lsig, idmap_idx, si->has_val ? si->val : 0, si->time);
 }
 
+void mpr_sig_set_value(mpr_sig sig, mpr_id id, int len, mpr_type type, const void *val)
+{
+    RETURN_UNLESS(sig);
+    if (!sig->is_local) {
+        _mpr_remote_sig_set_value(sig, len, type, val);
+        return;
+    }
+    if (!len || !val) {
+        mpr_sig_release_inst(sig, id);
+        return;
+    }
+    _set_value((mpr_local_sig)sig, id, len, type, val, mpr_dev_get_time(sig->dev));
+}
+
+/* Update up to lsig->num_inst instances with a shared timetag, so that the scratch arrays on the
+ * stack stay bounded by the signal's instance count. */
+static void _set_values(mpr_local_sig lsig, int num_inst, const mpr_id *ids, int len,
+                        mpr_type type, const char *vals, mpr_time time)
+{
+    mpr_sig_inst si, *insts;
+    int i, j, n, *idmap_idx;
+    size_t size = mpr_type_get_size(type) * len;
+    const char *val;
+    char *seen;
+
+    idmap_idx = alloca(num_inst * sizeof(int));
+    insts = alloca(num_inst * sizeof(mpr_sig_inst));
+    for (i = 0, n = 0; i < num_inst; i++) {
+        val = vals + i * size;
+        /* check for NaN */
+        if (type == MPR_FLT) {
+            for (j = 0; j < len && ((float*)val)[j] == ((float*)val)[j]; j++) ;
+        }
+        else if (type == MPR_DBL) {
+            for (j = 0; j < len && ((double*)val)[j] == ((double*)val)[j]; j++) ;
+        }
+        else
+            j = len;
+        if (j < len)
+            continue;
+
+        idmap_idx[n] = mpr_sig_get_idmap_with_LID(lsig, ids[i], 0, time, 1);
+        if (idmap_idx[n] < 0)
+            continue;
+        si = insts[n] = lsig->idmaps[idmap_idx[n]].inst;
+        ++n;
+
+        /* update time */
+        mpr_sig_update_timing_stats(lsig, si->has_val ? mpr_time_get_diff(time, si->time) : 0);
+        memcpy(&si->time, &time, sizeof(mpr_time));
+
+        /* update value */
+        if (type != lsig->type)
+            set_coerced_val(lsig->len, type, val, lsig->len, lsig->type, si->val);
+        else
+            memcpy(si->val, val, size);
+        si->has_val = 1;
+    }
+
+    /* Activating an instance may have stolen another from earlier in the batch, and repeated
+     * ids resolve to the same instance, so keep each still-active instance once. */
+    seen = alloca(lsig->num_inst / 8 + 1);
+    memset(seen, 0, lsig->num_inst / 8 + 1);
+    for (i = 0, j = 0; i < n; i++) {
+        si = insts[i];
+        if (lsig->idmaps[idmap_idx[i]].inst != si || get_bitflag(seen, si->idx))
+            continue;
+        set_bitflag(seen, si->idx);
+        idmap_idx[j++] = idmap_idx[i];
+
+        /* mark instance as updated */
+        set_bitflag(lsig->updated_inst, si->idx);
+    }
+    RETURN_UNLESS(j);
+    ((mpr_local_dev)lsig->dev)->sending = lsig->updated = 1;
+
+    mpr_rtr_process_sig_insts(lsig->obj.graph->net.rtr, lsig, idmap_idx, j, time);
+}
+
+void mpr_sig_set_values(mpr_sig sig, int num_inst, const mpr_id *ids, int len, mpr_type type,
+                        const void *vals, mpr_time time)
+{
+    mpr_local_sig lsig = (mpr_local_sig)sig;
+    int i, chunk;
+    size_t size;
+    RETURN_UNLESS(sig && num_inst > 0 && ids);
+    size = mpr_type_get_size(type) * len;
+    if (!sig->is_local || !len || !vals) {
+        /* nothing to batch */
+        for (i = 0; i < num_inst; i++)
+            mpr_sig_set_value(sig, ids[i], len, type, vals ? (char*)vals + i * size : 0);
+        return;
+    }
+    /* keep the device time current for bundling, although updates use the given timetag */
+    mpr_dev_get_time(sig->dev);
+    if (!lsig->use_inst || 1 == num_inst) {
+        for (i = 0; i < num_inst; i++)
+            _set_value(lsig, ids[i], len, type, (char*)vals + i * size, time);
+        return;
+    }
+    if (!mpr_type_get_is_num(type)) {
+#ifdef DEBUG
+        trace("called update on signal '%s' with non-number type '%c'\n", lsig->name, type);
+#endif
+        return;
+    }
+    if (len != lsig->len) {
+#ifdef DEBUG
+        trace("called update on signal '%s' with value length %d (should be %d)\n",
+              lsig->name, len, lsig->len);
+#endif
+        return;
+    }
+
+    RETURN_UNLESS(lsig->num_inst > 0);
+
+    /* Process the batch in chunks no larger than the number of instances, which bounds the
+     * scratch space used by each chunk. A larger batch must repeat ids or steal instances. */
+    for (i = 0; i < num_inst; i += chunk) {
+        chunk = num_inst - i < lsig->num_inst ? num_inst - i : lsig->num_inst;
+        _set_values(lsig, chunk, ids + i, len, type, (const char*)vals + i * size, time);
+    }
+}
+
 void mpr_sig_release_inst(mpr_sig sig, mpr_id id)
 {
     int idmap_idx;
@@ -822,12 +1100,17 @@ void mpr_sig_release_inst_internal(mpr_local_sig lsig, int idmap_idx)
 
     /* Put instance back in reserve list */
     smap->inst->active = 0;
+    _heap_push(lsig, HEAP_FREE, smap->inst);
+    if (lsig->inst_idmap_idx[smap->inst->idx] == idmap_idx) {
+        lsig->inst_idmap_idx[smap->inst->idx] = -1;
+        _heap_remove(lsig, smap->inst);
+    }
     smap->inst = 0;
 }
 
 void mpr_sig_remove_inst(mpr_sig sig, mpr_id id)
 {
-    int i, remove_idx;
+    int i, idmap_idx, remove_idx;
     mpr_local_sig lsig = (mpr_local_sig)sig;
     RETURN_UNLESS(sig && sig->is_local && sig->use_inst);
     for (i = 0; i < lsig->num_inst; i++) {
@@ -836,22 +1119,24 @@ void mpr_sig_remove_inst(mpr_sig sig, mpr_id id)
     }
     RETURN_UNLESS(i < lsig->num_inst);
 
+    remove_idx = lsig->inst[i]->idx;
+
     if (lsig->inst[i]->active) {
        /* First release instance */
-       mpr_sig_release_inst_internal(lsig, i);
+       idmap_idx = lsig->inst_idmap_idx[remove_idx];
+       if (idmap_idx >= 0)
+           mpr_sig_release_inst_internal(lsig, idmap_idx);
     }
 
-    remove_idx = lsig->inst[i]->idx;
-
-    /* Free value and timetag memory held by instance */
-    FUNC_IF(free, lsig->inst[i]->val);
-    FUNC_IF(free, lsig->inst[i]->has_val_flags);
-    free(lsig->inst[i]);
+    /* Keep instance memory for reuse by later reservations */
+    _heap_remove(lsig, lsig->inst[i]);
+    _heap_pop(lsig, HEAP_FREE, lsig->inst[i]);
+    lsig->inst_pool[lsig->inst_pool_len++] = lsig->inst[i];
 
     for (++i; i < lsig->num_inst; i++)
     lsig->inst[i-1] = lsig->inst[i];
+    /* the instance arrays keep their capacity; _alloc_insts() grows them when needed */
     --lsig->num_inst;
-    lsig->inst = realloc(lsig->inst, sizeof(mpr_sig_inst) * lsig->num_inst);
 
     /* Remove instance memory held by map slots */
     mpr_rtr_remove_inst(lsig->obj.graph->net.rtr, lsig, remove_idx);
@@ -860,6 +1145,8 @@ void mpr_sig_remove_inst(mpr_sig sig, mpr_id id)
         if (lsig->inst[i]->idx > remove_idx)
             --lsig->inst[i]->idx;
     }
+    for (i = remove_idx; i < lsig->num_inst; i++)
+        lsig->inst_idmap_idx[i] = lsig->inst_idmap_idx[i + 1];
 }
 
 const void *mpr_sig_get_value(mpr_sig sig, mpr_id id, mpr_time *time)
@@ -1017,8 +1304,11 @@ mpr_list mpr_sig_get_maps(mpr_sig sig, mpr_dir dir)
 
 static int _init_and_add_idmap(mpr_local_sig lsig, mpr_sig_inst si, mpr_id_map map)
 {
-    int i;
-    if (!si->active) {
+    int i, activated = !si->active;
+    if (activated) {
+        /* creation time is the heap key, so drop any stale heap entry before resetting it */
+        _heap_remove(lsig, si);
+        _heap_pop(lsig, HEAP_FREE, si);
         si->active = 1;
         si->has_val = 0;
         mpr_time_set(&si->created, MPR_NOW);
@@ -1032,18 +1322,29 @@ static int _init_and_add_idmap(mpr_local_sig lsig, mpr_sig_inst si, mpr_id_map m
     }
     if (i == lsig->idmap_len) {
         /* need more memory */
-        if (lsig->idmap_len >= MAX_INST) {
+        if (lsig->idmap_len >= (lsig->max_inst > MAX_INST ? lsig->max_inst : MAX_INST)) {
             /* Arbitrary limit to number of tracked idmaps */
             /* TODO: add checks for this return value */
+            if (activated) {
+                si->active = 0;
+                _heap_push(lsig, HEAP_FREE, si);
+            }
             return -1;
         }
         lsig->idmap_len = lsig->idmap_len ? lsig->idmap_len * 2 : 1;
         lsig->idmaps = realloc(lsig->idmaps, (lsig->idmap_len * sizeof(struct _mpr_sig_idmap)));
         memset(lsig->idmaps + i, 0, ((lsig->idmap_len - i) * sizeof(struct _mpr_sig_idmap)));
     }
+    else if (lsig->idmaps[i].inst && lsig->inst_idmap_idx[lsig->idmaps[i].inst->idx] == i) {
+        /* slot is being reused; unlink stale instance */
+        lsig->inst_idmap_idx[lsig->idmaps[i].inst->idx] = -1;
+        _heap_remove(lsig, lsig->idmaps[i].inst);
+    }
     lsig->idmaps[i].map = map;
     lsig->idmaps[i].inst = si;
     lsig->idmaps[i].status = 0;
+    lsig->inst_idmap_idx[si->idx] = i;
+    _heap_add(lsig, si);
     return i;
 }
 
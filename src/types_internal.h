@@ -279,9 +279,9 @@ typedef struct _mpr_graph {
 
 typedef struct _mpr_value_buffer
 {
-    void *samps;                /*!< Value for each sample of stored history. */
-    mpr_time *times;            /*!< Time for each sample of stored history. */
-    int8_t pos;                 /*!< Current position in the circular buffer. */
+    void *samps;                /*!< Value for each sample of stored history, in the slab. */
+    mpr_time *times;            /*!< Time for each sample of stored history, in the slab. */
+    int pos;                    /*!< Current position in the circular buffer. */
     uint8_t full;               /*!< Indicates whether complete buffer contains valid data. */
 } mpr_value_buffer_t, *mpr_value_buffer;
 
@@ -289,10 +289,12 @@ typedef struct _mpr_value
 {
     mpr_value_buffer inst;      /*!< Array of value histories for each signal instance. */
     int vlen;                   /*!< Vector length. */
-    uint8_t num_inst;           /*!< Number of instances. */
-    uint8_t num_active_inst;    /*!< Number of active instances. */
+    int num_inst;               /*!< Number of instances. */
+    int num_active_inst;        /*!< Number of active instances. */
     mpr_type type;              /*!< The type of this signal. */
-    int16_t mlen;               /*!< History size of the buffer. */
+    int mlen;                   /*!< History size of the buffer, always a power of two. */
+    void *samps;                /*!< Sample slab for all instances, laid out [inst][hist][vlen]. */
+    mpr_time *times;            /*!< Timetag slab for all instances, laid out [inst][hist]. */
 } mpr_value_t, *mpr_value;
 
 /*! Bit flags for indicating instance id_map status. */
@@ -318,7 +320,8 @@ typedef struct _mpr_sig_inst
     void *val;                  /*!< The current value of this signal instance. */
     mpr_time time;              /*!< The time associated with the current value. */
 
-    uint8_t idx;                /*!< Index for accessing value history. */
+    int idx;                    /*!< Index for accessing value history. */
+    int heap_pos[3];            /*!< Positions in the oldest/newest/free heaps, or -1. */
     uint8_t has_val;            /*!< Indicates whether this instance has a value. */
     uint8_t active;             /*!< Status of this instance. */
 } mpr_sig_inst_t, *mpr_sig_inst;
@@ -364,9 +367,18 @@ typedef struct _mpr_local_sig
     MPR_SIG_STRUCT_ITEMS
     mpr_local_dev dev;
 
+    struct _mpr_rtr_sig *rsig;      /*!< Router record, or 0 if signal is not mapped. */
     struct _mpr_sig_idmap *idmaps;  /*!< ID maps and active instances. */
     int idmap_len;
-    struct _mpr_sig_inst **inst;    /*!< Array of pointers to the signal insts. */
+    struct _mpr_sig_inst **inst;    /*!< Array of pointers to the signal insts, sorted by id. */
+    struct _mpr_sig_inst **inst_pool; /*!< Unused instances available for reservation. */
+    int inst_pool_len;              /*!< Number of instances in the pool. */
+    int max_inst;                   /*!< Maximum number of instances and id maps. */
+    struct _mpr_sig_inst **heaps[3]; /*!< Active instances oldest and newest first, and inactive
+                                      *   instances lowest id first. */
+    int heap_len[3];                /*!< Number of instances in each heap. */
+    void *inst_slabs;               /*!< Chained blocks of instance, value and flag storage. */
+    int *inst_idmap_idx;            /*!< Index of the id map for each instance idx, or -1. */
     char *vec_known;                /*!< Bitflags when entire vector is known. */
     char *updated_inst;             /*!< Bitflags to indicate updated instances. */
 
@@ -383,9 +395,42 @@ typedef struct _mpr_local_sig
 
 /**** Router ****/
 
+/*! A value update queued for direct delivery over a local-only link. */
+typedef struct _mpr_local_msg {
+    struct _mpr_local_sig *sig;     /*!< The destination signal. */
+    mpr_id GID;                     /*!< Global instance id, or 0 if none. */
+    int slot;                       /*!< Destination map slot id, or -1 if none. */
+    int len;                        /*!< Number of vector elements. */
+    int size;                       /*!< Size of each element value in bytes. */
+    size_t types;                   /*!< Offset of the element types in the buffer. */
+    size_t val;                     /*!< Offset of the element values in the buffer. */
+} mpr_local_msg_t, *mpr_local_msg;
+
+/*! Queued updates for a local-only link, bypassing OSC serialisation. */
+typedef struct _mpr_local_bundle {
+    mpr_local_msg msgs;             /*!< Array of queued updates. */
+    int num_msgs;                   /*!< Number of queued updates. */
+    int msgs_size;                  /*!< Allocated length of the update array. */
+    char *buf;                      /*!< Storage for types and values of queued updates. */
+    size_t buf_len;                 /*!< Used bytes in the storage buffer. */
+    size_t buf_size;                /*!< Allocated bytes in the storage buffer. */
+    mpr_time time;                  /*!< Timestamp of the bundle. */
+} mpr_local_bundle_t, *mpr_local_bundle;
+
+/*! An OSC bundle serialised in place for sending over UDP. */
+typedef struct _mpr_osc_bundle {
+    char *buf;                      /*!< Serialised bundle, or 0 if not yet allocated. */
+    size_t len;                     /*!< Bytes used, or 0 if the bundle is empty. */
+    size_t size;                    /*!< Bytes allocated. */
+    int num_msgs;                   /*!< Number of messages in the bundle. */
+    int batched;                    /*!< Non-zero if the bundle is awaiting a batched send. */
+} mpr_osc_bundle_t, *mpr_osc_bundle;
+
 typedef struct _mpr_bundle {
     lo_bundle udp;
     lo_bundle tcp;
+    mpr_osc_bundle_t osc;           /*!< Serialised UDP updates built from map templates. */
+    mpr_local_bundle_t local;       /*!< Updates for local-only links. */
 } mpr_bundle_t, *mpr_bundle;
 
 #define NUM_BUNDLES 1
@@ -401,6 +446,8 @@ typedef struct _mpr_link {
         lo_address admin;               /*!< Network address of remote endpoint */
         lo_address udp;                 /*!< Network address of remote endpoint */
         lo_address tcp;                 /*!< Network address of remote endpoint */
+        void *udp_sa;                   /*!< Resolved UDP socket address, or 0. */
+        int udp_sa_len;                 /*!< Length of the resolved UDP socket address. */
     } addr;
 
     int is_local_only;
@@ -419,7 +466,7 @@ typedef struct _mpr_link {
     mpr_sig sig;                    /*!< Pointer to parent signal */            \
     mpr_link link;                                                              \
     int id;                                                                     \
-    uint8_t num_inst;                                                           \
+    int num_inst;                                                               \
     char dir;                       /*!< DI_INCOMING or DI_OUTGOING */          \
     char causes_update;             /*!< 1 if causes update, 0 otherwise. */    \
     char is_local;                                                              \
@@ -462,6 +509,18 @@ typedef struct _mpr_map {
     mpr_slot dst;
 } mpr_map_t, *mpr_map;
 
+/*! A pre-serialised OSC update message for a map, with placeholder values. */
+typedef struct _mpr_map_msg_tmpl {
+    char *path;                     /*!< Copy of the destination path of the template. */
+    char *buf;                      /*!< The serialised message. */
+    int buf_len;                    /*!< Length of the serialised message in bytes. */
+    int val_offset;                 /*!< Offset of the first vector element. */
+    int GID_offset;                 /*!< Offset of the instance id, or -1 if none. */
+    int slot_id;                    /*!< Slot id included in the message, or -1 if none. */
+    int len;                        /*!< Number of vector elements. */
+    mpr_type type;                  /*!< Type of the vector elements, or MPR_NULL for releases. */
+} mpr_map_msg_tmpl_t, *mpr_map_msg_tmpl;
+
 typedef struct _mpr_local_map {
     MPR_MAP_STRUCT_ITEMS
     mpr_local_slot *src;
@@ -476,14 +535,18 @@ typedef struct _mpr_local_map {
     int num_vars;                   /*!< Number of user variables. */
     int num_inst;                   /*!< Number of local instances. */
 
+    mpr_map_msg_tmpl tmpls;         /*!< Cached serialised update messages. */
+    int num_tmpls;                  /*!< Number of cached update messages. */
+
     uint8_t is_local_only;
     uint8_t one_src;
     uint8_t updated;
+    uint8_t queued;                 /*!< Device queues holding this map (MPR_DIR_IN/OUT). */
 } mpr_local_map_t, *mpr_local_map;
 
 /*! The rtr_sig is a linked list containing a signal and a list of mapping
- *  slots.  TODO: This should be replaced with a more efficient approach
- *  such as a hash table or search tree. */
+ *  slots. Each local signal also stores a pointer to its own rtr_sig so that
+ *  lookups during signal updates do not need to walk this list. */
 typedef struct _mpr_rtr_sig {
     struct _mpr_rtr_sig *next;      /*!< The next rtr_sig in the list. */
 
@@ -507,7 +570,9 @@ typedef struct _mpr_rtr {
 /*! The instance ID map is a linked list of int32 instance ids for coordinating
  *  remote and local instances. */
 typedef struct _mpr_id_map {
-    struct _mpr_id_map *next;       /*!< The next id map in the list. */
+    struct _mpr_id_map *next;       /*!< The next id map in the reserve list or
+                                     *   LID hash bucket. */
+    struct _mpr_id_map *next_GID;   /*!< The next id map in the GID hash bucket. */
 
     mpr_id GID;                     /*!< Hash for originating device. */
     mpr_id LID;                     /*!< Local instance id to map. */
@@ -515,8 +580,49 @@ typedef struct _mpr_id_map {
     int GID_refcount;
 } mpr_id_map_t, *mpr_id_map;
 
+/*! Hash index of the active instance id maps belonging to a signal group. */
+typedef struct _mpr_id_map_tbl {
+    struct _mpr_id_map **LID;       /*!< Buckets of id maps hashed by local id. */
+    struct _mpr_id_map **GID;       /*!< Buckets of id maps hashed by global id. */
+    int num;                        /*!< Number of active id maps. */
+    int size;                       /*!< Number of buckets, a power of two. */
+} mpr_id_map_tbl_t, *mpr_id_map_tbl;
+
 /**** Device ****/
 
+/*! Allocator statistics for the buffers holding a device's outgoing updates. */
+typedef struct _mpr_bundle_stats {
+    int num_allocs;                 /*!< Number of buffer allocations and reallocations. */
+    int num_lo_bundles;             /*!< Number of liblo bundles allocated. */
+    size_t num_bytes;               /*!< Bytes currently held by the buffers. */
+} mpr_bundle_stats_t, *mpr_bundle_stats;
+
+/*! Links with serialised bundles awaiting a batched send. */
+typedef struct _mpr_link_batch {
+    struct _mpr_link **links;       /*!< Links with pending bundles. */
+    void *hdrs;                     /*!< Message headers for the batched system call. */
+    void *iov;                      /*!< Buffer descriptors for the batched system call. */
+    int num;                        /*!< Number of pending links. */
+    int size;                       /*!< Allocated length of the arrays. */
+    int enabled;                    /*!< Non-zero to batch sends at the end of each poll. */
+} mpr_link_batch_t, *mpr_link_batch;
+
+/*! Buffers for receiving several datagrams per system call. */
+typedef struct _mpr_recv_batch {
+    char *bufs;                     /*!< Datagram buffers, MAX_DGRAM_LEN bytes each. */
+    void *hdrs;                     /*!< Message headers for the batched system call. */
+    void *iov;                      /*!< Buffer descriptors for the batched system call. */
+    int size;                       /*!< Datagrams per call, or 0 to receive one at a time. */
+    int alloced;                    /*!< Number of datagram buffers allocated. */
+} mpr_recv_batch_t, *mpr_recv_batch;
+
+/*! A queue of local maps with pending instance updates. */
+typedef struct _mpr_map_queue {
+    struct _mpr_local_map **maps;   /*!< Array of queued maps. */
+    int num;                        /*!< Number of queued maps. */
+    int size;                       /*!< Allocated length of the array. */
+} mpr_map_queue_t, *mpr_map_queue;
+
 #define MPR_DEV_STRUCT_ITEMS                                            \
     mpr_obj_t obj;      /* always first */                              \
     mpr_dev *linked;                                                    \
@@ -551,10 +657,17 @@ struct _mpr_local_dev {
     mpr_subscriber subscribers;         /*!< Linked-list of subscribed peers. */
 
     struct {
-        struct _mpr_id_map **active;    /*!< The list of active instance id maps. */
+        struct _mpr_id_map_tbl *active; /*!< Indices of active instance id maps per group. */
         struct _mpr_id_map *reserve;    /*!< The list of reserve instance id maps. */
     } idmaps;
 
+    mpr_map_queue_t queued_in;          /*!< Maps awaiting processing at destination. */
+    mpr_map_queue_t queued_out;         /*!< Maps awaiting processing at source. */
+
+    mpr_bundle_stats_t bundle_stats;    /*!< Allocator statistics for outgoing bundles. */
+    mpr_link_batch_t tx_batch;          /*!< Links awaiting a batched send. */
+    mpr_recv_batch_t rx_batch;          /*!< Buffers for batched receiving. */
+
     mpr_expr_stack expr_stack;
     mpr_thread_data thread_data;
 
@@ -4,121 +4,156 @@
 #include <stdio.h>
 #include <stddef.h>
 #include <limits.h>
+#include <stdint.h>
 #include <assert.h>
 
 #include "mapper_internal.h"
 #include "types_internal.h"
 #include <mapper/mapper.h>
 
-MPR_INLINE static int _min(int a, int b) { return a < b ? a : b; }
+/* Sample and timetag slabs are aligned to cache lines so that instances can be streamed. */
+#define SLAB_ALIGN 64
+
+MPR_INLINE static int _pow2(int n)
+{
+    int p = 1;
+    while (p < n)
+        p <<= 1;
+    return p;
+}
+
+/* Allocate zeroed, aligned memory, storing the alignment offset in the preceding byte. */
+static void *_slab_alloc(size_t size)
+{
+    unsigned char *mem = calloc(1, size + SLAB_ALIGN), *slab;
+    RETURN_ARG_UNLESS(mem, 0);
+    slab = mem + SLAB_ALIGN - ((uintptr_t)mem & (SLAB_ALIGN - 1));
+    slab[-1] = (unsigned char)(slab - mem);
+    return slab;
+}
+
+static void _slab_free(void *slab)
+{
+    if (slab)
+        free((unsigned char*)slab - ((unsigned char*)slab)[-1]);
+}
+
+/* Point each instance buffer at its region of the slabs. */
+static void _set_inst_ptrs(mpr_value v, int samp_size)
+{
+    int i;
+    for (i = 0; i < v->num_inst; i++) {
+        v->inst[i].samps = (char*)v->samps + i * v->mlen * samp_size;
+        v->inst[i].times = v->times + i * v->mlen;
+    }
+}
+
+/* Copy the most recent history of an instance into a ring buffer of a different length,
+ * oldest sample first. */
+static void _copy_hist(mpr_value_buffer b, int old_mlen, char *samps, mpr_time *times, int mlen,
+                       int samp_size)
+{
+    int i, idx, n = b->full ? old_mlen : b->pos + 1;
+    if (n > mlen)
+        n = mlen;
+    for (i = 0; i < n; i++) {
+        idx = (b->pos - i) & (old_mlen - 1);
+        memcpy(samps + (n - 1 - i) * samp_size, (char*)b->samps + idx * samp_size, samp_size);
+        memcpy(&times[n - 1 - i], &b->times[idx], sizeof(mpr_time));
+    }
+    b->pos = n - 1;
+    b->full = (n == mlen);
+}
 
 void mpr_value_realloc(mpr_value v, unsigned int vlen, mpr_type type, unsigned int mlen,
                        unsigned int num_inst, int is_input)
 {
-    int i, samp_size;
-    mpr_value_buffer_t *b, tmp;
+    int i, samp_size, old_num_inst, keep;
+    size_t samps_size;
+    void *samps;
+    mpr_time *times;
     RETURN_UNLESS(v && mlen && num_inst >= v->num_inst);
     samp_size = vlen * mpr_type_get_size(type);
-
-    if (!v->inst || num_inst > v->num_inst) {
-        if (v->inst)
-            v->inst = realloc(v->inst, sizeof(mpr_value_buffer_t) * num_inst);
-        else {
-            v->inst = malloc(sizeof(mpr_value_buffer_t) * num_inst);
-            v->num_inst = 0;
-        }
-        /* initialize new instances */
-        for (i = v->num_inst; i < num_inst; i++) {
-            b = &v->inst[i];
-            b->samps = calloc(1, mlen * samp_size);
-            b->times = calloc(1, mlen * sizeof(mpr_time));
-            b->pos = -1;
-            b->full = 0;
-        }
+    mlen = _pow2(mlen);
+
+    if (v->inst)
+        old_num_inst = v->num_inst;
+    else {
+        old_num_inst = 0;
+        v->samps = 0;
+        v->times = 0;
     }
+    keep = is_input && vlen == v->vlen && type == v->type;
+    if (keep && old_num_inst == num_inst && mlen == v->mlen)
+        return;
 
-    if (!is_input || vlen != v->vlen || type != v->type) {
-        /* reallocate old instances (v->num_inst has not yet been updated) */
-        for (i = 0; i < v->num_inst; i++) {
-            b = &v->inst[i];
-            b->samps = realloc(b->samps, mlen * samp_size);
-            b->times = realloc(b->times, mlen * sizeof(mpr_time));
-            /* Initialize entire value to 0 */
-            memset(b->samps, 0, mlen * samp_size);
-            memset(b->times, 0, mlen * sizeof(mpr_time));
+    /* allocate one slab of samples laid out [inst][hist][vlen] and a parallel slab of times */
+    samps_size = ((size_t)num_inst * mlen * samp_size + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1);
+    samps = _slab_alloc(samps_size + (size_t)num_inst * mlen * sizeof(mpr_time));
+    RETURN_UNLESS(samps);
+    times = (mpr_time*)((char*)samps + samps_size);
+
+    v->inst = realloc(v->inst, sizeof(mpr_value_buffer_t) * num_inst);
+    for (i = 0; i < old_num_inst; i++) {
+        mpr_value_buffer b = &v->inst[i];
+        if (!keep) {
+            /* vector shape has changed: reset the entire value */
             b->pos = -1;
             b->full = 0;
         }
-        goto done;
-    }
-
-    if (mlen == v->mlen)
-        goto done;
-
-    /* only the memory size is different */
-
-    for (i = 0; i < v->num_inst; i++) {
-        b = &v->inst[i];
-        tmp.samps = malloc(samp_size * mlen);
-        tmp.times = malloc(sizeof(mpr_time) * mlen);
-
-        /* TODO: don't bother copying memory if pos is -1 */
-        if (mlen > v->mlen) {
-            int opos = b->pos < 0 ? 0 : b->pos;
-            int npos = v->mlen - opos;
-            /* copy from [v->pos, v->mlen] to [0, v->mlen - v->pos] */
-            memcpy(tmp.samps, (char*)b->samps + opos * samp_size, npos * samp_size);
-            memcpy(tmp.times, &b->times[opos], npos * sizeof(mpr_time));
-            /* copy from [0, v->pos] to [v->mlen - v->pos, v->mlen] */
-            memcpy((char*)tmp.samps + npos * samp_size, b->samps, opos * samp_size);
-            memcpy(&tmp.times[npos], b->times, opos * sizeof(mpr_time));
-            /* zero remainder */
-            memset((char*)tmp.samps + v->mlen * samp_size, 0, (mlen - v->mlen) * samp_size);
-            memset(&tmp.times[v->mlen], 0, (mlen - v->mlen) * sizeof(mpr_time));
-            b->pos = b->pos < 0 ? -1 : v->mlen;
-            b->full = 0;
-        }
-        else {
-            int opos = b->pos < 0 ? 0 : b->pos;
-            int len = _min(v->mlen - opos, mlen);
-            memcpy(tmp.samps, (char*)b->samps + opos * samp_size, len * samp_size);
-            memcpy(tmp.times, &b->times[opos], len * sizeof(mpr_time));
-            if (mlen > len) {
-                memcpy((char*)tmp.samps + len * samp_size, b->samps, (mlen - len) * samp_size);
-                memcpy(&tmp.times[len], b->times, (mlen - len) * sizeof(mpr_time));
-            }
-            b->pos = b->pos < 0 ? -1 : len;
-            b->full = (b->pos > mlen);
+        else if (mlen == v->mlen) {
+            memcpy((char*)samps + i * mlen * samp_size, b->samps, mlen * samp_size);
+            memcpy(times + i * mlen, b->times, mlen * sizeof(mpr_time));
         }
-
-        free(b->samps);
-        free(b->times);
-        b->samps = tmp.samps;
-        b->times = tmp.times;
+        else
+            _copy_hist(b, v->mlen, (char*)samps + i * mlen * samp_size, times + i * mlen, mlen,
+                       samp_size);
+    }
+    /* initialize new instances */
+    for (i = old_num_inst; i < num_inst; i++) {
+        v->inst[i].pos = -1;
+        v->inst[i].full = 0;
     }
+    _slab_free(v->samps);
 
-done:
+    v->samps = samps;
+    v->times = times;
     v->vlen = vlen;
     v->type = type;
     v->mlen = mlen;
     v->num_inst = num_inst;
+    v->num_active_inst = 0;
+    for (i = 0; i < num_inst; i++) {
+        if (v->inst[i].pos >= 0)
+            ++v->num_active_inst;
+    }
+    _set_inst_ptrs(v, samp_size);
 }
 
 int mpr_value_remove_inst(mpr_value v, int idx)
 {
-    int i;
+    int i, samp_size;
     RETURN_ARG_UNLESS(idx >= 0 && idx < v->num_inst, v->num_inst);
-    free(v->inst[idx].samps);
-    free(v->inst[idx].times);
+    samp_size = v->vlen * mpr_type_get_size(v->type);
     if (v->inst[idx].pos >= 0)
         --v->num_active_inst;
+    /* shift values down; the last instance has no successor to read from */
+    if (idx < v->num_inst - 1) {
+        memmove(v->inst[idx].samps, v->inst[idx + 1].samps,
+                (v->num_inst - idx - 1) * v->mlen * samp_size);
+        memmove(v->inst[idx].times, v->inst[idx + 1].times,
+                (v->num_inst - idx - 1) * v->mlen * sizeof(mpr_time));
+    }
     for (i = idx + 1; i < v->num_inst; i++) {
-        /* shift values down */
-        memcpy(&(v->inst[i-1]), &(v->inst[i]), sizeof(mpr_value_buffer_t));
+        v->inst[i-1].pos = v->inst[i].pos;
+        v->inst[i-1].full = v->inst[i].full;
     }
     --v->num_inst;
     assert(v->num_inst >= 0);
-    v->inst = realloc(v->inst, sizeof(mpr_value_buffer_t) * v->num_inst);
+    if (!v->num_inst)
+        mpr_value_free(v);
+    else
+        v->inst = realloc(v->inst, sizeof(mpr_value_buffer_t) * v->num_inst);
     return v->num_inst;
 }
 
@@ -150,14 +185,12 @@ void mpr_value_set_samp(mpr_value v, int idx, void *s, mpr_time t)
 }
 
 void mpr_value_free(mpr_value v) {
-    int i;
     RETURN_UNLESS(v->inst);
-    for (i = 0; i < v->num_inst; i++) {
-        FUNC_IF(free, v->inst[i].samps);
-        FUNC_IF(free, v->inst[i].times);
-    }
+    _slab_free(v->samps);
     free(v->inst);
     v->inst = 0;
+    v->samps = 0;
+    v->times = 0;
 }
 
 #ifdef DEBUG
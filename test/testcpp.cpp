@@ -1,5 +1,6 @@
 
 #include <cstring>
+#include <cmath>
 #include <iostream>
 #include <cstdio>
 #include <cstdlib>
@@ -173,6 +174,16 @@ void instance_handler(Signal::Instance&& si, Signal::Event event, int length,
     std::cout << std::endl;
 }
 
+int check_instance_value(Signal& sig, Id id, float expected)
+{
+    const float *v = (const float*)sig.instance(id).value();
+    if (v && *v == expected)
+        return 0;
+    std::cout << "error: " << sig[Property::NAME] << "." << id << " should have value "
+              << expected << std::endl;
+    return 1;
+}
+
 void ctrlc(int sig)
 {
     done = 1;
@@ -445,6 +456,45 @@ int main(int argc, char ** argv)
         dev.poll(period);
     }
 
+    // test bulk updates of signal instances
+    out << "testing bulk instance updates" << std::endl;
+    mapper::Signal batchsend = dev.add_signal(Direction::OUTGOING, "batchsend", 1, Type::FLOAT,
+                                              0, 0, 0, &num_inst);
+    Id batch_ids[3] = {1, 2, 3};
+    float batch_vals[3] = {10.f, 20.f, 30.f};
+    batchsend.set_values(3, batch_ids, batch_vals);
+    for (i = 0; i < 3; i++)
+        result |= check_instance_value(batchsend, batch_ids[i], batch_vals[i]);
+
+    // all instances in one call share the timetag
+    Time batch_time;
+    mpr_time value_time;
+    batchsend.set_values(3, batch_ids, batch_vals, batch_time);
+    for (i = 0; i < 3; i++) {
+        if (!mpr_sig_get_value(batchsend, batch_ids[i], &value_time)
+            || mpr_time_cmp(*(mpr_time*)batch_time, value_time)) {
+            out << "error: batchsend." << batch_ids[i] << " should have the shared timetag"
+                << std::endl;
+            result = 1;
+        }
+    }
+
+    // repeated ids update the same instance, the last value wins
+    batchsend.set_values(std::vector<Id>({1, 1, 2}), std::vector<int>({5, 6, 7}));
+    result |= check_instance_value(batchsend, 1, 6);
+    result |= check_instance_value(batchsend, 2, 7);
+
+    // values containing NaN are skipped
+    batchsend.set_values(std::vector<Id>({1, 2}), std::vector<double>({NAN, 8}));
+    result |= check_instance_value(batchsend, 1, 6);
+    result |= check_instance_value(batchsend, 2, 8);
+
+    // only instances with a complete value in the vector are updated
+    batchsend.set_values(std::vector<Id>({1, 2, 3}), std::vector<float>({40, 50}));
+    result |= check_instance_value(batchsend, 1, 40);
+    result |= check_instance_value(batchsend, 2, 50);
+    result |= check_instance_value(batchsend, 3, 30);
+
     // test some time manipulation
     Time t1(10, 200);
     Time t2(10, 300);
@@ -350,6 +350,20 @@ void release_active_instances(mpr_sig sig)
         mpr_sig_release_inst(sig, mpr_sig_get_inst_id(sig, 0, MPR_STATUS_ACTIVE));
 }
 
+void print_active_idmaps(mpr_local_dev dev)
+{
+    int i;
+    mpr_id_map id_map;
+    mpr_id_map_tbl tbl = &dev->idmaps.active[0];
+    /* active id maps are hashed by local id */
+    for (i = 0; i < tbl->size; i++) {
+        for (id_map = tbl->LID[i]; id_map; id_map = id_map->next) {
+            printf("  LID*%d: %"PR_MPR_ID", GID*%d: %"PR_MPR_ID"\n", id_map->LID_refcount,
+                   id_map->LID, id_map->GID_refcount, id_map->GID);
+        }
+    }
+}
+
 void loop(instance_type src_type, instance_type dst_type)
 {
     int i = 0, j, num_parallel_inst = 5;
@@ -567,11 +581,7 @@ int run_test(test_config *config)
         ++result;
     }
 
-    id_map = &((mpr_local_dev)src)->idmaps.active[0];
-    while (*id_map) {
-        ++active_count;
-        id_map = &(*id_map)->next;
-    }
+    active_count = ((mpr_local_dev)src)->idmaps.active[0].num;
     id_map = &((mpr_local_dev)src)->idmaps.reserve;
     while (*id_map) {
         ++reserve_count;
@@ -580,21 +590,12 @@ int run_test(test_config *config)
     if (active_count > 1 || reserve_count > 5) {
         printf("Error: src device using %d active and %d reserve id maps (should be 0 and <=10)\n",
                active_count, reserve_count);
-        id_map = &((mpr_local_dev)src)->idmaps.active[0];
-        while (*id_map) {
-            printf("  LID*%d: %"PR_MPR_ID", GID*%d: %"PR_MPR_ID"\n", (*id_map)->LID_refcount,
-                   (*id_map)->LID, (*id_map)->GID_refcount, (*id_map)->GID);
-            id_map = &(*id_map)->next;
-        }
+        print_active_idmaps((mpr_local_dev)src);
         ++result;
     }
 
-    active_count = reserve_count = 0;
-    id_map = &((mpr_local_dev)dst)->idmaps.active[0];
-    while (*id_map) {
-        ++active_count;
-        id_map = &(*id_map)->next;
-    }
+    reserve_count = 0;
+    active_count = ((mpr_local_dev)dst)->idmaps.active[0].num;
     id_map = &((mpr_local_dev)dst)->idmaps.reserve;
     while (*id_map) {
         ++reserve_count;
@@ -603,12 +604,7 @@ int run_test(test_config *config)
     if (active_count > 1 || reserve_count >= 10) {
         printf("Error: dst device using %d active and %d reserve id maps (should be 0 and <10)\n",
                active_count, reserve_count);
-        id_map = &((mpr_local_dev)dst)->idmaps.active[0];
-        while (*id_map) {
-            printf("  LID*%d: %"PR_MPR_ID", GID*%d: %"PR_MPR_ID"\n", (*id_map)->LID_refcount,
-                   (*id_map)->LID, (*id_map)->GID_refcount, (*id_map)->GID);
-            id_map = &(*id_map)->next;
-        }
+        print_active_idmaps((mpr_local_dev)dst);
         ++result;
     }
 
@@ -641,6 +637,486 @@ int run_test(test_config *config)
     return result;
 }
 
+/*! Removed instances should return to the signal's pool and be reused by later reservations. */
+int test_inst_pool()
+{
+    int i, j, num_inst = 10, result = 0;
+    mpr_sig sig;
+    mpr_local_sig lsig;
+    mpr_sig_inst removed[5];
+    void *slabs;
+
+    eprintf("Testing instance pool reuse... ");
+    sig = mpr_sig_new(src, MPR_DIR_OUT, "pool", 1, MPR_FLT, NULL, NULL, NULL, &num_inst, NULL, 0);
+    if (!sig)
+        return 1;
+    lsig = (mpr_local_sig)sig;
+    slabs = lsig->inst_slabs;
+
+    /* instances are sorted by id, so ids 0, 2, 4, 6 and 8 are at even positions */
+    for (i = 0; i < 5; i++)
+        removed[i] = lsig->inst[i * 2];
+    for (i = 0; i < 10; i += 2)
+        mpr_sig_remove_inst(sig, i);
+    if (mpr_sig_get_num_inst(sig, MPR_STATUS_ANY) != 5 || lsig->inst_pool_len != 5) {
+        printf("Error: expected 5 instances and 5 pooled after removal, got %d and %d\n",
+               mpr_sig_get_num_inst(sig, MPR_STATUS_ANY), lsig->inst_pool_len);
+        ++result;
+    }
+
+    /* the lowest unused ids are the removed ones, and their storage should be reused */
+    if (mpr_sig_reserve_inst(sig, 5, 0, 0) != 5) {
+        printf("Error: failed to reserve 5 instances from the pool\n");
+        ++result;
+    }
+    if (lsig->inst_slabs != slabs || lsig->inst_pool_len) {
+        printf("Error: reservation allocated new instance storage\n");
+        ++result;
+    }
+    for (i = 0; i < 10; i++) {
+        if (mpr_sig_get_inst_id(sig, i, MPR_STATUS_ANY) != i) {
+            printf("Error: expected instance id %d at index %d\n", i, i);
+            ++result;
+        }
+        if (i % 2)
+            continue;
+        for (j = 0; j < 5 && removed[j] != lsig->inst[i]; j++) ;
+        if (j == 5) {
+            printf("Error: instance %d does not reuse pooled memory\n", i);
+            ++result;
+        }
+    }
+
+    mpr_sig_free(sig);
+    eprintf("%s\n", result ? "FAILED" : "PASSED");
+    return result;
+}
+
+/*! Reservations are capped at 128 instances unless the limit is raised. */
+int test_max_inst()
+{
+    int i, num_inst = 0, max_inst = 300, result = 0;
+    float valf, *val;
+    mpr_sig sig;
+
+    eprintf("Testing instance limit... ");
+    sig = mpr_sig_new(src, MPR_DIR_OUT, "maxinst", 1, MPR_FLT, NULL, NULL, NULL, &num_inst, NULL, 0);
+    if (!sig)
+        return 1;
+
+    if (mpr_sig_reserve_inst(sig, max_inst, 0, 0) != 128) {
+        printf("Error: expected reservation to stop at the default limit of 128 instances\n");
+        ++result;
+    }
+    if (mpr_sig_set_max_inst(sig, max_inst) != max_inst) {
+        printf("Error: failed to raise the instance limit to %d\n", max_inst);
+        ++result;
+    }
+    mpr_sig_reserve_inst(sig, max_inst, 0, 0);
+    if (mpr_sig_get_num_inst(sig, MPR_STATUS_ANY) != max_inst) {
+        printf("Error: signal has %d instances (should be %d)\n",
+               mpr_sig_get_num_inst(sig, MPR_STATUS_ANY), max_inst);
+        ++result;
+    }
+    if (mpr_sig_set_max_inst(sig, 10) != max_inst) {
+        printf("Error: instance limit should not drop below the number of instances\n");
+        ++result;
+    }
+
+    /* every reserved instance should also be able to hold an id map */
+    for (i = 0; i < max_inst; i++) {
+        valf = i * 1.0f;
+        mpr_sig_set_value(sig, i, 1, MPR_FLT, &valf);
+    }
+    if (mpr_sig_get_num_inst(sig, MPR_STATUS_ACTIVE) != max_inst) {
+        printf("Error: signal has %d active instances (should be %d)\n",
+               mpr_sig_get_num_inst(sig, MPR_STATUS_ACTIVE), max_inst);
+        ++result;
+    }
+    for (i = 0; i < max_inst; i++) {
+        val = (float*)mpr_sig_get_value(sig, i, 0);
+        if (!val || *val != i * 1.0f) {
+            printf("Error: instance %d has the wrong value\n", i);
+            ++result;
+            break;
+        }
+    }
+
+    release_active_instances(sig);
+    mpr_sig_free(sig);
+    eprintf("%s\n", result ? "FAILED" : "PASSED");
+    return result;
+}
+
+mpr_id stolen = 0;
+int num_stolen = 0;
+
+/*! Release instances that are stolen to make room for a local update. */
+void steal_handler(mpr_sig sig, mpr_sig_evt e, mpr_id inst, int len, mpr_type type,
+                   const void *val, mpr_time t)
+{
+    if (val)
+        return;
+    eprintf("--> stealing instance %"PR_MPR_ID"\n", inst);
+    stolen = inst;
+    ++num_stolen;
+    mpr_sig_release_inst(sig, inst);
+}
+
+int has_inst_id(mpr_sig sig, mpr_id id)
+{
+    int i, n = mpr_sig_get_num_inst(sig, MPR_STATUS_ANY);
+    for (i = 0; i < n; i++) {
+        if (mpr_sig_get_inst_id(sig, i, MPR_STATUS_ANY) == id)
+            return 1;
+    }
+    return 0;
+}
+
+/*! Full signals should steal the oldest or newest active instance as configured. */
+int test_steal()
+{
+    int num_inst = 3, stl = MPR_STEAL_OLDEST, result = 0;
+    mpr_id i;
+    float valf = 0;
+    mpr_sig sig;
+
+    eprintf("Testing instance stealing... ");
+    sig = mpr_sig_new(src, MPR_DIR_OUT, "steal", 1, MPR_FLT, NULL, NULL, NULL, &num_inst,
+                      steal_handler, MPR_SIG_UPDATE);
+    if (!sig)
+        return 1;
+    mpr_obj_set_prop((mpr_obj)sig, MPR_PROP_STEAL_MODE, NULL, 1, MPR_INT32, &stl, 1);
+
+    /* activate instances in order, polling between them so that creation times differ */
+    for (i = 10; i < 13; i++) {
+        mpr_sig_set_value(sig, i, 1, MPR_FLT, &valf);
+        mpr_dev_poll(src, 10);
+    }
+    if (mpr_sig_get_oldest_inst_id(sig) != 10 || mpr_sig_get_newest_inst_id(sig) != 12) {
+        printf("Error: oldest and newest instances are %"PR_MPR_ID" and %"PR_MPR_ID
+               " (should be 10 and 12)\n", mpr_sig_get_oldest_inst_id(sig),
+               mpr_sig_get_newest_inst_id(sig));
+        ++result;
+    }
+
+    num_stolen = 0;
+    mpr_sig_set_value(sig, 13, 1, MPR_FLT, &valf);
+    if (num_stolen != 1 || stolen != 10 || !mpr_sig_get_inst_is_active(sig, 13)) {
+        printf("Error: activating instance 13 should steal oldest instance 10\n");
+        ++result;
+    }
+    mpr_dev_poll(src, 10);
+
+    stl = MPR_STEAL_NEWEST;
+    mpr_obj_set_prop((mpr_obj)sig, MPR_PROP_STEAL_MODE, NULL, 1, MPR_INT32, &stl, 1);
+    num_stolen = 0;
+    mpr_sig_set_value(sig, 14, 1, MPR_FLT, &valf);
+    if (num_stolen != 1 || stolen != 13 || !mpr_sig_get_inst_is_active(sig, 14)) {
+        printf("Error: activating instance 14 should steal newest instance 13\n");
+        ++result;
+    }
+    if (mpr_sig_get_oldest_inst_id(sig) != 11 || mpr_sig_get_newest_inst_id(sig) != 14) {
+        printf("Error: oldest and newest instances are %"PR_MPR_ID" and %"PR_MPR_ID
+               " (should be 11 and 14)\n", mpr_sig_get_oldest_inst_id(sig),
+               mpr_sig_get_newest_inst_id(sig));
+        ++result;
+    }
+
+    release_active_instances(sig);
+    mpr_sig_free(sig);
+    eprintf("%s\n", result ? "FAILED" : "PASSED");
+    return result;
+}
+
+/*! New instance ids should take over the released instance with the lowest id, regardless of
+ *  the order in which instances were released. */
+int test_lowest_id_reuse()
+{
+    int num_inst = 4, result = 0;
+    mpr_id i;
+    float valf = 0;
+    mpr_sig sig;
+
+    eprintf("Testing reuse of released instances... ");
+    sig = mpr_sig_new(src, MPR_DIR_OUT, "reuse", 1, MPR_FLT, NULL, NULL, NULL, &num_inst, NULL, 0);
+    if (!sig)
+        return 1;
+
+    for (i = 0; i < 4; i++)
+        mpr_sig_set_value(sig, i, 1, MPR_FLT, &valf);
+    mpr_sig_release_inst(sig, 2);
+    mpr_sig_release_inst(sig, 1);
+
+    mpr_sig_set_value(sig, 50, 1, MPR_FLT, &valf);
+    if (has_inst_id(sig, 1) || !has_inst_id(sig, 2) || mpr_sig_get_inst_is_active(sig, 2)) {
+        printf("Error: instance 50 should reuse released instance 1\n");
+        ++result;
+    }
+    mpr_sig_set_value(sig, 51, 1, MPR_FLT, &valf);
+    if (has_inst_id(sig, 2) || !mpr_sig_get_inst_is_active(sig, 51)) {
+        printf("Error: instance 51 should reuse released instance 2\n");
+        ++result;
+    }
+    if (mpr_sig_get_num_inst(sig, MPR_STATUS_ACTIVE) != 4) {
+        printf("Error: signal has %d active instances (should be 4)\n",
+               mpr_sig_get_num_inst(sig, MPR_STATUS_ACTIVE));
+        ++result;
+    }
+
+    release_active_instances(sig);
+    mpr_sig_free(sig);
+    eprintf("%s\n", result ? "FAILED" : "PASSED");
+    return result;
+}
+
+int batch_updates = 0;
+int batch_releases = 0;
+
+void batch_handler(mpr_sig sig, mpr_sig_evt e, mpr_id inst, int len, mpr_type type,
+                   const void *val, mpr_time t)
+{
+    if (val) {
+        eprintf("--> destination instance %i got %f\n", (int)inst, (*(float*)val));
+        ++batch_updates;
+    }
+    else {
+        eprintf("--> destination instance %i released\n", (int)inst);
+        ++batch_releases;
+        mpr_sig_release_inst(sig, inst);
+    }
+}
+
+/*! Return the id of the active instance holding a value, or -1 if there is none. */
+int find_inst_with_value(mpr_sig sig, float valf)
+{
+    int i, n = mpr_sig_get_num_inst(sig, MPR_STATUS_ACTIVE);
+    for (i = 0; i < n; i++) {
+        mpr_id id = mpr_sig_get_inst_id(sig, i, MPR_STATUS_ACTIVE);
+        float *val = (float*)mpr_sig_get_value(sig, id, 0);
+        if (val && *val == valf)
+            return (int)id;
+    }
+    return -1;
+}
+
+int check_inst_value(mpr_sig sig, mpr_id id, float valf)
+{
+    float *val = (float*)mpr_sig_get_value(sig, id, 0);
+    if (val && *val == valf)
+        return 0;
+    printf("Error: %s instance %d should have value %f\n",
+           mpr_obj_get_prop_as_str((mpr_obj)sig, MPR_PROP_NAME, NULL), (int)id, valf);
+    return 1;
+}
+
+void sync_batch()
+{
+    batch_updates = batch_releases = 0;
+    mpr_dev_poll(src, 0);
+    mpr_dev_poll(dst, 100);
+    mpr_dev_poll(src, 0);
+    mpr_dev_poll(dst, 100);
+}
+
+/*! Update several instances of a mapped signal with one call to mpr_sig_set_values(). */
+int test_set_values()
+{
+    int i, num_inst = 3, stl = MPR_STEAL_OLDEST, use_inst = 1, result = 0, dst_ids[3];
+    mpr_id ids[3] = {1, 2, 3}, repeated[3] = {1, 1, 2}, stealing[2] = {4, 5};
+    float vals[3] = {10, 20, 30}, valf;
+    mpr_sig send, recv;
+    mpr_map map;
+    mpr_time t, t_val = {0, 0};
+
+    eprintf("Testing bulk instance updates...\n");
+    send = mpr_sig_new(src, MPR_DIR_OUT, "batchsend", 1, MPR_FLT, NULL, NULL, NULL, &num_inst,
+                       steal_handler, MPR_SIG_UPDATE);
+    recv = mpr_sig_new(dst, MPR_DIR_IN, "batchrecv", 1, MPR_FLT, NULL, NULL, NULL, &num_inst,
+                       batch_handler, MPR_SIG_UPDATE | MPR_SIG_REL_UPSTRM);
+    if (!send || !recv)
+        return 1;
+    mpr_obj_set_prop((mpr_obj)send, MPR_PROP_STEAL_MODE, NULL, 1, MPR_INT32, &stl, 1);
+
+    map = mpr_map_new(1, &send, 1, &recv);
+    mpr_obj_set_prop((mpr_obj)map, MPR_PROP_USE_INST, NULL, 1, MPR_BOOL, &use_inst, 1);
+    mpr_obj_push((mpr_obj)map);
+    while (!done && !mpr_map_get_is_ready(map)) {
+        mpr_dev_poll(src, 100);
+        mpr_dev_poll(dst, 100);
+    }
+
+    /* several instances in one call share the timetag */
+    t = mpr_dev_get_time(src);
+    mpr_sig_set_values(send, 3, ids, 1, MPR_FLT, vals, t);
+    for (i = 0; i < 3; i++) {
+        result += check_inst_value(send, ids[i], vals[i]);
+        mpr_sig_get_value(send, ids[i], &t_val);
+        if (mpr_time_cmp(t, t_val)) {
+            printf("Error: instance %d does not have the shared timetag\n", (int)ids[i]);
+            ++result;
+        }
+    }
+    sync_batch();
+    if (batch_updates != 3) {
+        printf("Error: destination received %d updates (should be 3)\n", batch_updates);
+        ++result;
+    }
+    for (i = 0; i < 3; i++) {
+        if ((dst_ids[i] = find_inst_with_value(recv, vals[i])) < 0) {
+            printf("Error: no destination instance received value %f\n", vals[i]);
+            eprintf("FAILED\n");
+            return 1;
+        }
+    }
+
+    /* each map instance should keep receiving its own source instance */
+    for (i = 0; i < 3; i++)
+        vals[i] += 1;
+    mpr_sig_set_values(send, 3, ids, 1, MPR_FLT, vals, mpr_dev_get_time(src));
+    sync_batch();
+    for (i = 0; i < 3; i++)
+        result += check_inst_value(recv, dst_ids[i], vals[i]);
+
+    /* repeated ids update the same instance, which is sent once with the last value */
+    vals[0] = 5;
+    vals[1] = 6;
+    vals[2] = 7;
+    mpr_sig_set_values(send, 3, repeated, 1, MPR_FLT, vals, mpr_dev_get_time(src));
+    result += check_inst_value(send, 1, 6);
+    result += check_inst_value(send, 2, 7);
+    sync_batch();
+    if (batch_updates != 2) {
+        printf("Error: destination received %d updates (should be 2)\n", batch_updates);
+        ++result;
+    }
+    result += check_inst_value(recv, dst_ids[0], 6);
+    result += check_inst_value(recv, dst_ids[1], 7);
+
+    /* values containing NaN are skipped */
+    vals[0] = NAN;
+    vals[1] = 8;
+    mpr_sig_set_values(send, 2, ids, 1, MPR_FLT, vals, mpr_dev_get_time(src));
+    result += check_inst_value(send, 1, 6);
+    result += check_inst_value(send, 2, 8);
+    sync_batch();
+    if (batch_updates != 1) {
+        printf("Error: destination received %d updates (should be 1)\n", batch_updates);
+        ++result;
+    }
+    result += check_inst_value(recv, dst_ids[0], 6);
+    result += check_inst_value(recv, dst_ids[1], 8);
+
+    /* a null value array releases the instances */
+    mpr_sig_set_values(send, 3, ids, 1, MPR_FLT, NULL, mpr_dev_get_time(src));
+    if (mpr_sig_get_num_inst(send, MPR_STATUS_ACTIVE)) {
+        printf("Error: source instances should have been released\n");
+        ++result;
+    }
+    sync_batch();
+    if (batch_releases != 3 || mpr_sig_get_num_inst(recv, MPR_STATUS_ACTIVE)) {
+        printf("Error: destination received %d releases (should be 3)\n", batch_releases);
+        ++result;
+    }
+
+    /* activating instances in a full batch steals the oldest ones */
+    for (i = 0; i < 3; i++) {
+        valf = ids[i] * 10.0f;
+        mpr_sig_set_value(send, ids[i], 1, MPR_FLT, &valf);
+        mpr_dev_poll(src, 10);
+    }
+    sync_batch();
+    num_stolen = 0;
+    vals[0] = 40;
+    vals[1] = 50;
+    mpr_sig_set_values(send, 2, stealing, 1, MPR_FLT, vals, mpr_dev_get_time(src));
+    if (num_stolen != 2 || stolen != 2 || mpr_sig_get_inst_is_active(send, 1)
+        || !mpr_sig_get_inst_is_active(send, 3)) {
+        printf("Error: batch should have stolen source instances 1 and 2\n");
+        ++result;
+    }
+    result += check_inst_value(send, 4, 40);
+    result += check_inst_value(send, 5, 50);
+    sync_batch();
+    if (batch_releases != 2) {
+        printf("Error: destination received %d releases (should be 2)\n", batch_releases);
+        ++result;
+    }
+    if (find_inst_with_value(recv, 30) < 0 || find_inst_with_value(recv, 40) < 0
+        || find_inst_with_value(recv, 50) < 0) {
+        printf("Error: destination instances should hold values 30, 40 and 50\n");
+        ++result;
+    }
+
+    release_active_instances(send);
+    sync_batch();
+    mpr_sig_free(send);
+    mpr_sig_free(recv);
+    mpr_dev_poll(src, 100);
+    mpr_dev_poll(dst, 100);
+    eprintf("Bulk instance updates %s\n", result ? "FAILED" : "PASSED");
+    return result;
+}
+
+/*! Removing the instance stored last should shrink the map's instance storage. */
+int test_remove_mapped_inst()
+{
+    int i, num_inst = 3, use_inst = 1, result = 0;
+    mpr_id ids[3] = {0, 1, 2};
+    float vals[3] = {10, 20, 30};
+    mpr_sig send, recv;
+    mpr_local_slot slot;
+    mpr_map map;
+
+    eprintf("Testing removal of the last instance of a mapped signal...\n");
+    send = mpr_sig_new(src, MPR_DIR_OUT, "removesend", 1, MPR_FLT, NULL, NULL, NULL, &num_inst,
+                       NULL, 0);
+    recv = mpr_sig_new(dst, MPR_DIR_IN, "removerecv", 1, MPR_FLT, NULL, NULL, NULL, &num_inst,
+                       batch_handler, MPR_SIG_UPDATE | MPR_SIG_REL_UPSTRM);
+    if (!send || !recv)
+        return 1;
+
+    map = mpr_map_new(1, &send, 1, &recv);
+    mpr_obj_set_prop((mpr_obj)map, MPR_PROP_USE_INST, NULL, 1, MPR_BOOL, &use_inst, 1);
+    mpr_obj_push((mpr_obj)map);
+    while (!done && !mpr_map_get_is_ready(map)) {
+        mpr_dev_poll(src, 100);
+        mpr_dev_poll(dst, 100);
+    }
+
+    mpr_sig_set_values(send, 3, ids, 1, MPR_FLT, vals, mpr_dev_get_time(src));
+    sync_batch();
+
+    /* instance 2 was reserved last, so its history is stored last in the map slot */
+    mpr_sig_remove_inst(send, 2);
+    slot = ((mpr_local_sig)send)->rsig ? ((mpr_local_sig)send)->rsig->slots[0] : 0;
+    if (mpr_sig_get_num_inst(send, MPR_STATUS_ANY) != 2 || !slot || slot->num_inst != 2) {
+        printf("Error: removing instance 2 should leave 2 signal and slot instances\n");
+        ++result;
+    }
+    sync_batch();
+
+    /* the remaining instances should still be mapped */
+    for (i = 0; i < 2; i++)
+        vals[i] += 1;
+    mpr_sig_set_values(send, 2, ids, 1, MPR_FLT, vals, mpr_dev_get_time(src));
+    sync_batch();
+    if (batch_updates != 2 || find_inst_with_value(recv, 11) < 0
+        || find_inst_with_value(recv, 21) < 0) {
+        printf("Error: remaining instances should still update the destination\n");
+        ++result;
+    }
+
+    release_active_instances(send);
+    sync_batch();
+    mpr_sig_free(send);
+    mpr_sig_free(recv);
+    mpr_dev_poll(src, 100);
+    mpr_dev_poll(dst, 100);
+    eprintf("Removal of mapped instances %s\n", result ? "FAILED" : "PASSED");
+    return result;
+}
+
 int main(int argc, char **argv)
 {
     int i, j, k, result = 0;
@@ -739,6 +1215,20 @@ int main(int argc, char **argv)
         ++i;
     }
 
+    /* these leave id maps in the device reserve, so run them after the map configurations */
+    if (!done)
+        result |= test_inst_pool();
+    if (!done)
+        result |= test_max_inst();
+    if (!done)
+        result |= test_steal();
+    if (!done)
+        result |= test_lowest_id_reuse();
+    if (!done)
+        result |= test_set_values();
+    if (!done)
+        result |= test_remove_mapped_inst();
+
   done:
     cleanup_dst();
     cleanup_src();
@@ -21,9 +21,20 @@ mpr_dev dev = 0;
 mpr_sig sendsig = 0;
 mpr_sig recvsig = 0;
 mpr_sig sig3 = 0;
+mpr_sig vecsend = 0;
+mpr_sig vecrecv = 0;
+mpr_sig chain_a = 0;
+mpr_sig chain_b = 0;
+mpr_sig chain_c = 0;
 
 int sent = 0;
 int received = 0;
+int vec_sent = 0;
+int vec_received = 0;
+int vec_expected[2];
+int chain_sent = 0;
+int chain_received = 0;
+float chain_expected;
 
 float M, B, expected;
 
@@ -51,6 +62,34 @@ void handler(mpr_sig sig, mpr_sig_evt event, mpr_id instance, int length,
         eprintf(" expected %f\n", expected);
 }
 
+void vec_handler(mpr_sig sig, mpr_sig_evt event, mpr_id instance, int length,
+                 mpr_type type, const void *value, mpr_time t)
+{
+    const double *d = (const double*)value;
+    if (!value)
+        return;
+    eprintf("handler: signal %s got value [%f, %f], time %f\n",
+            mpr_obj_get_prop_as_str(sig, MPR_PROP_NAME, 0), d[0], d[1], mpr_time_as_dbl(t));
+    if (MPR_DBL == type && 2 == length && d[0] == vec_expected[0] * 2
+        && d[1] == vec_expected[1] * 2)
+        vec_received++;
+    else
+        eprintf(" expected [%d, %d]\n", vec_expected[0] * 2, vec_expected[1] * 2);
+}
+
+void chain_handler(mpr_sig sig, mpr_sig_evt event, mpr_id instance, int length,
+                   mpr_type type, const void *value, mpr_time t)
+{
+    if (!value)
+        return;
+    eprintf("handler: signal %s got value %f, time %f\n",
+            mpr_obj_get_prop_as_str(sig, MPR_PROP_NAME, 0), *(float*)value, mpr_time_as_dbl(t));
+    if (MPR_FLT == type && *(float*)value == chain_expected)
+        chain_received++;
+    else
+        eprintf(" expected %f\n", chain_expected);
+}
+
 int setup(const char *iface)
 {
     int mni=0, mxi=1;
@@ -129,6 +168,132 @@ int setup_maps()
     return 0;
 }
 
+/* Map an integer vector to a double vector so that the values passed over the local link differ
+ * in size from the source values. */
+int setup_type_test()
+{
+    mpr_map map;
+
+    vecsend = mpr_sig_new(dev, MPR_DIR_IN, "vecsend", 2, MPR_INT32, NULL,
+                          NULL, NULL, NULL, NULL, 0);
+    vecrecv = mpr_sig_new(dev, MPR_DIR_IN, "vecrecv", 2, MPR_DBL, NULL,
+                          NULL, NULL, NULL, vec_handler, MPR_SIG_UPDATE);
+    eprintf("Signals 'vecsend' and 'vecrecv' registered.\n");
+
+    map = mpr_map_new(1, &vecsend, 1, &vecrecv);
+    mpr_obj_set_prop(map, MPR_PROP_EXPR, NULL, 1, MPR_STR, "y=x*2", 1);
+    mpr_obj_push(map);
+
+    /* Wait until mapping has been established */
+    while (!done && !mpr_map_get_is_ready(map)) {
+        mpr_dev_poll(dev, 10);
+    }
+
+    eprintf("map initialized with expression '%s'\n",
+            mpr_obj_get_prop_as_str(map, MPR_PROP_EXPR, NULL));
+
+    return 0;
+}
+
+void type_loop()
+{
+    int i = 0;
+
+    while (i < 10 && !done) {
+        vec_expected[0] = i;
+        vec_expected[1] = -i;
+        mpr_sig_set_value(vecsend, 0, 2, MPR_INT32, vec_expected);
+        vec_sent++;
+        mpr_dev_poll(dev, period);
+        i++;
+    }
+}
+
+/* Map chain_a -> chain_b -> chain_c, where the intermediate signal chain_b has no handler so
+ * that both maps can be evaluated in a single pass. */
+int setup_chain_test()
+{
+    mpr_map map1, map2;
+
+    chain_a = mpr_sig_new(dev, MPR_DIR_IN, "chain_a", 1, MPR_FLT, NULL,
+                          NULL, NULL, NULL, NULL, 0);
+    chain_b = mpr_sig_new(dev, MPR_DIR_IN, "chain_b", 1, MPR_FLT, NULL,
+                          NULL, NULL, NULL, NULL, 0);
+    chain_c = mpr_sig_new(dev, MPR_DIR_IN, "chain_c", 1, MPR_FLT, NULL,
+                          NULL, NULL, NULL, chain_handler, MPR_SIG_UPDATE);
+    eprintf("Signals 'chain_a', 'chain_b' and 'chain_c' registered.\n");
+
+    map1 = mpr_map_new(1, &chain_a, 1, &chain_b);
+    mpr_obj_set_prop(map1, MPR_PROP_EXPR, NULL, 1, MPR_STR, "y=x+1", 1);
+    mpr_obj_push(map1);
+
+    map2 = mpr_map_new(1, &chain_b, 1, &chain_c);
+    mpr_obj_set_prop(map2, MPR_PROP_EXPR, NULL, 1, MPR_STR, "y=x*2", 1);
+    mpr_obj_push(map2);
+
+    /* Wait until mappings have been established */
+    while (!done && !(mpr_map_get_is_ready(map1) && mpr_map_get_is_ready(map2))) {
+        mpr_dev_poll(dev, 10);
+    }
+
+    eprintf("map chain initialized.\n");
+
+    return 0;
+}
+
+/* Each update to chain_a must reach chain_c within the same poll. */
+int chain_loop()
+{
+    int i = 0, received;
+    float val;
+
+    while (i < 10 && !done) {
+        val = i;
+        chain_expected = (val + 1) * 2;
+        received = chain_received;
+        mpr_sig_set_value(chain_a, 0, 1, MPR_FLT, &val);
+        chain_sent++;
+        mpr_dev_poll(dev, 0);
+        if (chain_received != received + 1) {
+            eprintf("Update to chain_a was not delivered to chain_c in a single poll.\n");
+            return 1;
+        }
+        i++;
+    }
+    return 0;
+}
+
+/* Update the intermediate signal directly in the same cycle as the start of the chain; the
+ * upstream update must still reach chain_b, and chain_c receives the direct update. */
+int chain_direct_loop()
+{
+    int i = 0, received;
+    float val, direct;
+    const float *b_val;
+
+    while (i < 10 && !done) {
+        val = i;
+        direct = 100 + i;
+        chain_expected = direct * 2;
+        received = chain_received;
+        mpr_sig_set_value(chain_b, 0, 1, MPR_FLT, &direct);
+        mpr_sig_set_value(chain_a, 0, 1, MPR_FLT, &val);
+        chain_sent++;
+        mpr_dev_poll(dev, period);
+        if (chain_received != received + 1) {
+            eprintf("Direct update to chain_b was not delivered to chain_c.\n");
+            return 1;
+        }
+        b_val = (const float*)mpr_sig_get_value(chain_b, 0, 0);
+        if (!b_val || *b_val != val + 1) {
+            eprintf("Upstream update to chain_b was dropped.\n");
+            return 1;
+        }
+        i++;
+    }
+    return 0;
+}
+
 int setup_loop_test()
 {
     mpr_map map1, map2;
@@ -257,6 +422,26 @@ int main(int argc, char **argv)
 
     loop();
 
+    if (autoconnect && setup_type_test()) {
+        eprintf("Error initializing type test maps.\n");
+        result = 1;
+        goto done;
+    }
+
+    type_loop();
+
+    if (autoconnect && setup_chain_test()) {
+        eprintf("Error initializing map chain.\n");
+        result = 1;
+        goto done;
+    }
+
+    if (autoconnect && (chain_loop() || chain_direct_loop())) {
+        eprintf("Map chain test failed.\n");
+        result = 1;
+        goto done;
+    }
+
     if (autoconnect && setup_loop_test()) {
         eprintf("Error initializing additional maps.\n");
         result = 1;
@@ -273,6 +458,13 @@ int main(int argc, char **argv)
         result = 1;
     }
 
+    if (autoconnect && (!vec_received || vec_sent != vec_received)) {
+        eprintf("Not all vector updates with mismatched types were received.\n");
+        eprintf("Updated value %d time%s and received %d of them.\n",
+                vec_sent, vec_sent == 1 ? "" : "s", vec_received);
+        result = 1;
+    }
+
   done:
     cleanup();
     printf("...................Test %s\x1B[0m.\n",
@@ -17,7 +17,10 @@
 #define MAX_STR_LEN 256
 #define SRC_ARRAY_LEN 3
 #define DST_ARRAY_LEN 6
-#define MAX_VARS 8
+#define MAX_VARS 32
+#define SIMD_VEC_LEN 512
+#define BATCH_NUM_INST 16
+#define BATCH_VEC_LEN 4
 
 int verbose = 1;
 char str[MAX_STR_LEN];
@@ -26,12 +29,18 @@ int iterations = 20000;
 int expression_count = 1;
 int token_count = 0;
 int update_count;
+int use_bytecode = 1;
+int compiled_count = 0;
+int jit_check = 0;
+int jit_count = 0;
+const char *simd_name = 0;
 
 int src_int[SRC_ARRAY_LEN], dst_int[DST_ARRAY_LEN], expect_int[DST_ARRAY_LEN];
 float src_flt[SRC_ARRAY_LEN], dst_flt[DST_ARRAY_LEN], expect_flt[DST_ARRAY_LEN];
 double src_dbl[SRC_ARRAY_LEN], dst_dbl[DST_ARRAY_LEN], expect_dbl[DST_ARRAY_LEN];
 double then, now;
 double total_elapsed_time = 0;
+double total_eval_time = 0;
 mpr_type out_types[DST_ARRAY_LEN];
 
 mpr_time time_in = {0, 0}, time_out = {0, 0};
@@ -84,8 +93,8 @@ typedef struct _var {
     char *name;
     mpr_type datatype;
     mpr_type casttype;
-    uint8_t vec_len;
     uint8_t flags;
+    int vec_len;
 } mpr_var_t, *mpr_var;
 
 struct _mpr_expr
@@ -93,17 +102,17 @@ struct _mpr_expr
     void *tokens;
     void *start;
     mpr_var vars;
-    uint8_t offset;
-    uint8_t n_tokens;
-    uint8_t stack_size;
-    uint8_t vec_size;
-    uint16_t *in_mem;
-    uint16_t out_mem;
-    uint8_t n_vars;
-    int8_t inst_ctl;
-    int8_t mute_ctl;
+    int offset;
+    int n_tokens;
+    int stack_size;
+    int vec_size;
+    int *in_mem;
+    int out_mem;
+    int max_in_mem;
+    int16_t n_vars;
+    int16_t inst_ctl;
+    int16_t mute_ctl;
     int8_t n_ins;
-    uint16_t max_in_mem;
 };
 
 /*! A helper function to seed the random number generator. */
@@ -271,31 +280,13 @@ void setup_test(mpr_type in_type, int in_len, mpr_type out_type, int out_len)
 #define EXPECT_SUCCESS 0
 #define EXPECT_FAILURE 1
 
-int parse_and_eval(int expectation, int max_tokens, int check, int exp_updates)
+/* reset the input, output and variable values of the current expression */
+void init_values()
 {
-    /* clear output arrays */
-    int i, j, result = 0, mlen, status;
-
-    if (verbose) {
-        printf("***************** Expression %d *****************\n", expression_count++);
-        printf("Parsing string '%s'\n", str);
-    }
-    else {
-        printf("\rExpression %d", expression_count++);
-        fflush(stdout);
-    }
-    e = mpr_expr_new_from_str(eval_stk, str, n_sources, src_types, src_lens, dst_type, dst_len);
-    if (!e) {
-        eprintf("Parser FAILED (expression %d)\n", expression_count - 1);
-        goto fail;
-    }
-    else if (EXPECT_FAILURE == expectation) {
-        eprintf("Error: expected FAILURE\n");
-        result = 1;
-        goto free;
-    }
+    int i, mlen;
     mpr_time_set(&time_in, MPR_NOW);
     for (i = 0; i < n_sources; i++) {
+
         mpr_value_reset_inst(&inh[i], 0);
         mlen = mpr_expr_get_in_hist_size(e, i);
         mpr_value_realloc(&inh[i], src_lens[i], src_types[i], mlen, 1, 0);
@@ -317,11 +308,6 @@ int parse_and_eval(int expectation, int max_tokens, int check, int exp_updates)
     mlen = mpr_expr_get_out_hist_size(e);
     mpr_value_realloc(&outh, dst_len, dst_type, mlen, 1, 1);
 
-    if (mpr_expr_get_num_vars(e) > MAX_VARS) {
-        eprintf("Maximum variables exceeded.\n");
-        goto fail;
-    }
-
     /* reallocate variable value histories */
     for (i = 0; i < e->n_vars; i++) {
         int vlen = mpr_expr_get_var_vec_len(e, i);
@@ -331,7 +317,99 @@ int parse_and_eval(int expectation, int max_tokens, int check, int exp_updates)
     }
     user_vars_p = user_vars;
 
-    eprintf("Parser returned %d tokens...", e->n_tokens);
+}
+
+/* evaluate the current expression n times, returning the number of updates */
+int eval_iterations(int n)
+{
+    int j, status, updates = 0;
+    while (n--) {
+        /* update timestamp */
+        mpr_time_set(&time_in, MPR_NOW);
+        /* copy src values */
+        for (j = 0; j < n_sources; j++) {
+            switch (inh[j].type) {
+                case MPR_INT32:
+                    mpr_value_set_samp(&inh[j], 0, src_int, time_in);
+                    break;
+                case MPR_FLT:
+                    mpr_value_set_samp(&inh[j], 0, src_flt, time_in);
+                    break;
+                case MPR_DBL:
+                    mpr_value_set_samp(&inh[j], 0, src_dbl, time_in);
+                    break;
+                default:
+                    assert(0);
+            }
+        }
+        status = mpr_expr_eval(eval_stk, e, inh_p, &user_vars_p, &outh, &time_in, out_types, 0);
+        if (status & MPR_SIG_UPDATE)
+            ++updates;
+        /* sleep here stops compiler from optimizing loop away */
+        usleep(1);
+    }
+    return updates;
+}
+
+/* evaluate the current expression again from its initial state with the interpreter and check
+ * that the output matches the one computed by the JIT-compiled expression */
+int cross_check_jit()
+{
+    char expect[sizeof(double) * DST_ARRAY_LEN];
+    mpr_type expect_types[DST_ARRAY_LEN];
+    int pos = outh.inst[0].pos, size = dst_len * mpr_type_get_size(dst_type), result = 0;
+
+    if (pos >= 0)
+        memcpy(expect, mpr_value_get_samp(&outh, 0), size);
+    memcpy(expect_types, out_types, sizeof(mpr_type) * dst_len);
+
+    eprintf("Cross-checking JIT against interpreter... ");
+    init_values();
+    mpr_expr_set_use_bytecode(e, 0);
+    eval_iterations(iterations);
+    mpr_expr_set_use_bytecode(e, 1);
+
+    if (outh.inst[0].pos != pos || memcmp(expect_types, out_types, sizeof(mpr_type) * dst_len))
+        result = 1;
+    else if (pos >= 0 && memcmp(expect, mpr_value_get_samp(&outh, 0), size))
+        result = 1;
+    eprintf(result ? "FAILED.\n" : "OK\n");
+    return result;
+}
+
+int parse_and_eval(int expectation, int max_tokens, int check, int exp_updates)
+{
+    /* clear output arrays */
+    int i, result = 0, status;
+
+    if (verbose) {
+        printf("***************** Expression %d *****************\n", expression_count++);
+        printf("Parsing string '%s'\n", str);
+    }
+    else {
+        printf("\rExpression %d", expression_count++);
+        fflush(stdout);
+    }
+    e = mpr_expr_new_from_str(eval_stk, str, n_sources, src_types, src_lens, dst_type, dst_len);
+    if (!e) {
+        eprintf("Parser FAILED (expression %d)\n", expression_count - 1);
+        goto fail;
+    }
+    else if (EXPECT_FAILURE == expectation) {
+        eprintf("Error: expected FAILURE\n");
+        result = 1;
+        goto free;
+    }
+    if (!use_bytecode)
+        mpr_expr_set_use_bytecode(e, 0);
+    if (mpr_expr_get_num_vars(e) > MAX_VARS) {
+        eprintf("Maximum variables exceeded.\n");
+        goto fail;
+    }
+    init_values();
+
+    eprintf("Parser returned %d tokens (%d before optimization)...", e->n_tokens,
+            mpr_expr_get_num_tokens(e, 0));
     if (max_tokens && e->n_tokens > max_tokens) {
         eprintf(" (expected %d)\n", max_tokens);
         result = 1;
@@ -362,44 +440,38 @@ int parse_and_eval(int expectation, int max_tokens, int check, int exp_updates)
     else if (status & MPR_SIG_UPDATE)
         ++update_count;
     eprintf("OK\n");
+    if (mpr_expr_get_uses_bytecode(e)) {
+        eprintf("Evaluating with bytecode.\n");
+        ++compiled_count;
+    }
 
     eprintf("Calculate expression %i more times... ", iterations-1);
     fflush(stdout);
-    i = iterations-1;
-    while (i--) {
-        /* update timestamp */
-        mpr_time_set(&time_in, MPR_NOW);
-        /* copy src values */
-        for (j = 0; j < n_sources; j++) {
-            switch (inh[j].type) {
-                case MPR_INT32:
-                    mpr_value_set_samp(&inh[j], 0, src_int, time_in);
-                    break;
-                case MPR_FLT:
-                    mpr_value_set_samp(&inh[j], 0, src_flt, time_in);
-                    break;
-                case MPR_DBL:
-                    mpr_value_set_samp(&inh[j], 0, src_dbl, time_in);
-                    break;
-                default:
-                    assert(0);
-            }
-        }
-        status = mpr_expr_eval(eval_stk, e, inh_p, &user_vars_p, &outh, &time_in, out_types, 0);
-        if (status & MPR_SIG_UPDATE)
-            ++update_count;
-        /* sleep here stops compiler from optimizing loop away */
-        usleep(1);
-    }
+    update_count += eval_iterations(iterations - 1);
     now = current_time();
     total_elapsed_time += now-then;
 
     if (0 == result)
         eprintf("OK\n");
 
+    if (mpr_expr_get_uses_jit(e)) {
+        eprintf("Evaluating with JIT-compiled bytecode.\n");
+        ++jit_count;
+        if (jit_check && check && cross_check_jit())
+            result = 1;
+    }
+
     if (check_result(out_types, outh.vlen, outh.inst[0].samps, outh.inst[0].pos, check))
         result = 1;
 
+    /* benchmark evaluation alone, now that the results have been checked */
+    then = current_time();
+    for (i = 0; i < iterations; i++)
+        mpr_expr_eval(eval_stk, e, inh_p, &user_vars_p, &outh, &time_in, out_types, 0);
+    now = current_time();
+    total_eval_time += now - then;
+    eprintf("Evaluation time: %g seconds for %d iterations.\n", now - then, iterations);
+
     eprintf("Recv'd %d updates... ", update_count);
     if (exp_updates >= 0 && exp_updates != update_count) {
         eprintf("error: expected %d\n", exp_updates);
@@ -426,7 +498,7 @@ fail:
 
 int run_tests()
 {
-    int i;
+    int i, j;
     mpr_type types[3] = {MPR_INT32, MPR_FLT, MPR_DBL};
     int lens[3] = {2, 3, 2};
 
@@ -573,13 +645,13 @@ int run_tests()
         return 1;
 
     /* 19) Invalid history index */
-    set_expr_str("y=x{-101}");
+    set_expr_str("y=x{-65537}");
     setup_test(MPR_INT32, 1, MPR_INT32, 1);
     if (parse_and_eval(EXPECT_FAILURE, 0, 1, iterations))
         return 1;
 
     /* 20) Invalid history index */
-    set_expr_str("y=x-y{-101}");
+    set_expr_str("y=x-y{-65537}");
     setup_test(MPR_INT32, 1, MPR_INT32, 1);
     if (parse_and_eval(EXPECT_FAILURE, 0, 1, iterations))
         return 1;
@@ -1442,9 +1514,483 @@ int run_tests()
     if (parse_and_eval(EXPECT_SUCCESS, 0, 1, iterations))
         return 1;
 
+    /* 113) Long history */
+    set_expr_str("y=x{-150}");
+    setup_test(MPR_INT32, 1, MPR_INT32, 1);
+    expect_int[0] = iterations > 150 ? src_int[0] : 0;
+    if (parse_and_eval(EXPECT_SUCCESS, 0, 1, iterations))
+        return 1;
+
+    /* 114) Many user variables */
+    j = snprintf(str, MAX_STR_LEN, "a0=x;");
+    for (i = 1; i < 24; i++)
+        j += snprintf(str + j, MAX_STR_LEN - j, "a%d=a%d+1;", i, i - 1);
+    snprintf(str + j, MAX_STR_LEN - j, "y=a%d;", i - 1);
+    setup_test(MPR_DBL, 1, MPR_DBL, 1);
+    expect_dbl[0] = src_dbl[0] + 23;
+    if (parse_and_eval(EXPECT_SUCCESS, 0, 1, iterations))
+        return 1;
+
+    /* 115) Filter functions: onepole() */
+    set_expr_str("y=onepole(x,0.9)");
+    setup_test(MPR_INT32, 1, MPR_FLT, 1);
+    expect_flt[0] = 0;
+    for (i = 0; i < iterations; i++)
+        expect_flt[0] = src_int[0] + 0.9f * (expect_flt[0] - src_int[0]);
+    if (parse_and_eval(EXPECT_SUCCESS, 0, 1, iterations))
+        return 1;
+
+    /* 116) Filter functions: biquad() with per-element coefficients */
+    set_expr_str("y=biquad(x,[0.2,0.4],0.3,0.1,-0.5,0.25)");
+    setup_test(MPR_DBL, 2, MPR_DBL, 2);
+    {
+        /* literals are parsed as floats */
+        double s[2][2] = {{0, 0}, {0, 0}}, b0[2] = {0.2f, 0.4f};
+        for (i = 0; i < iterations; i++) {
+            for (j = 0; j < 2; j++) {
+                expect_dbl[j] = b0[j] * src_dbl[j] + s[j][0];
+                s[j][0] = (double)0.3f * src_dbl[j] + 0.5 * expect_dbl[j] + s[j][1];
+                s[j][1] = (double)0.1f * src_dbl[j] - 0.25 * expect_dbl[j];
+            }
+        }
+    }
+    if (parse_and_eval(EXPECT_SUCCESS, 0, 1, iterations))
+        return 1;
+
+    /* 117) Filter functions: fir() */
+    set_expr_str("y=fir(x,[0.5,0.25,0.125,0.125])");
+    setup_test(MPR_FLT, 3, MPR_FLT, 3);
+    {
+        /* the input is constant so the delay line fills with copies of it */
+        float coeffs[4] = {0.5f, 0.25f, 0.125f, 0.125f};
+        for (i = 0; i < 3; i++) {
+            expect_flt[i] = coeffs[0] * src_flt[i];
+            for (j = 1; j < 4 && j < iterations; j++)
+                expect_flt[i] += coeffs[j] * src_flt[i];
+        }
+    }
+    if (parse_and_eval(EXPECT_SUCCESS, 0, 1, iterations))
+        return 1;
+
+    /* 118) Filter functions cannot use dot notation */
+    set_expr_str("y=x.fir([0.5,0.5])");
+    setup_test(MPR_FLT, 1, MPR_FLT, 1);
+    if (parse_and_eval(EXPECT_FAILURE, 0, 1, iterations))
+        return 1;
+
+    /* 119) Repeated subexpressions are evaluated once */
+    set_expr_str("y=(x*2+1)*(x*2+1)");
+    setup_test(MPR_FLT, 2, MPR_FLT, 2);
+    for (i = 0; i < 2; i++)
+        expect_flt[i] = (src_flt[i] * 2 + 1) * (src_flt[i] * 2 + 1);
+    if (parse_and_eval(EXPECT_SUCCESS, 8, 1, iterations))
+        return 1;
+
+    /* 120) Similar subexpressions are not confused */
+    set_expr_str("y=(x*2+1)*(x*2+2)+(x*2+1)");
+    setup_test(MPR_INT32, 1, MPR_INT32, 1);
+    expect_int[0] = (src_int[0] * 2 + 1) * (src_int[0] * 2 + 2) + (src_int[0] * 2 + 1);
+    if (parse_and_eval(EXPECT_SUCCESS, 0, 1, iterations))
+        return 1;
+
+    /* 121) Assignments to unused variables are removed */
+    set_expr_str("a=x*3;b=a+1;y=x+1");
+    setup_test(MPR_FLT, 1, MPR_FLT, 1);
+    expect_flt[0] = src_flt[0] + 1;
+    if (parse_and_eval(EXPECT_SUCCESS, 4, 1, iterations))
+        return 1;
+
+    /* 122) Ternary operator with a scalar condition and vector branches */
+    set_expr_str("y=x[0]>0?x*2+1:x-1");
+    setup_test(MPR_FLT, 3, MPR_FLT, 3);
+    for (i = 0; i < 3; i++)
+        expect_flt[i] = src_flt[0] > 0 ? src_flt[i] * 2 + 1 : src_flt[i] - 1;
+    if (parse_and_eval(EXPECT_SUCCESS, 0, 1, iterations))
+        return 1;
+
+    /* 123) Ternary operator with a vector condition */
+    set_expr_str("y=x>0?x*2+1:x-1");
+    setup_test(MPR_FLT, 3, MPR_FLT, 3);
+    for (i = 0; i < 3; i++)
+        expect_flt[i] = src_flt[i] > 0 ? src_flt[i] * 2 + 1 : src_flt[i] - 1;
+    if (parse_and_eval(EXPECT_SUCCESS, 0, 1, iterations))
+        return 1;
+
+    /* 124) Logical operators with scalar left operands */
+    set_expr_str("y=[x[0]&&(x[1]*2),x[1]||(x[0]-x[0])]");
+    setup_test(MPR_INT32, 2, MPR_INT32, 2);
+    expect_int[0] = src_int[0] && (src_int[1] * 2) != 0;
+    expect_int[1] = src_int[1] || (src_int[0] - src_int[0]);
+    if (parse_and_eval(EXPECT_SUCCESS, 0, 1, iterations))
+        return 1;
+
+    /* 125) Branches that are not taken are not evaluated */
+    set_expr_str("c=c+(x==x);y=c%2?onepole(x,0.5):-1");
+    setup_test(MPR_FLT, 1, MPR_FLT, 1);
+    expect_flt[0] = 0;
+    for (i = 1; i <= iterations; i += 2)
+        expect_flt[0] = src_flt[0] + 0.5f * (expect_flt[0] - src_flt[0]);
+    if (!(iterations % 2))
+        expect_flt[0] = -1;
+    if (parse_and_eval(EXPECT_SUCCESS, 0, 1, iterations))
+        return 1;
+
+    /* 126) Identity map with a slice and type coercion */
+    set_expr_str("y=x[1:2]");
+    setup_test(MPR_INT32, 3, MPR_DBL, 2);
+    expect_dbl[0] = (double)src_int[1];
+    expect_dbl[1] = (double)src_int[2];
+    if (parse_and_eval(EXPECT_SUCCESS, 0, 1, iterations))
+        return 1;
+
+    /* 127) Linear map with vector variable coefficients */
+    set_expr_str("m=[2.5,-3];b=[0.5,-1];y=m*x+b");
+    setup_test(MPR_DBL, 2, MPR_DBL, 2);
+    expect_dbl[0] = src_dbl[0] * 2.5;
+    expect_dbl[0] += 0.5;
+    expect_dbl[1] = src_dbl[1] * -3.;
+    expect_dbl[1] += -1.;
+    if (parse_and_eval(EXPECT_SUCCESS, 0, 1, iterations))
+        return 1;
+
+    /* 128) Linear map with scalar coefficients broadcast over a vector */
+    set_expr_str("y=x*0.5-4");
+    setup_test(MPR_FLT, 3, MPR_FLT, 3);
+    for (i = 0; i < 3; i++) {
+        expect_flt[i] = src_flt[i] * 0.5f;
+        expect_flt[i] -= 4.f;
+    }
+    if (parse_and_eval(EXPECT_SUCCESS, 0, 1, iterations))
+        return 1;
+
     return 0;
 }
 
+/* Compare the SIMD kernels against the scalar code on long vectors and time both. */
+int run_simd_tests()
+{
+    /* floating-point sums may be accumulated in a different order by the SIMD kernels */
+    struct {
+        const char *str;
+        int out_len;
+        int exact;
+    } tests[] = {
+        { "y=x*x-x",                SIMD_VEC_LEN,   1 },
+        { "y=(x>0)+(x<=1)*2",       SIMD_VEC_LEN,   1 },
+        { "y=x/3+x",                SIMD_VEC_LEN,   1 },
+        { "y=x.max()-x.min()",      1,              1 },
+        { "y=x.center()",           1,              1 },
+        { "y=x.sum()",              1,              0 },
+        { "y=x.mean()",             1,              0 },
+        { "y=x.norm()",             1,              0 },
+        { "y=dot(x,x)",             1,              0 }
+    };
+    mpr_type types[3] = {MPR_INT32, MPR_FLT, MPR_DBL};
+    int i, j, k, mode, len = SIMD_VEC_LEN, result = 0;
+    int ival[SIMD_VEC_LEN];
+    float fval[SIMD_VEC_LEN];
+    double dval[SIMD_VEC_LEN], elapsed[2], out[2][SIMD_VEC_LEN];
+    mpr_type simd_out_types[SIMD_VEC_LEN];
+    mpr_value_t in = {0}, outv = {0};
+    mpr_value in_p = &in;
+
+    for (i = 0; i < SIMD_VEC_LEN; i++) {
+        ival[i] = rand() % 2001 - 1000;
+        fval[i] = ival[i] * 0.1f;
+        dval[i] = ival[i] * 0.1;
+    }
+
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < sizeof(tests) / sizeof(tests[0]); j++) {
+            e = mpr_expr_new_from_str(eval_stk, tests[j].str, 1, &types[i], &len, types[i],
+                                      tests[j].out_len);
+            if (!e) {
+                eprintf("Parser FAILED for '%s'\n", tests[j].str);
+                return 1;
+            }
+            if (!use_bytecode)
+                mpr_expr_set_use_bytecode(e, 0);
+            mpr_value_realloc(&in, len, types[i], mpr_expr_get_in_hist_size(e, 0), 1, 0);
+            mpr_value_realloc(&outv, tests[j].out_len, types[i], mpr_expr_get_out_hist_size(e),
+                              1, 1);
+            mpr_value_set_samp(&in, 0, MPR_INT32 == types[i] ? (void*)ival
+                               : MPR_FLT == types[i] ? (void*)fval : (void*)dval, time_in);
+            for (mode = 0; mode < 2; mode++) {
+                mpr_expr_set_simd(mode ? simd_name : "none");
+                then = current_time();
+                for (k = 0; k < iterations; k++)
+                    mpr_expr_eval(eval_stk, e, &in_p, &user_vars_p, &outv, &time_in,
+                                  simd_out_types, 0);
+                elapsed[mode] = current_time() - then;
+                memcpy(out[mode], mpr_value_get_samp(&outv, 0),
+                       mpr_type_get_size(types[i]) * tests[j].out_len);
+            }
+            eprintf("'%s' (%c): scalar %f seconds, %s %f seconds", tests[j].str, types[i],
+                    elapsed[0], simd_name, elapsed[1]);
+            for (k = 0; k < tests[j].out_len; k++) {
+                double a, b;
+                switch (types[i]) {
+                    case MPR_INT32:
+                        a = ((int*)out[0])[k];
+                        b = ((int*)out[1])[k];
+                        break;
+                    case MPR_FLT:
+                        a = ((float*)out[0])[k];
+                        b = ((float*)out[1])[k];
+                        break;
+                    default:
+                        a = out[0][k];
+                        b = out[1][k];
+                }
+                if (a == b)
+                    continue;
+                if (tests[j].exact || MPR_INT32 == types[i]
+                    || fabs(a - b) > fabs(a) * (MPR_FLT == types[i] ? 1e-4 : 1e-12)) {
+                    eprintf("... error at index %d (scalar %g, SIMD %g)", k, a, b);
+                    result = 1;
+                    break;
+                }
+            }
+            eprintf("%s\n", result ? "" : "... OK");
+            mpr_expr_free(e);
+            if (result)
+                break;
+        }
+    }
+    mpr_expr_set_simd(simd_name);
+    mpr_value_free(&in);
+    mpr_value_free(&outv);
+    return result;
+}
+
+int run_batch_tests()
+{
+    /* batch evaluation must match evaluating each instance in turn */
+    const char *tests[] = {
+        "y=x*2+1",
+        "y=x+y{-1}",
+        "y=x-x{-1}",
+        "a=a*0.5+x;y=a",
+        "y=x.sum()-x.max()",
+        "y=(x>0)*x+[1,2,3,4]",
+        "y=fir(x,[0.5,0.25,0.25])",
+        "y=biquad(x,0.2,0.3,0.1,-0.5,0.25)"
+    };
+    mpr_type types[3] = {MPR_INT32, MPR_FLT, MPR_DBL};
+    int i, j, k, l, m, len = BATCH_VEC_LEN, size, result = 0;
+    int ival[BATCH_VEC_LEN], inst_idx[BATCH_NUM_INST], status[2][BATCH_NUM_INST];
+    float fval[BATCH_VEC_LEN];
+    double dval[BATCH_VEC_LEN], elapsed[2];
+    mpr_type batch_out_types[2][BATCH_NUM_INST * BATCH_VEC_LEN];
+    mpr_value_t in[2], outv[2], vars[2][MAX_VARS];
+    mpr_value in_p[2];
+
+    memset(in, 0, sizeof(in));
+    memset(outv, 0, sizeof(outv));
+    memset(vars, 0, sizeof(vars));
+    for (i = 0; i < BATCH_NUM_INST; i++)
+        inst_idx[i] = i;
+    in_p[0] = &in[0];
+    in_p[1] = &in[1];
+
+    for (i = 0; i < 3; i++) {
+        size = mpr_type_get_size(types[i]) * BATCH_VEC_LEN;
+        for (j = 0; j < sizeof(tests) / sizeof(tests[0]); j++) {
+            e = mpr_expr_new_from_str(eval_stk, tests[j], 1, &types[i], &len, types[i],
+                                      BATCH_VEC_LEN);
+            if (!e) {
+                eprintf("Parser FAILED for '%s'\n", tests[j]);
+                return 1;
+            }
+            if (!use_bytecode)
+                mpr_expr_set_use_bytecode(e, 0);
+            for (m = 0; m < 2; m++) {
+                mpr_value_free(&in[m]);
+                mpr_value_realloc(&in[m], len, types[i], mpr_expr_get_in_hist_size(e, 0),
+                                  BATCH_NUM_INST, 0);
+                mpr_value_free(&outv[m]);
+                mpr_value_realloc(&outv[m], BATCH_VEC_LEN, types[i],
+                                  mpr_expr_get_out_hist_size(e), BATCH_NUM_INST, 1);
+                for (k = 0; k < mpr_expr_get_num_vars(e) && k < MAX_VARS; k++) {
+                    mpr_value_free(&vars[m][k]);
+                    mpr_value_realloc(&vars[m][k], mpr_expr_get_var_vec_len(e, k),
+                                      mpr_expr_get_var_type(e, k), 1, BATCH_NUM_INST, 0);
+                }
+                elapsed[m] = 0;
+            }
+            for (k = 0; k < iterations && !result; k++) {
+                for (l = 0; l < BATCH_NUM_INST; l++) {
+                    for (m = 0; m < BATCH_VEC_LEN; m++) {
+                        ival[m] = rand() % 201 - 100;
+                        fval[m] = ival[m] * 0.1f;
+                        dval[m] = ival[m] * 0.1;
+                    }
+                    for (m = 0; m < 2; m++)
+                        mpr_value_set_samp(&in[m], l, MPR_INT32 == types[i] ? (void*)ival
+                                           : MPR_FLT == types[i] ? (void*)fval : (void*)dval,
+                                           time_in);
+                }
+                then = current_time();
+                for (l = 0; l < BATCH_NUM_INST; l++) {
+                    user_vars_p = vars[0];
+                    status[0][l] = mpr_expr_eval(eval_stk, e, &in_p[0], &user_vars_p, &outv[0],
+                                                 &time_in, batch_out_types[0] + l * len, l);
+                }
+                elapsed[0] += current_time() - then;
+                then = current_time();
+                user_vars_p = vars[1];
+                mpr_expr_eval_batch(eval_stk, e, &in_p[1], &user_vars_p, &outv[1], &time_in,
+                                    batch_out_types[1], inst_idx, BATCH_NUM_INST, status[1]);
+                elapsed[1] += current_time() - then;
+
+                for (l = 0; l < BATCH_NUM_INST; l++) {
+                    if (status[0][l] != status[1][l]
+                        || memcmp(mpr_value_get_samp(&outv[0], l), mpr_value_get_samp(&outv[1], l),
+                                  size)
+                        || memcmp(batch_out_types[0] + l * len, batch_out_types[1] + l * len,
+                                  len)) {
+                        eprintf("'%s' (%c): error at iteration %d, instance %d\n", tests[j],
+                                types[i], k, l);
+                        result = 1;
+                        break;
+                    }
+                }
+            }
+            if (!result)
+                eprintf("'%s' (%c): %d instances singly %f seconds, batched %f seconds... OK\n",
+                        tests[j], types[i], BATCH_NUM_INST, elapsed[0], elapsed[1]);
+            mpr_expr_free(e);
+            if (result)
+                break;
+        }
+    }
+    for (m = 0; m < 2; m++) {
+        mpr_value_free(&in[m]);
+        mpr_value_free(&outv[m]);
+        for (k = 0; k < MAX_VARS; k++)
+            mpr_value_free(&vars[m][k]);
+    }
+    user_vars_p = user_vars;
+    return result;
+}
+
+int run_shared_tests()
+{
+    /* expressions differing only in insignificant whitespace are shared */
+    const char *tests[][2] = {
+        {"y=x*2+1",                 " y = x * 2 + 1 "},
+        {"foo=0;y=x*10+foo",        "foo = 0;\n  y = x * 10 + foo"},
+        {"y=x<<1",                  "y=x< <1"},
+        {"y=1e-3*x",                "y=1e -3*x"},
+        {"y=-x",                    "y=- x"},
+        {"y=x-x{-1}",               "y=x - x{-1}"},
+        {"y=x*2+1",                 "y=x*2+ 1.0"}
+    };
+    int same[] = {1, 1, 0, 0, 1, 1, 0};
+    mpr_type types[2] = {MPR_INT32, MPR_FLT};
+    int i, len = 3, result = 0;
+    mpr_expr a, b, c;
+
+    for (i = 0; i < sizeof(tests) / sizeof(tests[0]) && !result; i++) {
+        a = mpr_expr_new_shared(eval_stk, tests[i][0], 1, types, &len, MPR_INT32, 3);
+        b = mpr_expr_new_shared(eval_stk, tests[i][1], 1, types, &len, MPR_INT32, 3);
+        eprintf("'%s' and '%s' %s shared... ", tests[i][0], tests[i][1],
+                same[i] ? "are" : "are not");
+        if (!a || (a == b) != same[i]) {
+            eprintf("FAILED\n");
+            result = 1;
+        }
+        else
+            eprintf("OK\n");
+        FUNC_IF(mpr_expr_free, a);
+        FUNC_IF(mpr_expr_free, b);
+    }
+    if (result)
+        return 1;
+
+    /* different signatures are not shared */
+    a = mpr_expr_new_shared(eval_stk, "y=x*2+1", 1, types, &len, MPR_INT32, 3);
+    b = mpr_expr_new_shared(eval_stk, "y=x*2+1", 1, types + 1, &len, MPR_INT32, 3);
+    c = mpr_expr_new_shared(eval_stk, "y=x*2+1", 1, types, &len, MPR_INT32, 1);
+    eprintf("expressions with different signatures are not shared... ");
+    if (a == b || a == c || b == c)
+        result = 1;
+    eprintf(result ? "FAILED\n" : "OK\n");
+    mpr_expr_free(b);
+    mpr_expr_free(c);
+
+    /* unsharing copies the expression unless it has a single user */
+    b = mpr_expr_new_shared(eval_stk, "y=x*2+1", 1, types, &len, MPR_INT32, 3);
+    c = mpr_expr_unshare(eval_stk, b);
+    eprintf("unsharing an expression with two users copies it... ");
+    if (c == a || mpr_expr_get_num_tokens(c, 1) != mpr_expr_get_num_tokens(a, 1))
+        result = 1;
+    eprintf(result ? "FAILED\n" : "OK\n");
+    b = mpr_expr_new_shared(eval_stk, "y=x*2+1", 1, types, &len, MPR_INT32, 3);
+    eprintf("unshared copies are not shared again... ");
+    if (b != a || b == c)
+        result = 1;
+    eprintf(result ? "FAILED\n" : "OK\n");
+    mpr_expr_free(b);
+    eprintf("unsharing an expression with one user keeps it... ");
+    if (mpr_expr_unshare(eval_stk, a) != a)
+        result = 1;
+    eprintf(result ? "FAILED\n" : "OK\n");
+    b = mpr_expr_new_shared(eval_stk, "y=x*2+1", 1, types, &len, MPR_INT32, 3);
+    if (b == a)
+        result = 1;
+    mpr_expr_free(a);
+    mpr_expr_free(b);
+    mpr_expr_free(c);
+    return result;
+}
+
+int run_value_tests()
+{
+    mpr_value_t v = {0};
+    mpr_time t = {0, 0};
+    int i, j, samp, result = 0;
+
+    /* histories are stored in power-of-two rings */
+    mpr_value_realloc(&v, 2, MPR_INT32, 3, 2, 1);
+    eprintf("history of 3 samples is stored in a ring of 4... ");
+    if (v.mlen != 4 || (char*)v.inst[1].samps != (char*)v.samps + 4 * 2 * sizeof(int))
+        result = 1;
+    eprintf(result ? "FAILED\n" : "OK\n");
+
+    for (i = 0; i < 6; i++) {
+        int s[2] = {i, -i};
+        t.sec = i;
+        mpr_value_set_samp(&v, 0, s, t);
+        s[0] += 100;
+        mpr_value_set_samp(&v, 1, s, t);
+    }
+
+    /* resizing the history and adding instances keeps the most recent samples */
+    mpr_value_realloc(&v, 2, MPR_INT32, 6, 3, 1);
+    eprintf("resizing history keeps samples in order... ");
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < 2; j++) {
+            samp = *(int*)mpr_value_get_samp_hist(&v, j, -i);
+            if (samp != 5 - i + j * 100 || mpr_value_get_time_hist(&v, j, -i)->sec != 5 - i)
+                result = 1;
+        }
+    }
+    if (v.mlen != 8 || v.inst[2].pos != -1 || v.num_active_inst != 2)
+        result = 1;
+    eprintf(result ? "FAILED\n" : "OK\n");
+
+    /* removing an instance shifts the following instances down */
+    mpr_value_remove_inst(&v, 0);
+    eprintf("removing an instance keeps the remaining samples... ");
+    if (v.num_inst != 2 || *(int*)mpr_value_get_samp(&v, 0) != 105 || v.num_active_inst != 1)
+        result = 1;
+    eprintf(result ? "FAILED\n" : "OK\n");
+
+    mpr_value_free(&v);
+    return result;
+}
+
 int main(int argc, char **argv)
 {
     int i, j, result = 0;
@@ -1457,18 +2003,35 @@ int main(int argc, char **argv)
                     case 'h':
                         eprintf("testparser.c: possible arguments "
                                 "-q quiet (suppress output), "
+                                "-i interpret (disable bytecode evaluation), "
+                                "-j cross-check JIT-compiled expressions against the "
+                                "interpreter, "
                                 "-h help, "
-                                "--num_iterations <int> (default %d)\n",
+                                "--num_iterations <int> (default %d), "
+                                "--simd <avx2|sse2|neon|none> (default: best supported)\n",
                                 iterations);
                         return 1;
                         break;
                     case 'q':
                         verbose = 0;
                         break;
+                    case 'i':
+                        use_bytecode = 0;
+                        break;
+                    case 'j':
+                        jit_check = 1;
+                        break;
                     case '-':
-                        if (++j < len && strcmp(argv[i]+j, "num_iterations")==0)
+                        if (++j < len && strcmp(argv[i]+j, "num_iterations")==0) {
                             if (++i < argc)
                                 iterations = atoi(argv[i]);
+                        }
+                        else if (j < len && strcmp(argv[i]+j, "simd")==0) {
+                            if (++i < argc)
+                                simd_name = argv[i];
+                        }
+                        /* don't parse the long option as single-character flags */
+                        j = len;
                         break;
                     default:
                         break;
@@ -1509,7 +2072,17 @@ int main(int argc, char **argv)
         inh_p[i] = &inh[i];
 
     eval_stk = mpr_expr_stack_new();
+    simd_name = mpr_expr_set_simd(simd_name);
+    eprintf("Using SIMD instruction set '%s'\n", simd_name);
     result = run_tests();
+    if (!result)
+        result = run_simd_tests();
+    if (!result)
+        result = run_batch_tests();
+    if (!result)
+        result = run_shared_tests();
+    if (!result)
+        result = run_value_tests();
     mpr_expr_stack_free(eval_stk);
 
     for (i = 0; i < SRC_ARRAY_LEN; i++)
@@ -1520,7 +2093,9 @@ int main(int argc, char **argv)
     printf("\r..................................................Test %s\x1B[0m.",
            result ? "\x1B[31mFAILED" : "\x1B[32mPASSED");
     if (!result)
-        printf(" (%f seconds, %d tokens).\n", total_elapsed_time, token_count);
+        printf(" (%f seconds, %d tokens, %d expressions using bytecode, %d JIT-compiled, "
+               "%f seconds evaluating).\n", total_elapsed_time, token_count, compiled_count,
+               jit_count, total_eval_time);
     else
         printf("\n");
     return result;
@@ -20,6 +20,8 @@ int count = 0;
 
 int verbose = 1;
 int shared_graph = 0;
+int batch_tx = 1;
+int batch_rx = 0;
 
 mpr_dev src = 0;
 mpr_dev dst = 0;
@@ -37,6 +39,7 @@ int received = 0;
 int done = 0;
 
 double times[100];
+mpr_bundle_stats_t bundle_stats;
 
 void switch_modes();
 void print_results();
@@ -262,6 +265,9 @@ void print_results()
         }
         eprintf("\nbest trial: %i messages in %f seconds\n", iterations, bestTime);
     }
+    eprintf("\nSOURCE BUNDLE BUFFERS:\n");
+    eprintf("allocations: %i, liblo bundles: %i, bytes held: %lu\n", bundle_stats.num_allocs,
+            bundle_stats.num_lo_bundles, (unsigned long)bundle_stats.num_bytes);
     eprintf("\n*****************************************************\n");
 }
 
@@ -282,6 +288,8 @@ int main(int argc, char **argv)
                         printf("testspeed.c: possible arguments "
                                "-q quiet (suppress output), "
                                "-s shared (use one mpr_graph only), "
+                               "-u unbatched (send each link bundle separately), "
+                               "-r batched receive (receive up to 32 datagrams per call), "
                                "-h help, "
                                "--iface network interface\n");
                         return 1;
@@ -292,6 +300,12 @@ int main(int argc, char **argv)
                     case 'q':
                         verbose = 0;
                         break;
+                    case 'u':
+                        batch_tx = 0;
+                        break;
+                    case 'r':
+                        batch_rx = 32;
+                        break;
                     case '-':
                         if (strcmp(argv[i], "--iface")==0 && argc>i+1) {
                             i++;
@@ -323,6 +337,17 @@ int main(int argc, char **argv)
         goto done;
     }
 
+    if (!batch_tx) {
+        mpr_dev_set_send_batching(src, 0);
+        mpr_dev_set_send_batching(dst, 0);
+    }
+    eprintf("Batched sending is %s.\n", mpr_dev_set_send_batching(src, batch_tx) ? "on" : "off");
+    if (batch_rx) {
+        mpr_dev_set_recv_buffer_size(dst, 1 << 20);
+        batch_rx = mpr_dev_set_recv_batch_size(dst, batch_rx);
+    }
+    eprintf("Batched receiving is %s.\n", batch_rx ? "on" : "off");
+
     wait_local_devs();
 
     map_sigs();
@@ -335,6 +360,7 @@ int main(int argc, char **argv)
         mpr_dev_poll(src, 0);
         mpr_dev_poll(dst, 0);
     }
+    memcpy(&bundle_stats, mpr_dev_get_bundle_stats((mpr_local_dev)src), sizeof(bundle_stats));
     goto done;
 
   done: